@@ -39,6 +39,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <cstring>
 #include <algorithm>
 #include <new>
+#include <pthread.h>
 
 #include "MemTrack.h"
 #undef new    // IMPORTANT!
@@ -63,15 +64,17 @@ namespace MemTrack
             BlockHeader *myPrevNode;
             BlockHeader *myNextNode;
             size_t myRequestedSize;
+            int myTag;
             char const *myFilename;
             int myLineNum;
             char const *myTypeName;
 
         public:     // members
-            BlockHeader(size_t requestedSize);
+            BlockHeader(size_t requestedSize, int tag);
             ~BlockHeader();
         
             size_t GetRequestedSize() const { return myRequestedSize; }
+            int GetTag() const { return myTag; }
             char const *GetFilename() const { return myFilename; }
             int GetLineNum() const { return myLineNum; }
             char const *GetTypeName() const { return myTypeName; }
@@ -91,11 +94,12 @@ namespace MemTrack
 
     /* ---------------------------------------- BlockHeader constructor */
 
-    BlockHeader::BlockHeader(size_t requestedSize)
+    BlockHeader::BlockHeader(size_t requestedSize, int tag)
     {
         myPrevNode = NULL;
         myNextNode = NULL;
         myRequestedSize = requestedSize;
+        myTag = tag;
         myFilename = "[unknown]";
         myLineNum = 0;
         myTypeName = "[unknown]";
@@ -250,7 +254,11 @@ namespace MemTrack
 
     /* ---------------------------------------- alignment */
 
-    const size_t ALIGNMENT = 4;
+    /* This is the alignment malloc gives on 64-bit platforms, which operator
+     * new must give too.
+     */
+
+    const size_t ALIGNMENT = 16;
 
     /* If "value" (a memory size or offset) falls on an alignment boundary,
      * then just return it.  Otherwise return the smallest number larger
@@ -320,6 +328,64 @@ namespace MemTrack
         return pSignature;
     }
 
+    /* ------------------------------------------------------------ */
+    /* ---------------------- allocation tags --------------------- */
+    /* ------------------------------------------------------------ */
+
+    struct TagCounts
+    {
+        size_t liveBytes;
+        size_t peakBytes;
+        size_t allocCount;
+    };
+
+    static TagCounts ourTagCounts[MAX_TAGS];
+
+    static __thread int ourCurrentTag = 0;
+
+    /* The block list and the tag counts are shared by all threads. */
+
+    static pthread_mutex_t ourMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    /* ---------------------------------------- TrackSetTag */
+
+    int TrackSetTag(int tag)
+    {
+        int previous = ourCurrentTag;
+        if (tag >= 0 && tag < MAX_TAGS) ourCurrentTag = tag;
+        return previous;
+    }
+
+    /* ---------------------------------------- TrackGetTag */
+
+    int TrackGetTag()
+    {
+        return ourCurrentTag;
+    }
+
+    /* ---------------------------------------- TrackTagUsage */
+
+    void TrackTagUsage(int tag, size_t &liveBytes, size_t &peakBytes, size_t &allocCount)
+    {
+        liveBytes = peakBytes = allocCount = 0;
+        if (tag < 0 || tag >= MAX_TAGS) return;
+        pthread_mutex_lock(&ourMutex);
+        liveBytes = ourTagCounts[tag].liveBytes;
+        peakBytes = ourTagCounts[tag].peakBytes;
+        allocCount = ourTagCounts[tag].allocCount;
+        pthread_mutex_unlock(&ourMutex);
+    }
+
+    /* ---------------------------------------- TrackResetPeaks */
+
+    void TrackResetPeaks()
+    {
+        pthread_mutex_lock(&ourMutex);
+        for (int i = 0; i < MAX_TAGS; i++)
+            ourTagCounts[i].peakBytes = ourTagCounts[i].liveBytes;
+        pthread_mutex_unlock(&ourMutex);
+    }
+
     /* ------------------------------------------------------------ */
     /* -------------- memory allocation and stamping -------------- */
     /* ------------------------------------------------------------ */
@@ -335,10 +401,18 @@ namespace MemTrack
         if (pProlog == NULL) return NULL;
         
         // Use placement new to construct the block header in place.
-        BlockHeader *pBlockHeader = new (pProlog) BlockHeader(size);
+        const int tag = ourCurrentTag;
+        BlockHeader *pBlockHeader = new (pProlog) BlockHeader(size, tag);
         
-        // Link the block header into the list of extant block headers.
+        // Link the block header into the list of extant block headers,
+        // and charge the block to its tag.
+        pthread_mutex_lock(&ourMutex);
         BlockHeader::AddNode(pBlockHeader);
+        TagCounts &counts = ourTagCounts[tag];
+        counts.liveBytes += size;
+        counts.allocCount++;
+        if (counts.liveBytes > counts.peakBytes) counts.peakBytes = counts.liveBytes;
+        pthread_mutex_unlock(&ourMutex);
         
         // Use placement new to construct the signature in place.
         Signature *pSignature = new (GetSignatureAddress(pProlog)) Signature;
@@ -368,9 +442,13 @@ namespace MemTrack
         pSignature->~Signature();
         pSignature = NULL;
 
-        // Unlink the block header from the list and destroy it.
+        // Unlink the block header from the list, release the block from its
+        // tag, and destroy the header.
         BlockHeader *pBlockHeader = GetHeaderAddress(pProlog);
+        pthread_mutex_lock(&ourMutex);
         BlockHeader::RemoveNode(pBlockHeader);
+        ourTagCounts[pBlockHeader->GetTag()].liveBytes -= pBlockHeader->GetRequestedSize();
+        pthread_mutex_unlock(&ourMutex);
         pBlockHeader->~BlockHeader();
         pBlockHeader = NULL;
 
@@ -400,6 +478,7 @@ namespace MemTrack
     void TrackDumpBlocks()
     {
         // Get an array of pointers to all extant blocks.
+        pthread_mutex_lock(&ourMutex);
         size_t numBlocks = BlockHeader::CountBlocks();
         BlockHeader **ppBlockHeader =
             (BlockHeader **)calloc(numBlocks, sizeof(*ppBlockHeader));
@@ -424,6 +503,7 @@ namespace MemTrack
 
         // Clean up.
         free(ppBlockHeader);
+        pthread_mutex_unlock(&ourMutex);
     }
 
     /* ---------------------------------------- struct MemDigest */
@@ -464,8 +544,13 @@ namespace MemTrack
     void TrackListMemoryUsage()
     {
         // If there are no allocated blocks, then return now.
+        pthread_mutex_lock(&ourMutex);
         size_t numBlocks = BlockHeader::CountBlocks();
-        if (numBlocks == 0) return;
+        if (numBlocks == 0)
+        {
+            pthread_mutex_unlock(&ourMutex);
+            return;
+        }
 
         // Get an array of pointers to all extant blocks.
         BlockHeader **ppBlockHeader =
@@ -560,6 +645,7 @@ namespace MemTrack
         // Clean up.
         free(ppBlockHeader);
         free(pMemDigestArray);
+        pthread_mutex_unlock(&ourMutex);
     }
 
 }    // namespace MemTrack
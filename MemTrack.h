@@ -34,6 +34,7 @@ OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef MemTrack_H_
 #define MemTrack_H_
 
+#include <cstddef>
 #include <typeinfo>
 
 namespace MemTrack
@@ -59,6 +60,20 @@ namespace MemTrack
     void TrackDumpBlocks();
     void TrackListMemoryUsage();
 
+    /* ---------------------------------------- allocation tags */
+
+    /* Each block is charged to the tag set in the allocating thread when it
+     * was allocated, and released from that tag when it is freed, by
+     * whichever thread.  Tag 0 is the default.
+     */
+
+    const int MAX_TAGS = 32;
+
+    int TrackSetTag(int tag);    // returns the previous tag of this thread
+    int TrackGetTag();
+    void TrackTagUsage(int tag, size_t &liveBytes, size_t &peakBytes, size_t &allocCount);
+    void TrackResetPeaks();      // the peak of each tag becomes its live bytes
+
     /* ---------------------------------------- operator * (MemStamp, ptr) */
 
     template <class T> inline T *operator*(const MemStamp &stamp, T *p)
@@ -71,8 +86,14 @@ namespace MemTrack
 
 /* ---------------------------------------- new macro */
 
+/* Define MEMTRACK_NO_NEW_MACRO before including this to use only the
+ * allocation tags, without stamping each new with its file and line.
+ */
+
+#ifndef MEMTRACK_NO_NEW_MACRO
 #define MEMTRACK_NEW MemTrack::MemStamp(__FILE__, __LINE__) * new
 #define new MEMTRACK_NEW
+#endif
 
 #endif    // MemTrack_H_
 
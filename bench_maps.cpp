@@ -0,0 +1,539 @@
+// bench_maps.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Benchmark of the containers that could hold the read names of seda's
+// duplicates between its passes, and the reads waiting for their mates in
+// sefibo and ibeji.  Built with 'make bench_maps', run with 'make bench'.
+//
+// A stream of coordinate-sorted read pairs with Illumina-style names is made
+// once, then each container runs each workload in a child process of its own
+// so that its peak RSS is its own:
+//
+//     duplicate  seda: a pass adding the names of the duplicate templates,
+//                then a pass looking up every read and removing a name when
+//                both of its reads have been seen
+//     mates      sefibo: the first read of each pair is added and the second
+//                looks it up and removes it, with the input position advanced
+//                at every read
+//
+// The containers are
+//
+//     node       tr1::unordered_map keyed by the read name, seda's dupMap
+//     ordered    std::map keyed by the read name
+//     hashed     tr1::unordered_map keyed by hashReadName()
+//     flat       pendingMateTable (yoruba_mates.h), open addressing on the hash
+//     sharded    a tr1::unordered_map keyed by name for each reference,
+//                dropped once the input has passed that reference
+//
+// For each the benchmark prints nanoseconds per operation (an add or a
+// lookup), the most entries held, the peak RSS of the child and bytes per
+// entry, the growth of RSS from before the workload to its peak divided by
+// the most entries held.  The hits column counts lookups that found their
+// name, and must be the same for every container.
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <tr1/unordered_map>
+#include <algorithm>
+#include <climits>
+#include <unistd.h>
+#include <sys/time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <sys/wait.h>
+
+#include "SimpleOpt.h"
+#include "yoruba_util.h"
+#include "yoruba_mates.h"
+
+using namespace std;
+using namespace yoruba;
+
+#define NAME "[bench_maps]"
+
+static int64_t      opt_reads = 2000000;
+static int32_t      opt_refs = 24;
+static double       opt_dup_rate = 0.15;
+static uint64_t     opt_seed = 1;
+static string       opt_container;  // all if empty
+static string       opt_workload;
+
+
+//-------------------------------------
+
+
+struct benchRead {
+    string   name;
+    int32_t  ref;
+    int32_t  pos;
+    int32_t  mate_ref;
+    int32_t  mate_pos;
+    bool     first;  // the first of its pair in coordinate order
+    bool     dup;    // its template is a duplicate
+
+    bool operator<(const benchRead& o) const
+        { return ref < o.ref || (ref == o.ref && pos < o.pos); }
+};
+
+static inline int64_t
+coordinate(const int32_t ref, const int32_t pos)
+{
+    return (int64_t(ref) << 32) | uint32_t(pos);
+}
+
+struct benchResult {
+    int64_t ops;
+    double  seconds;
+    int64_t max_entries;
+    int64_t hits;
+    int64_t rss_start_kb;
+    int64_t rss_peak_kb;
+};
+
+
+//-------------------------------------
+
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//-------------------------------------
+
+
+// a field of /proc/self/status in kB, or -1
+
+static int64_t
+statusKb(const char* field)
+{
+    FILE* fp = fopen("/proc/self/status", "r");
+    if (! fp)
+        return -1;
+    char line[256];
+    long long kb = -1;
+    const size_t len = strlen(field);
+    while (fgets(line, sizeof(line), fp))
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            sscanf(line + len + 1, "%lld", &kb);
+            break;
+        }
+    fclose(fp);
+    return kb;
+}
+
+
+//-------------------------------------
+
+
+// Read pairs spread over opt_refs references of equal length, dense enough
+// that about one read starts every 4 bp as at 30x coverage.  Mates are
+// 100-600 bp apart on the same reference, or for 3% of pairs on another
+// reference, and opt_dup_rate of the templates are duplicates.
+
+static void
+makeReads(vector<benchRead>& reads)
+{
+    yorubaRandom rng(opt_seed);
+    const int64_t n_pairs = opt_reads / 2;
+    const int32_t ref_length = int32_t(min(int64_t(INT_MAX / 2), max(int64_t(1000), opt_reads * 4 / opt_refs)));
+    reads.resize(n_pairs * 2);
+    char name[96];
+    for (int64_t t = 0; t < n_pairs; ++t) {
+        snprintf(name, sizeof(name), "HWI-ST1234:8:C2EAPACXX:%d:%d:%d:%d",
+                 int(1 + rng.Below(8)), int(1101 + rng.Below(16) * 100 + rng.Below(16)),
+                 int(1000 + rng.Below(20000)), int(1000 + rng.Below(200000)));
+        benchRead& a = reads[2 * t];
+        benchRead& b = reads[2 * t + 1];
+        a.name = b.name = name;
+        a.ref = int32_t(rng.Below(opt_refs));
+        a.pos = int32_t(rng.Below(ref_length));
+        if (rng.Uniform() < 0.03) {
+            b.ref = int32_t(rng.Below(opt_refs));
+            b.pos = int32_t(rng.Below(ref_length));
+        } else {
+            b.ref = a.ref;
+            b.pos = a.pos + 100 + int32_t(rng.Below(500));
+        }
+        a.mate_ref = b.ref;
+        a.mate_pos = b.pos;
+        b.mate_ref = a.ref;
+        b.mate_pos = a.pos;
+        a.dup = b.dup = rng.Uniform() < opt_dup_rate;
+        a.first = a < b || ! (b < a);
+        b.first = ! a.first;
+    }
+    stable_sort(reads.begin(), reads.end());
+#ifdef __GLIBC__
+    // the sort copied names, so hand back the freed pages before the
+    // containers are measured by their growth of RSS
+    malloc_trim(0);
+#endif
+}
+
+
+//-------------------------------------  containers
+
+
+// Each container counts the reads of a template added, Add() adding one and
+// Take() removing one if the name is there, the entry going when its count
+// reaches 0.  Passed() is called with the position of each read in a pass
+// that takes entries.
+
+class nodeMap {
+    public:
+        void     Add(const benchRead& r, int64_t) { ++m[r.name]; }
+        bool     Take(const benchRead& r) {
+            map_t::iterator i = m.find(r.name);
+            if (i == m.end())
+                return false;
+            if (--i->second == 0)
+                m.erase(i);
+            return true;
+        }
+        void     Passed(const benchRead&) { }
+        size_t   Size(void) const { return m.size(); }
+    private:
+        typedef std::tr1::unordered_map<string, int32_t> map_t;
+        map_t    m;
+};
+
+class orderedMap {
+    public:
+        void     Add(const benchRead& r, int64_t) { ++m[r.name]; }
+        bool     Take(const benchRead& r) {
+            map_t::iterator i = m.find(r.name);
+            if (i == m.end())
+                return false;
+            if (--i->second == 0)
+                m.erase(i);
+            return true;
+        }
+        void     Passed(const benchRead&) { }
+        size_t   Size(void) const { return m.size(); }
+    private:
+        typedef std::map<string, int32_t> map_t;
+        map_t    m;
+};
+
+class hashedMap {
+    public:
+        void     Add(const benchRead& r, int64_t) { ++m[hashReadName(r.name)]; }
+        bool     Take(const benchRead& r) {
+            map_t::iterator i = m.find(hashReadName(r.name));
+            if (i == m.end())
+                return false;
+            if (--i->second == 0)
+                m.erase(i);
+            return true;
+        }
+        void     Passed(const benchRead&) { }
+        size_t   Size(void) const { return m.size(); }
+    private:
+        typedef std::tr1::unordered_map<uint64_t, int32_t> map_t;
+        map_t    m;
+};
+
+class flatMap {
+    public:
+        void     Add(const benchRead& r, int64_t expires) {
+            const uint64_t key = hashReadName(r.name);
+            int32_t* n = t.Find(key);
+            if (n)
+                ++*n;
+            else
+                t.Add(key, expires, 1);
+        }
+        bool     Take(const benchRead& r) {
+            const uint64_t key = hashReadName(r.name);
+            int32_t* n = t.Find(key);
+            if (! n)
+                return false;
+            if (--*n == 0)
+                t.Remove(key);
+            return true;
+        }
+        void     Passed(const benchRead& r) { t.ExpireBefore(coordinate(r.ref, r.pos)); }
+        size_t   Size(void) const { return t.Size(); }
+    private:
+        pendingMateTable<int32_t> t;
+};
+
+// entries are held under the reference of the read they wait for
+
+class shardedMap {
+    public:
+        shardedMap(void) : shards(opt_refs), n(0), current(0) { }
+        void     Add(const benchRead& r, int64_t expires) {
+            const int32_t ref = expires == INT64_MAX ? r.ref : int32_t(expires >> 32);
+            if (++shards[ref][r.name] == 1)
+                ++n;
+        }
+        bool     Take(const benchRead& r) {
+            map_t& m = shards[r.ref];
+            map_t::iterator i = m.find(r.name);
+            if (i == m.end())
+                return false;
+            if (--i->second == 0) {
+                m.erase(i);
+                --n;
+            }
+            return true;
+        }
+        void     Passed(const benchRead& r) {
+            for (; current < r.ref; ++current) {
+                n -= shards[current].size();
+                map_t().swap(shards[current]);
+            }
+        }
+        size_t   Size(void) const { return n; }
+    private:
+        typedef std::tr1::unordered_map<string, int32_t> map_t;
+        vector<map_t> shards;
+        size_t   n;
+        int32_t  current;
+};
+
+
+//-------------------------------------  workloads
+
+
+template <typename C>
+static void
+runDuplicate(const vector<benchRead>& reads, benchResult& res)
+{
+    C c;
+    const double start = now();
+    // pass 1: names of duplicate templates, once for each read
+    for (size_t i = 0; i < reads.size(); ++i) {
+        if (reads[i].dup) {
+            c.Add(reads[i], INT64_MAX);
+            ++res.ops;
+        }
+    }
+    res.max_entries = c.Size();
+    // pass 2: every read is looked up
+    for (size_t i = 0; i < reads.size(); ++i) {
+        c.Passed(reads[i]);
+        if (c.Take(reads[i]))
+            ++res.hits;
+        ++res.ops;
+    }
+    res.seconds = now() - start;
+}
+
+
+template <typename C>
+static void
+runMates(const vector<benchRead>& reads, benchResult& res)
+{
+    C c;
+    const double start = now();
+    for (size_t i = 0; i < reads.size(); ++i) {
+        const benchRead& r = reads[i];
+        c.Passed(r);
+        if (r.first)
+            c.Add(r, coordinate(r.mate_ref, r.mate_pos));
+        else if (c.Take(r))
+            ++res.hits;
+        ++res.ops;
+        if ((i & 1023) == 0 && int64_t(c.Size()) > res.max_entries)
+            res.max_entries = c.Size();
+    }
+    res.seconds = now() - start;
+}
+
+
+//-------------------------------------
+
+
+template <typename C>
+static void
+runWorkload(const string& workload, const vector<benchRead>& reads, benchResult& res)
+{
+    if (workload == "duplicate")
+        runDuplicate<C>(reads, res);
+    else
+        runMates<C>(reads, res);
+}
+
+
+// Run in a child process and pass the result back through a pipe, false if
+// the child failed
+
+static bool
+runChild(const string& container, const string& workload,
+         const vector<benchRead>& reads, benchResult& res)
+{
+    int fd[2];
+    if (pipe(fd) != 0)
+        return false;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        benchResult r;
+        memset(&r, 0, sizeof(r));
+        // a forked child starts with the peak RSS of its parent, so reset it
+        FILE* fp = fopen("/proc/self/clear_refs", "w");
+        const bool reset = fp && fputs("5", fp) >= 0;
+        if (fp && fclose(fp) != 0)
+            fp = NULL;
+        r.rss_start_kb = (reset && fp) ? statusKb("VmRSS") : -1;
+        if (container == "node")
+            runWorkload<nodeMap>(workload, reads, r);
+        else if (container == "ordered")
+            runWorkload<orderedMap>(workload, reads, r);
+        else if (container == "hashed")
+            runWorkload<hashedMap>(workload, reads, r);
+        else if (container == "flat")
+            runWorkload<flatMap>(workload, reads, r);
+        else
+            runWorkload<shardedMap>(workload, reads, r);
+        r.rss_peak_kb = statusKb("VmHWM");
+        const bool ok = write(fd[1], &r, sizeof(r)) == ssize_t(sizeof(r));
+        close(fd[1]);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(fd[1]);
+    const bool ok = read(fd[0], &res, sizeof(res)) == ssize_t(sizeof(res));
+    close(fd[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
+
+
+static int
+usage(void)
+{
+    cerr << endl;
+    cerr << "Usage:   bench_maps [options]" << endl;
+    cerr << endl;
+    cerr << "Benchmark the containers for duplicate names and reads waiting for mates." << endl;
+    cerr << endl;
+    cerr << "    --reads N         reads in the stream [" << opt_reads << "]" << endl;
+    cerr << "    --refs N          references the reads are spread over [" << opt_refs << "]" << endl;
+    cerr << "    --dup-rate F      fraction of templates that are duplicates [" << opt_dup_rate << "]" << endl;
+    cerr << "    --seed N          seed of the random stream [" << opt_seed << "]" << endl;
+    cerr << "    --container NAME  only node, ordered, hashed, flat or sharded" << endl;
+    cerr << "    --workload NAME   only duplicate or mates" << endl;
+    cerr << "    --help | -?       help for bench_maps" << endl;
+    cerr << endl;
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+int
+main(int argc, char* argv[])
+{
+    enum { OPT_reads, OPT_refs, OPT_dup_rate, OPT_seed, OPT_container, OPT_workload, OPT_help };
+
+    CSimpleOpt::SOption bench_options[] = {
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_refs,            "--refs",            SO_REQ_SEP },
+        { OPT_dup_rate,        "--dup-rate",        SO_REQ_SEP },
+        { OPT_seed,            "--seed",            SO_REQ_SEP },
+        { OPT_container,       "--container",       SO_REQ_SEP },
+        { OPT_workload,        "--workload",        SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, bench_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage();
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_refs) {
+            opt_refs = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_dup_rate) {
+            opt_dup_rate = atof(args.OptionArg());
+        } else if (args.OptionId() == OPT_seed) {
+            opt_seed = strtoull(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_container) {
+            opt_container = args.OptionArg();
+        } else if (args.OptionId() == OPT_workload) {
+            opt_workload = args.OptionArg();
+        }
+    }
+    if (opt_reads < 2 || opt_refs < 1 || opt_dup_rate < 0 || opt_dup_rate > 1) {
+        cerr << NAME << " --reads must be at least 2, --refs at least 1 and --dup-rate from 0 to 1" << endl;
+        return usage();
+    }
+
+    const char* containers[] = { "node", "ordered", "hashed", "flat", "sharded" };
+    const char* workloads[] = { "duplicate", "mates" };
+    if (! opt_container.empty()
+        && find(containers, containers + 5, opt_container) == containers + 5) {
+        cerr << NAME << " unknown container '" << opt_container << "'" << endl;
+        return usage();
+    }
+    if (! opt_workload.empty()
+        && find(workloads, workloads + 2, opt_workload) == workloads + 2) {
+        cerr << NAME << " unknown workload '" << opt_workload << "'" << endl;
+        return usage();
+    }
+
+    vector<benchRead> reads;
+    const double t = now();
+    makeReads(reads);
+    cerr << NAME << " " << reads.size() << " reads on " << opt_refs << " references made in "
+        << fixed << setprecision(1) << now() - t << " s" << endl;
+
+    cout << fixed << left << setw(10) << "workload" << setw(10) << "container" << right
+        << setw(12) << "ops" << setw(9) << "ns/op" << setw(12) << "max entries"
+        << setw(12) << "bytes/entry" << setw(14) << "peak RSS MB" << setw(12) << "hits" << endl;
+    for (int w = 0; w < 2; ++w) {
+        if (! opt_workload.empty() && opt_workload != workloads[w])
+            continue;
+        for (int c = 0; c < 5; ++c) {
+            if (! opt_container.empty() && opt_container != containers[c])
+                continue;
+            benchResult res;
+            if (! runChild(containers[c], workloads[w], reads, res)) {
+                cerr << NAME << " " << containers[c] << " " << workloads[w] << " failed" << endl;
+                return EXIT_FAILURE;
+            }
+            cout << left << setw(10) << workloads[w] << setw(10) << containers[c] << right
+                << setw(12) << res.ops
+                << setw(9) << setprecision(1) << res.seconds * 1e9 / max(int64_t(1), res.ops)
+                << setw(12) << res.max_entries;
+            // too few entries for the growth of RSS to mean much
+            if (res.max_entries >= 10000 && res.rss_start_kb >= 0 && res.rss_peak_kb >= 0)
+                cout << setw(12) << setprecision(1)
+                    << 1024.0 * (res.rss_peak_kb - res.rss_start_kb) / res.max_entries;
+            else
+                cout << setw(12) << "-";
+            cout << setw(14) << setprecision(1) << res.rss_peak_kb / 1024.0
+                << setw(12) << res.hits << endl;
+        }
+    }
+    return EXIT_SUCCESS;
+}
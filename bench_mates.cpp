@@ -0,0 +1,278 @@
+// bench_mates.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Benchmark of matePairer (yoruba_mates.h), the engine pairing the reads of
+// a coordinate-sorted BAM in insertsize and twinreads.  Built with 'make
+// bench_mates', run with its defaults by 'make bench'.
+//
+// Read pairs are made as they are fed to the pairer, in coordinate order,
+// so streams of any length take no memory of their own beyond the second
+// reads still to come.  Reads start every 4 bp over the references.  The
+// mate of a read is 200 to 400 bp on, or with probability --cross anywhere
+// on a later reference.  With --drop, that fraction of second reads is
+// never fed, so their first reads are orphaned.
+//
+// With --cap, held reads beyond that many KB that have mates on later
+// references are spilled.  The benchmark prints the reads fed, the pairs
+// found, the orphans by reason, the most reads held, the most bytes held by
+// the table, the reads spilled, the time and the peak RSS.  Every pair found
+// is checked to be two reads of the same template.
+//
+// For example,
+//
+//     bench_mates --reads 1000000000
+//     bench_mates --reads 1000000000 --cap 100
+
+#include <cstdio>
+#include <climits>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "SimpleOpt.h"
+#include "yoruba_util.h"
+#include "yoruba_mates.h"
+
+using namespace std;
+using namespace yoruba;
+
+#define NAME "[bench_mates]"
+
+static int64_t      opt_reads = 10000000;
+static int32_t      opt_refs = 100;
+static double       opt_cross = 0.01;
+static double       opt_drop = 0;
+static int64_t      opt_cap = 0;  // KB, 0 for no cap
+static uint64_t     opt_seed = 7;
+
+
+//-------------------------------------
+
+
+// what the pairer holds for each read
+
+struct benchMate {
+    int32_t pos;
+    int64_t id;
+};
+
+// a read to come, ordered by coordinate for the queue
+
+struct benchRead {
+    int32_t ref, pos, mate_ref, mate_pos;
+    int64_t id;
+
+    bool operator>(const benchRead& o) const
+        { return ref > o.ref || (ref == o.ref && pos > o.pos); }
+};
+
+class benchHandler : public matePairerHandler<benchMate> {
+
+    public:
+        benchHandler(void) : n_paired(0), n_cross(0), n_mismatched(0)
+            { n_orphaned[0] = n_orphaned[1] = n_orphaned[2] = 0; }
+
+        void Paired(const benchMate& held, const benchMate& current)
+            { ++n_paired; if (held.id != current.id) ++n_mismatched; }
+        void CrossReference(const benchMate& held, const benchMate& current)
+            { ++n_cross; if (held.id != current.id) ++n_mismatched; }
+        void Orphaned(const benchMate& read, const orphan_t why)
+            { ++n_orphaned[why]; }
+
+    public:
+        int64_t n_paired;
+        int64_t n_cross;
+        int64_t n_mismatched;
+        int64_t n_orphaned[3];
+
+};  // class benchHandler
+
+
+//-------------------------------------
+
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//-------------------------------------
+
+
+static inline void
+feed(matePairer<benchMate>& pairer, const benchRead& r)
+{
+    char name[32];
+    const int len = sprintf(name, "SIM:%lld", (long long)r.id);
+    const benchMate m = { r.pos, r.id };
+    pairer.Add(hashReadName(name, len), r.ref, r.pos, r.mate_ref, r.mate_pos, m);
+}
+
+
+//-------------------------------------
+
+
+static int
+usage(void)
+{
+    cerr << endl;
+    cerr << "Usage:   bench_mates [options]" << endl;
+    cerr << endl;
+    cerr << "Benchmark matePairer on a stream of coordinate-sorted read pairs." << endl;
+    cerr << endl;
+    cerr << "    --reads N         about N reads in the stream [" << opt_reads << "]" << endl;
+    cerr << "    --refs N          references the reads are spread over [" << opt_refs << "]" << endl;
+    cerr << "    --cross F         fraction of pairs with the mate on a later reference [" << opt_cross << "]" << endl;
+    cerr << "    --drop F          fraction of second reads left out [" << opt_drop << "]" << endl;
+    cerr << "    --cap KB          spill held reads beyond KB, 0 for no cap [" << opt_cap << "]" << endl;
+    cerr << "    --seed N          seed of the random stream [" << opt_seed << "]" << endl;
+    cerr << "    --help | -?       help for bench_mates" << endl;
+    cerr << endl;
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+int
+main(int argc, char* argv[])
+{
+    enum { OPT_reads, OPT_refs, OPT_cross, OPT_drop, OPT_cap, OPT_seed, OPT_help };
+
+    CSimpleOpt::SOption bench_options[] = {
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_refs,            "--refs",            SO_REQ_SEP },
+        { OPT_cross,           "--cross",           SO_REQ_SEP },
+        { OPT_drop,            "--drop",            SO_REQ_SEP },
+        { OPT_cap,             "--cap",             SO_REQ_SEP },
+        { OPT_seed,            "--seed",            SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, bench_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage();
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_refs) {
+            opt_refs = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_cross) {
+            opt_cross = atof(args.OptionArg());
+        } else if (args.OptionId() == OPT_drop) {
+            opt_drop = atof(args.OptionArg());
+        } else if (args.OptionId() == OPT_cap) {
+            opt_cap = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_seed) {
+            opt_seed = strtoull(args.OptionArg(), NULL, 10);
+        }
+    }
+    if (opt_reads < 2 || opt_refs < 1 || opt_cross < 0 || opt_cross > 1
+        || opt_drop < 0 || opt_drop > 1 || opt_cap < 0) {
+        cerr << NAME << " --reads must be at least 2, --refs at least 1, --cross and --drop"
+            << " from 0 to 1 and --cap at least 0" << endl;
+        return usage();
+    }
+
+    // the first reads of the pairs start every 4 bp
+    const int64_t ref_length = max(int64_t(4), opt_reads / 2 / opt_refs * 4);
+    if (ref_length > INT_MAX) {
+        cerr << NAME << " too many reads for " << opt_refs << " references" << endl;
+        return usage();
+    }
+
+    yorubaRandom random(opt_seed);
+    benchHandler handler;
+    matePairer<benchMate> pairer(handler, opt_cap * 1024);
+    // second reads on the current reference, and on each later one
+    priority_queue<benchRead, vector<benchRead>, greater<benchRead> > ahead;
+    vector<vector<benchRead> > later(opt_refs);
+    int64_t n_fed = 0, n_made = 0;
+
+    const double t = now();
+    for (int32_t ref = 0; ref < opt_refs; ++ref) {
+        for (size_t i = 0; i < later[ref].size(); ++i)
+            ahead.push(later[ref][i]);
+        vector<benchRead>().swap(later[ref]);
+        for (int32_t pos = 0; pos < ref_length; pos += 4) {
+            for ( ; ! ahead.empty() && ahead.top().ref == ref && ahead.top().pos <= pos; ahead.pop()) {
+                if (opt_drop == 0 || random.Uniform() >= opt_drop) {
+                    feed(pairer, ahead.top());
+                    ++n_fed;
+                }
+            }
+            benchRead first, second;
+            first.ref = ref;
+            first.pos = pos;
+            first.id = second.id = n_made++;
+            if (ref + 1 < opt_refs && random.Uniform() < opt_cross) {
+                second.ref = ref + 1 + random.Below(opt_refs - ref - 1);
+                second.pos = random.Below(ref_length);
+            } else {
+                second.ref = ref;
+                second.pos = pos + 200 + random.Below(200);
+            }
+            first.mate_ref = second.ref;
+            first.mate_pos = second.pos;
+            second.mate_ref = first.ref;
+            second.mate_pos = first.pos;
+            feed(pairer, first);
+            ++n_fed;
+            if (second.ref == ref)
+                ahead.push(second);
+            else
+                later[second.ref].push_back(second);
+        }
+        for ( ; ! ahead.empty() && ahead.top().ref == ref; ahead.pop()) {
+            if (opt_drop == 0 || random.Uniform() >= opt_drop) {
+                feed(pairer, ahead.top());
+                ++n_fed;
+            }
+        }
+    }
+    pairer.Finish();
+    const double seconds = now() - t;
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+
+    cout << NAME << " " << n_fed << " reads of " << n_made << " templates on " << opt_refs
+        << " references, " << opt_cross << " cross-reference, " << opt_drop << " dropped" << endl;
+    cout << fixed << setprecision(1);
+    cout << NAME << " " << handler.n_paired << " pairs, " << handler.n_cross
+        << " cross-reference pairs" << endl;
+    cout << NAME << " " << handler.n_orphaned[ORPHAN_expired] << " orphans expired, "
+        << handler.n_orphaned[ORPHAN_mate_passed] << " mate passed, "
+        << handler.n_orphaned[ORPHAN_collision] << " name hash collisions" << endl;
+    cout << NAME << " " << pairer.MaxSize() << " reads held at most, "
+        << pairer.MaxBytes() / 1048576.0 << " MB table, " << pairer.Spilled()
+        << " reads spilled" << endl;
+    cout << NAME << " " << seconds << " s, " << n_fed / seconds / 1e6 << " M reads/s, "
+        << ru.ru_maxrss / 1024.0 << " MB peak RSS" << endl;
+
+    if (pairer.Error()) {
+        cerr << NAME << " could not spill held reads" << endl;
+        return EXIT_FAILURE;
+    }
+    if (handler.n_mismatched) {
+        cerr << NAME << " " << handler.n_mismatched << " pairs of reads of different templates" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -14,7 +14,7 @@ using namespace yoruba;
 
 namespace yoruba {
 
-const bool debug_processReadPair = true;
+bool debug_processReadPair = false;
 const bool debug_checkLinkPairCandidate = false;
 const bool debug_checkLinkPair = true;
 const bool debug_readTail = false;
@@ -46,21 +46,21 @@ processReadPair(const BamAlignment& al1,
         && ! checkLinkPairCandidate(al2, refs, critTail)) {
         return false;  // neither read was a link pair candidate
     }
-    if (debug_processReadPair) cout << "---------------------------------" << endl;
+    if (debug_processReadPair) cerr << "---------------------------------" << endl;
     int32_t lpc_tail1 = checkLinkPairCandidate(al1, refs, critTail);
     int32_t lpc_tail2 = checkLinkPairCandidate(al2, refs, critTail);
     if (debug_processReadPair) {
-        printAlignmentInfo(al1, refs);
+        printAlignmentInfo(cerr, al1, refs);
         if (lpc_tail1) {
-            cout << "LINK PAIR CANDIDATE ";
-            cout << ((lpc_tail1 > 0) ? "--->" : "<---") << " " << lpc_tail1 << endl;
+            cerr << "LINK PAIR CANDIDATE ";
+            cerr << ((lpc_tail1 > 0) ? "--->" : "<---") << " " << lpc_tail1 << endl;
         }
-        printAlignmentInfo(al2, refs);
+        printAlignmentInfo(cerr, al2, refs);
         if (lpc_tail2) {
-            cout << "LINK PAIR CANDIDATE ";
-            cout << ((lpc_tail2 > 0) ? "--->" : "<---") << " " << lpc_tail2 << endl;
+            cerr << "LINK PAIR CANDIDATE ";
+            cerr << ((lpc_tail2 > 0) ? "--->" : "<---") << " " << lpc_tail2 << endl;
         }
-        cout << "TOTAL TAIL " << (abs(readTail(al1, refs)) + abs(readTail(al2, refs))) << endl;
+        cerr << "TOTAL TAIL " << (abs(readTail(al1, refs)) + abs(readTail(al2, refs))) << endl;
     }
 
     return true;
@@ -135,7 +135,7 @@ lookForMate(BamReader& rdr, BamAlignment& al, RefVector& refs)
             && al_jump.RefID == al.MateRefID
             && al_jump.Position == al.MatePosition) {
          cout << "MATE FOUND" << endl;
-            printAlignmentInfo(al_jump, refs);
+            printAlignmentInfo(cout, al_jump, refs);
             break;
         } else if (al_jump.Position > al.MatePosition) {
          cout << "NO MATE FOUND, beyond MatePosition" << endl;
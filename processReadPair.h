@@ -21,38 +21,41 @@
 #include "yoruba_util.h"
 
 
-namespace ibeji {
+namespace yoruba {
+
+// print each link pair to cerr as it is found
+extern bool debug_processReadPair;
 
 bool 
-processReadPair(const BamAlignment& al1, 
-        const BamAlignment& al2, 
+processReadPair(const BamTools::BamAlignment& al1, 
+        const BamTools::BamAlignment& al2, 
         const BamTools::RefVector& refs, 
         const int32_t totalTail, 
         const int32_t critTail, 
         const bool diff_ref = true);
 
 int32_t 
-checkLinkPair(const BamAlignment& al1,
-        const BamAlignment& al2, 
+checkLinkPair(const BamTools::BamAlignment& al1,
+        const BamTools::BamAlignment& al2, 
         const BamTools::RefVector& refs, 
         const int32_t totalTail, 
         const int32_t critTail, 
         const bool diff_ref = true);
 
 int32_t
-checkLinkPairCandidate(const BamAlignment&, 
+checkLinkPairCandidate(const BamTools::BamAlignment&, 
         const BamTools::RefVector&, 
         const int32_t critTail);
 
 int32_t
-readTail(const BamAlignment& al, 
+readTail(const BamTools::BamAlignment& al, 
         const BamTools::RefVector& refs);
 
 int32_t
 readTailS(const bool mapped, const bool rev, const int32_t pos, 
         const int32_t ref_len, const int32_t aligned_len);
 
-}  // namespace ibeji
+}  // namespace yoruba
 
 
 #endif /* PROCESSREADPAIR_H_ */
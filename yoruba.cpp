@@ -23,7 +23,7 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
-#include <ctime>
+#include <cstring>
 
 #undef _STANDALONE
 #undef _IMPLEMENTED
@@ -34,11 +34,19 @@
 #include "yoruba_inu.h"
 #include "yoruba_kojopodipo.h"
 #include "yoruba_seda.h"
-#include "yoruba_util.h"
-#ifdef _IMPLEMENTED
 #include "yoruba_sefibo.h"
 #include "yoruba_ibeji.h"
-#endif
+#include "yoruba_to.h"
+#include "yoruba_sunmo.h"
+#include "yoruba_dapo.h"
+#include "yoruba_sopo.h"
+#include "yoruba_pin.h"
+#include "yoruba_tuka.h"
+#include "yoruba_kojo.h"
+#include "yoruba_farawe.h"
+#include "yoruba_util.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 using namespace std;
 using namespace yoruba;
@@ -52,16 +60,25 @@ usage()
     cerr << endl;
     cerr << "Program: " << YORUBA_NAME << " -- query and manipulate BAM files" << endl;
     cerr << "Version: " << YORUBA_VERSION << endl << endl;
-    cerr << "Usage:   " << YORUBA_NAME << " <command> [options]" << endl << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " [--stats-json FILE] <command> [options]" << endl << endl;
     cerr << "Each command has two names, one in English and one in Yoruba" << endl << endl;
     cerr << "Command: forget     | gbagbe       remove unused reference sequences" << endl;
     cerr << "         inside     | inu          display summary of BAM file contents" << endl;
     cerr << "         readgroup  | kojopodipo   add or modify read group information" << endl;
     cerr << "         duplicate  | seda         mark (and optionally remove) duplicate reads" << endl;
-#ifdef _IMPLEMENTED
-    cerr << "         insertsize | sefibo       calculates insert sizes" << endl;
-    cerr << "         twinreads  | ibeji        find reads paired in various ways" << endl;
-#endif
+    cerr << "         insertsize | sefibo       calculate insert size distributions" << endl;
+    cerr << "         twinreads  | ibeji        find link pairs near reference ends" << endl;
+    cerr << "         sort       | to           sort by coordinate or read name" << endl;
+    cerr << "         collate    | sunmo        group records by read name" << endl;
+    cerr << "         merge      | dapo         merge coordinate-sorted BAM files" << endl;
+    cerr << "         cat        | sopo         concatenate BAM files block by block" << endl;
+    cerr << "         split      | pin          split into shards of whole references" << endl;
+    cerr << "         scatter    | tuka         scatter into fragments for separate workers" << endl;
+    cerr << "         gather     | kojo         gather fragments written by scatter workers" << endl;
+    cerr << "         simulate   | farawe       write a synthetic BAM file for benchmarks" << endl;
+    cerr << endl;
+    cerr << "--stats-json FILE writes the wall and CPU time, peak memory, bytes read and" << endl;
+    cerr << "written and reads per second of each phase of the command to FILE." << endl;
     cerr << endl;
 
     return EXIT_FAILURE;
@@ -70,7 +87,17 @@ usage()
 int
 main (int argc, char* argv[])
 {
-    clock_t time_start = clock();
+    string stats_file;
+    if (argc >= 3 && strcmp(argv[1], "--stats-json") == 0) {
+        stats_file = argv[2];
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    string command = YORUBA_NAME;
+    for (int i = 1; i < argc; ++i)
+        command = command + " " + argv[i];
+    profile.Start();
     if (argc < 2) return usage();
     string cmd = argv[1];
     int retval = EXIT_SUCCESS;
@@ -82,18 +109,42 @@ main (int argc, char* argv[])
         retval = main_kojopodipo(argc-1, argv+1);
     else if (cmd == "duplicate" || cmd == "seda") 
         retval = main_seda(argc-1, argv+1);
-#ifdef _IMPLEMENTED
-    else if (cmd == "insert" || cmd == "sefibo") 
+    else if (cmd == "insertsize" || cmd == "sefibo") 
         retval = main_sefibo(argc-1, argv+1);
     else if (cmd == "twinreads" || cmd == "ibeji") 
         retval = main_ibeji(argc-1, argv+1);
-#endif
+    else if (cmd == "sort" || cmd == "to") 
+        retval = main_to(argc-1, argv+1);
+    else if (cmd == "collate" || cmd == "sunmo") 
+        retval = main_sunmo(argc-1, argv+1);
+    else if (cmd == "merge" || cmd == "dapo") 
+        retval = main_dapo(argc-1, argv+1);
+    else if (cmd == "cat" || cmd == "sopo") 
+        retval = main_sopo(argc-1, argv+1);
+    else if (cmd == "split" || cmd == "pin") 
+        retval = main_pin(argc-1, argv+1);
+    else if (cmd == "scatter" || cmd == "tuka") 
+        retval = main_tuka(argc-1, argv+1);
+    else if (cmd == "gather" || cmd == "kojo") 
+        retval = main_kojo(argc-1, argv+1);
+    else if (cmd == "simulate" || cmd == "farawe") 
+        retval = main_farawe(argc-1, argv+1);
     else {
         cerr << "Unrecognized command '" << argv[1] << "'" << endl;
         retval = EXIT_FAILURE;
     }
-    float runtime = ((float)(clock() - time_start)) / CLOCKS_PER_SEC;
-    cerr << NAME << " runtime " << fixed << setprecision(3) << runtime << " sec" << endl;
+    progress.Stop();
+    profile.Stop();
+    const profilePhase& total = profile.Total();
+    cerr << NAME << " runtime " << fixed << setprecision(3) << total.wall << " sec wall, "
+        << total.user + total.sys << " sec CPU, " << total.max_rss_kb << " KB peak RSS" << endl;
+    if (! stats_file.empty()) {
+        profile.Report(cerr, NAME);
+        if (! profile.WriteJson(stats_file, YORUBA_VERSION, command, retval)) {
+            cerr << NAME << " could not write --stats-json " << stats_file << endl;
+            retval = EXIT_FAILURE;
+        }
+    }
     return retval;
 }
 
@@ -0,0 +1,217 @@
+// yoruba_bai.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Reads a BAM index (.bai).  The binning scheme and the layout of the file are
+// described in section 5 of the SAM specification.
+
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include "yoruba_bai.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+static bool
+readBytes(FILE* fp, void* dest, const size_t len)
+{
+    return fread(dest, 1, len, fp) == len;
+}
+
+
+//-------------------------------------
+
+
+bool
+baiIndex::Load(const string& bam_file)
+{
+    if (LoadIndexFile(bam_file + ".bai"))
+        return true;
+    if (bam_file.size() > 4 && bam_file.compare(bam_file.size() - 4, 4, ".bam") == 0)
+        return LoadIndexFile(bam_file.substr(0, bam_file.size() - 4) + ".bai");
+    return false;
+}
+
+
+//-------------------------------------
+
+
+bool
+baiIndex::LoadIndexFile(const string& filename)
+{
+    refs.clear();
+    n_no_coordinate = 0;
+    index_file.clear();
+
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (! fp)
+        return false;
+
+    char magic[4];
+    int32_t n_ref;
+    if (! readBytes(fp, magic, 4) || memcmp(magic, "BAI\1", 4) != 0
+        || ! readBytes(fp, &n_ref, 4) || n_ref < 0) {
+        cerr << "baiIndex: " << filename << " is not a BAM index" << endl;
+        fclose(fp);
+        return false;
+    }
+
+    refs.resize(n_ref);
+    bool ok = true;
+    for (int32_t r = 0; ok && r < n_ref; ++r) {
+        baiReference& ref = refs[r];
+        int32_t n_bin;
+        ok = readBytes(fp, &n_bin, 4) && n_bin >= 0;
+        for (int32_t b = 0; ok && b < n_bin; ++b) {
+            uint32_t bin;
+            int32_t n_chunk;
+            ok = readBytes(fp, &bin, 4) && readBytes(fp, &n_chunk, 4) && n_chunk >= 0;
+            if (! ok)
+                break;
+            if (bin == pseudo_bin) {
+                // samtools metadata: two pseudo-chunks holding the span of
+                // the reference's records and its mapped/unmapped counts
+                uint64_t meta[4];
+                ok = n_chunk == 2 && readBytes(fp, meta, sizeof(meta));
+                ref.has_metadata = ok;
+                ref.ref_beg = meta[0];
+                ref.ref_end = meta[1];
+                ref.n_mapped = meta[2];
+                ref.n_unmapped = meta[3];
+                continue;
+            }
+            baiChunkVector& chunks = ref.bins[bin];
+            chunks.resize(n_chunk);
+            for (int32_t c = 0; ok && c < n_chunk; ++c)
+                ok = readBytes(fp, &chunks[c].beg, 8) && readBytes(fp, &chunks[c].end, 8);
+        }
+        int32_t n_intv;
+        ok = ok && readBytes(fp, &n_intv, 4) && n_intv >= 0;
+        if (ok) {
+            ref.linear.resize(n_intv);
+            ok = ! n_intv || readBytes(fp, &ref.linear[0], 8 * size_t(n_intv));
+        }
+    }
+    if (! ok) {
+        cerr << "baiIndex: " << filename << " is truncated or corrupt" << endl;
+        refs.clear();
+        fclose(fp);
+        return false;
+    }
+    // optional trailing count of reads without coordinates
+    if (! readBytes(fp, &n_no_coordinate, 8))
+        n_no_coordinate = 0;
+    fclose(fp);
+    index_file = filename;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+uint64_t
+baiIndex::LinearOffset(const int32_t ref, const int32_t beg) const
+{
+    const vector<uint64_t>& linear = refs[ref].linear;
+    if (linear.empty())
+        return 0;
+    int32_t i = beg >> linear_shift;
+    if (i >= int32_t(linear.size()))
+        i = linear.size() - 1;
+    // windows without records hold 0, so fall back to an earlier window
+    while (i > 0 && ! linear[i])
+        --i;
+    return linear[i];
+}
+
+
+//-------------------------------------
+
+
+void
+baiIndex::RegionToBins(const int32_t beg, int32_t end, vector<uint32_t>& bins)
+{
+    // reg2bins() from the SAM specification
+    bins.clear();
+    --end;
+    bins.push_back(0);
+    for (int32_t k =    1 + (beg >> 26); k <=    1 + (end >> 26); ++k) bins.push_back(k);
+    for (int32_t k =    9 + (beg >> 23); k <=    9 + (end >> 23); ++k) bins.push_back(k);
+    for (int32_t k =   73 + (beg >> 20); k <=   73 + (end >> 20); ++k) bins.push_back(k);
+    for (int32_t k =  585 + (beg >> 17); k <=  585 + (end >> 17); ++k) bins.push_back(k);
+    for (int32_t k = 4681 + (beg >> 14); k <= 4681 + (end >> 14); ++k) bins.push_back(k);
+}
+
+
+//-------------------------------------
+
+
+baiChunkVector
+baiIndex::Chunks(const int32_t ref, const int32_t beg, const int32_t end) const
+{
+    baiChunkVector chunks;
+    if (ref < 0 || ref >= ReferenceCount() || end <= beg)
+        return chunks;
+
+    const baiReference& r = refs[ref];
+    const uint64_t min_offset = LinearOffset(ref, beg);
+    vector<uint32_t> bins;
+    RegionToBins(beg, end, bins);
+    for (size_t b = 0; b < bins.size(); ++b) {
+        map<uint32_t, baiChunkVector>::const_iterator bI = r.bins.find(bins[b]);
+        if (bI == r.bins.end())
+            continue;
+        for (size_t c = 0; c < bI->second.size(); ++c)
+            if (bI->second[c].end > min_offset)
+                chunks.push_back(bI->second[c]);
+    }
+    sort(chunks.begin(), chunks.end());
+
+    // merge overlapping and adjacent chunks
+    baiChunkVector merged;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        if (! merged.empty() && chunks[c].beg <= merged.back().end) {
+            if (chunks[c].end > merged.back().end)
+                merged.back().end = chunks[c].end;
+        } else {
+            merged.push_back(chunks[c]);
+        }
+    }
+    return merged;
+}
+
+
+//-------------------------------------
+
+
+bool
+baiIndex::ReferenceSpan(const int32_t ref, uint64_t& beg, uint64_t& end) const
+{
+    const baiReference& r = refs[ref];
+    if (r.has_metadata && r.ref_end > r.ref_beg) {
+        beg = r.ref_beg;
+        end = r.ref_end;
+        return true;
+    }
+    bool found = false;
+    for (map<uint32_t, baiChunkVector>::const_iterator bI = r.bins.begin();
+         bI != r.bins.end(); ++bI) {
+        if (bI->first == pseudo_bin)
+            continue;
+        for (size_t c = 0; c < bI->second.size(); ++c) {
+            if (! found || bI->second[c].beg < beg)
+                beg = bI->second[c].beg;
+            if (! found || bI->second[c].end > end)
+                end = bI->second[c].end;
+            found = true;
+        }
+    }
+    return found;
+}
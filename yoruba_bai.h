@@ -0,0 +1,101 @@
+// yoruba_bai.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_bai.cpp
+//
+// Reads a BAM index (.bai, see the SAM specification section 5.2) into memory
+// so its contents can be used directly: the virtual offsets at which to start
+// reading a region, and the per-reference counts of mapped and unmapped reads
+// that samtools stores in the pseudo-bin.  BamTools uses the index only to
+// answer SetRegion() and Jump(), and keeps the counts to itself.
+
+#ifndef _YORUBA_BAI_H_
+#define _YORUBA_BAI_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+namespace yoruba {
+
+// A span of the BAM file [beg, end) in virtual offsets
+
+struct baiChunk {
+    uint64_t beg;
+    uint64_t end;
+    baiChunk(const uint64_t b = 0, const uint64_t e = 0) : beg(b), end(e) { }
+    bool operator<(const baiChunk& other) const { return beg < other.beg; }
+};
+
+typedef std::vector<baiChunk> baiChunkVector;
+
+// The index for one reference sequence
+
+struct baiReference {
+    std::map<uint32_t, baiChunkVector> bins;
+    std::vector<uint64_t>              linear;   // 16 kbp windows
+    bool                               has_metadata;
+    uint64_t                           ref_beg;  // from the pseudo-bin, if present
+    uint64_t                           ref_end;
+    uint64_t                           n_mapped;
+    uint64_t                           n_unmapped;
+    baiReference(void)
+        : has_metadata(false), ref_beg(0), ref_end(0), n_mapped(0), n_unmapped(0)
+    { }
+};
+
+
+//-------------------------------------
+
+
+class baiIndex {
+
+    public:
+        baiIndex(void) : n_no_coordinate(0) { }
+
+        // load the index for bam_file, looking for <bam_file>.bai and then
+        // for the .bam suffix replaced with .bai
+        bool     Load(const std::string& bam_file);
+        // load the index from index_file
+        bool     LoadIndexFile(const std::string& index_file);
+        const std::string& IndexFile(void) const { return index_file; }
+
+        int32_t  ReferenceCount(void) const { return refs.size(); }
+        const baiReference& Reference(const int32_t ref) const { return refs[ref]; }
+
+        bool     HasMetadata(const int32_t ref) const { return refs[ref].has_metadata; }
+        uint64_t Mapped(const int32_t ref) const { return refs[ref].n_mapped; }
+        uint64_t Unmapped(const int32_t ref) const { return refs[ref].n_unmapped; }
+        uint64_t NoCoordinate(void) const { return n_no_coordinate; }
+
+        // virtual offset at or before the first record on ref that could
+        // overlap position beg, from the linear index, or 0 if the reference
+        // has no records
+        uint64_t LinearOffset(const int32_t ref, const int32_t beg) const;
+        // merged chunks that hold all records on ref overlapping [beg, end)
+        baiChunkVector Chunks(const int32_t ref, const int32_t beg, const int32_t end) const;
+        // the span of the file holding the records placed on ref, from the
+        // pseudo-bin or else from the bins, false if there are none
+        bool     ReferenceSpan(const int32_t ref, uint64_t& beg, uint64_t& end) const;
+
+        // the bins that may hold records overlapping [beg, end)
+        static void RegionToBins(const int32_t beg, int32_t end,
+                                 std::vector<uint32_t>& bins);
+
+    public:
+        static const uint32_t pseudo_bin = 37450;
+        static const int32_t  linear_shift = 14;  // 16 kbp linear index windows
+
+    private:
+        std::string               index_file;
+        std::vector<baiReference> refs;
+        uint64_t                  n_no_coordinate;
+
+};  // class baiIndex
+
+}  // namespace yoruba
+
+#endif // _YORUBA_BAI_H_
@@ -0,0 +1,708 @@
+// yoruba_bamraw.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// BAM records kept as the bytes found in the file, see section 4.2 of the SAM
+// specification for the layout.
+
+
+#include <cctype>
+#include <sys/stat.h>
+
+#include "yoruba_bamraw.h"
+#include "yoruba_yvi.h"
+#include "yoruba_memtrack.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+
+//-------------------------------------  bamRawRecord
+
+
+int32_t
+bamRawRecord::EndPosition(void) const
+{
+    const char* cigar = data.data() + BAM_CORE_LENGTH + NameLength();
+    int32_t end = Position();
+    for (uint16_t i = 0; i < CigarCount(); ++i) {
+        uint32_t op;
+        memcpy(&op, cigar + 4 * i, 4);
+        switch (op & 0xf) {
+            case 0:  // M
+            case 2:  // D
+            case 3:  // N
+            case 7:  // =
+            case 8:  // X
+                end += op >> 4;
+                break;
+            default:
+                break;
+        }
+    }
+    return end;
+}
+
+
+//-------------------------------------
+
+
+size_t
+yoruba::bamTagValueLength(const char type, const char* p, const char* end)
+{
+    size_t len = 0;
+    switch (type) {
+        case 'A': case 'c': case 'C':           len = 1; break;
+        case 's': case 'S':                     len = 2; break;
+        case 'i': case 'I': case 'f':           len = 4; break;
+        case 'Z': case 'H': {
+            const char* nul = static_cast<const char*>(memchr(p, '\0', end - p));
+            if (! nul) return 0;
+            len = nul - p + 1;
+            break;
+        }
+        case 'B': {
+            if (end - p < 5) return 0;
+            int32_t count;
+            memcpy(&count, p + 1, 4);
+            size_t elem = bamTagValueLength(p[0], p, end);
+            if (p[0] == 'Z' || p[0] == 'H' || p[0] == 'B' || ! elem) return 0;
+            len = 5 + elem * count;
+            break;
+        }
+        default:
+            return 0;
+    }
+    return (p + len <= end) ? len : 0;
+}
+
+
+//-------------------------------------
+
+
+const char*
+bamRawRecord::FindTag(const char* tag) const
+{
+    const char* p = data.data() + auxOffset();
+    const char* end = data.data() + data.size();
+    while (p + 3 <= end) {
+        const char* type = p + 2;
+        size_t len = bamTagValueLength(*type, type + 1, end);
+        if (! len)
+            return NULL;
+        if (p[0] == tag[0] && p[1] == tag[1])
+            return type;
+        p = type + 1 + len;
+    }
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawRecord::GetTagString(const char* tag, string& value) const
+{
+    const char* type = FindTag(tag);
+    if (! type || (*type != 'Z' && *type != 'H'))
+        return false;
+    // FindTag() checked the NUL lies within the record
+    const char* end = data.data() + data.size();
+    value.assign(type + 1, bamTagValueLength(*type, type + 1, end) - 1);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawRecord::RemoveTag(const char* tag)
+{
+    const char* type = FindTag(tag);
+    if (! type)
+        return false;
+    size_t len = bamTagValueLength(*type, type + 1, data.data() + data.size());
+    data.erase(type - 2 - data.data(), 3 + len);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void
+bamRawRecord::SetTagString(const char* tag, const string& value)
+{
+    RemoveTag(tag);
+    data.append(tag, 2);
+    data += 'Z';
+    data.append(value.c_str(), value.size() + 1);
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawRecord::IsConsistent(void) const
+{
+    if (data.size() < size_t(BAM_CORE_LENGTH))
+        return false;
+    // in 64 bits, so a wild l_seq cannot wrap around
+    if (NameLength() < 2 || QueryLength() < 0
+        || int64_t(data.size()) < BAM_CORE_LENGTH + NameLength() + 4 * int64_t(CigarCount())
+                                  + (int64_t(QueryLength()) + 1) / 2 + QueryLength())
+        return false;
+    return data[BAM_CORE_LENGTH + NameLength() - 1] == '\0';
+}
+
+
+uint16_t
+yoruba::bamRegionBin(const int32_t beg, int32_t end)
+{
+    --end;
+    if (beg >> 14 == end >> 14) return ((1 << 15) - 1) / 7 + (beg >> 14);
+    if (beg >> 17 == end >> 17) return ((1 << 12) - 1) / 7 + (beg >> 17);
+    if (beg >> 20 == end >> 20) return ((1 << 9) - 1) / 7 + (beg >> 20);
+    if (beg >> 23 == end >> 23) return ((1 << 6) - 1) / 7 + (beg >> 23);
+    if (beg >> 26 == end >> 26) return ((1 << 3) - 1) / 7 + (beg >> 26);
+    return 0;
+}
+
+
+//-------------------------------------
+
+
+void
+bamRawRecord::SetFromAlignment(const BamAlignment& al)
+{
+    static const string cigar_ops = "MIDNSHP=X";
+    static const string seq_codes = "=ACMGRSVTWYHKDBN";
+
+    const bool no_seq = al.QueryBases.empty() || al.QueryBases == "*";
+    const int32_t l_seq = no_seq ? 0 : al.QueryBases.size();
+    const uint16_t n_cigar = al.CigarData.size();
+
+    int32_t end = al.Position;
+    for (uint16_t i = 0; i < n_cigar; ++i) {
+        char t = al.CigarData[i].Type;
+        if (t == 'M' || t == 'D' || t == 'N' || t == '=' || t == 'X')
+            end += al.CigarData[i].Length;
+    }
+    if (end <= al.Position)
+        end = al.Position + 1;
+
+    data.clear();
+    data.reserve(BAM_CORE_LENGTH + al.Name.size() + 1 + 4 * n_cigar
+                 + (l_seq + 1) / 2 + l_seq + al.TagData.size());
+    int32_t i32;
+    uint16_t u16;
+    uint8_t u8;
+    i32 = al.RefID;                          data.append((const char*)&i32, 4);
+    i32 = al.Position;                       data.append((const char*)&i32, 4);
+    u8 = al.Name.size() + 1;                 data.append((const char*)&u8, 1);
+    u8 = al.MapQuality;                      data.append((const char*)&u8, 1);
+    u16 = bamRegionBin(al.Position, end);    data.append((const char*)&u16, 2);
+    u16 = n_cigar;                           data.append((const char*)&u16, 2);
+    u16 = al.AlignmentFlag;                  data.append((const char*)&u16, 2);
+    i32 = l_seq;                             data.append((const char*)&i32, 4);
+    i32 = al.MateRefID;                      data.append((const char*)&i32, 4);
+    i32 = al.MatePosition;                   data.append((const char*)&i32, 4);
+    i32 = al.InsertSize;                     data.append((const char*)&i32, 4);
+    data.append(al.Name.c_str(), al.Name.size() + 1);
+    for (uint16_t i = 0; i < n_cigar; ++i) {
+        size_t op = cigar_ops.find(al.CigarData[i].Type);
+        uint32_t u32 = (al.CigarData[i].Length << 4) | (op == string::npos ? 0 : op);
+        data.append((const char*)&u32, 4);
+    }
+    for (int32_t i = 0; i < l_seq; i += 2) {
+        size_t hi = seq_codes.find(toupper(al.QueryBases[i]));
+        size_t lo = i + 1 < l_seq ? seq_codes.find(toupper(al.QueryBases[i + 1])) : 0;
+        if (hi == string::npos) hi = 15;  // N
+        if (lo == string::npos) lo = 15;
+        data.push_back(char((hi << 4) | lo));
+    }
+    if (al.Qualities.empty() || al.Qualities == "*" || int32_t(al.Qualities.size()) != l_seq)
+        data.append(l_seq, char(0xff));
+    else
+        for (int32_t i = 0; i < l_seq; ++i)
+            data.push_back(char(al.Qualities[i] - 33));
+    data.append(al.TagData);
+}
+
+
+//-------------------------------------  bamRawReader
+
+
+bool
+bamRawReader::Open(const string& filename, bgzfPool* pool)
+{
+    MEM_TAG(MEM_header);
+    header_text.clear();
+    refs.clear();
+    error = false;
+    if (! bgzf.Open(filename, pool))
+        return false;
+
+    char magic[4];
+    int32_t l_text, n_ref;
+    if (bgzf.Read(magic, 4) != 4 || memcmp(magic, "BAM\1", 4) != 0
+        || bgzf.Read(&l_text, 4) != 4 || l_text < 0) {
+        bgzf.Close();
+        return false;
+    }
+    header_text.resize(l_text);
+    if ((l_text && bgzf.Read(&header_text[0], l_text) != l_text)
+        || bgzf.Read(&n_ref, 4) != 4 || n_ref < 0) {
+        bgzf.Close();
+        return false;
+    }
+    // the text may be NUL-padded
+    size_t nul = header_text.find('\0');
+    if (nul != string::npos)
+        header_text.resize(nul);
+
+    refs.reserve(n_ref);
+    for (int32_t i = 0; i < n_ref; ++i) {
+        int32_t l_name, l_ref;
+        if (bgzf.Read(&l_name, 4) != 4 || l_name < 1) {
+            bgzf.Close();
+            return false;
+        }
+        string name(l_name, '\0');
+        if (bgzf.Read(&name[0], l_name) != l_name || bgzf.Read(&l_ref, 4) != 4) {
+            bgzf.Close();
+            return false;
+        }
+        name.resize(l_name - 1);
+        refs.push_back(RefData(name, l_ref));
+    }
+    first_record_offset = bgzf.Tell();
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawReader::GetNextRecord(bamRawRecord& r)
+{
+    MEM_TAG(MEM_reader);
+    int32_t block_size;
+    int64_t n = bgzf.Read(&block_size, 4);
+    if (n != 4) {
+        if (n != 0) {
+            cerr << "bamRawReader: truncated record length" << endl;
+            error = true;
+        }
+        return false;
+    }
+    if (block_size < BAM_CORE_LENGTH) {
+        cerr << "bamRawReader: invalid record length " << block_size << endl;
+        error = true;
+        return false;
+    }
+    r.data.resize(block_size);
+    if (bgzf.Read(&r.data[0], block_size) != block_size) {
+        cerr << "bamRawReader: truncated record" << endl;
+        error = true;
+        return false;
+    }
+    if (! r.IsConsistent()) {
+        cerr << "bamRawReader: inconsistent record of length " << block_size << endl;
+        error = true;
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------  bamRawWriter
+
+
+bool
+bamRawWriter::Open(const string& filename, const string& header_text,
+                   const RefVector& refs, bgzfPool* pool, const int32_t level)
+{
+    if (! bgzf.Open(filename, pool, level))
+        return false;
+    this->filename = filename;
+    n_records = 0;
+    yvi_resumed.clear();
+    yvi_marks.clear();
+    int32_t l_text = header_text.size(), n_ref = refs.size();
+    bool ok = bgzf.Write("BAM\1", 4) && bgzf.Write(&l_text, 4)
+              && bgzf.Write(header_text.data(), l_text) && bgzf.Write(&n_ref, 4);
+    for (int32_t i = 0; ok && i < n_ref; ++i) {
+        int32_t l_name = refs[i].RefName.size() + 1, l_ref = refs[i].RefLength;
+        ok = bgzf.Write(&l_name, 4) && bgzf.Write(refs[i].RefName.c_str(), l_name)
+             && bgzf.Write(&l_ref, 4);
+    }
+    // start the records in a new block, as samtools does
+    ok = ok && bgzf.Flush();
+    if (! ok)
+        bgzf.Close();
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::Resume(const string& filename, const int64_t length,
+                     bgzfPool* pool, const int32_t level)
+{
+    this->filename = filename;
+    n_records = 0;
+    yvi_resumed.clear();
+    yvi_marks.clear();
+    if (! bgzf.Resume(filename, length, pool, level))
+        return false;
+    // the file is now the length it was at the checkpoint, as was the index
+    yviIndex yvi;
+    if (yvi_interval > 0 && yvi.Load(filename) && yvi.Interval() == yvi_interval) {
+        n_records = yvi.Records();
+        for (size_t i = 0; i < yvi.Entries().size(); ++i)
+            yvi_resumed.push_back(make_pair(yvi.Entries()[i].ordinal, yvi.Entries()[i].voffset));
+    } else {
+        yvi_interval = 0;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::Write(const bamRawRecord& r)
+{
+    return Write(r.data.data(), r.data.size());
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::Write(const char* data, const int32_t block_size)
+{
+    if (yvi_interval > 0 && n_records % yvi_interval == 0)
+        yvi_marks.push_back(make_pair(n_records, bgzf.Mark()));
+    ++n_records;
+    return bgzf.Write(&block_size, 4) && bgzf.Write(data, block_size);
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::Close(void)
+{
+    if (! bgzf.IsOpen())
+        return true;
+    if (! bgzf.Close())
+        return false;
+    writeIndex();
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::Checkpoint(int64_t& length)
+{
+    if (! bgzf.Checkpoint(length))
+        return false;
+    // for Resume() to continue; without it the resumed file is not indexed
+    writeIndex();
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bamRawWriter::writeIndex(void) const
+{
+    // /dev/stdout is a regular file when redirected to one, but has no place
+    // for an index beside it
+    struct stat st;
+    if (yvi_interval <= 0 || filename.compare(0, 5, "/dev/") == 0
+        || stat(filename.c_str(), &st) != 0 || ! S_ISREG(st.st_mode))
+        return false;
+    yviIndex yvi(yvi_interval);
+    for (size_t i = 0; i < yvi_resumed.size(); ++i)
+        yvi.Add(yvi_resumed[i].first, yvi_resumed[i].second);
+    for (size_t i = 0; i < yvi_marks.size(); ++i) {
+        const int64_t voffset = bgzf.Resolve(yvi_marks[i].second);
+        if (voffset < 0)
+            return false;
+        yvi.Add(yvi_marks[i].first, voffset);
+    }
+    yvi.SetRecords(n_records);
+    if (! yvi.Write(filename)) {
+        cerr << "bamRawWriter: could not write record index " << yviIndex::Filename(filename) << endl;
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------  bamCopyRecords
+
+
+static const size_t copy_buffer_size = 4 << 20;
+
+
+// Read the block at coffset, returning false if it is not a BGZF block
+
+static bool
+readBlock(FILE* fp, const int64_t coffset, string& block)
+{
+    unsigned char head[BGZF_BLOCK_HEADER_LENGTH];
+    if (fseeko(fp, coffset, SEEK_SET) != 0
+        || fread(head, 1, BGZF_BLOCK_HEADER_LENGTH, fp) != size_t(BGZF_BLOCK_HEADER_LENGTH))
+        return false;
+    const int32_t size = bgzfBlockSize(head, BGZF_BLOCK_HEADER_LENGTH);
+    if (! size)
+        return false;
+    block.assign((const char*)head, BGZF_BLOCK_HEADER_LENGTH);
+    block.resize(size);
+    return fread(&block[BGZF_BLOCK_HEADER_LENGTH], 1, size - BGZF_BLOCK_HEADER_LENGTH, fp)
+           == size_t(size - BGZF_BLOCK_HEADER_LENGTH);
+}
+
+
+//-------------------------------------
+
+
+// Decompress the block at coffset and write bytes [from, to) of it, to -1
+// for the rest of it, returning the size of the compressed block or 0
+
+static int64_t
+writePartialBlock(FILE* fp, const int64_t coffset, const int32_t from, const int32_t to,
+                  bamRawWriter& writer)
+{
+    bgzfJob job(bgzfJob::DECOMPRESS);
+    if (! readBlock(fp, coffset, job.in))
+        return 0;
+    job.Run();
+    const size_t e = to < 0 ? job.out.size() : size_t(to);
+    if (! job.ok || e > job.out.size() || size_t(from) > e
+        || ! writer.WriteStream(job.out.data() + from, e - from))
+        return 0;
+    return job.in.size();
+}
+
+
+//-------------------------------------
+
+
+bool
+yoruba::bamCopyRecords(const string& file, const int64_t beg, const int64_t end,
+                       bamRawWriter& writer, int64_t& n_copied, int64_t& n_recompressed)
+{
+    if (end >= 0 && end <= beg)
+        return true;
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (! fp) {
+        cerr << "bamCopyRecords: could not open " << file << endl;
+        return false;
+    }
+    int64_t coffset = bgzfBlockOffset(beg);
+    const int64_t end_coffset = end < 0 ? -1 : bgzfBlockOffset(end);
+    bool ok = true;
+
+    if (bgzfWithinBlockOffset(beg) || coffset == end_coffset) {
+        // a block holding bytes before beg, or beg and end both
+        const int32_t to = coffset == end_coffset ? bgzfWithinBlockOffset(end) : -1;
+        const int64_t size = writePartialBlock(fp, coffset, bgzfWithinBlockOffset(beg), to, writer);
+        ok = size > 0;
+        ++n_recompressed;
+        if (! ok)
+            cerr << "bamCopyRecords: could not read block at " << coffset << " of " << file << endl;
+        if (! ok || coffset == end_coffset) {
+            fclose(fp);
+            return ok;
+        }
+        coffset += size;
+    }
+
+    vector<char> buf(copy_buffer_size);
+    size_t have = 0;  // bytes in buf, starting at coffset
+    ok = ok && fseeko(fp, coffset, SEEK_SET) == 0;
+    while (ok) {
+        size_t want = buf.size() - have;
+        if (end_coffset >= 0 && int64_t(want) > end_coffset - coffset - int64_t(have))
+            want = end_coffset - coffset - have;
+        const size_t n = want ? fread(&buf[have], 1, want, fp) : 0;
+        have += n;
+        if (! have)
+            break;
+        size_t pos = 0, run = 0;  // next block and start of blocks to write
+        while (ok && pos + BGZF_BLOCK_HEADER_LENGTH <= have) {
+            const unsigned char* b = (const unsigned char*)&buf[pos];
+            const int32_t size = bgzfBlockSize(b, have - pos);
+            if (! size) {
+                cerr << "bamCopyRecords: no BGZF block at " << coffset + pos << " of " << file << endl;
+                ok = false;
+            } else if (pos + size > have) {
+                break;  // block continues in the next read
+            } else {
+                uint32_t isize;
+                memcpy(&isize, b + size - 4, 4);
+                if (! isize) {  // empty, write those before it and skip it
+                    if (pos > run)
+                        ok = writer.WriteBlocks(&buf[run], pos - run);
+                    run = pos + size;
+                } else {
+                    ++n_copied;
+                }
+                pos += size;
+            }
+        }
+        if (ok && pos > run)
+            ok = writer.WriteBlocks(&buf[run], pos - run);
+        if (ok && ! n && have > pos) {
+            cerr << "bamCopyRecords: " << file << " ends within a block" << endl;
+            ok = false;
+        }
+        memmove(&buf[0], &buf[0] + pos, have - pos);
+        have -= pos;
+        coffset += pos;
+        if (! n)
+            break;
+    }
+    if (ferror(fp)) {
+        cerr << "bamCopyRecords: could not read " << file << endl;
+        ok = false;
+    }
+
+    if (ok && end >= 0 && bgzfWithinBlockOffset(end)) {
+        ok = writePartialBlock(fp, end_coffset, 0, bgzfWithinBlockOffset(end), writer) > 0;
+        ++n_recompressed;
+        if (! ok)
+            cerr << "bamCopyRecords: could not read block at " << end_coffset << " of " << file << endl;
+    }
+    fclose(fp);
+    return ok;
+}
+
+
+//-------------------------------------  bamFindRecordStart
+
+
+// Length of the plausible record at p, including block_size, 0 if it is not
+// plausible, or -1 if buf ends before it can be judged
+
+static int64_t
+plausibleRecord(const char* p, const int64_t avail, const int32_t n_refs)
+{
+    if (avail < 4 + BAM_CORE_LENGTH)
+        return -1;
+    int32_t block_size, ref, pos, l_seq, mate_ref, mate_pos;
+    uint16_t n_cigar;
+    memcpy(&block_size, p, 4);
+    memcpy(&ref, p + 4, 4);
+    memcpy(&pos, p + 8, 4);
+    const int32_t l_read_name = uint8_t(p[12]);
+    memcpy(&n_cigar, p + 16, 2);
+    memcpy(&l_seq, p + 20, 4);
+    memcpy(&mate_ref, p + 24, 4);
+    memcpy(&mate_pos, p + 28, 4);
+    if (ref < -1 || ref >= n_refs || mate_ref < -1 || mate_ref >= n_refs
+        || pos < -1 || mate_pos < -1 || l_seq < 0 || l_read_name < 2)
+        return 0;
+    const int64_t need = int64_t(BAM_CORE_LENGTH) + l_read_name + 4 * int64_t(n_cigar)
+                         + (int64_t(l_seq) + 1) / 2 + l_seq;
+    if (block_size < 0 || int64_t(block_size) < need)
+        return 0;
+    if (avail < 4 + BAM_CORE_LENGTH + l_read_name)
+        return -1;
+    const char* name = p + 4 + BAM_CORE_LENGTH;
+    if (name[l_read_name - 1] != '\0')
+        return 0;
+    for (int32_t i = 0; i < l_read_name - 1; ++i)
+        if (name[i] < '!' || name[i] > '~')
+            return 0;
+    return 4 + int64_t(block_size);
+}
+
+
+//-------------------------------------
+
+
+int64_t
+yoruba::bamFindRecordStart(const char* buf, const int64_t len, const int64_t from,
+                           const int32_t n_refs, const bool at_eof, const int32_t n_chain)
+{
+    for (int64_t i = from; i + 4 + BAM_CORE_LENGTH <= len; ++i) {
+        int64_t p = i;
+        int32_t k = 0;
+        for ( ; k <= n_chain; ++k) {
+            if (at_eof && p == len)
+                break;
+            const int64_t l = plausibleRecord(buf + p, len - p, n_refs);
+            if (l == 0 || (k == 0 && (l < 0 || p + l > len)))
+                break;
+            if (l < 0 || p + l > len) {  // runs past buf, so accept what chained
+                k = n_chain + 1;
+                break;
+            }
+            p += l;
+        }
+        if (k > n_chain || (at_eof && p == len && k > 0))
+            return i;
+    }
+    return -1;
+}
+
+
+//-------------------------------------
+
+
+bool
+yoruba::bamFindRecordBoundary(const string& file, const int64_t from, const int32_t n_refs,
+                              int64_t& voffset)
+{
+    FILE* fp = fopen(file.c_str(), "rb");
+    if (! fp)
+        return false;
+    bgzfReader reader;
+    if (! reader.Open(file)) {
+        fclose(fp);
+        return false;
+    }
+    // a window of several blocks, so records spanning blocks can be chained
+    static const int64_t window = 4 * BGZF_MAX_BLOCK_SIZE;
+    string buf(window, '\0');
+    bool found = false;
+    for (int64_t c = from; ! found; ++c) {
+        if ((c = bgzfFindBlock(fp, c)) < 0)
+            break;
+        if (! reader.Seek(bgzfVirtualOffset(c, 0)))
+            break;
+        const int64_t n = reader.Read(&buf[0], window);
+        if (n <= 0)
+            break;
+        const int64_t i = bamFindRecordStart(buf.data(), n, 0, n_refs, n < window);
+        if (i < 0)
+            continue;
+        // reread up to the start, so the reader settles its virtual offset
+        if (! reader.Seek(bgzfVirtualOffset(c, 0)) || reader.Read(&buf[0], i) != i)
+            break;
+        voffset = reader.Tell();
+        found = true;
+    }
+    reader.Close();
+    fclose(fp);
+    return found;
+}
@@ -0,0 +1,265 @@
+// yoruba_bamraw.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_bamraw.cpp
+//
+// BAM records kept as the bytes found in the file.  Fields are read in place
+// when asked for, so scans that only need a few core fields never pay for
+// decoding read names, bases, qualities and tags into strings.  Records are
+// written the same way, so writers can share a bgzfPool for compression.
+
+#ifndef _YORUBA_BAMRAW_H_
+#define _YORUBA_BAMRAW_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// BamTools includes: https://github.com/pezmaster31/bamtools
+#include "api/BamAux.h"
+#include "api/BamAlignment.h"
+
+// Yoruba includes
+#include "yoruba_bgzf.h"
+
+namespace yoruba {
+
+// BAM flag bits, see the SAM specification section 1.4
+
+const uint16_t BAM_FPAIRED        = 0x1;
+const uint16_t BAM_FPROPER_PAIR   = 0x2;
+const uint16_t BAM_FUNMAP         = 0x4;
+const uint16_t BAM_FMUNMAP        = 0x8;
+const uint16_t BAM_FREVERSE       = 0x10;
+const uint16_t BAM_FMREVERSE      = 0x20;
+const uint16_t BAM_FREAD1         = 0x40;
+const uint16_t BAM_FREAD2         = 0x80;
+const uint16_t BAM_FSECONDARY     = 0x100;
+const uint16_t BAM_FQCFAIL        = 0x200;
+const uint16_t BAM_FDUP           = 0x400;
+const uint16_t BAM_FSUPPLEMENTARY = 0x800;
+
+// Length of the fixed-size part of a BAM record, following block_size
+
+const int32_t  BAM_CORE_LENGTH    = 32;
+
+
+//-------------------------------------
+
+
+// One BAM record, holding the bytes following block_size in the file.
+
+class bamRawRecord {
+
+    public:
+        int32_t     RefID(void) const        { return get_i32(0); }
+        int32_t     Position(void) const     { return get_i32(4); }
+        uint8_t     NameLength(void) const   { return uint8_t(data[8]); }  // with NUL
+        uint8_t     MapQuality(void) const   { return uint8_t(data[9]); }
+        uint16_t    Bin(void) const          { return get_u16(10); }
+        uint16_t    CigarCount(void) const   { return get_u16(12); }
+        uint16_t    Flag(void) const         { return get_u16(14); }
+        int32_t     QueryLength(void) const  { return get_i32(16); }
+        int32_t     MateRefID(void) const    { return get_i32(20); }
+        int32_t     MatePosition(void) const { return get_i32(24); }
+        int32_t     InsertSize(void) const   { return get_i32(28); }
+        const char* Name(void) const         { return data.data() + BAM_CORE_LENGTH; }
+
+        bool IsPaired(void) const            { return Flag() & BAM_FPAIRED; }
+        bool IsMapped(void) const            { return ! (Flag() & BAM_FUNMAP); }
+        bool IsMateMapped(void) const        { return ! (Flag() & BAM_FMUNMAP); }
+        bool IsReverseStrand(void) const     { return Flag() & BAM_FREVERSE; }
+        bool IsMateReverseStrand(void) const { return Flag() & BAM_FMREVERSE; }
+        bool IsFirstMate(void) const         { return Flag() & BAM_FREAD1; }
+        bool IsSecondMate(void) const        { return Flag() & BAM_FREAD2; }
+        bool IsPrimaryAlignment(void) const
+            { return ! (Flag() & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)); }
+        bool IsFailedQC(void) const          { return Flag() & BAM_FQCFAIL; }
+        bool IsDuplicate(void) const         { return Flag() & BAM_FDUP; }
+
+        // one past the last reference base covered, like
+        // BamAlignment::GetEndPosition()
+        int32_t     EndPosition(void) const;
+        // pointer to the type character of the tag, or NULL if absent
+        const char* FindTag(const char* tag) const;
+        // value of a Z- or H-type tag
+        bool        GetTagString(const char* tag, std::string& value) const;
+        // remove a tag, false if it is absent
+        bool        RemoveTag(const char* tag);
+        // set a Z-type tag, replacing any value it has
+        void        SetTagString(const char* tag, const std::string& value);
+        // true if the record length and its internal lengths agree
+        bool        IsConsistent(void) const;
+
+        void        SetRefID(const int32_t id)      { set_i32(0, id); }
+        void        SetMateRefID(const int32_t id)  { set_i32(20, id); }
+        void        SetFlag(const uint16_t flag)    { memcpy(&data[14], &flag, 2); }
+
+        // encode a BamTools alignment, which must have its string fields
+        // filled, as from BamReader::GetNextAlignment()
+        void        SetFromAlignment(const BamTools::BamAlignment& al);
+
+    public:
+        std::string data;
+
+    private:
+        int32_t  get_i32(const size_t i) const
+            { int32_t v; memcpy(&v, data.data() + i, 4); return v; }
+        void     set_i32(const size_t i, const int32_t v)
+            { memcpy(&data[i], &v, 4); }
+        uint16_t get_u16(const size_t i) const
+            { uint16_t v; memcpy(&v, data.data() + i, 2); return v; }
+        size_t   auxOffset(void) const
+            { return BAM_CORE_LENGTH + NameLength() + 4 * CigarCount()
+                     + (QueryLength() + 1) / 2 + QueryLength(); }
+
+};  // class bamRawRecord
+
+
+// Length of the value of a tag of the given type starting at p, or 0 if it
+// runs past end
+
+size_t
+bamTagValueLength(const char type, const char* p, const char* end);
+
+// Bin of a record spanning [beg, end), reg2bin() from the SAM specification
+
+uint16_t
+bamRegionBin(const int32_t beg, int32_t end);
+
+
+//-------------------------------------
+
+
+// Reads the header and then records from a BAM file through a bgzfReader,
+// so block decompression can be spread over a bgzfPool.
+
+class bamRawReader {
+
+    public:
+        bamRawReader(void) : first_record_offset(0), error(false) { }
+
+        bool    Open(const std::string& filename, bgzfPool* pool = NULL);
+        void    Close(void) { bgzf.Close(); }
+        // false at the end of the records or on error; a truncated, corrupt
+        // or inconsistent record is an error, see Error()
+        bool    GetNextRecord(bamRawRecord& r);
+        // true if reading stopped short of the end of the records
+        bool    Error(void) const { return error || bgzf.Error(); }
+
+        const std::string&         HeaderText(void) const { return header_text; }
+        const BamTools::RefVector& References(void) const { return refs; }
+        int32_t                    ReferenceCount(void) const { return refs.size(); }
+
+        int64_t Tell(void) const { return bgzf.Tell(); }
+        bool    Seek(const int64_t voffset) { return bgzf.Seek(voffset); }
+        int64_t FirstRecordOffset(void) const { return first_record_offset; }
+        int64_t CompressedOffset(void) const { return bgzf.CompressedOffset(); }
+
+    private:
+        bgzfReader          bgzf;
+        std::string         header_text;
+        BamTools::RefVector refs;
+        int64_t             first_record_offset;
+        bool                error;
+
+};  // class bamRawReader
+
+
+//-------------------------------------
+
+
+// Writes the header and then records to a BAM file through a bgzfWriter,
+// so block compression can be spread over a bgzfPool.
+
+class bamRawWriter {
+
+    public:
+        bamRawWriter(void) : yvi_interval(0), n_records(0) { }
+
+        bool    Open(const std::string& filename, const std::string& header_text,
+                     const BamTools::RefVector& refs, bgzfPool* pool = NULL,
+                     const int32_t level = -1);
+        // continue a file written before, from a length given by Checkpoint();
+        // with IndexRecords(), the record index left by Checkpoint() is
+        // continued, and if there is none no index is written
+        bool    Resume(const std::string& filename, const int64_t length,
+                       bgzfPool* pool = NULL, const int32_t level = -1);
+        // with IndexRecords(), also writes the record index <filename>.yvi
+        bool    Close(void);
+        // end the current block and write everything, giving the length of
+        // the file so far; with IndexRecords(), also writes the record index
+        // of the file so far
+        bool    Checkpoint(int64_t& length);
+        bool    IsOpen(void) const { return bgzf.IsOpen(); }
+        // build a record index (yoruba_yvi.h) of every interval-th record,
+        // written when the file is closed if it is a regular file
+        void    IndexRecords(const int32_t interval) { yvi_interval = interval; }
+        int64_t Records(void) const { return n_records; }
+        bool    Write(const bamRawRecord& r);
+        // write a record held elsewhere, data being the bytes following
+        // block_size
+        bool    Write(const char* data, const int32_t block_size);
+        // write part of the record stream of another BAM file, which need not
+        // start or end at a record boundary; records are no longer counted,
+        // so no record index is written
+        bool    WriteStream(const char* data, const int64_t len)
+                    { yvi_interval = 0; return bgzf.Write(data, len); }
+        // copy whole BGZF blocks of the record stream of another BAM file
+        bool    WriteBlocks(const char* blocks, const int64_t len)
+                    { yvi_interval = 0; return bgzf.WriteBlocks(blocks, len); }
+
+    private:
+        // write the record index of what is written so far, false if it
+        // could not be
+        bool    writeIndex(void) const;
+
+    private:
+        bgzfWriter  bgzf;
+        std::string filename;
+        int32_t     yvi_interval;
+        int64_t     n_records;
+        std::vector<std::pair<int64_t, int64_t> > yvi_resumed;  // ordinal, virtual offset
+        std::vector<std::pair<int64_t, int64_t> > yvi_marks;  // ordinal, bgzfWriter mark
+
+};  // class bamRawWriter
+
+
+// Copy the record stream of the BAM file between virtual offsets beg and end,
+// end -1 for the end of the file, to writer.  Whole blocks are copied as they
+// are, in large reads; only a block partly within [beg, end) is decompressed
+// and its part written through the compressor.  Empty blocks, such as the
+// EOF marker, are dropped.  Blocks copied and recompressed are added to the
+// counts.
+
+bool
+bamCopyRecords(const std::string& file, const int64_t beg, const int64_t end,
+               bamRawWriter& writer, int64_t& n_copied, int64_t& n_recompressed);
+
+// Offset in buf, at or after from, of the first place a record plausibly
+// starts: its block_size, l_read_name, n_cigar_op and l_seq agree, its
+// reference IDs are below n_refs, its read name is printable, and n_chain
+// records follow it the same way, or run to the end of buf.  at_eof says
+// buf ends with the record stream.  Returns -1 if there is none.
+
+int64_t
+bamFindRecordStart(const char* buf, const int64_t len, const int64_t from,
+                   const int32_t n_refs, const bool at_eof, const int32_t n_chain = 4);
+
+// Virtual offset of a record start in the first block at or after file
+// offset from of a BAM file with n_refs references, found without an index
+// with bgzfFindBlock() and bamFindRecordStart().  The start may lie in a later
+// block if no record starts in that one.  Returns false if there is none.
+
+bool
+bamFindRecordBoundary(const std::string& file, const int64_t from, const int32_t n_refs,
+                      int64_t& voffset);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_BAMRAW_H_
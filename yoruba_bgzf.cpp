@@ -0,0 +1,769 @@
+// yoruba_bgzf.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// BGZF block reading and writing, with compression and decompression over a
+// pool of threads.
+//
+// The BGZF format is a series of gzip members ('blocks'), each holding at
+// most 64 KiB of uncompressed data, and each with an extra header field
+// giving the compressed size of the block so it can be found without
+// decompressing it.  See section 4.1 of the SAM specification.
+
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "yoruba_bgzf.h"
+#include "yoruba_memtrack.h"
+
+using namespace std;
+using namespace yoruba;
+
+const unsigned char yoruba::bgzf_eof_block[BGZF_EOF_BLOCK_LENGTH] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00,
+    0x42, 0x43, 0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00
+};
+
+static inline uint16_t
+get_u16(const unsigned char* p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+static inline uint32_t
+get_u32(const unsigned char* p)
+    { return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24); }
+
+
+//-------------------------------------
+
+
+int32_t
+yoruba::bgzfBlockSize(const unsigned char* buf, const size_t len)
+{
+    if (len < size_t(BGZF_BLOCK_HEADER_LENGTH))
+        return 0;
+    if (buf[0] != 0x1f || buf[1] != 0x8b || buf[2] != 0x08 || (buf[3] & 0x04) == 0)
+        return 0;
+    if (get_u16(buf + 10) != 6 || buf[12] != 'B' || buf[13] != 'C' || get_u16(buf + 14) != 2)
+        return 0;
+    int32_t size = int32_t(get_u16(buf + 16)) + 1;
+    if (size < BGZF_BLOCK_HEADER_LENGTH + BGZF_BLOCK_FOOTER_LENGTH)
+        return 0;
+    return size;
+}
+
+
+// True if a block header at coffset leads through n_chain block sizes to
+// further block headers, or to the end of the file
+
+static bool
+blockChains(FILE* fp, int64_t coffset, const int32_t n_chain)
+{
+    unsigned char head[BGZF_BLOCK_HEADER_LENGTH];
+    for (int32_t k = 0; k <= n_chain; ++k) {
+        if (fseeko(fp, coffset, SEEK_SET) != 0)
+            return false;
+        const size_t n = fread(head, 1, BGZF_BLOCK_HEADER_LENGTH, fp);
+        if (n == 0 && k > 0 && feof(fp))
+            return true;
+        const int32_t size = bgzfBlockSize(head, n);
+        if (! size)
+            return false;
+        coffset += size;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+yoruba::bgzfFindBlock(FILE* fp, const int64_t from, const int32_t n_chain)
+{
+    static const int32_t window = 4 * BGZF_MAX_BLOCK_SIZE;
+    vector<unsigned char> buf(window);
+    for (int64_t pos = from; ; pos += window - 3) {
+        if (fseeko(fp, pos, SEEK_SET) != 0)
+            return -1;
+        const size_t n = fread(&buf[0], 1, window, fp);
+        if (n < 4)
+            return -1;
+        for (size_t i = 0; i + 3 < n; ++i)
+            if (buf[i] == 0x1f && buf[i + 1] == 0x8b && buf[i + 2] == 0x08 && (buf[i + 3] & 0x04)
+                && blockChains(fp, pos + i, n_chain))
+                return pos + i;
+        if (n < size_t(window))
+            return -1;
+    }
+}
+
+
+//-------------------------------------  bgzfJob
+
+
+static bool
+inflateBlock(const string& in, string& out)
+{
+    const unsigned char* buf = reinterpret_cast<const unsigned char*>(in.data());
+    int32_t block_size = bgzfBlockSize(buf, in.size());
+    if (! block_size || size_t(block_size) != in.size())
+        return false;
+    uint32_t crc = get_u32(buf + block_size - 8);
+    uint32_t isize = get_u32(buf + block_size - 4);
+    if (isize > uint32_t(BGZF_MAX_BLOCK_SIZE))
+        return false;
+    out.resize(isize);
+    if (isize == 0)
+        return true;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    zs.next_in = const_cast<Bytef*>(buf + BGZF_BLOCK_HEADER_LENGTH);
+    zs.avail_in = block_size - BGZF_BLOCK_HEADER_LENGTH - BGZF_BLOCK_FOOTER_LENGTH;
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = isize;
+    if (inflateInit2(&zs, -15) != Z_OK)
+        return false;
+    int status = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (status != Z_STREAM_END || zs.total_out != isize)
+        return false;
+    return crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(out.data()), isize) == crc;
+}
+
+
+//-------------------------------------
+
+
+static bool
+deflateBlock(const string& in, string& out, int32_t level)
+{
+    if (in.size() > size_t(BGZF_MAX_BLOCK_SIZE - 1024))
+        return false;
+    out.resize(BGZF_MAX_BLOCK_SIZE);
+    unsigned char* buf = reinterpret_cast<unsigned char*>(&out[0]);
+    memcpy(buf, bgzf_eof_block, BGZF_BLOCK_HEADER_LENGTH);
+
+    int32_t compressed = 0;
+    for (;;) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        zs.avail_in = in.size();
+        zs.next_out = buf + BGZF_BLOCK_HEADER_LENGTH;
+        zs.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_BLOCK_HEADER_LENGTH - BGZF_BLOCK_FOOTER_LENGTH;
+        if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        int status = deflate(&zs, Z_FINISH);
+        deflateEnd(&zs);
+        if (status == Z_STREAM_END) {
+            compressed = zs.total_out;
+            break;
+        }
+        if (level == 0)
+            return false;
+        level = 0;  // incompressible data, store it instead
+    }
+
+    int32_t block_size = BGZF_BLOCK_HEADER_LENGTH + compressed + BGZF_BLOCK_FOOTER_LENGTH;
+    buf[16] = (block_size - 1) & 0xff;
+    buf[17] = ((block_size - 1) >> 8) & 0xff;
+    uint32_t crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(in.data()), in.size());
+    unsigned char* footer = buf + BGZF_BLOCK_HEADER_LENGTH + compressed;
+    for (int i = 0; i < 4; ++i) {
+        footer[i] = (crc >> (8 * i)) & 0xff;
+        footer[4 + i] = (uint32_t(in.size()) >> (8 * i)) & 0xff;
+    }
+    out.resize(block_size);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfJob::Run(void)
+{
+    MEM_TAG(type == DECOMPRESS ? MEM_reader : MEM_writer);
+    if (type == DECOMPRESS)
+        ok = inflateBlock(in, out);
+    else
+        ok = deflateBlock(in, out, level);
+}
+
+
+//-------------------------------------  bgzfPool
+
+
+bgzfPool::bgzfPool(const int32_t n_threads)
+    : shutdown(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&job_ready, NULL);
+    pthread_cond_init(&job_done, NULL);
+    for (int32_t i = 0; i < n_threads; ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, bgzfPool::worker, this) != 0) {
+            std::cerr << "bgzfPool: could not create thread " << i
+                << ", continuing with " << threads.size() << std::endl;
+            break;
+        }
+        threads.push_back(t);
+    }
+}
+
+
+//-------------------------------------
+
+
+bgzfPool::~bgzfPool(void)
+{
+    pthread_mutex_lock(&mutex);
+    shutdown = true;
+    pthread_cond_broadcast(&job_ready);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&job_done);
+    pthread_cond_destroy(&job_ready);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+//-------------------------------------
+
+
+void*
+bgzfPool::worker(void* arg)
+{
+    bgzfPool* pool = static_cast<bgzfPool*>(arg);
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (pool->queue.empty() && ! pool->shutdown)
+            pthread_cond_wait(&pool->job_ready, &pool->mutex);
+        if (pool->queue.empty())  // and shutting down
+            break;
+        bgzfJob* job = pool->queue.front();
+        pool->queue.pop_front();
+        pthread_mutex_unlock(&pool->mutex);
+        job->Run();
+        pthread_mutex_lock(&pool->mutex);
+        job->done = true;
+        pthread_cond_broadcast(&pool->job_done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfPool::Submit(bgzfJob* job)
+{
+    job->done = false;
+    if (threads.empty()) {
+        job->Run();
+        job->done = true;
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    queue.push_back(job);
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfPool::Wait(bgzfJob* job)
+{
+    if (threads.empty())
+        return;
+    pthread_mutex_lock(&mutex);
+    while (! job->done)
+        pthread_cond_wait(&job_done, &mutex);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------  bgzfReader
+
+
+static const size_t reader_file_buffer = 1 << 20;
+
+// blocks a reader keeps being read and decompressed ahead of the current one
+static inline size_t
+readerAhead(const int32_t n_threads)
+{
+    return n_threads ? 4 * n_threads : 1;
+}
+
+
+//-------------------------------------
+
+
+bgzfReader::bgzfReader(void)
+    : fp(NULL)
+    , pool(NULL)
+    , current(NULL)
+    , current_pos(0)
+    , next_coffset(0)
+    , max_ahead(1)
+    , eof(false)
+    , error(false)
+{ }
+
+
+//-------------------------------------
+
+
+bgzfReader::~bgzfReader(void)
+{
+    Close();
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfReader::Open(const string& filename, bgzfPool* p)
+{
+    Close();
+    fp = fopen(filename.c_str(), "rb");
+    if (! fp)
+        return false;
+    setvbuf(fp, NULL, _IOFBF, reader_file_buffer);
+    pool = p ? p : &inline_pool;
+    max_ahead = readerAhead(pool->Threads());
+    next_coffset = 0;
+    eof = error = false;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+size_t
+bgzfReader::Footprint(const int32_t n_threads)
+{
+    // each block ahead and the current one hold compressed and decompressed
+    return reader_file_buffer + (readerAhead(n_threads) + 1) * 2 * BGZF_MAX_BLOCK_SIZE;
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfReader::Close(void)
+{
+    discardAhead();
+    if (fp) {
+        fclose(fp);
+        fp = NULL;
+    }
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfReader::discardAhead(void)
+{
+    // jobs may still be running in the pool, so wait for each before freeing
+    while (! ahead.empty()) {
+        pool->Wait(ahead.front());
+        delete ahead.front();
+        ahead.pop_front();
+    }
+    delete current;
+    current = NULL;
+    current_pos = 0;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfReader::readBlock(bgzfJob* job)
+{
+    unsigned char header[BGZF_BLOCK_HEADER_LENGTH];
+    size_t n = fread(header, 1, BGZF_BLOCK_HEADER_LENGTH, fp);
+    if (n == 0 && feof(fp))
+        return false;  // clean end of file
+    int32_t block_size = bgzfBlockSize(header, n);
+    if (! block_size) {
+        error = true;
+        return false;
+    }
+    job->in.resize(block_size);
+    memcpy(&job->in[0], header, BGZF_BLOCK_HEADER_LENGTH);
+    size_t rest = block_size - BGZF_BLOCK_HEADER_LENGTH;
+    if (fread(&job->in[BGZF_BLOCK_HEADER_LENGTH], 1, rest, fp) != rest) {
+        error = true;
+        return false;
+    }
+    job->coffset = next_coffset;
+    next_coffset += block_size;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// Make the next block current.  Keep up to max_ahead blocks being
+// decompressed in the pool, in file order.
+
+bool
+bgzfReader::nextBlock(void)
+{
+    delete current;
+    current = NULL;
+    current_pos = 0;
+    while (! eof && ! error && ahead.size() < max_ahead) {
+        bgzfJob* job = new bgzfJob(bgzfJob::DECOMPRESS);
+        if (! readBlock(job)) {
+            delete job;
+            eof = true;
+            break;
+        }
+        pool->Submit(job);
+        ahead.push_back(job);
+    }
+    if (ahead.empty())
+        return false;
+    current = ahead.front();
+    ahead.pop_front();
+    pool->Wait(current);
+    if (! current->ok) {
+        std::cerr << "bgzfReader: corrupt BGZF block at file offset "
+            << current->coffset << std::endl;
+        error = true;
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+bgzfReader::Read(void* buf, const int64_t len)
+{
+    if (! fp)
+        return -1;
+    char* dest = static_cast<char*>(buf);
+    int64_t n_read = 0;
+    while (n_read < len) {
+        if (! current || current_pos >= int32_t(current->out.size())) {
+            if (! nextBlock())
+                break;
+            continue;  // the block might be empty, such as the EOF block
+        }
+        int64_t n = current->out.size() - current_pos;
+        if (n > len - n_read)
+            n = len - n_read;
+        memcpy(dest + n_read, current->out.data() + current_pos, n);
+        current_pos += n;
+        n_read += n;
+    }
+    return error ? -1 : n_read;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+bgzfReader::Tell(void) const
+{
+    if (! current)
+        return bgzfVirtualOffset(ahead.empty() ? next_coffset : ahead.front()->coffset, 0);
+    if (current_pos >= int32_t(current->out.size()))
+        return bgzfVirtualOffset(current->coffset + current->in.size(), 0);
+    return bgzfVirtualOffset(current->coffset, current_pos);
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfReader::Seek(const int64_t voffset)
+{
+    if (! fp)
+        return false;
+    discardAhead();
+    eof = error = false;
+    next_coffset = bgzfBlockOffset(voffset);
+    if (fseeko(fp, next_coffset, SEEK_SET) != 0) {
+        error = true;
+        return false;
+    }
+    int32_t uoffset = bgzfWithinBlockOffset(voffset);
+    if (uoffset == 0)
+        return true;
+    if (! nextBlock() || uoffset > int32_t(current->out.size())) {
+        error = true;
+        return false;
+    }
+    current_pos = uoffset;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+bgzfReader::CompressedOffset(void) const
+{
+    return next_coffset;
+}
+
+
+//-------------------------------------  bgzfWriter
+
+
+bgzfWriter::bgzfWriter(void)
+    : fp(NULL)
+    , pool(NULL)
+    , level(-1)
+    , current(NULL)
+    , max_behind(1)
+    , n_submitted(0)
+    , n_written(0)
+    , coffset(0)
+    , error(false)
+{ }
+
+
+//-------------------------------------
+
+
+bgzfWriter::~bgzfWriter(void)
+{
+    Close();
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Open(const string& filename, bgzfPool* p, const int32_t l)
+{
+    Close();
+    fp = fopen(filename.c_str(), "wb");
+    if (! fp)
+        return false;
+    start(p, l, 0);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Resume(const string& filename, const int64_t length, bgzfPool* p, const int32_t l)
+{
+    Close();
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0 || st.st_size < length
+        || truncate(filename.c_str(), length) != 0)
+        return false;
+    fp = fopen(filename.c_str(), "r+b");
+    if (! fp)
+        return false;
+    if (fseeko(fp, length, SEEK_SET) != 0) {
+        fclose(fp);
+        fp = NULL;
+        return false;
+    }
+    start(p, l, length);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void
+bgzfWriter::start(bgzfPool* p, const int32_t l, const int64_t length)
+{
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    pool = p ? p : &inline_pool;
+    max_behind = pool->Threads() ? 4 * pool->Threads() : 1;
+    level = l;
+    n_submitted = n_written = 0;
+    coffset = length;
+    marks.clear();
+    error = false;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Close(void)
+{
+    if (! fp)
+        return true;
+    Flush();
+    writeFinished(0);
+    delete current;
+    current = NULL;
+    if (! error && fwrite(bgzf_eof_block, 1, BGZF_EOF_BLOCK_LENGTH, fp) != size_t(BGZF_EOF_BLOCK_LENGTH))
+        error = true;
+    if (fclose(fp) != 0)
+        error = true;
+    fp = NULL;
+    return ! error;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Write(const void* buf, const int64_t len)
+{
+    MEM_TAG(MEM_writer);
+    if (! fp)
+        return false;
+    const char* src = static_cast<const char*>(buf);
+    int64_t n_written = 0;
+    while (n_written < len) {
+        if (! current) {
+            current = new bgzfJob(bgzfJob::COMPRESS, level);
+            current->in.reserve(block_data_size);
+        }
+        int64_t n = block_data_size - current->in.size();
+        if (n > len - n_written)
+            n = len - n_written;
+        current->in.append(src + n_written, n);
+        n_written += n;
+        if (int32_t(current->in.size()) == block_data_size && ! Flush())
+            return false;
+    }
+    return ! error;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Flush(void)
+{
+    if (current && ! current->in.empty()) {
+        pool->Submit(current);
+        behind.push_back(current);
+        current = NULL;
+        ++n_submitted;
+    }
+    return writeFinished(max_behind - 1);
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::WriteBlocks(const void* blocks, const int64_t len)
+{
+    if (! fp || ! Flush() || ! writeFinished(0))
+        return false;
+    if (fwrite(blocks, 1, len, fp) != size_t(len)) {
+        std::cerr << "bgzfWriter: could not write blocks" << std::endl;
+        error = true;
+    }
+    coffset += len;
+    return ! error;
+}
+
+
+//-------------------------------------
+
+
+bool
+bgzfWriter::Checkpoint(int64_t& length)
+{
+    if (! fp || ! Flush() || ! writeFinished(0))
+        return false;
+    if (fflush(fp) != 0) {
+        std::cerr << "bgzfWriter: could not flush for checkpoint" << std::endl;
+        error = true;
+        return false;
+    }
+    length = coffset;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// A mark is the number of the block the next byte goes into, shifted as for
+// a virtual offset, plus the offset of the byte within it
+
+int64_t
+bgzfWriter::Mark(void)
+{
+    const int32_t uoffset = current ? current->in.size() : 0;
+    marks.insert(make_pair(n_submitted, int64_t(-1)));
+    return bgzfVirtualOffset(n_submitted, uoffset);
+}
+
+
+//-------------------------------------
+
+
+int64_t
+bgzfWriter::Resolve(const int64_t mark) const
+{
+    map<int64_t, int64_t>::const_iterator m = marks.find(bgzfBlockOffset(mark));
+    if (m == marks.end() || m->second < 0)
+        return -1;
+    return bgzfVirtualOffset(m->second, bgzfWithinBlockOffset(mark));
+}
+
+
+//-------------------------------------
+
+
+// Write blocks in order until at most keep are still being compressed
+
+bool
+bgzfWriter::writeFinished(const size_t keep)
+{
+    while (behind.size() > keep) {
+        bgzfJob* job = behind.front();
+        behind.pop_front();
+        pool->Wait(job);
+        if (! error && (! job->ok || fwrite(job->out.data(), 1, job->out.size(), fp) != job->out.size())) {
+            std::cerr << "bgzfWriter: could not compress or write block" << std::endl;
+            error = true;
+        }
+        map<int64_t, int64_t>::iterator m = marks.find(n_written++);
+        if (m != marks.end())
+            m->second = coffset;
+        coffset += job->out.size();
+        delete job;
+    }
+    return ! error;
+}
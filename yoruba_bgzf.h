@@ -0,0 +1,250 @@
+// yoruba_bgzf.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_bgzf.cpp
+//
+// Direct access to the BGZF blocks of a BAM file, with block compression and
+// decompression spread over a pool of threads.  BamTools does all of this
+// internally but does not expose blocks or virtual offsets, and compresses and
+// decompresses in one thread.
+
+#ifndef _YORUBA_BGZF_H_
+#define _YORUBA_BGZF_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace yoruba {
+
+// BGZF format constants, see the SAM specification section 4.1
+
+const int32_t BGZF_MAX_BLOCK_SIZE      = 0x10000;  // compressed or uncompressed
+const int32_t BGZF_BLOCK_HEADER_LENGTH = 18;
+const int32_t BGZF_BLOCK_FOOTER_LENGTH = 8;
+const int32_t BGZF_EOF_BLOCK_LENGTH    = 28;
+
+extern const unsigned char bgzf_eof_block[BGZF_EOF_BLOCK_LENGTH];
+
+// A virtual offset is the file offset of the start of a compressed block,
+// shifted left 16 bits, plus the offset within the uncompressed block.
+
+inline int64_t
+bgzfVirtualOffset(const int64_t coffset, const int32_t uoffset)
+    { return (coffset << 16) | uoffset; }
+
+inline int64_t
+bgzfBlockOffset(const int64_t voffset)
+    { return voffset >> 16; }
+
+inline int32_t
+bgzfWithinBlockOffset(const int64_t voffset)
+    { return int32_t(voffset & 0xffff); }
+
+// If buf holds a valid BGZF block header, return the total size of the
+// block, otherwise return 0
+
+int32_t
+bgzfBlockSize(const unsigned char* buf, const size_t len);
+
+// Find the first BGZF block starting at or after file offset 'from' without
+// an index, by its magic bytes and a header whose size leads to n_chain more
+// valid block headers, or to the end of the file.  Returns the offset of the
+// block, or -1 if there is none.
+
+int64_t
+bgzfFindBlock(FILE* fp, const int64_t from, const int32_t n_chain = 4);
+
+
+//-------------------------------------
+
+
+// One block of work for a bgzfPool.  'in' holds the compressed block for
+// DECOMPRESS, uncompressed data for COMPRESS, and 'out' receives the result.
+
+class bgzfJob {
+
+    public:
+        enum job_t { COMPRESS, DECOMPRESS };
+
+    public:
+        bgzfJob(const job_t t = DECOMPRESS, const int32_t l = -1)
+            : type(t), level(l), coffset(-1), done(false), ok(false) { }
+        void Run(void);
+
+    public:
+        job_t       type;
+        int32_t     level;    // zlib compression level, for COMPRESS
+        std::string in;
+        std::string out;
+        int64_t     coffset;  // file offset of a compressed block, for DECOMPRESS
+        bool        done;
+        bool        ok;
+
+};  // class bgzfJob
+
+
+//-------------------------------------
+
+
+// A pool of worker threads that run bgzfJobs.  A pool may be shared among
+// several readers and writers.  A pool with 0 threads runs each job in the
+// calling thread at Submit().
+
+class bgzfPool {
+
+    public:
+        bgzfPool(const int32_t n_threads = 0);
+        ~bgzfPool(void);
+
+        int32_t Threads(void) const { return threads.size(); }
+        void    Submit(bgzfJob* job);
+        void    Wait(bgzfJob* job);
+
+    private:
+        static void* worker(void* arg);
+
+    private:
+        std::vector<pthread_t> threads;
+        std::deque<bgzfJob*>   queue;
+        pthread_mutex_t        mutex;
+        pthread_cond_t         job_ready;
+        pthread_cond_t         job_done;
+        bool                   shutdown;
+
+    private:  // not copyable
+        bgzfPool(const bgzfPool&);
+        bgzfPool& operator=(const bgzfPool&);
+
+};  // class bgzfPool
+
+
+//-------------------------------------
+
+
+// Sequential reader of the uncompressed stream of a BGZF file.  When given
+// a pool with threads, blocks are read ahead and decompressed in parallel,
+// and are handed back in file order.
+
+class bgzfReader {
+
+    public:
+        bgzfReader(void);
+        ~bgzfReader(void);
+
+        bool    Open(const std::string& filename, bgzfPool* p = NULL);
+        void    Close(void);
+        bool    IsOpen(void) const { return fp != NULL; }
+        // bytes an open reader holds with a pool of n_threads, in its file
+        // buffer and the blocks it reads ahead
+        static size_t Footprint(const int32_t n_threads);
+
+        // returns the number of bytes read, less than len only at EOF, or -1
+        // on error
+        int64_t Read(void* buf, const int64_t len);
+        // virtual offset of the next byte to be read
+        int64_t Tell(void) const;
+        bool    Seek(const int64_t voffset);
+        // number of compressed bytes consumed from the file so far
+        int64_t CompressedOffset(void) const;
+        bool    Error(void) const { return error; }
+
+    private:
+        bool    readBlock(bgzfJob* job);
+        bool    nextBlock(void);
+        void    discardAhead(void);
+
+    private:
+        FILE*                fp;
+        bgzfPool*            pool;
+        bgzfPool             inline_pool;   // used when no pool is given
+        std::deque<bgzfJob*> ahead;         // blocks read, in file order
+        bgzfJob*             current;
+        int32_t              current_pos;
+        int64_t              next_coffset;  // file offset of the next block to read
+        size_t               max_ahead;
+        bool                 eof;
+        bool                 error;
+
+    private:  // not copyable
+        bgzfReader(const bgzfReader&);
+        bgzfReader& operator=(const bgzfReader&);
+
+};  // class bgzfReader
+
+
+//-------------------------------------
+
+
+// Sequential writer of a BGZF file.  Data is cut into blocks that are
+// compressed in the pool and written in order, so several writers sharing a
+// pool keep all of its threads busy.  Close() writes the EOF block.
+
+class bgzfWriter {
+
+    public:
+        // uncompressed bytes per block, leaving room for incompressible data
+        static const int32_t block_data_size = BGZF_MAX_BLOCK_SIZE - 1024;
+
+    public:
+        bgzfWriter(void);
+        ~bgzfWriter(void);
+
+        // level is the zlib compression level, -1 for the zlib default
+        bool    Open(const std::string& filename, bgzfPool* p = NULL,
+                     const int32_t level = -1);
+        // reopen a file written before, truncated to length, to continue it
+        bool    Resume(const std::string& filename, const int64_t length,
+                       bgzfPool* p = NULL, const int32_t level = -1);
+        bool    Close(void);
+        bool    IsOpen(void) const { return fp != NULL; }
+
+        bool    Write(const void* buf, const int64_t len);
+        // end the current block, so the next byte written starts a new one
+        bool    Flush(void);
+        // write whole compressed blocks as they are, following everything
+        // written before them
+        bool    WriteBlocks(const void* blocks, const int64_t len);
+        // mark the place of the next byte written, whose virtual offset is
+        // known once its block is written; Resolve() gives it, or -1
+        int64_t Mark(void);
+        int64_t Resolve(const int64_t mark) const;
+        // end the current block and write everything, giving the length of
+        // the file, a place Resume() can continue from
+        bool    Checkpoint(int64_t& length);
+        bool    Error(void) const { return error; }
+
+    private:
+        void    start(bgzfPool* p, const int32_t l, const int64_t length);
+        bool    writeFinished(const size_t keep);
+
+    private:
+        FILE*                fp;
+        bgzfPool*            pool;
+        bgzfPool             inline_pool;   // used when no pool is given
+        int32_t              level;
+        bgzfJob*             current;       // block being filled
+        std::deque<bgzfJob*> behind;        // blocks being compressed, in file order
+        size_t               max_behind;
+        int64_t              n_submitted;   // blocks submitted for compression
+        int64_t              n_written;     // of those, blocks written
+        int64_t              coffset;       // file offset of the next block written
+        std::map<int64_t, int64_t> marks;   // block number to file offset, -1 until written
+        bool                 error;
+
+    private:  // not copyable
+        bgzfWriter(const bgzfWriter&);
+        bgzfWriter& operator=(const bgzfWriter&);
+
+};  // class bgzfWriter
+
+}  // namespace yoruba
+
+#endif // _YORUBA_BGZF_H_
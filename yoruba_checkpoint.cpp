@@ -0,0 +1,172 @@
+// yoruba_checkpoint.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Checkpoints of long write loops, see yoruba_checkpoint.h.
+
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "yoruba_checkpoint.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+string
+checkpointState::Command(int argc, char* argv[])
+{
+    // from argv[1] on, since argv[0] is however the command was invoked
+    string c;
+    for (int i = 1; i < argc; ++i) {
+        if (string(argv[i]) == "--resume")
+            continue;
+        if (! c.empty())
+            c += " ";
+        c += argv[i];
+    }
+    return c;
+}
+
+
+//-------------------------------------
+
+
+bool
+checkpointState::Save(const string& filename, const bamRawReader& reader,
+                      const vector<pair<string, bamRawWriter*> >& writers)
+{
+    outputs.clear();
+    for (size_t i = 0; i < writers.size(); ++i) {
+        int64_t length;
+        if (! writers[i].second->Checkpoint(length)) {
+            cerr << "checkpointState: could not write " << writers[i].first << endl;
+            return false;
+        }
+        outputs.push_back(make_pair(writers[i].first, length));
+    }
+    input_offset = reader.Tell();
+    const string tmp = filename + ".tmp";
+    if (! Write(tmp) || rename(tmp.c_str(), filename.c_str()) != 0) {
+        cerr << "checkpointState: could not write " << filename << endl;
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+checkpointState::Write(const string& filename) const
+{
+    ofstream out(filename.c_str());
+    if (! out)
+        return false;
+    out << "# yoruba checkpoint" << endl;
+    out << "command\t" << command << endl;
+    out << "input\t" << input_offset << endl;
+    for (size_t i = 0; i < outputs.size(); ++i)
+        out << "output\t" << outputs[i].first << "\t" << outputs[i].second << endl;
+    for (map<string, int64_t>::const_iterator cI = counters.begin(); cI != counters.end(); ++cI)
+        out << "counter\t" << cI->first << "\t" << cI->second << endl;
+    out.close();
+    return ! out.fail();
+}
+
+
+//-------------------------------------
+
+
+bool
+checkpointState::Read(const string& filename)
+{
+    ifstream in(filename.c_str());
+    if (! in) {
+        cerr << "checkpointState: could not open " << filename << endl;
+        return false;
+    }
+    command.clear();
+    input_offset = -1;
+    outputs.clear();
+    counters.clear();
+    string line;
+    int64_t n_line = 0;
+    while (getline(in, line)) {
+        ++n_line;
+        if (line.empty() || line[0] == '#')
+            continue;
+        vector<string> fields;
+        istringstream ls(line);
+        string f;
+        while (getline(ls, f, '\t'))
+            fields.push_back(f);
+        bool ok = true;
+        char* e = NULL;
+        if (fields[0] == "command" && fields.size() == 2) {
+            command = fields[1];
+        } else if (fields[0] == "input" && fields.size() == 2) {
+            input_offset = strtoll(fields[1].c_str(), &e, 10);
+        } else if (fields[0] == "output" && fields.size() == 3) {
+            outputs.push_back(make_pair(fields[1], int64_t(strtoll(fields[2].c_str(), &e, 10))));
+        } else if (fields[0] == "counter" && fields.size() == 3) {
+            counters[fields[1]] = strtoll(fields[2].c_str(), &e, 10);
+        } else {
+            ok = false;
+        }
+        if (! ok || (e && *e)) {
+            cerr << "checkpointState: " << filename << " line " << n_line << " is malformed" << endl;
+            return false;
+        }
+    }
+    if (command.empty() || input_offset < 0 || outputs.empty()) {
+        cerr << "checkpointState: " << filename << " is incomplete" << endl;
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+checkpointState::Restore(const vector<pair<string, bamRawWriter*> >& writers,
+                         bgzfPool* pool, const int32_t level) const
+{
+    if (writers.size() != outputs.size()) {
+        cerr << "checkpointState: the checkpoint has " << outputs.size()
+            << " outputs, not " << writers.size() << endl;
+        return false;
+    }
+    for (size_t i = 0; i < writers.size(); ++i) {
+        if (writers[i].first != outputs[i].first) {
+            cerr << "checkpointState: the checkpoint is of output " << outputs[i].first
+                << ", not " << writers[i].first << endl;
+            return false;
+        }
+        if (! writers[i].second->Resume(outputs[i].first, outputs[i].second, pool, level)) {
+            cerr << "checkpointState: could not reopen " << outputs[i].first
+                << " at " << outputs[i].second << " bytes, is it shorter?" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+checkpointState::Counter(const string& name) const
+{
+    map<string, int64_t>::const_iterator cI = counters.find(name);
+    return cI == counters.end() ? 0 : cI->second;
+}
@@ -0,0 +1,76 @@
+// yoruba_checkpoint.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_checkpoint.cpp
+//
+// The state of a long write loop, saved every so many reads so that a command
+// that dies can be resumed with --resume rather than started again.  At each
+// checkpoint the outputs are written through to the end of a block, and the
+// state file records the virtual offset of the next input record, the length
+// of each output and the loop's counters.  On resume the outputs are truncated
+// to those lengths and the loop continues from the input offset.  Since the
+// outputs are cut into blocks at the same reads either way, a resumed output
+// is identical to one written without interruption.  The state is a text file
+// beside the first output, <out.bam>.checkpoint:
+//
+//     # yoruba checkpoint
+//     command     --ID lane1 --checkpoint 10000000 -o out.bam in.bam
+//     input       1309741219840
+//     output      out.bam     2340871
+//     counter     n_reads     10000000
+//
+// with fields separated by single tabs.  The command's arguments, less
+// --resume, must match for the state to be used.
+
+#ifndef _YORUBA_CHECKPOINT_H_
+#define _YORUBA_CHECKPOINT_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+// Yoruba includes
+#include "yoruba_bamraw.h"
+
+namespace yoruba {
+
+class checkpointState {
+
+    public:
+        checkpointState(void) : input_offset(-1) { }
+
+        static std::string Filename(const std::string& output_file)
+            { return output_file + ".checkpoint"; }
+        // the arguments after argv[0], without --resume, to identify the run
+        static std::string Command(int argc, char* argv[]);
+
+        // checkpoint the writers, note the reader's place, and write the
+        // state to filename, replacing it only once complete
+        bool    Save(const std::string& filename, const bamRawReader& reader,
+                     const std::vector<std::pair<std::string, bamRawWriter*> >& writers);
+        bool    Write(const std::string& filename) const;
+        // false with a message to cerr if filename is missing or malformed
+        bool    Read(const std::string& filename);
+
+        // reopen each writer at its checkpointed length, false with a message
+        // to cerr if the state does not fit; the caller then seeks its reader
+        // to input_offset, or reads up to it to rebuild its own state
+        bool    Restore(const std::vector<std::pair<std::string, bamRawWriter*> >& writers,
+                        bgzfPool* pool = NULL, const int32_t level = -1) const;
+
+        int64_t Counter(const std::string& name) const;
+
+    public:
+        std::string                                    command;
+        int64_t                                        input_offset;
+        std::vector<std::pair<std::string, int64_t> >  outputs;   // file and length
+        std::map<std::string, int64_t>                 counters;
+
+};  // class checkpointState
+
+}  // namespace yoruba
+
+#endif // _YORUBA_CHECKPOINT_H_
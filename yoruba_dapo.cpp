@@ -0,0 +1,454 @@
+// yoruba_dapo.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Merge coordinate-sorted BAM files into one coordinate-sorted BAM file.
+//
+// Dàpọ̀ is the Yoruba (Nigeria) verb for 'mix together'.
+
+// dictionaries
+//
+// The reference dictionaries of the inputs are reconciled by name.  The
+// output dictionary starts as that of the first input, and each reference
+// of a later input that is not yet in it is placed just after the reference
+// that precedes it in that input, so the order of every input is kept.  If
+// two inputs order the same references differently, or give one reference
+// different lengths, the inputs cannot be merged.  Each input gets a table
+// remapping its reference IDs to those of the output, as gbagbe does for
+// the references it keeps, and RefID and MateRefID of its records are
+// rewritten through it unless its dictionary is the output's.
+
+// headers
+//
+// The output header has the @HD line of the first input, given SO:coordinate,
+// the @SQ line of each reference from the first input to have it, and then
+// the union of the remaining lines (@RG, @PG, @CO) of all inputs in the order
+// they are first seen.  Identical lines are kept once.  An @RG or @PG line
+// whose ID was already seen with different content is dropped with a warning.
+
+// merge
+//
+// Records are read raw (yoruba_bamraw.h) and merged with a loser tree
+// (yoruba_sort.h) on the coordinate key, ties going to the earlier input.
+// Each input has its own one-thread bgzfPool, so its blocks are read ahead
+// and decompressed in parallel with the others and with the merge, and the
+// merge does not wait on any one input.  The output is compressed by a pool
+// of --threads threads.
+
+#include "yoruba_dapo.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static vector<string> input_files;
+static string       output_file;  // defaults to stdout, set with -o FILE
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+static string       metrics_file;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static int64_t      opt_reads = -1;
+static double       opt_progress = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_dapo(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " merge [options] <in1.bam> <in2.bam> ..." << endl;
+    cerr << "         " << YORUBA_NAME << " dapo [options] <in1.bam> <in2.bam> ..." << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Merge coordinate-sorted BAM files into one coordinate-sorted BAM file,\n\
+reconciling their reference dictionaries by name and taking the union of\n\
+their read groups and programs.\n\
+\n\
+Options: --threads INT           threads for compressing the output [" << opt_threads << "]\n\
+         -l INT | --level INT    compression level of the output, -1 for zlib default [" << opt_level << "]\n\
+         -o FILE | --output FILE output BAM file [default is stdout]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+The output dictionary is that of the first input, with references found only\n\
+in later inputs placed after the reference preceding them in that input.\n\
+Inputs that order shared references differently, or give a reference\n\
+different lengths, cannot be merged.  Reference IDs of records are remapped\n\
+to the output dictionary.\n\
+\n\
+The output header has the @HD line of the first input with SO:coordinate, the\n\
+@SQ lines, and the other lines of all inputs, identical lines kept once.  An\n\
+@RG or @PG line repeating an ID with different content is dropped with a\n\
+warning.\n\
+\n\
+Each input is decompressed by its own thread.  Records that tie keep the order\n\
+of the inputs.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Dapo is the Yoruba (Nigeria) verb for 'mix together'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// One input being merged
+
+struct mergeInput {
+    string          file;
+    bgzfPool*       pool;
+    bamRawReader    reader;
+    bamRawRecord    r;      // the head
+    uint64_t        key;    // of the head
+    vector<int32_t> remap;  // input reference ID to output reference ID
+    bool            identity;  // remap changes nothing
+    bool            done;
+    bool            unsorted;
+    int64_t         n_reads;
+
+    mergeInput(void) : pool(0), key(0), identity(true), done(false),
+                       unsorted(false), n_reads(0) { }
+    ~mergeInput(void) { reader.Close(); delete pool; }
+    bool Advance(void);
+};
+
+
+//-------------------------------------
+
+
+bool
+mergeInput::Advance(void)
+{
+    if (! reader.GetNextRecord(r))
+        return ! (done = true);
+    ++n_reads;
+    if (! identity) {
+        int32_t id = r.RefID();
+        if (id >= 0) {
+            id = remap[id];
+            memcpy(&r.data[0], &id, 4);
+        }
+        id = r.MateRefID();
+        if (id >= 0) {
+            id = remap[id];
+            memcpy(&r.data[20], &id, 4);
+        }
+    }
+    const uint64_t k = coordinateKey(r.data.data());
+    if (k < key) {
+        cerr << NAME << " " << file << " is not sorted by coordinate at read "
+            << n_reads << ", " << r.Name() << endl;
+        unsorted = true;
+        return ! (done = true);
+    }
+    key = k;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+struct inputLess {
+    const vector<mergeInput*>* inputs;
+    inputLess(const vector<mergeInput*>& in) : inputs(&in) { }
+    bool operator()(const size_t i, const size_t j) const
+    {
+        const mergeInput& a = *(*inputs)[i];
+        const mergeInput& b = *(*inputs)[j];
+        if (a.done || b.done)
+            return ! a.done || (b.done && i < j);
+        if (a.key != b.key)
+            return a.key < b.key;
+        return i < j;
+    }
+};
+
+
+//-------------------------------------
+
+
+// Reconcile the reference dictionaries of the inputs into refs, filling
+// each input's remap table
+
+static bool
+mergeDictionaries(vector<mergeInput*>& inputs, RefVector& refs)
+{
+    // the output order is kept as a list of indices into all, so a
+    // reference can be placed after any other without renumbering
+    RefVector all;
+    list<size_t> order;
+    typedef tr1::unordered_map<string, list<size_t>::iterator> refMap;
+    refMap found;
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const RefVector& in_refs = inputs[i]->reader.References();
+        list<size_t>::iterator prev = order.end();
+        for (size_t j = 0; j < in_refs.size(); ++j) {
+            refMap::iterator f = found.find(in_refs[j].RefName);
+            if (f != found.end()) {
+                if (all[*f->second].RefLength != in_refs[j].RefLength) {
+                    cerr << NAME << " reference " << in_refs[j].RefName << " has length "
+                        << in_refs[j].RefLength << " in " << inputs[i]->file << " but "
+                        << all[*f->second].RefLength << " in an earlier input" << endl;
+                    return false;
+                }
+                prev = f->second;
+                continue;
+            }
+            all.push_back(in_refs[j]);
+            list<size_t>::iterator next = prev;
+            next = (prev == order.end()) ? order.begin() : ++next;
+            prev = order.insert(next, all.size() - 1);
+            found[in_refs[j].RefName] = prev;
+        }
+    }
+
+    vector<int32_t> id(all.size());
+    refs.clear();
+    refs.reserve(all.size());
+    for (list<size_t>::iterator o = order.begin(); o != order.end(); ++o) {
+        id[*o] = refs.size();
+        refs.push_back(all[*o]);
+    }
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        mergeInput& in = *inputs[i];
+        const RefVector& in_refs = in.reader.References();
+        in.remap.resize(in_refs.size());
+        for (size_t j = 0; j < in_refs.size(); ++j) {
+            in.remap[j] = id[*found[in_refs[j].RefName]];
+            if (in.remap[j] != int32_t(j))
+                in.identity = false;
+            if (j > 0 && in.remap[j] < in.remap[j - 1]) {
+                cerr << NAME << " " << in.file << " orders references " << in_refs[j - 1].RefName
+                    << " and " << in_refs[j].RefName << " differently from an earlier input" << endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// The header text of the merged output
+
+static string
+mergeHeaders(const vector<mergeInput*>& inputs, const RefVector& refs)
+{
+    vector<string> texts;
+    for (size_t i = 0; i < inputs.size(); ++i)
+        texts.push_back(inputs[i]->reader.HeaderText());
+    vector<pair<size_t, string> > dropped;
+    const string header = headerUnion(texts, refs, dropped);
+    for (size_t i = 0; i < dropped.size(); ++i)
+        cerr << NAME << " warning: dropping " << dropped[i].second.substr(0, 3) << " line from "
+            << inputs[dropped[i].first]->file << ", its ID is that of an earlier input: "
+            << dropped[i].second << endl;
+    return headerWithSortOrder(header, SORT_coordinate);
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_dapo(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_threads, OPT_level, OPT_output, OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_reads, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption dapo_options[] = {
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, dapo_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "merge", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (args.FileCount() < 1) {
+        cerr << NAME << " requires one or more BAM files specified as input" << endl;
+        return usage();
+    }
+    for (int i = 0; i < args.FileCount(); ++i)
+        input_files.push_back(args.File(i));
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    //----------------- Open inputs and reconcile their headers
+
+    profile.Begin("open");
+    vector<mergeInput*> inputs;
+    bool ok = true;
+    for (size_t i = 0; ok && i < input_files.size(); ++i) {
+        inputs.push_back(new mergeInput);
+        mergeInput& in = *inputs.back();
+        in.file = input_files[i];
+        in.pool = new bgzfPool(1);
+        if (! in.reader.Open(in.file, in.pool)) {
+            cerr << NAME << " could not open BAM input " << in.file << endl;
+            ok = false;
+        }
+    }
+
+    RefVector refs;
+    ok = ok && mergeDictionaries(inputs, refs);
+
+    if (ok && DEBUG(1)) {
+        cerr << NAME << " " << refs.size() << " reference" << PLURAL(refs.size())
+            << " in the merged dictionary" << endl;
+        for (size_t i = 0; i < inputs.size(); ++i)
+            cerr << NAME << " " << inputs[i]->file << ": " << inputs[i]->remap.size()
+                << " references, " << (inputs[i]->identity ? "not " : "") << "remapped" << endl;
+    }
+
+    bgzfPool pool(opt_threads);
+    bamRawWriter writer;
+    if (ok && ! writer.Open(output_file, mergeHeaders(inputs, refs), refs, &pool, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        ok = false;
+    }
+    writer.IndexRecords(yviIndex::default_interval);
+
+    //----------------- Merge
+
+    profile.Begin("merge");
+    for (size_t i = 0; i < input_files.size(); ++i)
+        progress.AddInput(input_files[i]);
+    int64_t n_reads = 0;
+    if (ok) {
+        for (size_t i = 0; i < inputs.size(); ++i)
+            inputs[i]->Advance();
+        loserTree<inputLess> tree(inputs.size(), inputLess(inputs));
+        tree.Build();
+        while (ok && (opt_reads < 0 || n_reads < opt_reads)) {
+            mergeInput& in = *inputs[tree.Winner()];
+            if (in.done)
+                break;
+            progress.Reads(++n_reads);
+            ok = writer.Write(in.r);
+            in.Advance();
+            tree.Replay();
+        }
+        profile.Reads(n_reads);
+        profile.Begin("close");
+        if (! (ok = writer.Close() && ok))
+            cerr << NAME << " could not write BAM output " << output_file << endl;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i]->reader.Error()) {
+                cerr << NAME << " could not read BAM input " << inputs[i]->file << endl;
+                ok = false;
+            }
+            if (inputs[i]->unsorted)
+                ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < inputs.size(); ++i)
+        delete inputs[i];
+
+    if (! ok)
+        return EXIT_FAILURE;
+
+    cerr << NAME << " " << n_reads << " reads merged from " << input_files.size()
+        << " input" << PLURAL(input_files.size()) << ", " << refs.size()
+        << " reference" << PLURAL(refs.size()) << endl;
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,41 @@
+// yoruba_dapo.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_DAPO_H_
+#define _YORUBA_DAPO_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <tr1/unordered_map>
+#include <list>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_merge]"
+#endif
+
+// Functions defined in yoruba_dapo.cpp
+//
+namespace yoruba {
+
+int  main_dapo(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_DAPO_H_
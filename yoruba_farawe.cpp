@@ -0,0 +1,878 @@
+// yoruba_farawe.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Write a synthetic BAM file, for benchmarks and tests that cannot use real
+// data.
+//
+// Farawe is the Yoruba (Nigeria) verb for 'imitate'.
+
+// genome
+//
+// The references all have the same length.  A read may start at any of the
+// first length - read length + 1 positions of a reference, and these starts,
+// laid end to end over all references, make a single range of positions from
+// which templates draw the start of their leftmost read.  The mate of a paired
+// read is on the same reference, --insert-size away on average and at most
+// half as far again, facing it (FR), and held back from the end of the
+// reference.  A duplicate template takes the positions, orientation, read
+// group and UMI of the template before it, as PCR duplicates would, but not
+// its name; nothing is flagged as a duplicate.  Each spike adds --spike-depth
+// templates starting within two read lengths of a random position.
+
+// chunks
+//
+// The output is made in chunks, each generated from its own seed by
+// splitmix64 (yorubaRandom in yoruba_util.h) from --seed and its number, so
+// the file depends only on the options and not on --threads.  In coordinate
+// order a chunk is a stretch of the range of positions, holding templates in
+// proportion to its length, and the mates that fall past its end are carried
+// into the next chunk, which is always longer than a template.  In name order
+// a chunk is a run of consecutive template numbers, and names are made from
+// the number in fixed width so they sort as the numbers do.  With --threads
+// INT, INT threads generate the chunks ahead of the one being written, and
+// a pool of INT threads compresses the output.
+
+#include "yoruba_farawe.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       output_file;  // defaults to stdout, set with -o FILE
+static sortOrder_t  opt_order = SORT_coordinate;
+static int64_t      opt_read_count = 1000000;
+static int64_t      opt_references = 24;
+static int32_t      opt_reference_length = 10000000;
+static int32_t      opt_read_length = 100;
+static int32_t      opt_insert_size = 300;
+static double       opt_pair_fraction = 1.0;
+static double       opt_duplicate_rate = 0.1;
+static int64_t      opt_spikes = 0;
+static int32_t      opt_spike_depth = 1000;
+static int32_t      opt_read_groups = 1;
+static int32_t      opt_umi_length = 0;
+static int32_t      opt_tag_bytes = 0;
+static uint64_t     opt_seed = 1;
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+static string       metrics_file;
+static const int64_t chunk_templates = 50000;  // templates in each chunk, about
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static double       opt_progress = 0;
+#endif
+
+// the layout of the output, set before any chunk is made
+static int64_t          starts_per_ref;   // read starts on each reference
+static int64_t          n_starts;         // read starts on all references
+static int64_t          n_templates;      // templates not in spikes
+static int64_t          n_all_templates;  // and those in spikes
+static int64_t          chunk_span;       // read starts in each chunk, coordinate order
+static int64_t          n_chunks;
+static int32_t          spike_width;
+static vector<int64_t>  spike_starts;
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_farawe(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " simulate [options]" << endl;
+    cerr << "         " << YORUBA_NAME << " farawe [options]" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Write a synthetic BAM file sorted by coordinate, or with --name by read name.\n\
+The same options and --seed always give the same file.\n\
+\n\
+Options: -n | --name             sort by read name rather than coordinate\n\
+         --read-count INT        about INT reads, not counting spikes [" << opt_read_count << "]\n\
+         --references INT        number of references [" << opt_references << "]\n\
+         --reference-length INT  length of each reference [" << opt_reference_length << "]\n\
+         --read-length INT       length of each read [" << opt_read_length << "]\n\
+         --insert-size INT       mean insert size of pairs [" << opt_insert_size << "]\n\
+         --pair-fraction FLOAT   fraction of templates that are paired [" << opt_pair_fraction << "]\n\
+         --duplicate-rate FLOAT  fraction of templates duplicating the one before [" << opt_duplicate_rate << "]\n\
+         --spikes INT            number of pileups of extra depth [" << opt_spikes << "]\n\
+         --spike-depth INT       templates in each pileup [" << opt_spike_depth << "]\n\
+         --read-groups INT       number of read groups, given in RG tags [" << opt_read_groups << "]\n\
+         --umi-length INT        length of a UMI given in an RX tag, 0 for none [" << opt_umi_length << "]\n\
+         --tag-bytes INT         pad the tags of each read to INT bytes with an XF tag [" << opt_tag_bytes << "]\n\
+         --seed INT              seed for the random number generator [" << opt_seed << "]\n\
+         --threads INT           threads for generating reads and for compression [" << opt_threads << "]\n\
+         -l INT | --level INT    compression level of the output, -1 for zlib default [" << opt_level << "]\n\
+         -o FILE | --output FILE output BAM file [default is stdout]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+References are named chr1, chr2, ... or, if there are more than 100, contig1,\n\
+contig2, ...; 10000000 tiny contigs make a header of several hundred MB.  Read\n\
+starts are spread evenly over the references.  Mates are on the same reference,\n\
+facing each other, their insert size uniform from half to one and a half times\n\
+--insert-size.  A duplicate template has the positions, orientation, read\n\
+group and UMI of the template before it but its own name, and is not flagged.\n\
+Bases and qualities are random, every read is mapped with a CIGAR of INT M and\n\
+mapping quality 60.  Names are like Illumina names, and sort as their template\n\
+numbers do.  Each spike adds --spike-depth templates starting within two read\n\
+lengths of a random position.\n\
+\n\
+The output is made in chunks of about " << chunk_templates << " templates, each from its own\n\
+seed derived from --seed, so it does not depend on --threads.  When written to\n\
+a file, a record index <out.bam>.yvi is written too.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Farawe is the Yoruba (Nigeria) verb for 'imitate'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// One template, its reads placed by their start in the range of read starts
+
+struct simTemplate {
+    int64_t  id;
+    int64_t  left;        // start of the leftmost read
+    int64_t  right;       // start of its mate, if paired
+    bool     paired;
+    bool     read1_left;  // read 1 is the leftmost, forward read
+    bool     reverse;     // strand of an unpaired read
+    int32_t  rg;
+    string   umi;
+};
+
+// records made for one chunk, each with its block_size
+
+struct simChunk {
+    string          records;
+    vector<int64_t> keys;        // read start of each, in coordinate order
+    string          carry;       // mates starting past the end of the chunk
+    vector<int64_t> carry_keys;
+    int64_t         n_templates;
+    int64_t         n_duplicates;
+
+    simChunk(void) : n_templates(0), n_duplicates(0) { }
+};
+
+// a read waiting to be made, in coordinate order
+
+struct simEntry {
+    int64_t  key;
+    uint32_t t;      // index of its template
+    bool     left;
+
+    bool operator<(const simEntry& o) const {
+        if (key != o.key) return key < o.key;
+        if (t != o.t) return t < o.t;
+        return left && ! o.left;
+    }
+};
+
+
+//-------------------------------------
+
+
+static inline uint64_t
+chunkSeed(const int64_t k, const uint64_t salt)
+{
+    yorubaRandom r(opt_seed ^ (uint64_t(k + 1) * salt));
+    return r.Next();
+}
+
+
+// templates not in spikes that start before read start x
+
+static inline int64_t
+templatesBefore(const int64_t x)
+{
+    return int64_t(double(n_templates) * double(x) / double(n_starts));
+}
+
+
+// fixed-width so that names sort as the template numbers do
+
+static void
+readName(const int64_t id, char* name, const size_t len)
+{
+    snprintf(name, len, "SIM:1:HSIMFC:%d:%04d:%05d:%06d",
+             int(1 + id / 100000000000LL / 10000 % 8), int(id / 100000000000LL % 10000),
+             int(id / 1000000 % 100000), int(id % 1000000));
+}
+
+
+//-------------------------------------
+
+
+// A new template starting at read start lin, or a duplicate of prev
+
+static void
+makeTemplate(simTemplate& t, const int64_t id, const int64_t lin,
+             const simTemplate* prev, yorubaRandom& rng)
+{
+    if (prev) {
+        t = *prev;
+        t.id = id;
+        return;
+    }
+    t.id = id;
+    t.left = lin;
+    t.paired = rng.Uniform() < opt_pair_fraction;
+    t.read1_left = rng.Next() & 1;
+    t.reverse = rng.Next() & 1;
+    t.rg = int32_t(rng.Below(opt_read_groups));
+    t.right = lin;
+    if (t.paired) {
+        const int64_t insert = opt_insert_size / 2 + int64_t(rng.Below(opt_insert_size + 1));
+        const int64_t ref_start = lin - lin % starts_per_ref;
+        t.right = min(lin + max(int64_t(0), insert - opt_read_length),
+                      ref_start + starts_per_ref - 1);
+    }
+    static const char bases[] = "ACGT";
+    t.umi.resize(opt_umi_length);
+    for (int32_t i = 0; i < opt_umi_length; ++i)
+        t.umi[i] = bases[rng.Next() & 3];
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+static inline void
+append(string& buf, const T v)
+{
+    buf.append(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+
+// Append the leftmost or the rightmost read of t to buf
+
+static void
+appendRead(string& buf, const simTemplate& t, const bool left, yorubaRandom& rng)
+{
+    const int64_t self = left ? t.left : t.right;
+    const int64_t mate = left ? t.right : t.left;
+    const int32_t ref = int32_t(self / starts_per_ref);
+    const int32_t pos = int32_t(self % starts_per_ref);
+    const int32_t mate_pos = int32_t(mate % starts_per_ref);
+
+    uint16_t flag;
+    int32_t tlen = 0;
+    if (t.paired) {
+        flag = BAM_FPAIRED | BAM_FPROPER_PAIR | (left ? BAM_FMREVERSE : BAM_FREVERSE)
+            | (left == t.read1_left ? BAM_FREAD1 : BAM_FREAD2);
+        tlen = int32_t(t.right - t.left) + opt_read_length;
+        if (! left)
+            tlen = -tlen;
+    } else {
+        flag = t.reverse ? BAM_FREVERSE : 0;
+    }
+
+    char name[64];
+    readName(t.id, name, sizeof(name));
+    const int32_t l_name = strlen(name) + 1;
+    const int32_t l_seq = opt_read_length;
+
+    char rg[16];
+    sprintf(rg, "rg%d", int(t.rg + 1));
+    int32_t l_aux = 3 + strlen(rg) + 1;
+    if (opt_umi_length)
+        l_aux += 3 + opt_umi_length + 1;
+    const int32_t l_fill = opt_tag_bytes - l_aux - 4;
+    if (l_fill >= 0)
+        l_aux += 3 + l_fill + 1;
+
+    const int32_t block_size = BAM_CORE_LENGTH + l_name + 4 + (l_seq + 1) / 2 + l_seq + l_aux;
+    buf.reserve(buf.size() + 4 + block_size);
+    append<int32_t>(buf, block_size);
+    append<int32_t>(buf, ref);
+    append<int32_t>(buf, pos);
+    append<uint8_t>(buf, l_name);
+    append<uint8_t>(buf, 60);
+    append<uint16_t>(buf, bamRegionBin(pos, pos + l_seq));
+    append<uint16_t>(buf, 1);
+    append<uint16_t>(buf, flag);
+    append<int32_t>(buf, l_seq);
+    append<int32_t>(buf, t.paired ? ref : -1);
+    append<int32_t>(buf, t.paired ? mate_pos : -1);
+    append<int32_t>(buf, tlen);
+    buf.append(name, l_name);
+    append<uint32_t>(buf, uint32_t(l_seq) << 4);  // M
+
+    // bases A, C, G and T are 1, 2, 4 and 8, two to a byte
+    uint64_t bits = 0;
+    for (int32_t i = 0; i < l_seq; i += 2) {
+        if (i % 32 == 0)
+            bits = rng.Next();
+        const int hi = 1 << (bits & 3);
+        const int lo = i + 1 < l_seq ? 1 << ((bits >> 2) & 3) : 0;
+        bits >>= 4;
+        buf.push_back(char((hi << 4) | lo));
+    }
+    for (int32_t i = 0; i < l_seq; ++i) {
+        if (i % 16 == 0)
+            bits = rng.Next();
+        buf.push_back(char(25 + (bits & 15)));
+        bits >>= 4;
+    }
+
+    buf.append("RGZ", 3);
+    buf.append(rg, strlen(rg) + 1);
+    if (opt_umi_length) {
+        buf.append("RXZ", 3);
+        buf.append(t.umi.c_str(), opt_umi_length + 1);
+    }
+    if (l_fill >= 0) {
+        buf.append("XFZ", 3);
+        for (int32_t i = 0; i < l_fill; ++i) {
+            if (i % 8 == 0)
+                bits = rng.Next();
+            buf.push_back(char('a' + (bits & 0xff) % 26));
+            bits >>= 8;
+        }
+        buf.push_back('\0');
+    }
+}
+
+
+//-------------------------------------
+
+
+// Make chunk k of coordinate order: the templates starting in its stretch of
+// read starts, then their reads in order
+
+static void
+makeCoordinateChunk(const int64_t k, simChunk& c)
+{
+    yorubaRandom rng(chunkSeed(k, 0x9e3779b97f4a7c15ULL));
+    const int64_t start = k * chunk_span;
+    const int64_t end = min(n_starts, start + chunk_span);
+    const int64_t base = templatesBefore(start);
+    const int64_t n = templatesBefore(end) - base;
+
+    // (read start, template number)
+    vector<pair<int64_t, int64_t> > starts;
+    starts.reserve(n);
+    for (int64_t i = 0; i < n; ++i)
+        starts.push_back(make_pair(start + int64_t(rng.Below(end - start)), base + i));
+
+    // spikes that may reach into the chunk
+    vector<int64_t>::const_iterator s = lower_bound(spike_starts.begin(), spike_starts.end(),
+                                                    start - spike_width);
+    for (; s != spike_starts.end() && *s < end; ++s) {
+        const int64_t j = s - spike_starts.begin();
+        yorubaRandom spike_rng(chunkSeed(j, 0xc2b2ae3d27d4eb4fULL));
+        for (int32_t d = 0; d < opt_spike_depth; ++d) {
+            const int64_t lin = min(n_starts - 1, *s + int64_t(spike_rng.Below(spike_width)));
+            if (lin >= start && lin < end)
+                starts.push_back(make_pair(lin, n_templates + j * opt_spike_depth + d));
+        }
+    }
+    sort(starts.begin(), starts.end());
+
+    vector<simTemplate> ts(starts.size());
+    vector<simEntry> entries;
+    entries.reserve(2 * ts.size());
+    for (size_t i = 0; i < ts.size(); ++i) {
+        const bool dup = i > 0 && rng.Uniform() < opt_duplicate_rate;
+        makeTemplate(ts[i], starts[i].second, starts[i].first, dup ? &ts[i - 1] : NULL, rng);
+        c.n_duplicates += dup;
+        simEntry e;
+        e.key = ts[i].left;
+        e.t = i;
+        e.left = true;
+        entries.push_back(e);
+        if (ts[i].paired) {
+            e.key = ts[i].right;
+            e.left = false;
+            entries.push_back(e);
+        }
+    }
+    c.n_templates = ts.size();
+    sort(entries.begin(), entries.end());
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const simEntry& e = entries[i];
+        if (e.key < end) {
+            appendRead(c.records, ts[e.t], e.left, rng);
+            c.keys.push_back(e.key);
+        } else {
+            appendRead(c.carry, ts[e.t], e.left, rng);
+            c.carry_keys.push_back(e.key);
+        }
+    }
+}
+
+
+//-------------------------------------
+
+
+// Make chunk k of name order: consecutive template numbers, read 1 before
+// read 2
+
+static void
+makeNameChunk(const int64_t k, simChunk& c)
+{
+    yorubaRandom rng(chunkSeed(k, 0x9e3779b97f4a7c15ULL));
+    const int64_t first = k * chunk_templates;
+    const int64_t last = min(n_all_templates, first + chunk_templates);
+    simTemplate prev, t;
+    for (int64_t id = first; id < last; ++id) {
+        int64_t lin;
+        if (id < n_templates) {
+            lin = int64_t(rng.Below(n_starts));
+        } else {
+            const int64_t j = (id - n_templates) / opt_spike_depth;
+            lin = min(n_starts - 1, spike_starts[j] + int64_t(rng.Below(spike_width)));
+        }
+        const bool dup = id > first && rng.Uniform() < opt_duplicate_rate;
+        makeTemplate(t, id, lin, dup ? &prev : NULL, rng);
+        c.n_duplicates += dup;
+        if (t.paired) {
+            appendRead(c.records, t, t.read1_left, rng);
+            appendRead(c.records, t, ! t.read1_left, rng);
+        } else {
+            appendRead(c.records, t, true, rng);
+        }
+        prev = t;
+    }
+    c.n_templates = last - first;
+}
+
+
+//-------------------------------------
+
+
+// Makes chunks in n_threads threads, at most ahead of them beyond the one
+// last taken, or at Take() if n_threads is 0.  Chunks are taken in order.
+
+class chunkMaker {
+
+    public:
+        chunkMaker(const int32_t n_threads);
+        ~chunkMaker(void);
+
+        // chunk k, which the caller then owns
+        simChunk* Take(const int64_t k);
+
+    private:
+        static void* worker(void* arg);
+        static void  make(const int64_t k, simChunk& c);
+
+    private:
+        vector<pthread_t>   threads;
+        vector<simChunk*>   slots;     // chunk k in slots[k % slots.size()]
+        int64_t             next;      // the next chunk to make
+        int64_t             taken;     // chunks taken so far
+        pthread_mutex_t     mutex;
+        pthread_cond_t      chunk_made;
+        pthread_cond_t      chunk_taken;
+        bool                shutdown;
+
+    private:  // not copyable
+        chunkMaker(const chunkMaker&);
+        chunkMaker& operator=(const chunkMaker&);
+
+};  // class chunkMaker
+
+
+//-------------------------------------
+
+
+chunkMaker::chunkMaker(const int32_t n_threads)
+    : slots(2 * n_threads, NULL), next(0), taken(0), shutdown(false)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&chunk_made, NULL);
+    pthread_cond_init(&chunk_taken, NULL);
+    for (int32_t i = 0; i < n_threads; ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, worker, this) == 0)
+            threads.push_back(t);
+    }
+}
+
+
+//-------------------------------------
+
+
+chunkMaker::~chunkMaker(void)
+{
+    pthread_mutex_lock(&mutex);
+    shutdown = true;
+    pthread_cond_broadcast(&chunk_taken);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+    for (size_t i = 0; i < slots.size(); ++i)
+        delete slots[i];
+    pthread_cond_destroy(&chunk_taken);
+    pthread_cond_destroy(&chunk_made);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+//-------------------------------------
+
+
+void
+chunkMaker::make(const int64_t k, simChunk& c)
+{
+    if (opt_order == SORT_name)
+        makeNameChunk(k, c);
+    else
+        makeCoordinateChunk(k, c);
+}
+
+
+//-------------------------------------
+
+
+simChunk*
+chunkMaker::Take(const int64_t k)
+{
+    if (threads.empty()) {
+        simChunk* c = new simChunk;
+        make(k, *c);
+        return c;
+    }
+    const size_t i = k % slots.size();
+    pthread_mutex_lock(&mutex);
+    while (! slots[i])
+        pthread_cond_wait(&chunk_made, &mutex);
+    simChunk* c = slots[i];
+    slots[i] = NULL;
+    taken = k + 1;
+    pthread_cond_broadcast(&chunk_taken);
+    pthread_mutex_unlock(&mutex);
+    return c;
+}
+
+
+//-------------------------------------
+
+
+void*
+chunkMaker::worker(void* arg)
+{
+    chunkMaker& m = *static_cast<chunkMaker*>(arg);
+    const int64_t ahead = m.slots.size();
+    pthread_mutex_lock(&m.mutex);
+    while (true) {
+        while (! m.shutdown && m.next < n_chunks && m.next >= m.taken + ahead)
+            pthread_cond_wait(&m.chunk_taken, &m.mutex);
+        if (m.shutdown || m.next >= n_chunks)
+            break;
+        const int64_t k = m.next++;
+        pthread_mutex_unlock(&m.mutex);
+
+        simChunk* c = new simChunk;
+        make(k, *c);
+
+        pthread_mutex_lock(&m.mutex);
+        m.slots[k % ahead] = c;
+        pthread_cond_broadcast(&m.chunk_made);
+    }
+    pthread_mutex_unlock(&m.mutex);
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+// Write the records of buf from offset i, the one with key below limit, or
+// all of them if limit is -1, returning the new offset
+
+static size_t
+writeRecords(bamRawWriter& writer, const string& buf, size_t i, const vector<int64_t>& keys,
+             size_t& ki, const int64_t limit, int64_t& n_reads, bool& ok)
+{
+    while (ok && i < buf.size() && (limit < 0 || keys[ki] < limit)) {
+        int32_t block_size;
+        memcpy(&block_size, buf.data() + i, 4);
+        ok = writer.Write(buf.data() + i + 4, block_size);
+        i += 4 + block_size;
+        ++ki;
+        progress.Reads(++n_reads);
+    }
+    return i;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_farawe(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+    enum { OPT_name, OPT_read_count, OPT_references, OPT_reference_length, OPT_read_length,
+        OPT_insert_size, OPT_pair_fraction, OPT_duplicate_rate, OPT_spikes, OPT_spike_depth,
+        OPT_read_groups, OPT_umi_length, OPT_tag_bytes, OPT_seed, OPT_threads, OPT_level,
+        OPT_output, OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption farawe_options[] = {
+        { OPT_name,            "--name",            SO_NONE },
+        { OPT_name,            "-n",                SO_NONE },
+        { OPT_read_count,      "--read-count",      SO_REQ_SEP },
+        { OPT_references,      "--references",      SO_REQ_SEP },
+        { OPT_reference_length, "--reference-length", SO_REQ_SEP },
+        { OPT_read_length,     "--read-length",     SO_REQ_SEP },
+        { OPT_insert_size,     "--insert-size",     SO_REQ_SEP },
+        { OPT_pair_fraction,   "--pair-fraction",   SO_REQ_SEP },
+        { OPT_duplicate_rate,  "--duplicate-rate",  SO_REQ_SEP },
+        { OPT_spikes,          "--spikes",          SO_REQ_SEP },
+        { OPT_spike_depth,     "--spike-depth",     SO_REQ_SEP },
+        { OPT_read_groups,     "--read-groups",     SO_REQ_SEP },
+        { OPT_umi_length,      "--umi-length",      SO_REQ_SEP },
+        { OPT_tag_bytes,       "--tag-bytes",       SO_REQ_SEP },
+        { OPT_seed,            "--seed",            SO_REQ_SEP },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, farawe_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_name) {
+            opt_order = SORT_name;
+        } else if (args.OptionId() == OPT_read_count) {
+            opt_read_count = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_references) {
+            opt_references = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_reference_length) {
+            opt_reference_length = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_read_length) {
+            opt_read_length = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_insert_size) {
+            opt_insert_size = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_pair_fraction) {
+            opt_pair_fraction = atof(args.OptionArg());
+        } else if (args.OptionId() == OPT_duplicate_rate) {
+            opt_duplicate_rate = atof(args.OptionArg());
+        } else if (args.OptionId() == OPT_spikes) {
+            opt_spikes = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_spike_depth) {
+            opt_spike_depth = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_read_groups) {
+            opt_read_groups = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_umi_length) {
+            opt_umi_length = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_tag_bytes) {
+            opt_tag_bytes = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_seed) {
+            opt_seed = strtoull(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (args.FileCount() > 0) {
+        cerr << NAME << " takes no input files" << endl;
+        return usage();
+    }
+    if (opt_read_count < 0 || opt_spikes < 0 || opt_spike_depth < 1) {
+        cerr << NAME << " --read-count and --spikes must be 0 or more, --spike-depth 1 or more" << endl;
+        return usage();
+    }
+    if (opt_references < 1 || opt_references > INT_MAX
+        || opt_read_length < 1 || opt_read_length > opt_reference_length) {
+        cerr << NAME << " --references must be from 1 to " << INT_MAX
+            << ", and --read-length from 1 to --reference-length" << endl;
+        return usage();
+    }
+    if (opt_insert_size < 1 || opt_pair_fraction < 0 || opt_pair_fraction > 1
+        || opt_duplicate_rate < 0 || opt_duplicate_rate > 1) {
+        cerr << NAME << " --insert-size must be 1 or more, and --pair-fraction and"
+            " --duplicate-rate from 0 to 1" << endl;
+        return usage();
+    }
+    if (opt_read_groups < 1 || opt_umi_length < 0 || opt_tag_bytes < 0 || opt_threads < 0) {
+        cerr << NAME << " --read-groups must be 1 or more, and --umi-length, --tag-bytes"
+            " and --threads 0 or more" << endl;
+        return usage();
+    }
+    if (opt_level < -1 || opt_level > 9) {
+        cerr << NAME << " --level must be from -1 to 9" << endl;
+        return usage();
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "simulate", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    //----------------- Lay out the output
+
+    profile.Begin("header");
+    starts_per_ref = opt_reference_length - opt_read_length + 1;
+    n_starts = starts_per_ref * opt_references;
+    n_templates = int64_t(opt_read_count / (1.0 + opt_pair_fraction) + 0.5);
+    n_all_templates = n_templates + opt_spikes * opt_spike_depth;
+    spike_width = 2 * opt_read_length;
+    {
+        yorubaRandom rng(chunkSeed(-1, 0x94d049bb133111ebULL));
+        for (int64_t j = 0; j < opt_spikes; ++j)
+            spike_starts.push_back(int64_t(rng.Below(n_starts)));
+        sort(spike_starts.begin(), spike_starts.end());
+    }
+    if (opt_order == SORT_name) {
+        n_chunks = (n_all_templates + chunk_templates - 1) / chunk_templates;
+    } else {
+        // a chunk must be longer than any template, so mates are carried
+        // into the next chunk at most
+        chunk_span = n_templates ? int64_t(double(n_starts) * chunk_templates / n_templates) : n_starts;
+        chunk_span = max(chunk_span, int64_t(2 * opt_insert_size + opt_read_length));
+        chunk_span = min(max(chunk_span, int64_t(1)), n_starts);
+        n_chunks = (n_starts + chunk_span - 1) / chunk_span;
+    }
+
+    RefVector refs;
+    refs.reserve(opt_references);
+    string text;
+    char line[128];
+    for (int64_t i = 0; i < opt_references; ++i) {
+        sprintf(line, opt_references > 100 ? "contig%lld" : "chr%lld", (long long)(i + 1));
+        refs.push_back(RefData(line, opt_reference_length));
+        text += string("@SQ\tSN:") + line;
+        sprintf(line, "\tLN:%d\n", int(opt_reference_length));
+        text += line;
+    }
+    for (int32_t i = 0; i < opt_read_groups; ++i) {
+        sprintf(line, "@RG\tID:rg%d\tSM:sample%d\tLB:lib%d\tPL:ILLUMINA\n",
+                int(i + 1), int(i + 1), int(i + 1));
+        text += line;
+    }
+    string command = YORUBA_NAME " simulate";
+    for (int i = 1; i < argc; ++i)
+        command = command + " " + argv[i];
+    text += "@PG\tID:" YORUBA_NAME "\tPN:" YORUBA_NAME "\tVN:" YORUBA_VERSION "\tCL:" + command + "\n";
+    const string header = headerWithSortOrder(text, opt_order);
+
+    bgzfPool pool(opt_threads);
+    bamRawWriter writer;
+    if (! writer.Open(output_file, header, refs, &pool, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    writer.IndexRecords(yviIndex::default_interval);
+    RefVector().swap(refs);
+
+    //----------------- Make and write the reads
+
+    profile.Begin("reads");
+    progress.Expect(int64_t(n_all_templates * (1.0 + opt_pair_fraction)));
+    chunkMaker maker(opt_threads);
+    int64_t n_reads = 0;
+    int64_t n_made = 0;  // templates
+    int64_t n_duplicates = 0;
+    bool ok = true;
+    string carry;                // mates carried from the chunk before
+    vector<int64_t> carry_keys;
+
+    for (int64_t k = 0; ok && k < n_chunks; ++k) {
+        simChunk* c = maker.Take(k);
+        n_made += c->n_templates;
+        n_duplicates += c->n_duplicates;
+        size_t ci = 0, cki = 0, ri = 0, rki = 0;
+        if (opt_order == SORT_name) {
+            writeRecords(writer, c->records, ri, c->keys, rki, -1, n_reads, ok);
+            delete c;
+            continue;
+        }
+        // merge the carried mates into the chunk's reads, the carried going
+        // first at a tie as their templates start earlier
+        while (ok && ri < c->records.size()) {
+            const int64_t limit = c->keys[rki] + 1;
+            ci = writeRecords(writer, carry, ci, carry_keys, cki, limit, n_reads, ok);
+            const int64_t next = cki < carry_keys.size() ? carry_keys[cki] : -1;
+            ri = writeRecords(writer, c->records, ri, c->keys, rki, next, n_reads, ok);
+        }
+        ci = writeRecords(writer, carry, ci, carry_keys, cki, -1, n_reads, ok);
+        carry.swap(c->carry);
+        carry_keys.swap(c->carry_keys);
+        delete c;
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("close");
+    ok = writer.Close() && ok;
+    if (! ok) {
+        cerr << NAME << " could not write BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << NAME << " " << n_reads << " reads of " << n_made << " templates, "
+        << n_duplicates << " duplicate" << PLURAL(n_duplicates) << ", written in "
+        << sortOrderName(opt_order) << " order" << endl;
+
+    return EXIT_SUCCESS;
+}
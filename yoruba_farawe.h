@@ -0,0 +1,41 @@
+// yoruba_farawe.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_FARAWE_H_
+#define _YORUBA_FARAWE_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_simulate]"
+#endif
+
+// Functions defined in yoruba_farawe.cpp
+//
+namespace yoruba {
+
+int  main_farawe(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_FARAWE_H_
@@ -40,11 +40,15 @@ static bool         opt_usageonly = false;
 static string       usage_file;
 static bool         opt_mate = true;
 static string       list_file;
+static int64_t      opt_checkpoint = 0;  // reads between checkpoints, 0 for none
+static bool         opt_resume = false;
+static string       opt_tmp_prefix;  // defaults to output file, or yoruba_forget
+static string       metrics_file;
 #ifdef _WITH_DEBUG
 static int32_t      opt_debug = 0;
-static int32_t      debug_progress = 100000;
+static double       debug_progress = 10;
 static int64_t      opt_reads = -1;
-static int64_t      opt_progress = 0; // 1000000;
+static double       opt_progress = 0;
 #endif
 static const string sep = "\t";
 class refStats {  // holds statistics for reference sequences
@@ -75,8 +79,8 @@ static int
 usage(bool longer = false)
 {
     cerr << endl;
-    cerr << "Usage:   " << YORUBA_NAME << " forget [options] <in.bam>" << endl;
-    cerr << "         " << YORUBA_NAME << " gbagbe [options] <in.bam>" << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " forget [options] [<in.bam>]" << endl;
+    cerr << "         " << YORUBA_NAME << " gbagbe [options] [<in.bam>]" << endl;
     cerr << "\n\
 Dynamically reduce the number of reference sequences in <in.bam>.\n\
 Either command invokes this function.\n\
@@ -106,6 +110,16 @@ A list of reference sequences to keep regardless of whether they are referred\n\
 to can be provided with the --list option.  The file provided can be in BED\n\
 format or contains whitespace-separated fields with the reference sequence name\n\
 as the first field.\n\
+\n\
+With --checkpoint INT, the output is written through to a block boundary every\n\
+INT reads and the place reached is saved in FILE.checkpoint.  If the command\n\
+dies, running it again with the same options plus --resume repeats the first\n\
+pass, then continues writing from the last checkpoint, and the output is the\n\
+same as if it had not been interrupted.  Both require -o FILE.\n\
+\n\
+If <in.bam> is not given, input is read from stdin.  Since it is read twice,\n\
+a piped input is copied as it is read to PREFIX.PID.spool, which the second\n\
+pass reads and then removes.\n\
 \n";
     cerr << "\
 Options: --no-mate                 also forget references for paired-end mates\n\
@@ -113,13 +127,18 @@ Options: --no-mate                 also forget references for paired-end mates\n
          --usage-file FILE         write per-reference usage details to FILE\n\
          -L FILE | --list FILE     file containing names of reference sequences to keep\n\
          -o FILE | --output FILE   output file name [default is stdout]\n\
+         --checkpoint INT          checkpoint every INT reads, for --resume [" << opt_checkpoint << "]\n\
+         --resume                  resume from the checkpoint of -o FILE\n\
+         -T PREFIX | --tmp-prefix PREFIX\n\
+                                   prefix for spooling stdin [output file, or yoruba_forget]\n\
+         --metrics FILE            write progress metrics to FILE for Prometheus\n\
          -? | --help               longer help\n\
 \n";
 #ifdef _WITH_DEBUG
     cerr << "\
          --debug INT      debug info level INT [" << opt_debug << "]\n\
          --reads INT      only process INT reads [" << opt_reads << "]\n\
-         --progress INT   print reads processed mod INT [" << opt_progress << "]\n\
+         --progress SEC   report progress every SEC seconds [" << opt_progress << "]\n\
 \n";
 #endif
     cerr << "Gbagbe is the Yoruba (Nigeria) verb for 'to forget'." << endl;
@@ -152,6 +171,7 @@ yoruba::main_gbagbe(int argc, char* argv[])
 	}
     
     enum { OPT_output, OPT_nomate, OPT_usageonly, OPT_usagefile, OPT_list,
+        OPT_checkpoint, OPT_resume, OPT_tmp_prefix, OPT_metrics,
 #ifdef _WITH_DEBUG
         OPT_debug, OPT_reads, OPT_progress,
 #endif
@@ -167,6 +187,11 @@ yoruba::main_gbagbe(int argc, char* argv[])
         { OPT_list,            "-L",                SO_REQ_SEP },
         { OPT_output,          "--output",          SO_REQ_SEP },
         { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_checkpoint,      "--checkpoint",      SO_REQ_SEP },
+        { OPT_resume,          "--resume",          SO_NONE },
+        { OPT_tmp_prefix,      "--tmp-prefix",      SO_REQ_SEP },
+        { OPT_tmp_prefix,      "-T",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
 #ifdef _WITH_DEBUG
         { OPT_debug,           "--debug",           SO_REQ_SEP },
         { OPT_reads,           "--reads",           SO_REQ_SEP },
@@ -194,13 +219,21 @@ yoruba::main_gbagbe(int argc, char* argv[])
             list_file = args.OptionArg();
         } else if (args.OptionId() == OPT_output) {
             output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_checkpoint) {
+            opt_checkpoint = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_resume) {
+            opt_resume = true;
+        } else if (args.OptionId() == OPT_tmp_prefix) {
+            opt_tmp_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
 #ifdef _WITH_DEBUG
         } else if (args.OptionId() == OPT_debug) {
             opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
         } else if (args.OptionId() == OPT_reads) {
             opt_reads = strtoll(args.OptionArg(), NULL, 10);
         } else if (args.OptionId() == OPT_progress) {
-            opt_progress = args.OptionArg() ? strtoll(args.OptionArg(), NULL, 10) : opt_progress;
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
 #endif
         } else {
             cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
@@ -210,6 +243,13 @@ yoruba::main_gbagbe(int argc, char* argv[])
 
     if (DEBUG(1) && ! opt_progress)
         opt_progress = debug_progress;
+    if (! progress.Start(NAME, "forget", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if ((opt_checkpoint || opt_resume) && output_file.empty()) {
+        cerr << NAME << " --checkpoint and --resume require -o FILE" << endl;
+        return usage();
+    }
 
     if (args.FileCount() > 1) {
         cerr << NAME << " requires at most one BAM file specified as input" << endl;
@@ -217,8 +257,6 @@ yoruba::main_gbagbe(int argc, char* argv[])
     } else if (args.FileCount() == 1) {
         input_file = args.File(0);
     } else if (input_file.empty()) {
-        cerr << NAME << " can't currently read from stdin, ask Doug about it" << endl;
-        return EXIT_FAILURE;
         input_file = "/dev/stdin";
     }
 
@@ -227,6 +265,12 @@ yoruba::main_gbagbe(int argc, char* argv[])
         output_file = "/dev/stdout";
     }
 
+    if (opt_tmp_prefix.empty())
+        opt_tmp_prefix = output_file == "/dev/stdout" ? string("yoruba_forget") : output_file;
+    char pid[32];
+    sprintf(pid, ".%d", int(getpid()));
+    opt_tmp_prefix += pid;
+
 
     //----------------- If --list option used, open file and read in list of references.
 
@@ -260,13 +304,22 @@ yoruba::main_gbagbe(int argc, char* argv[])
 
     //----------------- Open input BAM, create header for output BAM
 
+    profile.Begin("open");
+
+    // a piped input is spooled during pass 1 for reading again in pass 2
+    inputSpool spool;
+    if (opt_usageonly) {
+        // there is no pass 2
+    } else if (! spool.Start(input_file, opt_tmp_prefix + ".spool")) {
+        return EXIT_FAILURE;
+    }
 
 	BamReader reader;
 
     if (opt_progress || DEBUG(1))
         cerr << NAME << "[pass1] opening input BAM and reading references..." << endl;
 
-	if (! reader.Open(input_file)) {
+	if (! reader.Open(opt_usageonly ? input_file : spool.FirstPass())) {
         cerr << NAME << "[pass1] could not open BAM input" << endl;
         return EXIT_FAILURE;
     }
@@ -310,6 +363,8 @@ yoruba::main_gbagbe(int argc, char* argv[])
 
     //----------------- Pass 1: Determine which references are used
 
+    profile.Begin("pass1");
+    progress.Input(input_file);
 
     if (true || opt_progress || DEBUG(1))
         cerr << NAME << "[pass1] " << reader.GetReferenceCount() 
@@ -344,16 +399,16 @@ yoruba::main_gbagbe(int argc, char* argv[])
         }
         // FIXME handle at least a subset of reference mentions within tags
 
-        if ((opt_progress || DEBUG(1)) && n_reads % opt_progress == 0)
-            cerr << NAME << "[pass1] " << n_reads << " reads examined..." << endl;
- 
+        progress.Reads(n_reads);
 	}
     if (opt_progress || DEBUG(1))
         cerr << NAME << "[pass1] " << n_reads << " reads examined" << endl;
+    profile.Reads(n_reads);
 
 
     //----------------- Pass 2: Create new reference set
 
+    profile.Begin("references");
 
     const RefVector& old_refs = reader.GetReferenceData();
     RefVector        new_refs;
@@ -494,8 +549,26 @@ yoruba::main_gbagbe(int argc, char* argv[])
 
     //----------------- Pass 2: Second pass through reads, write new BAM file
 
+    profile.Begin("pass2");
+
+    // records are handled raw in this pass, which lets the input be sought
+    // and the output be cut at block boundaries for checkpoints
+    reader.Close();
+    if (! spool.Finish())
+        return EXIT_FAILURE;
+    bamRawReader raw_reader;
+    if (! raw_reader.Open(spool.SecondPass())) {
+        cerr << NAME << "[pass2] could not reopen BAM input" << endl;
+        return EXIT_FAILURE;
+    }
 
-    BamWriter writer;
+    bamRawWriter writer;
+    // before any resume, so the index left at the checkpoint is continued
+    writer.IndexRecords(yviIndex::default_interval);
+    vector<pair<string, bamRawWriter*> > writers(1, make_pair(output_file, &writer));
+    const string state_file = checkpointState::Filename(output_file);
+    checkpointState state;
+    state.command = checkpointState::Command(argc, argv);
 
     IF_DEBUG(2) {
         cerr << "********* BEGIN new_header.ToString()" << endl;
@@ -503,53 +576,80 @@ yoruba::main_gbagbe(int argc, char* argv[])
         cerr << "********* END   new_header.ToString()" << endl;
     }
 
-
-    if (! writer.Open(output_file, new_header, new_refs)) {
-        cerr << NAME << " could not open output " << output_file << endl;
-        return EXIT_FAILURE;
-    }
-
     int64_t n_reads_pass1 = n_reads;
     n_reads = 0;
+    progress.Input(spool.SecondPass());
+    progress.Expect(n_reads_pass1);
     int64_t n_reads_rerefd = 0;  // number of reads given re-references
     int64_t n_mates_derefd = 0;  // number of mates that have references removed
 
-    reader.Rewind();
+    if (opt_resume) {
+        checkpointState saved;
+        if (! saved.Read(state_file))
+            return EXIT_FAILURE;
+        if (saved.command != state.command) {
+            cerr << NAME << " " << state_file << " is a checkpoint of another command: "
+                << saved.command << endl;
+            return EXIT_FAILURE;
+        }
+        if (! saved.Restore(writers) || ! raw_reader.Seek(saved.input_offset)) {
+            cerr << NAME << " could not resume from " << state_file << endl;
+            return EXIT_FAILURE;
+        }
+        n_reads = saved.Counter("n_reads");
+        n_reads_rerefd = saved.Counter("n_reads_rerefd");
+        n_mates_derefd = saved.Counter("n_mates_derefd");
+        cerr << NAME << "[pass2] resuming after " << n_reads << " reads" << endl;
+    } else if (! writer.Open(output_file, new_header.ToString(), new_refs)) {
+        cerr << NAME << " could not open output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
 
-	while (reader.GetNextAlignmentCore(al) && (opt_reads < 0 || n_reads < opt_reads)) {
+    bamRawRecord r;
+
+	while ((opt_reads < 0 || n_reads < opt_reads) && raw_reader.GetNextRecord(r)) {
 
         ++n_reads;
 
-        if (al.IsMapped()) {
-            assert(al.RefID >= 0);  // it was valid before...
-            if (al.RefID != refs_mentioned[al.RefID]) {  // the reference ID is different
+        if (r.IsMapped()) {
+            assert(r.RefID() >= 0);  // it was valid before...
+            if (r.RefID() != refs_mentioned[r.RefID()]) {  // the reference ID is different
                 ++n_reads_rerefd;  // strictly rereferenced
-                if (al.IsPaired()) {
-                    if (al.MateRefID == al.RefID
-                        || refs_mentioned[al.MateRefID] >= 0) {
+                if (r.IsPaired()) {
+                    if (r.MateRefID() == r.RefID()
+                        || refs_mentioned[r.MateRefID()] >= 0) {
                         // update the mate RefID
-                        al.MateRefID = refs_mentioned[al.MateRefID];
-                    } else if (al.IsMateMapped()) {
+                        r.SetMateRefID(refs_mentioned[r.MateRefID()]);
+                    } else if (r.IsMateMapped()) {
                         // mate ref is now unavailable
-                        al.MateRefID = -1;
+                        r.SetMateRefID(-1);
                         ++n_mates_derefd;
                     }
                 }
-                al.RefID = refs_mentioned[al.RefID];
-                assert(al.RefID >= 0);  // and it is valid after
+                r.SetRefID(refs_mentioned[r.RefID()]);
+                assert(r.RefID() >= 0);  // and it is valid after
             }
         }
 
-        writer.SaveAlignment(al);
+        if (! writer.Write(r)) {
+            cerr << NAME << "[pass2] could not write to " << output_file << endl;
+            return EXIT_FAILURE;
+        }
 
-        if (opt_progress && n_reads % opt_progress == 0) {
-            cerr << NAME << "[pass2] " << n_reads << " reads rereferenced";
-            if (! opt_mate)
-                cerr << ", "<< n_mates_derefd << " mates dereferenced";
-            cerr << "..." << endl;
+        if (opt_checkpoint && n_reads % opt_checkpoint == 0) {
+            state.counters["n_reads"] = n_reads;
+            state.counters["n_reads_rerefd"] = n_reads_rerefd;
+            state.counters["n_mates_derefd"] = n_mates_derefd;
+            if (! state.Save(state_file, raw_reader, writers))
+                return EXIT_FAILURE;
         }
- 
+
+        progress.Reads(n_reads);
 	}
+    if (raw_reader.Error()) {
+        cerr << NAME << "[pass2] could not read BAM input" << endl;
+        return EXIT_FAILURE;
+    }
     if (true || opt_progress || DEBUG(1)) {
         cerr << NAME << "[pass2] " << n_reads << " reads rereferenced";
         if (! opt_mate)
@@ -557,10 +657,17 @@ yoruba::main_gbagbe(int argc, char* argv[])
         cerr << endl;
     }
     assert(n_reads == n_reads_pass1);
+    profile.Reads(n_reads);
 
-	reader.Close();
-	writer.Close();
+    profile.Begin("close");
+    raw_reader.Close();
+    if (! writer.Close()) {
+        cerr << NAME << "[pass2] could not write to " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    if (opt_checkpoint || opt_resume)
+        remove(state_file.c_str());
 
-	return EXIT_SUCCESS;
+    return EXIT_SUCCESS;
 }
 
@@ -12,6 +12,7 @@
 
 // Std C/C++ includes
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -20,6 +21,7 @@
 #include <sstream>
 #include <map>
 #include <tr1/unordered_map>
+#include <unistd.h>
 
 // BamTools includes: my own fork of https://github.com/pezmaster31/bamtools
 #include "api/BamAux.h"
@@ -38,6 +40,12 @@
 // Yoruba includes
 #include "yoruba.h"
 #include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_yvi.h"
+#include "yoruba_checkpoint.h"
+#include "yoruba_spool.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 #ifndef _YORUBA_MAIN
 #define NAME "[yoruba_forget]"
@@ -0,0 +1,381 @@
+// yoruba_histogram.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Fixed-size histograms for insert size distributions.
+//
+// The insert size histogram is log-linear, in the style of HdrHistogram: small
+// values are counted exactly and larger values into buckets whose width grows
+// with the value, so relative precision is constant and memory is fixed no
+// matter how many read pairs are added.
+
+
+#include <cmath>
+#include <sstream>
+
+#include "yoruba_histogram.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+const char*
+yoruba::pairOrientationName(pairOrientation_t o)
+{
+    switch (o) {
+        case ORIENT_FR: return "FR";
+        case ORIENT_RF: return "RF";
+        case ORIENT_FF: return "FF";
+        default:        return "??";
+    }
+}
+
+
+//-------------------------------------
+
+
+bool
+yoruba::parsePairOrientation(const string& s, pairOrientation_t& o)
+{
+    if (s == "FR" || s == "fr")                        o = ORIENT_FR;
+    else if (s == "RF" || s == "rf")                   o = ORIENT_RF;
+    else if (s == "FF" || s == "ff" || s == "RR" || s == "rr") o = ORIENT_FF;
+    else return false;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+yoruba::parseInsertType(const string& s, insertType_t& t)
+{
+    if (s == "outer")      t = INSERT_outer;
+    else if (s == "inner") t = INSERT_inner;
+    else if (s == "left")  t = INSERT_left;
+    else if (s == "right") t = INSERT_right;
+    else return false;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+yoruba::parseQuantiles(const string& s, vector<double>& q)
+{
+    q.clear();
+    stringstream ss(s);
+    string field;
+    while (getline(ss, field, ',')) {
+        char* end = NULL;
+        double d = strtod(field.c_str(), &end);
+        if (field.empty() || *end != '\0' || d < 0.0 || d > 1.0)
+            return false;
+        q.push_back(d);
+    }
+    return ! q.empty();
+}
+
+
+//-------------------------------------
+
+
+pairOrientation_t
+yoruba::pairOrientation(const bool left_rev, const bool right_rev)
+{
+    if (left_rev == right_rev) return ORIENT_FF;
+    return left_rev ? ORIENT_RF : ORIENT_FR;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+yoruba::insertSize(const insertType_t t,
+                   const int32_t left_start, const int32_t left_end,
+                   const int32_t right_start, const int32_t right_end)
+{
+    switch (t) {
+        case INSERT_outer: return (right_end > left_end ? right_end : left_end) - left_start;
+        case INSERT_inner: return right_start - left_end;
+        case INSERT_left:  return right_start - left_start;
+        case INSERT_right: return right_end - left_end;
+    }
+    return 0;
+}
+
+
+//-------------------------------------  insertHistogram
+
+
+insertHistogram::insertHistogram(void)
+    : pos(n_buckets, 0)
+    , neg(n_buckets, 0)
+    , n(0)
+    , min_value(0)
+    , max_value(0)
+    , sum(0.0)
+    , sum_sq(0.0)
+{ }
+
+
+//-------------------------------------
+
+
+int32_t
+insertHistogram::bucketIndex(const uint64_t magnitude)
+{
+    if (magnitude < uint64_t(2 * sub_count))
+        return int32_t(magnitude);
+    uint64_t v = magnitude > 0xffffffffULL ? 0xffffffffULL : magnitude;
+    int32_t msb = 63 - __builtin_clzll(v);
+    int32_t shift = msb - sub_bits;
+    return shift * sub_count + int32_t(v >> shift);
+}
+
+
+//-------------------------------------
+
+
+void
+insertHistogram::bucketBounds(const int32_t idx, uint64_t& lo, uint64_t& hi)
+{
+    if (idx < 2 * sub_count) {
+        lo = hi = idx;
+        return;
+    }
+    int32_t shift = idx / sub_count - 1;
+    uint64_t m = idx - shift * sub_count;
+    lo = m << shift;
+    hi = ((m + 1) << shift) - 1;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+insertHistogram::bucketValue(const int32_t idx, const bool negative) const
+{
+    uint64_t lo, hi;
+    bucketBounds(idx, lo, hi);
+    int64_t v = int64_t(lo + (hi - lo) / 2);
+    if (negative) v = -v;
+    // the exact extremes are known, so never report beyond them
+    if (v < min_value) v = min_value;
+    if (v > max_value) v = max_value;
+    return v;
+}
+
+
+//-------------------------------------
+
+
+void
+insertHistogram::Add(const int64_t value, const int64_t count)
+{
+    if (count <= 0) return;
+    if (value < 0)
+        neg[bucketIndex(uint64_t(-value))] += count;
+    else
+        pos[bucketIndex(uint64_t(value))] += count;
+    if (n == 0 || value < min_value) min_value = value;
+    if (n == 0 || value > max_value) max_value = value;
+    n += count;
+    sum += double(value) * count;
+    sum_sq += double(value) * double(value) * count;
+}
+
+
+//-------------------------------------
+
+
+void
+insertHistogram::Merge(const insertHistogram& other)
+{
+    if (other.n == 0) return;
+    for (int32_t i = 0; i < n_buckets; ++i) {
+        pos[i] += other.pos[i];
+        neg[i] += other.neg[i];
+    }
+    if (n == 0 || other.min_value < min_value) min_value = other.min_value;
+    if (n == 0 || other.max_value > max_value) max_value = other.max_value;
+    n += other.n;
+    sum += other.sum;
+    sum_sq += other.sum_sq;
+}
+
+
+//-------------------------------------
+
+
+void
+insertHistogram::Clear(void)
+{
+    pos.assign(n_buckets, 0);
+    neg.assign(n_buckets, 0);
+    n = min_value = max_value = 0;
+    sum = sum_sq = 0.0;
+}
+
+
+//-------------------------------------
+
+
+double
+insertHistogram::Mean(void) const
+{
+    return n ? sum / n : 0.0;
+}
+
+
+//-------------------------------------
+
+
+double
+insertHistogram::SD(void) const
+{
+    if (n < 2) return 0.0;
+    double var = (sum_sq - sum * sum / n) / (n - 1);
+    return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+insertHistogram::ValueAtRank(int64_t rank) const
+{
+    if (n == 0) return 0;
+    if (rank < 1) rank = 1;
+    if (rank >= n) return max_value;
+    if (rank == 1) return min_value;
+    int64_t seen = 0;
+    // negative values first, from the largest magnitude down
+    for (int32_t i = n_buckets - 1; i >= 1; --i) {
+        if (! neg[i]) continue;
+        seen += neg[i];
+        if (seen >= rank) return bucketValue(i, true);
+    }
+    for (int32_t i = 0; i < n_buckets; ++i) {
+        if (! pos[i]) continue;
+        seen += pos[i];
+        if (seen >= rank) return bucketValue(i, false);
+    }
+    return max_value;
+}
+
+
+//-------------------------------------
+
+
+int64_t
+insertHistogram::Quantile(const double q) const
+{
+    return ValueAtRank(int64_t(ceil(q * n)));
+}
+
+
+//-------------------------------------
+
+
+void
+insertHistogram::QuantileBounds(const double q, const double z,
+                                int64_t& lo, int64_t& hi) const
+{
+    // the number of values below the q quantile is binomial(n, q), so the
+    // bounds are the values at ranks n q -/+ z sqrt(n q (1 - q))
+    double half = z * sqrt(double(n) * q * (1.0 - q));
+    lo = ValueAtRank(int64_t(floor(q * n - half)));
+    hi = ValueAtRank(int64_t(ceil(q * n + half)));
+}
+
+
+//-------------------------------------  insertSizeStats
+
+
+int32_t
+insertSizeStats::ReadGroupIndex(const string& rg)
+{
+    rgIndexMap::const_iterator rgI = rg_index.find(rg);
+    if (rgI != rg_index.end())
+        return rgI->second;
+    int32_t idx = rg_names.size();
+    rg_names.push_back(rg);
+    rg_index[rg] = idx;
+    hists.resize(hists.size() + ORIENT_N);
+    return idx;
+}
+
+
+//-------------------------------------
+
+
+void
+insertSizeStats::Merge(const insertSizeStats& other)
+{
+    for (int32_t i = 0; i < other.ReadGroupCount(); ++i) {
+        int32_t idx = ReadGroupIndex(other.rg_names[i]);
+        for (int32_t o = 0; o < ORIENT_N; ++o)
+            hists[idx * ORIENT_N + o].Merge(other.hists[i * ORIENT_N + o]);
+    }
+}
+
+
+//-------------------------------------
+
+
+int64_t
+insertSizeStats::Count(void) const
+{
+    int64_t count = 0;
+    for (size_t i = 0; i < hists.size(); ++i)
+        count += hists[i].Count();
+    return count;
+}
+
+
+//-------------------------------------
+
+
+void
+insertSizeStats::Report(ostream& os, const vector<double>& quantiles,
+                        const pairOrientation_t orient, const double z) const
+{
+    const string sep = "\t";
+    os << "readgroup" << sep << "orientation" << sep << "pairs" << sep << "min"
+        << sep << "max" << sep << "mean" << sep << "sd";
+    for (size_t q = 0; q < quantiles.size(); ++q) {
+        os << sep << "q" << quantiles[q];
+        if (z > 0.0)
+            os << sep << "q" << quantiles[q] << "_lo" << sep << "q" << quantiles[q] << "_hi";
+    }
+    os << endl;
+    for (int32_t i = 0; i < ReadGroupCount(); ++i) {
+        for (int32_t o = 0; o < ORIENT_N; ++o) {
+            if (orient != ORIENT_N && o != orient) continue;
+            const insertHistogram& h = hists[i * ORIENT_N + o];
+            if (orient == ORIENT_N && ! h.Count()) continue;
+            os << rg_names[i] << sep << pairOrientationName(pairOrientation_t(o))
+                << sep << h.Count() << sep << h.Min() << sep << h.Max()
+                << sep << fixed << setprecision(1) << h.Mean()
+                << sep << h.SD();
+            for (size_t q = 0; q < quantiles.size(); ++q) {
+                os << sep << h.Quantile(quantiles[q]);
+                if (z > 0.0) {
+                    int64_t lo, hi;
+                    h.QuantileBounds(quantiles[q], z, lo, hi);
+                    os << sep << lo << sep << hi;
+                }
+            }
+            os << endl;
+        }
+    }
+}
+
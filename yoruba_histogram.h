@@ -0,0 +1,152 @@
+// yoruba_histogram.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_histogram.cpp
+//
+// Fixed-size histograms for insert size distributions, kept per read group
+// and per read pair orientation.
+
+#ifndef _YORUBA_HISTOGRAM_H_
+#define _YORUBA_HISTOGRAM_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <tr1/unordered_map>
+
+namespace yoruba {
+
+// Orientation of the two reads of a pair, relative to the forward strand of
+// the reference and read from the leftmost read to the rightmost read.  RR
+// pairs are tandem like FF pairs, and are counted with them.
+
+enum pairOrientation_t { ORIENT_FR = 0, ORIENT_RF = 1, ORIENT_FF = 2, ORIENT_N = 3 };
+
+// How the insert size is calculated, see 'yoruba insertsize --help'
+
+enum insertType_t { INSERT_outer, INSERT_inner, INSERT_left, INSERT_right };
+
+const char* pairOrientationName(pairOrientation_t o);
+
+bool parsePairOrientation(const std::string& s, pairOrientation_t& o);
+
+bool parseInsertType(const std::string& s, insertType_t& t);
+
+bool parseQuantiles(const std::string& s, std::vector<double>& q);
+
+pairOrientation_t
+pairOrientation(const bool left_rev, const bool right_rev);
+
+// Starts are 0-based and ends are one past the last aligned base, as returned
+// by BamAlignment::GetEndPosition(), and the left read is the one with the
+// lesser start.
+
+int64_t
+insertSize(const insertType_t t,
+           const int32_t left_start, const int32_t left_end,
+           const int32_t right_start, const int32_t right_end);
+
+
+//-------------------------------------
+
+
+// Log-linear histogram of signed integer values.  Values with a magnitude
+// below 2^(sub_bits+1) are counted exactly; each larger power of two is split
+// into 2^sub_bits buckets, so a value reported from the histogram is within
+// 2^-sub_bits of the values counted.  Memory is fixed at construction and
+// does not depend on the number of values added.  Histograms can be merged,
+// so each thread can keep its own and combine them at the end.
+
+class insertHistogram {
+
+    public:
+        static const int32_t sub_bits = 7;
+        static const int32_t sub_count = 1 << sub_bits;
+        static const int32_t n_buckets = (32 - sub_bits + 1) * sub_count;
+
+    public:
+        insertHistogram(void);
+
+        void    Add(const int64_t value, const int64_t count = 1);
+        void    Merge(const insertHistogram& other);
+        void    Clear(void);
+
+        int64_t Count(void) const { return n; }
+        int64_t Min(void) const { return min_value; }
+        int64_t Max(void) const { return max_value; }
+        double  Mean(void) const;
+        double  SD(void) const;
+
+        // value of the rank-th smallest value (1-based), to bucket precision
+        int64_t ValueAtRank(int64_t rank) const;
+        // rank is ceil(q * Count())
+        int64_t Quantile(const double q) const;
+        // distribution-free confidence bounds on quantile q, from the ranks
+        // of the order statistics bracketing it at normal deviate z
+        void    QuantileBounds(const double q, const double z,
+                               int64_t& lo, int64_t& hi) const;
+
+    private:
+        static int32_t bucketIndex(const uint64_t magnitude);
+        static void    bucketBounds(const int32_t idx, uint64_t& lo, uint64_t& hi);
+        int64_t        bucketValue(const int32_t idx, const bool negative) const;
+
+    private:
+        std::vector<uint64_t> pos;  // counts for values >= 0
+        std::vector<uint64_t> neg;  // counts for values < 0, by magnitude
+        int64_t n;
+        int64_t min_value;
+        int64_t max_value;
+        double  sum;
+        double  sum_sq;
+
+};  // class insertHistogram
+
+
+//-------------------------------------
+
+
+// One insertHistogram per read group and pair orientation.  Read groups are
+// added as they are seen, reads without an RG tag go to read group "*".
+
+class insertSizeStats {
+
+    public:
+        insertSizeStats(void) { }
+
+        int32_t ReadGroupIndex(const std::string& rg);
+        void    Add(const int32_t rg_idx, const pairOrientation_t o, const int64_t insert)
+                    { hists[rg_idx * ORIENT_N + o].Add(insert); }
+        void    Merge(const insertSizeStats& other);
+
+        int32_t ReadGroupCount(void) const { return rg_names.size(); }
+        const std::string& ReadGroupName(const int32_t rg_idx) const
+                    { return rg_names[rg_idx]; }
+        insertHistogram& Histogram(const int32_t rg_idx, const pairOrientation_t o)
+                    { return hists[rg_idx * ORIENT_N + o]; }
+        const insertHistogram& Histogram(const int32_t rg_idx, const pairOrientation_t o) const
+                    { return hists[rg_idx * ORIENT_N + o]; }
+        int64_t Count(void) const;
+
+        // write a table with one line per read group and orientation; if
+        // orient is ORIENT_N all orientations with any pairs are reported;
+        // if z > 0, each quantile is followed by its confidence bounds
+        void    Report(std::ostream& os, const std::vector<double>& quantiles,
+                       const pairOrientation_t orient = ORIENT_N,
+                       const double z = 0.0) const;
+
+    private:
+        typedef std::tr1::unordered_map<std::string, int32_t> rgIndexMap;
+        std::vector<std::string>     rg_names;
+        rgIndexMap                   rg_index;
+        std::vector<insertHistogram> hists;
+
+};  // class insertSizeStats
+
+}  // namespace yoruba
+
+#endif // _YORUBA_HISTOGRAM_H_
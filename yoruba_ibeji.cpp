@@ -13,12 +13,12 @@
 //
 // TODO
 //
-// process name-sorted BAM files with --name/-n
+// xxx process name-sorted BAM files with --name/-n
 // regular expression handling for matching strings
-// command line opotion processing via SimpleOpt.h
-// BAM file writing
-// FastQ file writing
-// debugging options
+// xxx command line opotion processing via SimpleOpt.h
+// xxx BAM file writing
+// xxx FastQ file writing
+// xxx debugging options
 // lightweight alignment class to reduce memory usage?
 //
 // Command line options
@@ -53,24 +53,33 @@
 // --same-chrom         Pairs that map to the same chromosome are allowed
 // -s
 //
-// --0                  Output pairs for which neither read fits link-pair criteria
+// xxx --0 <file>       Output pairs for which neither read fits link-pair criteria
 // -0
 //
-// --1                  Output pairs for which one read fits link-pair criteria
+// xxx --1 <file>       Output pairs for which one read fits link-pair criteria
 // -1
 //
-// --2                  Output pairs for which both reads fit link-pair criteria (DEFAULT)
+// xxx --2 <file>       Output pairs for which both reads fit link-pair criteria
 // -2
 //
-// --name               Expect the input BAM file to be sorted by read name.  Processing
+// xxx --name           Expect the input BAM file to be sorted by read name.  Processing
 // -n                   a name-sorted BAM file will be faster and use much less memory
 //                      than processing a coordinate-sorted BAM file.
 //
+// xxx --coordinate     Expect the input BAM file to be sorted by coordinate.  Without
+//                      --name or --coordinate, the order is detected from the header
+//                      and the first reads.
+//
 // --out <file>         Write BAM-format <file> containing link pair alignments, else STDOUT.
 // -o <file>            Note the output 
 //
-// --fastq <file>       Write FastQ-format <file> containing link pairs as reads
-// -r <file>
+// xxx --fastq <file>   Write FastQ-format <file> containing link pairs as reads
+// -r <file>            Done as: any output <file> ending .fq or .fastq (.gz) is FastQ
+//
+// xxx --orphans <file> Output pairs with one link pair candidate and its mate unmapped
+//
+// xxx --broken <file>  Output pairs with one link pair candidate and its mate mapped
+//                      but not a candidate
 
 
 
@@ -136,221 +145,1151 @@
 // Find reads in BAM files that are mapped near the end of a contig and
 // oriented so they point off the contig
 
-// Std C/C++ includes
-#include <cstdlib>
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include <list>
-using namespace std;
+// Input order
+//
+// In a coordinate-sorted BAM, the first read of each pair seen is held by a
+// matePairer (yoruba_mates.h) until its mate arrives, so memory grows with the
+// number of pairs spanning the current position.  Reads with mates on later
+// references are held longest; with --max-memory those beyond the cap are
+// spilled to a temporary file until the input reaches their mates' reference.
+// In a BAM grouped by read name (sorted with
+// samtools sort -n, or collated with samtools collate), the reads of a pair
+// are adjacent, so pairs are processed as each group of reads with the same
+// name ends and memory use is constant.  The order is taken from the SO and
+// GO tags of the header @HD line if present, otherwise from the first
+// detect_reads reads.  In grouped input, the hashes of recently-finished read
+// names are kept in a small fixed-size table, and a name that reappears after
+// its group has ended stops the run.
 
-// BamTools includes
-#include "api/BamMultiReader.h"
-#include "api/BamWriter.h"
-#include "api/BamAlignment.h"
-using namespace BamTools;
+// Reference ends
+//
+// Both reads of a link pair must lie within min(tail, total tail) of an end
+// of their reference, so with --index only those windows of each reference
+// are read, positioned with BamReader::Jump().  Windows separated by less than
+// coalesce_gap are read through as one region, which joins the end window of
+// one reference to the start window of the next, and for assemblies of many
+// short contigs makes long runs of contigs a single sequential read.
 
-// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
-#include "SimpleOpt.h"
+#include "yoruba_ibeji.h"
 
-// Ibeji includes
-#include "ibejiAlignment.h"
-#include "processReadPair.h"
-#include "yoruba_util.h"
+using namespace std;
+using namespace BamTools;
 using namespace yoruba;
 
-string  output_bam_filename = "test.bam";
-int32_t pairs_to_process = 20;
-int32_t max_read_length = 101;
-int32_t link_pair_total_tail = 1000;
-int32_t link_pair_crit_tail = 999999;
-bool    link_pair_diff_chrom = true;
+enum inputOrder_t { ORDER_unknown, ORDER_coordinate, ORDER_name };
+
+// Classes of pairs that may be written, each to its own file.  A pair is
+// classed by how many of its reads are link pair candidates, and if one is, by
+// whether its mate is unmapped (an orphan) or mapped but not a candidate
+// (broken).  Link pairs are class 2 pairs that also meet the reference and
+// total tail criteria.
+
+enum pairClass_t { CLASS_0, CLASS_1, CLASS_2, CLASS_orphan, CLASS_broken, CLASS_link,
+                   CLASS_N };
+
+// options
+static string       input_file;  // defaults to stdin, set from command line
+static string       class_file[CLASS_N];  // only written if set, link pairs with -o FILE
+static string       links_file;  // edge table, defaults to stdout
+static string       gfa_file;  // edge table as GFA, only written if set
+static int64_t      opt_max_links = 0;  // 0 for all
+static int32_t      opt_max_read_length = 101;
+static int32_t      opt_total_tail = 1000;
+static int32_t      opt_crit_tail = 999999;
+static bool         opt_same_chrom = false;
+static inputOrder_t opt_order = ORDER_unknown;  // detect unless set
+static bool         opt_index = false;
+static int32_t      opt_threads = 0;  // compression threads shared by class files
+static int64_t      opt_max_memory = 0;  // MB of reads held awaiting mates, 0 for no cap
+static string       metrics_file;
+static const int32_t coalesce_gap = 1 << 16;  // read through smaller gaps
+static const size_t detect_reads = 10000;
+static const size_t recent_names = 1 << 16;  // size of the recent name table
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static int64_t      opt_reads = -1;
+static double       opt_progress = 0;
+#endif
+static bool         debug_ref_mate = false;
 
-int32_t mate_tail_est_crit = link_pair_total_tail + max_read_length;
 
-bool    debug_ref_mate = false;
+//-------------------------------------
 
+
+#ifdef _STANDALONE
 int 
 main(int argc, char* argv[]) {
+    return main_ibeji(argc, argv);
+}
+#endif
 
-	// validate argument count
-	if( argc != 2 ) {
-		cerr << "USAGE: " << argv[0] << " <input BAM file> " << endl;
-		return EXIT_FAILURE;
-	}
-
-	string filename = argv[1];
-	//cerr << "Printing alignments from file: " << filename << endl;
-	
-	BamReader reader;
-	if (!reader.Open(filename)) {
-        cerr << "could not open filename " << filename << endl;
-        return EXIT_FAILURE;
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " twinreads [options] <in.bam>" << endl;
+    cerr << "         " << YORUBA_NAME << " ibeji [options] <in.bam>" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Find link pairs in <in.bam>, pairs in which each read is mapped near the end of\n\
+a reference sequence and oriented so that its mate may lie off it, and count\n\
+them by the pair of reference ends they join.  <in.bam> must be sorted by\n\
+coordinate or grouped by read name.\n\
+\n\
+Options: --max-read-length INT   maximum read length, used to estimate the tail of\n\
+                                 an unseen mate [" << opt_max_read_length << "]\n\
+         -m INT | --max-link INT maximum number of link pairs to find, 0 for all [" << opt_max_links << "]\n\
+         -t INT | --tail INT     maximum tail for a read to be a link pair candidate [" << opt_crit_tail << "]\n\
+         -T INT | --total-tail INT\n\
+                                 maximum total tail of a link pair [" << opt_total_tail << "]\n\
+         -s | --same-chrom       allow link pairs with both reads on the same reference\n\
+         -n | --name             input is grouped by read name\n\
+         --coordinate            input is sorted by coordinate\n\
+         -i | --index            use the BAM index to read only reference ends\n\
+         --links FILE            write the link edge table to FILE [default is stdout]\n\
+         --gfa FILE              also write the link edge table as GFA to FILE\n\
+         -o FILE | --output FILE write link pairs to FILE\n\
+         -2 FILE | --2 FILE      write pairs with both reads link pair candidates to FILE\n\
+         -1 FILE | --1 FILE      write pairs with one read a link pair candidate to FILE\n\
+         -0 FILE | --0 FILE      write pairs with neither read a link pair candidate to FILE\n\
+         --orphans FILE          write pairs with one read a candidate and its mate\n\
+                                 unmapped to FILE\n\
+         --broken FILE           write pairs with one read a candidate and its mate\n\
+                                 mapped but not a candidate to FILE\n\
+         --threads INT           threads for compressing pairs written [" << opt_threads << "]\n\
+         --max-memory INT        MB of reads to hold awaiting mates in coordinate-sorted\n\
+                                 input before spilling to disk, 0 for no cap [" << opt_max_memory << "]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+The tail of a read is the distance from its mapped position to the end of the\n\
+reference sequence it points towards, and the total tail of a pair is the sum\n\
+of the tails of its reads.\n\
+\n\
+The link edge table has a line for each pair of reference ends joined by link\n\
+pairs, giving the two references and ends, the orientation of the join, the\n\
+number of link pairs and the mean and SD of their total tails.\n\
+\n\
+Pairs are written as BAM, or as FASTQ if FILE ends with .fq or .fastq, which is\n\
+compressed if FILE also ends with .gz.  All pairs are classed in the one pass\n\
+through <in.bam>, and all files share the --threads compression threads.\n\
+\n\
+Without --name or --coordinate, the input order is taken from the @HD line of\n\
+the header, or if the header doesn't say, from the first " << detect_reads << " reads.\n\
+Input grouped by read name (samtools sort -n or samtools collate) is processed\n\
+pair by pair using constant memory.  Coordinate-sorted input requires holding\n\
+reads until their mates are seen; with --max-memory, held reads with mates on\n\
+later references are spilled to a temporary file beyond the cap.  If grouped input turns out not to be\n\
+grouped, processing stops with an error.\n\
+\n\
+With --index, <in.bam> must be coordinate-sorted and indexed, and only the reads\n\
+within min(tail, total tail) of each end of each reference are read.\n\
+\n";
     }
-    cerr << filename << ": Done opening" << endl;
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Ibeji is the Yoruba (Nigeria) noun for 'twin'." << endl;
+    cerr << endl;
 
-    // Header can't be used to accurately determine sort order because samtools never
-    // changes it; instead, check after loading each read as is done with "samtools index"
+    return EXIT_FAILURE;
+}
 
-    // We don't need to load an index (right?)
-	// if (!reader.LocateIndex()) {
-    //     const string index_filename = filename + ".bai";
-	//     if (!reader.OpenIndex(index_filename)) {
-    //         cerr << "could not open index" << endl;
-    //     }
-    // }
 
+//-------------------------------------
 
-    const SamHeader header = reader.GetHeader();
-    cerr << filename << ": Done getting header" << endl;
-    const RefVector refs = reader.GetReferenceData();
-    cerr << filename << ": Done getting reference data" << endl;
-	
-    BamWriter writer;
-    if (! output_bam_filename.empty()) {
-        if (! writer.Open(output_bam_filename, header, refs)) {
-            cerr << "Could not open BAM output file " << output_bam_filename << endl;
-            return EXIT_FAILURE;
-        }
-        cerr << filename << ": Done opening BAM output file " << output_bam_filename << endl;
-    }
 
-    alignmentMap read1Map;  // a single map, for all reads awaiting their mate
-    typedef map<string,int32_t> stringMap;
-    typedef stringMap::iterator stringMapI;
-    stringMap ref_mates;
-    // alignmentMap read1Map, read2Map;
-
-	BamAlignment full_al;
-    int32_t count = 0;
-    uint32_t max_reads_in_map = 0;
-    int32_t n_reads_skipped_unmapped = 0;
-    int32_t n_reads_skipped_mate_unmapped = 0;
-    int32_t n_reads_skipped_wont_see_mate = 0;
-    int32_t n_reads_skipped_mate_tail_est = 0;
-    int32_t n_reads_skipped_ref_mate = 0;
-    int32_t n_reads = 0;
-    int32_t n_singleton_reads = 0;
-    int32_t last_RefID = -1;
-    int32_t last_Position = -1;
+// A span of a coordinate-sorted BAM from (beg_ref, beg_pos) up to but not
+// including (end_ref, end_pos)
 
-    cerr << filename << ": Looking for up to " << pairs_to_process << " link pairs,"
-        << " total tail = " << link_pair_total_tail 
-        << " critical tail = " << link_pair_crit_tail 
-        << ", must be on diff chromosome = " << link_pair_diff_chrom << endl;
+struct ibejiRegion {
+    int32_t beg_ref;
+    int32_t beg_pos;
+    int32_t end_ref;
+    int32_t end_pos;
+    ibejiRegion(const int32_t br, const int32_t bp, const int32_t er, const int32_t ep)
+        : beg_ref(br), beg_pos(bp), end_ref(er), end_pos(ep)
+    { }
+};
 
-	while (reader.GetNextAlignment(full_al) 
-           && (! pairs_to_process || count < pairs_to_process)) {
+typedef std::vector<ibejiRegion> ibejiRegionVector;
 
-        BamAlignment al = full_al;
 
-        //printAlignmentInfo(al, refs);
-        //++count;
-        ++n_reads;
+//-------------------------------------
 
-        if (last_RefID < 0) last_RefID = al.RefID;
-        if (last_Position < 0) last_Position = al.Position;
-        if (al.RefID > last_RefID) {
-            // We've moved to the next reference sequence
-            // Clean up reads with mates expected here that haven't been seen
-            if (debug_ref_mate) {
-                cerr << "MISSED " << ref_mates.size() << " ref_mates on this reference "
-                    << last_RefID << " " << refs[last_RefID].RefName << endl;
+
+// Hands back reads saved while detecting the input order, then continues
+// with the reader.  If regions are set, only reads starting within them are
+// returned, jumping to the start of each region in turn.
+
+class bufferedReader {
+
+    public:
+        bufferedReader(BamReader& r)
+            : reader(r), region(0), in_region(false), n_jumps(0)
+        { }
+        void SetRegions(const ibejiRegionVector& r) {
+            regions = r;
+            region = 0;
+            in_region = false;
+            buffer.clear();
+        }
+        bool GetNextAlignment(BamAlignment& al) {
+            if (! buffer.empty()) {
+                al = buffer.front();
+                buffer.pop_front();
+                return true;
             }
-            for (stringMapI rmI = ref_mates.begin(); rmI != ref_mates.end(); ++rmI) {
-                ++n_reads_skipped_ref_mate;
-                read1Map.erase(read1Map.find(rmI->first));
-                ref_mates.erase(ref_mates.find(rmI->first));
+            if (regions.empty())
+                return reader.GetNextAlignment(al);
+            for ( ; region < regions.size(); ++region, in_region = false) {
+                const ibejiRegion& g = regions[region];
+                if (! in_region && ! jump(g))
+                    continue;
+                in_region = true;
+                while (reader.GetNextAlignment(al)) {
+                    if (al.RefID < 0 || al.RefID > g.end_ref
+                        || (al.RefID == g.end_ref && al.Position >= g.end_pos))
+                        break;
+                    // Jump() also returns earlier reads overlapping beg_pos
+                    if (al.RefID == g.beg_ref && al.Position < g.beg_pos)
+                        continue;
+                    return true;
+                }
             }
-            last_RefID = al.RefID;
-            last_Position = al.Position;
-        } else if (! isCoordinateSorted(al.RefID, al.Position, last_RefID, last_Position)) {
-            cerr << filename << " is not sorted, " << al.Name << " out of position" << endl;
-            return EXIT_FAILURE;
+            return false;
+        }
+    private:
+        bool jump(const ibejiRegion& g) {
+            // Jump() fails for a reference with no reads, so try the
+            // remaining references of the region in turn
+            for (int32_t ref = g.beg_ref; ref <= g.end_ref; ++ref) {
+                ++n_jumps;
+                if (reader.Jump(ref, ref == g.beg_ref ? g.beg_pos : 0))
+                    return true;
+            }
+            return false;
         }
+    public:
+        BamReader&               reader;
+        std::deque<BamAlignment> buffer;
+        ibejiRegionVector        regions;
+        size_t                   region;
+        bool                     in_region;
+        int64_t                  n_jumps;
 
-        if (! al.IsMapped()) { ++n_reads_skipped_unmapped; continue; }
+};  // class bufferedReader
 
-        if (! al.IsMateMapped()) { ++n_reads_skipped_mate_unmapped; continue; }
 
-        alignmentMapI mI = read1Map.find(al.Name);
+//-------------------------------------
 
-        if (mI == read1Map.end()) {
-            // the read name has not been seen before
 
-            if (al.MateRefID < al.RefID
-                || (al.MateRefID == al.RefID && al.MatePosition < al.Position)) {
-                // we should have seen its mate earlier, so skip it
-                ++n_reads_skipped_wont_see_mate;
+// The windows of each reference that may hold reads of link pairs, merged
+// into regions where they are separated by less than coalesce_gap.  A
+// forward read is a candidate if its tail, ref_len - pos + 1, is at most
+// the limit, and a reverse read if pos + its length is at most the limit.
+
+static ibejiRegionVector
+referenceEndRegions(const RefVector& refs, int64_t& windowed_length)
+{
+    const int32_t limit = min(opt_crit_tail, opt_total_tail);
+    ibejiRegionVector regions;
+    windowed_length = 0;
+    for (int32_t r = 0; r < int32_t(refs.size()); ++r) {
+        const int32_t len = refs[r].RefLength;
+        if (len <= 0)
+            continue;
+        int32_t win[2][2] = { { 0, min(limit, len) },
+                              { max(0, len + 1 - limit), len } };
+        if (win[1][0] < win[0][1])
+            win[1][0] = win[0][1];
+        windowed_length += (win[0][1] - win[0][0]) + (win[1][1] - win[1][0]);
+        for (int w = 0; w < 2; ++w) {
+            const int32_t beg = win[w][0], end = win[w][1];
+            if (end <= beg)
                 continue;
+            if (! regions.empty()) {
+                ibejiRegion& last = regions.back();
+                // the gap to the previous region, which may end on this
+                // reference or at the end of an earlier one
+                bool near = false;
+                if (last.end_ref == r)
+                    near = beg - last.end_pos < coalesce_gap;
+                else if (last.end_ref == r - 1)
+                    near = int64_t(refs[r - 1].RefLength) - last.end_pos + beg < coalesce_gap;
+                if (near) {
+                    last.end_ref = r;
+                    last.end_pos = end;
+                    continue;
+                }
+            }
+            regions.push_back(ibejiRegion(r, beg, r, end));
+        }
+    }
+    return regions;
+}
+
+
+//-------------------------------------
+
+
+static const char*
+orderName(const inputOrder_t o)
+{
+    switch (o) {
+        case ORDER_coordinate: return "coordinate-sorted";
+        case ORDER_name:       return "grouped by read name";
+        default:               return "of unknown order";
+    }
+}
+
+
+//-------------------------------------
+
+
+// Order declared in the header, from SO:queryname or GO:query for grouped
+// input and SO:coordinate for sorted input
+
+static inputOrder_t
+headerOrder(const SamHeader& header)
+{
+    if (header.SortOrder == "queryname" || header.GroupOrder == "query")
+        return ORDER_name;
+    if (header.SortOrder == "coordinate")
+        return ORDER_coordinate;
+    return ORDER_unknown;
+}
+
+
+//-------------------------------------
+
+
+// Order of the reads in the buffer.  The buffer is grouped if each name's
+// reads are adjacent and at least one name has more than one read.  If the
+// reads are consistent with both, coordinate order is chosen as it is always
+// safe for coordinate-sorted input.
+
+static inputOrder_t
+bufferOrder(const deque<BamAlignment>& buffer)
+{
+    bool sorted = true;
+    bool grouped = true;
+    bool any_group = false;
+    map<string, bool> finished;
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        const BamAlignment& al = buffer[i];
+        if (i > 0) {
+            const BamAlignment& prev = buffer[i - 1];
+            // unmapped reads without a position sort after all others
+            const int32_t last_ref = 0x7fffffff;
+            int32_t ref = al.RefID < 0 ? last_ref : al.RefID;
+            int32_t prev_ref = prev.RefID < 0 ? last_ref : prev.RefID;
+            if (! isCoordinateSorted(ref, al.Position, prev_ref, prev.Position))
+                sorted = false;
+            if (al.Name == prev.Name)
+                any_group = true;
+            else if (finished.count(al.Name))
+                grouped = false;
+            else
+                finished[prev.Name] = true;
+        }
+    }
+    if (sorted)
+        return ORDER_coordinate;
+    if (grouped && any_group)
+        return ORDER_name;
+    return ORDER_unknown;
+}
+
+
+//-------------------------------------
+
+
+// Counts of reads and pairs, reported at the end
+
+struct ibejiCounts {
+    int64_t n_reads;
+    int64_t n_links;
+    int64_t n_pairs_examined;
+    int64_t max_reads_held;
+    int64_t n_reads_spilled;
+    int64_t n_reads_skipped_unmapped;
+    int64_t n_reads_skipped_mate_unmapped;
+    int64_t n_reads_skipped_not_primary;
+    int64_t n_reads_skipped_wont_see_mate;
+    int64_t n_reads_skipped_mate_tail_est;
+    int64_t n_reads_skipped_ref_mate;
+    int64_t n_reads_skipped_name_collision;
+    int64_t n_reads_mate_not_in_group;
+    ibejiCounts(void)
+        : n_reads(0), n_links(0), n_pairs_examined(0), max_reads_held(0), n_reads_spilled(0),
+          n_reads_skipped_unmapped(0), n_reads_skipped_mate_unmapped(0),
+          n_reads_skipped_not_primary(0), n_reads_skipped_wont_see_mate(0),
+          n_reads_skipped_mate_tail_est(0), n_reads_skipped_ref_mate(0),
+          n_reads_skipped_name_collision(0), n_reads_mate_not_in_group(0)
+    { }
+};
+
+
+//-------------------------------------
+
+
+// Writes the reads of one class of pairs, as BAM or, if the file name ends
+// with .fq or .fastq, as FASTQ, compressed if it also ends with .gz.  BAM and
+// compressed FASTQ are compressed in a bgzfPool shared by all classes.
+
+class classWriter {
+
+    public:
+        classWriter(void) : fastq(false), fq(NULL), n_pairs(0) { }
+        ~classWriter(void) { Close(); }
+
+        bool    Open(const string& filename, const string& header_text,
+                     const RefVector& refs, bgzfPool* pool);
+        bool    Close(void);
+        bool    IsOpen(void) const { return bam.IsOpen() || gz.IsOpen() || fq; }
+        bool    WritePair(const BamAlignment& al1, const BamAlignment& al2)
+                    { ++n_pairs; return write(al1) && write(al2); }
+        int64_t Pairs(void) const { return n_pairs; }
+
+    private:
+        bool    write(const BamAlignment& al);
+        static bool endsWith(const string& s, const string& suffix)
+            { return s.size() >= suffix.size()
+                     && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0; }
+
+    private:
+        bool         fastq;
+        bamRawWriter bam;
+        bgzfWriter   gz;   // compressed FASTQ
+        FILE*        fq;   // uncompressed FASTQ
+        bamRawRecord rec;
+        string       text;
+        int64_t      n_pairs;
+
+};  // class classWriter
+
+
+//-------------------------------------
+
+
+bool
+classWriter::Open(const string& filename, const string& header_text,
+                  const RefVector& refs, bgzfPool* pool)
+{
+    string base = filename;
+    bool compressed = endsWith(base, ".gz");
+    if (compressed)
+        base.resize(base.size() - 3);
+    fastq = endsWith(base, ".fq") || endsWith(base, ".fastq");
+    if (! fastq)
+        return bam.Open(filename, header_text, refs, pool);
+    if (compressed)
+        return gz.Open(filename, pool);
+    fq = fopen(filename.c_str(), "w");
+    return fq != NULL;
+}
+
+
+//-------------------------------------
+
+
+bool
+classWriter::Close(void)
+{
+    bool ok = bam.Close();
+    ok = gz.Close() && ok;
+    if (fq) {
+        ok = (fclose(fq) == 0) && ok;
+        fq = NULL;
+    }
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+bool
+classWriter::write(const BamAlignment& al)
+{
+    if (! fastq) {
+        rec.SetFromAlignment(al);
+        return bam.Write(rec);
+    }
+    // reads are written as sequenced, so reverse-strand reads are reverse
+    // complemented
+    string seq = al.QueryBases, qual = al.Qualities;
+    if (qual.empty() || qual == "*")
+        qual.assign(seq.size(), '!');
+    if (al.IsReverseStrand()) {
+        reverse(seq.begin(), seq.end());
+        reverse(qual.begin(), qual.end());
+        for (size_t i = 0; i < seq.size(); ++i) {
+            switch (seq[i]) {
+                case 'A': seq[i] = 'T'; break;  case 'a': seq[i] = 't'; break;
+                case 'C': seq[i] = 'G'; break;  case 'c': seq[i] = 'g'; break;
+                case 'G': seq[i] = 'C'; break;  case 'g': seq[i] = 'c'; break;
+                case 'T': seq[i] = 'A'; break;  case 't': seq[i] = 'a'; break;
+                default: break;
+            }
+        }
+    }
+    text = "@" + al.Name + (al.IsFirstMate() ? "/1" : (al.IsSecondMate() ? "/2" : ""))
+           + "\n" + seq + "\n+\n" + qual + "\n";
+    if (fq)
+        return fwrite(text.data(), 1, text.size(), fq) == text.size();
+    return gz.Write(text.data(), text.size());
+}
+
+
+//-------------------------------------
+
+
+// Where pairs go: link pairs always into the edge table, and each class of
+// pair to its file if one was asked for
+
+struct ibejiOutput {
+    linkEdgeTable edges;
+    classWriter   writers[CLASS_N];
+    bool          all_pairs;  // some class needs pairs that are not link pairs
+    bool          ok;
+    ibejiOutput(void) : all_pairs(false), ok(true) { }
+    void          Write(const pairClass_t k, const BamAlignment& al1, const BamAlignment& al2)
+                      { if (writers[k].IsOpen() && ! writers[k].WritePair(al1, al2)) ok = false; }
+};
+
+
+//-------------------------------------
+
+
+// Tail of a link pair candidate, or 0 if the read is not one
+
+static int32_t
+candidateTail(const BamAlignment& al, const RefVector& refs)
+{
+    return al.IsMapped() ? checkLinkPairCandidate(al, refs, opt_crit_tail) : 0;
+}
+
+
+//-------------------------------------
+
+
+// Classify a pair, adding it to the edge table if it is a link pair and
+// writing it to the files for its classes.  al1 is the read seen first.
+
+static void
+processPair(const BamAlignment& al1, const BamAlignment& al2, const RefVector& refs,
+            ibejiOutput& out, ibejiCounts& c)
+{
+    ++c.n_pairs_examined;
+    const int32_t tail1 = candidateTail(al1, refs);
+    const int32_t tail2 = candidateTail(al2, refs);
+    if (tail1 && tail2) {
+        out.Write(CLASS_2, al1, al2);
+        if (processReadPair(al2, al1, refs, opt_total_tail, opt_crit_tail, ! opt_same_chrom)) {
+            ++c.n_links;
+            out.edges.Add(al1.RefID, tail1 < 0 ? END_start : END_end,
+                          al2.RefID, tail2 < 0 ? END_start : END_end,
+                          abs(tail1) + abs(tail2));
+            out.Write(CLASS_link, al1, al2);
+        }
+    } else if (tail1 || tail2) {
+        out.Write(CLASS_1, al1, al2);
+        const BamAlignment& other = tail1 ? al2 : al1;
+        out.Write(other.IsMapped() ? CLASS_broken : CLASS_orphan, al1, al2);
+    } else {
+        out.Write(CLASS_0, al1, al2);
+    }
+}
+
+
+//-------------------------------------
+
+
+// Spilled reads are written field by field, the strings with their lengths
+
+namespace yoruba {
+
+template <>
+struct matePayload<BamAlignment> {
+
+    static bool Write(FILE* fp, const BamAlignment& al)
+    {
+        const uint32_t n_cigar = al.CigarData.size();
+        if (! (writeString(fp, al.Name) && writeString(fp, al.QueryBases)
+               && writeString(fp, al.AlignedBases) && writeString(fp, al.Qualities)
+               && writeString(fp, al.TagData)
+               && writeInt(fp, al.Length) && writeInt(fp, al.RefID)
+               && writeInt(fp, al.Position) && writeInt(fp, al.Bin)
+               && writeInt(fp, al.MapQuality) && writeInt(fp, al.AlignmentFlag)
+               && writeInt(fp, al.MateRefID) && writeInt(fp, al.MatePosition)
+               && writeInt(fp, al.InsertSize) && writeInt(fp, n_cigar)))
+            return false;
+        for (uint32_t i = 0; i < n_cigar; ++i)
+            if (! (writeInt(fp, al.CigarData[i].Type) && writeInt(fp, al.CigarData[i].Length)))
+                return false;
+        return true;
+    }
+
+    static bool Read(FILE* fp, BamAlignment& al)
+    {
+        uint32_t n_cigar;
+        if (! (readString(fp, al.Name) && readString(fp, al.QueryBases)
+               && readString(fp, al.AlignedBases) && readString(fp, al.Qualities)
+               && readString(fp, al.TagData)
+               && readInt(fp, al.Length) && readInt(fp, al.RefID)
+               && readInt(fp, al.Position) && readInt(fp, al.Bin)
+               && readInt(fp, al.MapQuality) && readInt(fp, al.AlignmentFlag)
+               && readInt(fp, al.MateRefID) && readInt(fp, al.MatePosition)
+               && readInt(fp, al.InsertSize) && readInt(fp, n_cigar)))
+            return false;
+        al.CigarData.resize(n_cigar);
+        for (uint32_t i = 0; i < n_cigar; ++i)
+            if (! (readInt(fp, al.CigarData[i].Type) && readInt(fp, al.CigarData[i].Length)))
+                return false;
+        return true;
+    }
+
+    template <typename I>
+    static bool writeInt(FILE* fp, const I& i) { return fwrite(&i, sizeof(I), 1, fp) == 1; }
+    template <typename I>
+    static bool readInt(FILE* fp, I& i) { return fread(&i, sizeof(I), 1, fp) == 1; }
+    static bool writeString(FILE* fp, const string& str)
+    {
+        const uint32_t len = str.size();
+        return writeInt(fp, len) && (! len || fwrite(str.data(), len, 1, fp) == 1);
+    }
+    static bool readString(FILE* fp, string& str)
+    {
+        uint32_t len;
+        if (! readInt(fp, len))
+            return false;
+        str.resize(len);
+        return ! len || fread(&str[0], len, 1, fp) == 1;
+    }
+
+};
+
+}  // namespace yoruba
+
+
+//-------------------------------------
+
+
+// Hands the pairs from a matePairer to processPair, and counts the reads
+// whose mates were not seen
+
+class ibejiPairs : public matePairerHandler<BamAlignment> {
+
+    public:
+        ibejiPairs(const RefVector& r, ibejiOutput& o, ibejiCounts& cc)
+            : refs(r), out(o), c(cc)
+        { }
+
+        void Paired(const BamAlignment& held, const BamAlignment& current)
+            { processPair(held, current, refs, out, c); }
+        void Orphaned(const BamAlignment& read, const orphan_t why)
+        {
+            switch (why) {
+                case ORPHAN_expired:     ++c.n_reads_skipped_ref_mate; break;
+                case ORPHAN_mate_passed: ++c.n_reads_skipped_wont_see_mate; break;
+                case ORPHAN_collision:   ++c.n_reads_skipped_name_collision; break;
             }
+        }
+
+    private:
+        const RefVector& refs;
+        ibejiOutput&     out;
+        ibejiCounts&     c;
+
+};  // class ibejiPairs
+
+
+//-------------------------------------
+
+
+// Coordinate-sorted input: hold the first read of each pair seen until its
+// mate arrives
+
+static bool
+processCoordinateSorted(bufferedReader& reader, const RefVector& refs,
+                        ibejiOutput& out, ibejiCounts& c)
+{
+    const int32_t mate_tail_est_crit = opt_total_tail + opt_max_read_length;
+    const int32_t unplaced_RefID = 0x7fffffff;
+
+    // a held read also holds its name, bases, qualities and tags
+    ibejiPairs pairs(refs, out, c);
+    matePairer<BamAlignment> pairer(pairs, opt_max_memory * 1024 * 1024,
+                                    3 * opt_max_read_length + 128);
+
+    BamAlignment al;
+    int32_t last_RefID = -1;
+    int32_t last_Position = -1;
+    bool ok = true;
+
+    while ((opt_max_links == 0 || c.n_links < opt_max_links)
+           && (opt_reads < 0 || c.n_reads < opt_reads)
+           && reader.GetNextAlignment(al)) {
+
+        progress.Reads(++c.n_reads);
+
+        if (! al.IsPrimaryAlignment() || (al.AlignmentFlag & 0x800)) {
+            ++c.n_reads_skipped_not_primary;
+            continue;
+        }
+        if (! al.IsMapped() && ! out.all_pairs) { ++c.n_reads_skipped_unmapped; continue; }
+
+        // unmapped reads without a position sort after all others
+        const int32_t RefID = al.RefID < 0 ? unplaced_RefID : al.RefID;
+        const int32_t MateRefID = al.MateRefID < 0 ? unplaced_RefID : al.MateRefID;
+        if (last_RefID < 0) last_RefID = RefID;
+        if (last_Position < 0) last_Position = al.Position;
+        if (! isCoordinateSorted(RefID, al.Position, last_RefID, last_Position)) {
+            cerr << NAME << " input is not coordinate-sorted, " << al.Name 
+                << " out of position" << endl;
+            ok = false;
+            break;
+        }
+        if (RefID != last_RefID && debug_ref_mate) {
+            cerr << "MISSED " << pairer.Size() << " reads held at the end of reference "
+                << last_RefID << " " << refs[last_RefID].RefName << endl;
+        }
+        // reads whose mates were expected at positions we have passed are
+        // orphaned
+        pairer.Advance(RefID, al.Position);
+        last_RefID = RefID;
+        last_Position = al.Position;
+
+        if (! al.IsMateMapped() && ! out.all_pairs) {
+            ++c.n_reads_skipped_mate_unmapped;
+            continue;
+        }
 
-            // If the mate likely to also be a link pair candidate, add the read
+        if (! out.all_pairs && (MateRefID > RefID
+                                || (MateRefID == RefID && al.MatePosition > al.Position))) {
+            // the read is the first of its pair, so hold it only if the mate
+            // is likely to also be a link pair candidate
             int32_t mate_tail_est = readTailS(al.IsMateMapped(), al.IsMateReverseStrand(),
-                            al.MatePosition, refs[al.MateRefID].RefLength, max_read_length);
-            if (mate_tail_est <= mate_tail_est_crit) {
-                // the mate tail estimate suggests it might be a link pair candidate
-                read1Map[al.Name] = al;  // add the read to the map
-            } else {
+                                              al.MatePosition, refs[al.MateRefID].RefLength,
+                                              opt_max_read_length);
+            if (abs(mate_tail_est) > mate_tail_est_crit) {
                 // the mate tail estimate appears too long for the mate to be a candidate
-                ++n_reads_skipped_mate_tail_est;
+                ++c.n_reads_skipped_mate_tail_est;
                 continue;
             }
+        }
+
+        // held until its mate arrives, or processed with it if already held
+        pairer.Add(hashReadName(al.Name),
+                   RefID, al.Position, MateRefID, al.MatePosition, al);
+    }
+
+    pairer.Finish();
+    c.max_reads_held = pairer.MaxSize();
+    c.n_reads_spilled = pairer.Spilled();
+
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// Input grouped by read name: process the primary alignments of each pair as
+// the group of reads with its name ends
+
+static bool
+processNameGrouped(bufferedReader& reader, const RefVector& refs,
+                   ibejiOutput& out, ibejiCounts& c)
+{
+    // hashes of recently-finished names, to catch input that is not grouped
+    vector<uint64_t> recent(recent_names, 0);
+
+    BamAlignment al, first, second;
+    bool have_first = false, have_second = false;
+    string name;
+    uint64_t name_hash = 0;
+    bool more = true;
 
-            if (read1Map.size() > max_reads_in_map) max_reads_in_map = read1Map.size();
-            if (al.MateRefID == al.RefID && al.MatePosition >= al.Position) {
-                // the mate is expected later on this contig
-                ref_mates[al.Name] = al.MateRefID;
+    while (more) {
+
+        more = (opt_max_links == 0 || c.n_links < opt_max_links)
+               && (opt_reads < 0 || c.n_reads < opt_reads)
+               && reader.GetNextAlignment(al);
+
+        if (! more || al.Name != name) {
+            // the group for name has ended
+            if (have_first && have_second) {
+                if ((first.IsMapped() && second.IsMapped()) || out.all_pairs)
+                    processPair(first, second, refs, out, c);
+                else
+                    c.n_reads_skipped_unmapped += (first.IsMapped() ? 0 : 1)
+                                                  + (second.IsMapped() ? 0 : 1);
+            } else if (have_first || have_second) {
+                ++c.n_reads_mate_not_in_group;
+            }
+            if (name_hash)
+                recent[name_hash & (recent_names - 1)] = name_hash;
+            if (! more)
+                break;
+
+            name = al.Name;
+            name_hash = hashReadName(name);
+            if (recent[name_hash & (recent_names - 1)] == name_hash) {
+                cerr << NAME << " input is not grouped by read name, " << name 
+                    << " seen again after " << c.n_reads << " reads" << endl;
+                cerr << NAME << " group reads with 'samtools collate' or 'samtools sort -n'," 
+                    << " or use --coordinate for coordinate-sorted input" << endl;
+                return false;
             }
+            have_first = have_second = false;
+        }
+
+        progress.Reads(++c.n_reads);
 
+        if (! al.IsPrimaryAlignment() || (al.AlignmentFlag & 0x800)) {
+            ++c.n_reads_skipped_not_primary;
+            continue;
+        }
+        if (al.IsFirstMate() && ! have_first) {
+            first = al;
+            have_first = true;
+        } else if (al.IsSecondMate() && ! have_second) {
+            second = al;
+            have_second = true;
+        } else if (! al.IsPaired()) {
+            ++c.n_reads_mate_not_in_group;
         } else {
-            // get the mate's alignment, and process the pair
+            cerr << NAME << " input is not grouped by read name, more than one primary "
+                << (al.IsFirstMate() ? "first" : "second") << " mate for " << name << endl;
+            return false;
+        }
+    }
 
-            const BamAlignment& al_mate = mI->second;
+    return true;
+}
 
-            if (processReadPair(al, al_mate, refs, link_pair_total_tail, 
-                                link_pair_crit_tail, link_pair_diff_chrom)) {
-                ++count;
 
-                // write to the new BAM file, if the string is not empty
-                if (! output_bam_filename.empty()) {
-                    writer.SaveAlignment(al_mate);  // the first one seen
-                    writer.SaveAlignment(al);  // the second one seen
-                }
-            }
+//-------------------------------------
 
-            read1Map.erase(mI);
 
-            if (al.MateRefID == al.RefID) {
-                stringMapI rmI = ref_mates.find(al.Name);
-                if (rmI == ref_mates.end()) {
-                    cerr << "expected a ref_mate, couldn't find its name: " << al.Name << endl;
-                    return EXIT_FAILURE;
-                }
-                ref_mates.erase(rmI);
-            }
+int 
+yoruba::main_ibeji(int argc, char* argv[])
+{
+    //----------------- Command-line options
 
+    if( argc < 2 ) {
+        return usage();
+    }
+
+    enum { OPT_max_read_length, OPT_max_links, OPT_tail, OPT_total_tail, OPT_same_chrom,
+        OPT_name, OPT_coordinate, OPT_index, OPT_links, OPT_gfa, OPT_output,
+        OPT_class_0, OPT_class_1, OPT_class_2, OPT_orphans, OPT_broken, OPT_threads,
+        OPT_max_memory, OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_reads, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption ibeji_options[] = {
+        { OPT_max_read_length, "--max-read-length", SO_REQ_SEP },
+        { OPT_max_links,       "--max-link",        SO_REQ_SEP },
+        { OPT_max_links,       "-m",                SO_REQ_SEP },
+        { OPT_tail,            "--tail",            SO_REQ_SEP },
+        { OPT_tail,            "-t",                SO_REQ_SEP },
+        { OPT_total_tail,      "--total-tail",      SO_REQ_SEP },
+        { OPT_total_tail,      "-T",                SO_REQ_SEP },
+        { OPT_same_chrom,      "--same-chrom",      SO_NONE },
+        { OPT_same_chrom,      "-s",                SO_NONE },
+        { OPT_name,            "--name",            SO_NONE },
+        { OPT_name,            "-n",                SO_NONE },
+        { OPT_coordinate,      "--coordinate",      SO_NONE },
+        { OPT_index,           "--index",           SO_NONE },
+        { OPT_index,           "-i",                SO_NONE },
+        { OPT_links,           "--links",           SO_REQ_SEP },
+        { OPT_gfa,             "--gfa",             SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_class_0,         "--0",               SO_REQ_SEP },
+        { OPT_class_0,         "-0",                SO_REQ_SEP },
+        { OPT_class_1,         "--1",               SO_REQ_SEP },
+        { OPT_class_1,         "-1",                SO_REQ_SEP },
+        { OPT_class_2,         "--2",               SO_REQ_SEP },
+        { OPT_class_2,         "-2",                SO_REQ_SEP },
+        { OPT_orphans,         "--orphans",         SO_REQ_SEP },
+        { OPT_broken,          "--broken",          SO_REQ_SEP },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_max_memory,      "--max-memory",      SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE }, 
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, ibeji_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_max_read_length) {
+            opt_max_read_length = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_max_links) {
+            opt_max_links = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_tail) {
+            opt_crit_tail = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_total_tail) {
+            opt_total_tail = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_same_chrom) {
+            opt_same_chrom = true;
+        } else if (args.OptionId() == OPT_name) {
+            opt_order = ORDER_name;
+        } else if (args.OptionId() == OPT_coordinate) {
+            opt_order = ORDER_coordinate;
+        } else if (args.OptionId() == OPT_index) {
+            opt_index = true;
+        } else if (args.OptionId() == OPT_links) {
+            links_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_gfa) {
+            gfa_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_output) {
+            class_file[CLASS_link] = args.OptionArg();
+        } else if (args.OptionId() == OPT_class_0) {
+            class_file[CLASS_0] = args.OptionArg();
+        } else if (args.OptionId() == OPT_class_1) {
+            class_file[CLASS_1] = args.OptionArg();
+        } else if (args.OptionId() == OPT_class_2) {
+            class_file[CLASS_2] = args.OptionArg();
+        } else if (args.OptionId() == OPT_orphans) {
+            class_file[CLASS_orphan] = args.OptionArg();
+        } else if (args.OptionId() == OPT_broken) {
+            class_file[CLASS_broken] = args.OptionArg();
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+        } else if (args.OptionId() == OPT_max_memory) {
+            opt_max_memory = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "twinreads", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+    if (DEBUG(2))
+        debug_processReadPair = true;
+
+    if (args.FileCount() > 1) {
+        cerr << NAME << " requires at most one BAM file specified as input" << endl;
+        return usage();
+    } else if (args.FileCount() == 1) {
+        input_file = args.File(0);
+    } else if (input_file.empty()) {
+        input_file = "/dev/stdin";
+    }
+
+    if (links_file.empty())
+        links_file = "/dev/stdout";
+    set<string> out_files;
+    out_files.insert(links_file);
+    size_t n_out_files = 1;
+    if (! gfa_file.empty()) {
+        out_files.insert(gfa_file);
+        ++n_out_files;
+    }
+    for (int32_t k = 0; k < CLASS_N; ++k) {
+        if (! class_file[k].empty()) {
+            out_files.insert(class_file[k]);
+            ++n_out_files;
+        }
+    }
+    if (out_files.size() != n_out_files) {
+        cerr << NAME << " each output must be written to a different file" << endl;
+        return EXIT_FAILURE;
+    }
+    // classes other than link pairs and class 2 need every pair resolved
+    const bool all_pairs = ! class_file[CLASS_0].empty() || ! class_file[CLASS_1].empty()
+        || ! class_file[CLASS_orphan].empty() || ! class_file[CLASS_broken].empty();
+    if (opt_index && all_pairs) {
+        cerr << NAME << " --index reads only reference ends, so only --2 and --output" 
+            << " may be written" << endl;
+        return EXIT_FAILURE;
+    }
+
+    //----------------- Open input BAM
+
+    profile.Begin("open");
+    BamReader reader;
+    if (! reader.Open(input_file)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    const SamHeader header = reader.GetHeader();
+    const RefVector refs = reader.GetReferenceData();
+
+    if (opt_index) {
+        if (opt_order == ORDER_name) {
+            cerr << NAME << " --index requires coordinate-sorted input" << endl;
+            return EXIT_FAILURE;
+        }
+        if (! reader.LocateIndex()) {
+            cerr << NAME << " could not find the index for " << input_file 
+                << ", create one with 'samtools index'" << endl;
+            return EXIT_FAILURE;
+        }
+        opt_order = ORDER_coordinate;  // as the index implies
+    }
+
+    //----------------- Determine input order
+
+    bufferedReader breader(reader);
+    inputOrder_t order = opt_order;
+    if (order == ORDER_unknown)
+        order = headerOrder(header);
+    if (order == ORDER_unknown) {
+        BamAlignment al;
+        while (breader.buffer.size() < detect_reads && reader.GetNextAlignment(al))
+            breader.buffer.push_back(al);
+        order = bufferOrder(breader.buffer);
+        if (order == ORDER_unknown) {
+            cerr << NAME << " input is neither coordinate-sorted nor grouped by read name" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (DEBUG(1))
+        cerr << NAME << " input is " << orderName(order) << endl;
+
+    int64_t windowed_length = 0;
+    if (opt_index)
+        breader.SetRegions(referenceEndRegions(refs, windowed_length));
+
+    //----------------- Open class outputs, if any
+
+    bgzfPool pool(opt_threads);
+    ibejiOutput out;
+    out.all_pairs = all_pairs;
+    const string header_text = header.ToString();
+    for (int32_t k = 0; k < CLASS_N; ++k) {
+        if (class_file[k].empty())
+            continue;
+        if (! out.writers[k].Open(class_file[k], header_text, refs, &pool)) {
+            cerr << NAME << " could not open output " << class_file[k] << endl;
+            return EXIT_FAILURE;
         }
+    }
+
+    //----------------- Find link pairs
 
-	}
-
-	cerr << "===============================" << endl;
-    cerr << read1Map.size() << " alignments left in read1Map" << endl;
-    cerr << max_reads_in_map << " maximum number of reads in read1Map" << endl;
-    cerr << count << " pairs processed" << endl;
-	cerr << "===============================" << endl;
-    cerr << n_reads << " total reads" << endl;
-    cerr << n_singleton_reads << " singleton reads" << endl;
-    cerr << n_reads_skipped_unmapped << " reads skipped because unmapped" << endl;
-    cerr << n_reads_skipped_mate_unmapped << " reads skipped because mate unmapped" << endl;
-    cerr << n_reads_skipped_wont_see_mate << " reads skipped because mate won't be seen" << endl;
-    cerr << n_reads_skipped_mate_tail_est << " reads skipped because mate tail appears too long" << endl;
-    cerr << n_reads_skipped_ref_mate << " reads skipped because mate not on reference" << endl;
-
-	reader.Close();
-    if (! output_bam_filename.empty()) {
-	    writer.Close();
+    profile.Begin("reads");
+    progress.Input(input_file);
+    ibejiCounts c;
+    bool ok = (order == ORDER_name)
+              ? processNameGrouped(breader, refs, out, c)
+              : processCoordinateSorted(breader, refs, out, c);
+    profile.Reads(c.n_reads);
+
+    profile.Begin("close");
+    reader.Close();
+    for (int32_t k = 0; k < CLASS_N; ++k) {
+        if (! out.writers[k].Close()) {
+            cerr << NAME << " error writing " << class_file[k] << endl;
+            ok = false;
+        }
     }
-	return EXIT_SUCCESS;
+    if (! out.ok) {
+        cerr << NAME << " error writing pairs" << endl;
+        ok = false;
+    }
+
+    if (! ok)
+        return EXIT_FAILURE;
+
+    //----------------- Write the edge table
+
+    profile.Begin("links");
+    ofstream links_os(links_file.c_str());
+    if (! links_os) {
+        cerr << NAME << " could not open links output " << links_file << endl;
+        return EXIT_FAILURE;
+    }
+    out.edges.WriteTSV(links_os, refs);
+    links_os.close();
+    if (! gfa_file.empty()) {
+        ofstream gfa_os(gfa_file.c_str());
+        if (! gfa_os) {
+            cerr << NAME << " could not open GFA output " << gfa_file << endl;
+            return EXIT_FAILURE;
+        }
+        out.edges.WriteGFA(gfa_os, refs);
+    }
+
+    cerr << NAME << " " << c.n_links << " link pairs found among " 
+        << c.n_pairs_examined << " pairs examined, joining " << out.edges.Size() 
+        << " pairs of reference ends" << endl;
+    if (opt_progress || DEBUG(1)) {
+        cerr << NAME << " " << c.n_reads << " total reads, input " << orderName(order) << endl;
+        if (opt_index) {
+            int64_t total_length = 0;
+            for (size_t r = 0; r < refs.size(); ++r)
+                total_length += refs[r].RefLength;
+            cerr << NAME << " " << breader.regions.size() << " regions read with " 
+                << breader.n_jumps << " jumps, covering " << windowed_length << " of " 
+                << total_length << " bp of reference" << endl;
+        }
+        if (order == ORDER_coordinate) {
+            cerr << NAME << " " << c.max_reads_held << " maximum number of reads awaiting mates" << endl;
+            if (opt_max_memory)
+                cerr << NAME << " " << c.n_reads_spilled << " reads spilled to disk" << endl;
+        }
+        cerr << NAME << " " << c.n_reads_skipped_unmapped << " reads skipped because unmapped" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_mate_unmapped << " reads skipped because mate unmapped" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_not_primary << " reads skipped because secondary or supplementary" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_wont_see_mate << " reads skipped because mate won't be seen" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_mate_tail_est << " reads skipped because mate tail appears too long" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_ref_mate << " reads skipped because mate not found where expected" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_name_collision << " reads skipped because of a read name hash collision" << endl;
+        cerr << NAME << " " << c.n_reads_mate_not_in_group << " reads without a mate in their group" << endl;
+        for (int32_t k = 0; k < CLASS_N; ++k)
+            if (! class_file[k].empty())
+                cerr << NAME << " " << out.writers[k].Pairs() << " pairs written to " 
+                    << class_file[k] << endl;
+    }
+
+    return EXIT_SUCCESS;
 }
 
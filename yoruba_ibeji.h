@@ -1,24 +1,24 @@
-// yoruba_kojopodipo.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+// yoruba_ibeji.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
 
-#ifndef _YORUBA_KOJOPODIPO_H_
-#define _YORUBA_KOJOPODIPO_H_
+#ifndef _YORUBA_IBEJI_H_
+#define _YORUBA_IBEJI_H_
 
 // Std C/C++ includes
 #include <cstdlib>
 #include <iostream>
+#include <fstream>
 #include <iomanip>
 #include <string>
-#include <list>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <algorithm>
 
 // BamTools includes: https://github.com/pezmaster31/bamtools
 #include "api/BamReader.h"
-#include "api/BamWriter.h"
 #include "api/BamAlignment.h"
 #include "api/SamHeader.h"
-#include "api/SamReadGroup.h"
-#include "api/SamReadGroupDictionary.h"
-#include "api/SamProgram.h"
-#include "api/SamProgramChain.h"
 
 // SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
 #include "SimpleOpt.h"
@@ -26,17 +26,25 @@
 // Yoruba includes
 #include "yoruba.h"
 #include "yoruba_util.h"
+#include "ibejiAlignment.h"
+#include "processReadPair.h"
+#include "yoruba_links.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_mates.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 #ifndef _YORUBA_MAIN
-#define NAME "[yoruba_readgroup]"
+#define NAME "[yoruba_twinreads]"
 #endif
 
-// Functions defined in yoruba_kojopodipo.cpp
+// Functions defined in yoruba_ibeji.cpp
 //
 namespace yoruba {
 
-int  main_kojopodipo(int argc, char* argv[]);
+int  main_ibeji(int argc, char* argv[]);
 
 }  // namespace yoruba
 
-#endif // _YORUBA_KOJOPODIPO_H_
+#endif // _YORUBA_IBEJI_H_
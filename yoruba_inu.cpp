@@ -25,11 +25,12 @@ static int64_t      opt_reads_to_report = 10;
 static bool         opt_continue = false;
 static bool         opt_validate = false;
 static int32_t      opt_refs_to_report = 10;
+static string       metrics_file;
 #ifdef _WITH_DEBUG
 static int32_t      opt_debug = 0;
-static int32_t      debug_progress = 100000;
+static double       debug_progress = 10;
 static int64_t      opt_reads = -1;
-static int64_t      opt_progress = 0; // 100000;
+static double       opt_progress = 0;
 #endif
 static const string delim = "'";
 static const string sep = "\t";
@@ -70,13 +71,14 @@ Options: --reads-to-report INT   print this many reads [" << opt_reads_to_report
          --refs-to-report INT    print this many references [" << opt_refs_to_report << "]\n\
          --continue              continue counting reads until the end of the BAM\n\
          --validate              check validity using BamTools API; very strict\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
          -? | --help             longer help\n\
 \n";
 #ifdef _WITH_DEBUG
     cerr << "\
          --debug INT      debug info level INT [" << opt_debug << "]\n\
          --reads INT      only process INT reads [" << opt_reads << "]\n\
-         --progress INT   print reads processed mod INT [" << opt_progress << "]\n\
+         --progress SEC   report progress every SEC seconds [" << opt_progress << "]\n\
 \n";
 #endif
     cerr << "Inu is the Yoruba (Nigeria) noun for 'inside'." << endl;
@@ -98,7 +100,7 @@ yoruba::main_inu(int argc, char* argv[])
 		return usage();
 	}
 
-    enum { OPT_reads_to_report, OPT_refs_to_report, OPT_continue, OPT_validate, 
+    enum { OPT_reads_to_report, OPT_refs_to_report, OPT_continue, OPT_validate, OPT_metrics,
 #ifdef _WITH_DEBUG
         OPT_debug, OPT_reads, OPT_progress,
 #endif
@@ -109,6 +111,7 @@ yoruba::main_inu(int argc, char* argv[])
         { OPT_reads_to_report, "--reads-to-report", SO_REQ_SEP },
         { OPT_continue,        "--continue",        SO_NONE },
         { OPT_validate,        "--validate",        SO_NONE },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
         { OPT_help,            "--help",            SO_NONE },
         { OPT_help,            "-?",                SO_NONE }, 
 #ifdef _WITH_DEBUG
@@ -133,13 +136,14 @@ yoruba::main_inu(int argc, char* argv[])
             opt_refs_to_report = strtol(args.OptionArg(), NULL, 10);
         else if (args.OptionId() == OPT_continue)  opt_continue = true;
         else if (args.OptionId() == OPT_validate) opt_validate = true;
+        else if (args.OptionId() == OPT_metrics) metrics_file = args.OptionArg();
 #ifdef _WITH_DEBUG
         else if (args.OptionId() == OPT_debug) 
             opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
         else if (args.OptionId() == OPT_reads) 
             opt_reads = strtoll(args.OptionArg(), NULL, 10);
         else if (args.OptionId() == OPT_progress) 
-            opt_progress = args.OptionArg() ? strtoll(args.OptionArg(), NULL, 10) : opt_progress;
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
 #endif
         else {
             cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
@@ -149,6 +153,8 @@ yoruba::main_inu(int argc, char* argv[])
 
     if (DEBUG(1) && ! opt_progress)
         opt_progress = debug_progress;
+    if (! progress.Start(NAME, "inside", opt_progress, metrics_file))
+        return EXIT_FAILURE;
 
     if (args.FileCount() > 1) {
         cerr << NAME << " requires at most one BAM file specified as input" << endl;
@@ -161,6 +167,7 @@ yoruba::main_inu(int argc, char* argv[])
 
     //----------------- Open file, start reading data
 
+    profile.Begin("header");
 	BamReader reader;
 
 	if (! reader.Open(input_file)) {
@@ -256,6 +263,8 @@ yoruba::main_inu(int argc, char* argv[])
 
     //----------------- Reads
 
+    profile.Begin("reads");
+    progress.Input(input_file);
 	BamAlignment al;  // holds the current read from the BAM file
 
     int64_t n_reads = 0;  // number of reads processed
@@ -274,15 +283,16 @@ yoruba::main_inu(int argc, char* argv[])
             printAlignmentInfo(cout, al, refs, 99);
         }
 
-        if (opt_progress && n_reads % opt_progress == 0)
-            cerr << NAME << "[read] " << n_reads << " reads processed..." << endl;
+        progress.Reads(n_reads);
 
         if (! opt_continue && n_reads == opt_reads_to_report)
             break;
 	}
 
     cout << NAME << "[read] " << n_reads << " reads examined from the BAM file" << endl;
+    profile.Reads(n_reads);
 
+    profile.Begin("close");
 	reader.Close();
 
 	return EXIT_SUCCESS;
@@ -32,6 +32,8 @@
 // Yoruba includes
 #include "yoruba.h"
 #include "yoruba_util.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 #ifndef _YORUBA_MAIN
 #define NAME "[yoruba_inside]"
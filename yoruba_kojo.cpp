@@ -0,0 +1,212 @@
+// yoruba_kojo.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Gather the fragments of a BAM file scattered with scatter (yoruba_tuka.cpp)
+// into one BAM file.
+//
+// Kójọ is the Yoruba (Nigeria) verb for 'gather together'.
+
+// The header is that of PREFIX.header.bam, and the fragments follow it in the
+// order of the manifest (yoruba_manifest.h), their compressed blocks copied
+// as they are by bamCopyRecords() (yoruba_bamraw.h).  Every fragment must be
+// present before anything is written.
+
+#include "yoruba_kojo.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       manifest_file;
+static string       output_file;  // defaults to stdout, set with -o FILE
+static bool         opt_remove = false;
+static int32_t      opt_level = -1;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_kojo(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " gather [options] <PREFIX.manifest>" << endl;
+    cerr << "         " << YORUBA_NAME << " kojo [options] <PREFIX.manifest>" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Gather the fragments listed in <PREFIX.manifest>, written by scatter workers,\n\
+into one BAM file with the header in PREFIX.header.bam.\n\
+\n\
+Options: -o FILE | --output FILE output BAM file [default is stdout]\n\
+         --remove                remove the fragments and header file once gathered\n\
+         -l INT | --level INT    compression level of the header, -1 for zlib default [" << opt_level << "]\n\
+\n";
+    if (long_help) {
+        cerr << "\
+Every fragment must be present.  Their compressed blocks are copied as they\n\
+are, so gathering runs at about the speed of the disk.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Kojo is the Yoruba (Nigeria) verb for 'gather together'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_kojo(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_output, OPT_remove, OPT_level,
+#ifdef _WITH_DEBUG
+        OPT_debug,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption kojo_options[] = {
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_remove,          "--remove",          SO_NONE },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, kojo_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_remove) {
+            opt_remove = true;
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (args.FileCount() != 1) {
+        cerr << NAME << " requires one manifest specified as input" << endl;
+        return usage();
+    }
+    manifest_file = args.File(0);
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    //----------------- Check the fragments are all present
+
+    profile.Begin("manifest");
+    scatterManifest manifest;
+    if (! manifest.Read(manifest_file))
+        return EXIT_FAILURE;
+    int32_t n_missing = 0;
+    for (size_t i = 0; i < manifest.fragments.size(); ++i) {
+        struct stat st;
+        if (stat(manifest.fragments[i].file.c_str(), &st) != 0) {
+            cerr << NAME << " fragment " << i << ", " << manifest.fragments[i].file
+                << ", is missing" << endl;
+            ++n_missing;
+        }
+    }
+    if (n_missing) {
+        cerr << NAME << " " << n_missing << " of " << manifest.fragments.size()
+            << " fragments missing, run scatter --worker for each" << endl;
+        return EXIT_FAILURE;
+    }
+
+    //----------------- Write the header and copy the fragments
+
+    profile.Begin("copy");
+    bamRawReader header;
+    if (! header.Open(manifest.header_file)) {
+        cerr << NAME << " could not open header " << manifest.header_file << endl;
+        return EXIT_FAILURE;
+    }
+    bamRawWriter writer;
+    if (! writer.Open(output_file, header.HeaderText(), header.References(), NULL, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    header.Close();
+
+    int64_t n_copied = 0, n_recompressed = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < manifest.fragments.size(); ++i) {
+        ok = bamCopyRecords(manifest.fragments[i].file, 0, -1, writer, n_copied, n_recompressed);
+        if (DEBUG(1))
+            cerr << NAME << " fragment " << i << " copied, " << n_copied << " blocks so far" << endl;
+    }
+    profile.Begin("close");
+    if (! writer.Close() && ok) {
+        cerr << NAME << " could not write BAM output " << output_file << endl;
+        ok = false;
+    }
+    if (! ok)
+        return EXIT_FAILURE;
+
+    if (opt_remove) {
+        for (size_t i = 0; i < manifest.fragments.size(); ++i)
+            remove(manifest.fragments[i].file.c_str());
+        remove(manifest.header_file.c_str());
+    }
+
+    cerr << NAME << " " << manifest.fragments.size() << " fragment"
+        << PLURAL(manifest.fragments.size()) << " gathered, " << n_copied << " block"
+        << PLURAL(n_copied) << " copied" << endl;
+
+    return EXIT_SUCCESS;
+}
+
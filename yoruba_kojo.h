@@ -0,0 +1,37 @@
+// yoruba_kojo.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_KOJO_H_
+#define _YORUBA_KOJO_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_manifest.h"
+#include "yoruba_profile.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_gather]"
+#endif
+
+// Functions defined in yoruba_kojo.cpp
+//
+namespace yoruba {
+
+int  main_kojo(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_KOJO_H_
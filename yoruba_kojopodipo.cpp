@@ -33,11 +33,14 @@ static string       dictionary_string;
 static bool         opt_replace;
 static string       replace_string;
 static bool         opt_clear = false;
+static int64_t      opt_checkpoint = 0;  // reads between checkpoints, 0 for none
+static bool         opt_resume = false;
+static string       metrics_file;
 #ifdef _WITH_DEBUG
 static int32_t      opt_debug = 0;
-static int32_t      debug_progress = 100000;
+static double       debug_progress = 10;
 static int64_t      opt_reads = -1;
-static int64_t      opt_progress = 0; // 1000000;
+static double       opt_progress = 0;
 static int64_t      debug_reads_to_report = 1;
 #endif
 
@@ -104,12 +107,15 @@ The only argument required to specify a valid read group is --ID or --id.\n\
     cerr << "         -o FILE | --output FILE             output file name [default is stdout]" << endl;
     cerr << "         --replace STR                       replace read group STR with --ID" << endl;
     cerr << "         --clear                             clear all read group information" << endl;
+    cerr << "         --checkpoint INT                    checkpoint every INT reads, for --resume [" << opt_checkpoint << "]" << endl;
+    cerr << "         --resume                            resume from the checkpoint of -o FILE" << endl;
+    cerr << "         --metrics FILE                      write progress metrics to FILE for Prometheus" << endl;
     cerr << "         -? | --help                         longer help" << endl;
     cerr << endl;
 #ifdef _WITH_DEBUG
     cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
     cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
-    cerr << "         --progress INT  print reads processed mod INT [" << opt_progress << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
     cerr << endl;
 #endif
     if (long_help) {
@@ -129,6 +135,12 @@ The --clear option removes all read group information from all reads.  If\n\
 specified with options defining a read group, then the read group dictionary\n\
 will be cleared prior to defining the new read group.\n\
 \n\
+With --checkpoint INT, the output is written through to a block boundary every\n\
+INT reads and the place reached is saved in FILE.checkpoint.  If the command\n\
+dies, running it again with the same options plus --resume continues from the\n\
+last checkpoint, and the output is the same as if it had not been interrupted.\n\
+Both require an input file and -o FILE.\n\
+\n\
 Only one of these may be supplied at a time.  To summarizing the effects of these options:\n\
 \n\
                       Read read group (RG) tag status                        \n\
@@ -184,6 +196,7 @@ yoruba::main_kojopodipo(int argc, char* argv[])
 
     enum { OPT_ID, OPT_LB, OPT_SM, OPT_DS, OPT_DT, OPT_PG, OPT_PL, OPT_PU, OPT_PI, OPT_FO,
         OPT_KS, OPT_CN, OPT_dictionary, OPT_output, OPT_replace, OPT_clear,
+        OPT_checkpoint, OPT_resume, OPT_metrics,
 #ifdef _WITH_DEBUG
         OPT_debug, OPT_reads, OPT_progress,
 #endif
@@ -207,6 +220,9 @@ yoruba::main_kojopodipo(int argc, char* argv[])
         { OPT_dictionary,  "--dictionary", SO_REQ_SEP },
         { OPT_replace,     "--replace", SO_REQ_SEP },
         { OPT_clear,       "--clear", SO_NONE },
+        { OPT_checkpoint,  "--checkpoint", SO_REQ_SEP },
+        { OPT_resume,      "--resume", SO_NONE },
+        { OPT_metrics,     "--metrics", SO_REQ_SEP },
         { OPT_help,        "--help", SO_NONE },
         { OPT_help,        "-?", SO_NONE }, 
 #ifdef _WITH_DEBUG
@@ -258,13 +274,19 @@ yoruba::main_kojopodipo(int argc, char* argv[])
             opt_replace = true; replace_string = args.OptionArg();
         } else if (args.OptionId() == OPT_clear) {
             opt_clear = true;
+        } else if (args.OptionId() == OPT_checkpoint) {
+            opt_checkpoint = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_resume) {
+            opt_resume = true;
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
 #ifdef _WITH_DEBUG
         } else if (args.OptionId() == OPT_debug) {
             opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
         } else if (args.OptionId() == OPT_reads) {
             opt_reads = strtoll(args.OptionArg(), NULL, 10);
         } else if (args.OptionId() == OPT_progress) {
-            opt_progress = args.OptionArg() ? strtoll(args.OptionArg(), NULL, 10) : opt_progress;
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
 #endif
         } else {
             cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
@@ -274,6 +296,8 @@ yoruba::main_kojopodipo(int argc, char* argv[])
 
     if (DEBUG(1) && ! opt_progress)
         opt_progress = debug_progress;
+    if (! progress.Start(NAME, "readgroup", opt_progress, metrics_file))
+        return EXIT_FAILURE;
 
     // set up input location; if file not specified, use /dev/stdin
     IF_DEBUG(1) {
@@ -303,15 +327,24 @@ yoruba::main_kojopodipo(int argc, char* argv[])
         cerr << NAME << " use only one of --replace or --clear" << endl;
         return usage(true);
     }
+    if ((opt_checkpoint || opt_resume)
+        && (input_file == "/dev/stdin" || output_file == "/dev/stdout")) {
+        cerr << NAME << " --checkpoint and --resume require an input file and -o FILE" << endl;
+        return usage();
+    }
 
-	BamReader reader;
+    profile.Begin("open");
+
+    // records are handled raw, which lets the input be sought and the output
+    // be cut at block boundaries for checkpoints
+	bamRawReader reader;
 
 	if (! reader.Open(input_file)) {
         cerr << NAME << " could not open BAM input" << endl;
         return EXIT_FAILURE;
     }
 
-    SamHeader header = reader.GetHeader();
+    SamHeader header(reader.HeaderText());
 
     IF_DEBUG(2) { 
         if (opt_reads >= 0) 
@@ -408,69 +441,108 @@ yoruba::main_kojopodipo(int argc, char* argv[])
         header.Programs.Add(new_program);
     }
 	
-    //-------------------------------------  open output
+    //-------------------------------------  open output, or resume it
+
+    bamRawWriter writer;
+    // before any resume, so the index left at the checkpoint is continued
+    writer.IndexRecords(yviIndex::default_interval);
+    vector<pair<string, bamRawWriter*> > writers(1, make_pair(output_file, &writer));
+    const string state_file = checkpointState::Filename(output_file);
+    checkpointState state;
+    state.command = checkpointState::Command(argc, argv);
 
-    BamWriter writer;
+    int64_t n_reads = 0;  // number of reads processed
 
-    if (! writer.Open(output_file, header, reader.GetReferenceData())) {
+    if (opt_resume) {
+        checkpointState saved;
+        if (! saved.Read(state_file))
+            return EXIT_FAILURE;
+        if (saved.command != state.command) {
+            cerr << NAME << " " << state_file << " is a checkpoint of another command: "
+                << saved.command << endl;
+            return EXIT_FAILURE;
+        }
+        if (! saved.Restore(writers) || ! reader.Seek(saved.input_offset)) {
+            cerr << NAME << " could not resume from " << state_file << endl;
+            return EXIT_FAILURE;
+        }
+        n_reads = saved.Counter("n_reads");
+        cerr << NAME << " resuming after " << n_reads << " reads" << endl;
+    } else if (! writer.Open(output_file, header.ToString(), reader.References())) {
         cerr << NAME << " could not open output " << output_file << endl;
         return EXIT_FAILURE;
     }
 
-	BamAlignment al;  // holds the current read from the BAM file
-    int64_t n_reads = 0;  // number of reads processed
+	bamRawRecord r;  // holds the current read from the BAM file
 
     //-------------------------------------  loop through reads in BAM file
 
-	while (reader.GetNextAlignment(al) && (opt_reads < 0 || n_reads < opt_reads)) {
+    profile.Begin("reads");
+    progress.Input(input_file);
+	while ((opt_reads < 0 || n_reads < opt_reads) && reader.GetNextRecord(r)) {
 
         ++n_reads;
 
-        if (DEBUG(1) && n_reads <= debug_reads_to_report) {
-            cerr << NAME << " " << n_reads << " read before processing: ";
-            printAlignmentInfo(cerr, al);
-        }
-
         string RG_tag;
 
+        if (DEBUG(1) && n_reads <= debug_reads_to_report)
+            cerr << NAME << " " << n_reads << " read before processing: " << r.Name()
+                << " RG " << (r.GetTagString("RG", RG_tag) ? RG_tag : "none") << endl;
+
         if (opt_clear) {
-            al.RemoveTag("RG");
+            r.RemoveTag("RG");
         }
 
         if (opt_replace) {
 
             // only modify reads with an RG tag matching replace_string
-            if (al.GetTag("RG", RG_tag) && RG_tag == replace_string) {
-                if (! al.EditTag("RG", "Z", new_rg.ID)) {
-                    cerr << NAME << " could not edit tag for read " << al.Name << endl;
-                    return EXIT_FAILURE;
-                }
-            }
+            if (r.GetTagString("RG", RG_tag) && RG_tag == replace_string)
+                r.SetTagString("RG", new_rg.ID);
 
         } else if (! new_rg.ID.empty()) {
 
-            al.AddTag("RG", "Z", new_rg.ID);
+            // as BamAlignment::AddTag did, an existing RG is left alone
+            if (! r.FindTag("RG"))
+                r.SetTagString("RG", new_rg.ID);
 
         }
 
-        if (DEBUG(1) && n_reads <= debug_reads_to_report) {
-            cerr << NAME << " " << n_reads << " read after processing: ";
-            printAlignmentInfo(cerr, al);
+        if (DEBUG(1) && n_reads <= debug_reads_to_report)
+            cerr << NAME << " " << n_reads << " read after processing: " << r.Name()
+                << " RG " << (r.GetTagString("RG", RG_tag) ? RG_tag : "none") << endl;
+
+        if (! writer.Write(r)) {
+            cerr << NAME << " could not write to " << output_file << endl;
+            return EXIT_FAILURE;
         }
 
-        writer.SaveAlignment(al);
+        if (opt_checkpoint && n_reads % opt_checkpoint == 0) {
+            state.counters["n_reads"] = n_reads;
+            if (! state.Save(state_file, reader, writers))
+                return EXIT_FAILURE;
+        }
 
-        if ((opt_progress || DEBUG(1)) && n_reads % opt_progress == 0)
-            cerr << NAME << " " << n_reads << " reads processed..." << endl;
+        progress.Reads(n_reads);
 	}
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
 
     if (opt_progress || DEBUG(1)) 
         cerr << NAME << " " << n_reads << " reads processed" << endl;
+    profile.Reads(n_reads);
 
-	reader.Close();
-	writer.Close();
+    profile.Begin("close");
+    reader.Close();
+    if (! writer.Close()) {
+        cerr << NAME << " could not write to " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    if (opt_checkpoint || opt_resume)
+        remove(state_file.c_str());
 
-	return EXIT_SUCCESS;
+    return EXIT_SUCCESS;
 }
 
 
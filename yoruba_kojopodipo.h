@@ -26,6 +26,11 @@
 // Yoruba includes
 #include "yoruba.h"
 #include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_yvi.h"
+#include "yoruba_checkpoint.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 #ifndef _YORUBA_MAIN
 #define NAME "[yoruba_readgroup]"
@@ -0,0 +1,171 @@
+// yoruba_links.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Link pairs aggregated into the edges of a scaffolding graph.
+
+
+#include <cmath>
+#include <iomanip>
+#include <algorithm>
+
+#include "yoruba_links.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+const char*
+yoruba::refEndName(refEnd_t e)
+{
+    return e == END_start ? "start" : "end";
+}
+
+
+//-------------------------------------
+
+
+double
+linkEdge::SD(void) const
+{
+    if (n < 2) return 0.0;
+    double var = (sum_sq - sum * sum / n) / (n - 1);
+    return var > 0.0 ? sqrt(var) : 0.0;
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::Add(int32_t ref_a, refEnd_t end_a, int32_t ref_b, refEnd_t end_b,
+                   const int32_t total_tail)
+{
+    if (ref_b < ref_a || (ref_b == ref_a && end_b < end_a)) {
+        swap(ref_a, ref_b);
+        swap(end_a, end_b);
+    }
+    edges[packKey(ref_a, end_a, ref_b, end_b)].Add(total_tail);
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::Merge(const linkEdgeTable& other)
+{
+    for (edgeMap::const_iterator eI = other.edges.begin(); eI != other.edges.end(); ++eI)
+        edges[eI->first].Merge(eI->second);
+}
+
+
+//-------------------------------------
+
+
+int64_t
+linkEdgeTable::Count(void) const
+{
+    int64_t count = 0;
+    for (edgeMap::const_iterator eI = edges.begin(); eI != edges.end(); ++eI)
+        count += eI->second.n;
+    return count;
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::unpackKey(const uint64_t key, int32_t& ref_a, refEnd_t& end_a,
+                         int32_t& ref_b, refEnd_t& end_b)
+{
+    ref_a = int32_t(key >> 33);
+    end_a = refEnd_t((key >> 32) & 1);
+    ref_b = int32_t((key >> 1) & 0x7fffffff);
+    end_b = refEnd_t(key & 1);
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::orientation(const refEnd_t end_a, const refEnd_t end_b,
+                           char& orient_a, char& orient_b)
+{
+    // leaving a from its end means a is forward; entering b at its start
+    // means b is forward
+    orient_a = end_a == END_end ? '+' : '-';
+    orient_b = end_b == END_start ? '+' : '-';
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::sortedKeys(vector<uint64_t>& keys) const
+{
+    // the packed keys sort by ref a, end a, ref b, end b
+    keys.clear();
+    keys.reserve(edges.size());
+    for (edgeMap::const_iterator eI = edges.begin(); eI != edges.end(); ++eI)
+        keys.push_back(eI->first);
+    sort(keys.begin(), keys.end());
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::WriteTSV(ostream& os, const RefVector& refs) const
+{
+    const string sep = "\t";
+    os << "ref_a" << sep << "end_a" << sep << "ref_b" << sep << "end_b" << sep
+        << "orientation" << sep << "links" << sep << "mean_total_tail" << sep
+        << "sd_total_tail" << endl;
+    vector<uint64_t> keys;
+    sortedKeys(keys);
+    for (size_t k = 0; k < keys.size(); ++k) {
+        int32_t ref_a, ref_b;
+        refEnd_t end_a, end_b;
+        char orient_a, orient_b;
+        unpackKey(keys[k], ref_a, end_a, ref_b, end_b);
+        orientation(end_a, end_b, orient_a, orient_b);
+        const linkEdge& e = edges.find(keys[k])->second;
+        os << refs[ref_a].RefName << sep << refEndName(end_a) << sep
+            << refs[ref_b].RefName << sep << refEndName(end_b) << sep
+            << orient_a << orient_b << sep << e.n << sep
+            << fixed << setprecision(1) << e.Mean() << sep << e.SD() << endl;
+    }
+}
+
+
+//-------------------------------------
+
+
+void
+linkEdgeTable::WriteGFA(ostream& os, const RefVector& refs) const
+{
+    os << "H\tVN:Z:1.0" << endl;
+    for (size_t r = 0; r < refs.size(); ++r)
+        os << "S\t" << refs[r].RefName << "\t*\tLN:i:" << refs[r].RefLength << endl;
+    vector<uint64_t> keys;
+    sortedKeys(keys);
+    for (size_t k = 0; k < keys.size(); ++k) {
+        int32_t ref_a, ref_b;
+        refEnd_t end_a, end_b;
+        char orient_a, orient_b;
+        unpackKey(keys[k], ref_a, end_a, ref_b, end_b);
+        orientation(end_a, end_b, orient_a, orient_b);
+        const linkEdge& e = edges.find(keys[k])->second;
+        os << "L\t" << refs[ref_a].RefName << "\t" << orient_a
+            << "\t" << refs[ref_b].RefName << "\t" << orient_b << "\t*"
+            << "\tRC:i:" << e.n << "\tTT:f:" << fixed << setprecision(1) << e.Mean()
+            << endl;
+    }
+}
@@ -0,0 +1,102 @@
+// yoruba_links.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_links.cpp
+//
+// Link pairs aggregated into the edges of a scaffolding graph.  An edge joins
+// one end of a reference sequence to one end of another, and carries the
+// number of link pairs supporting it and the mean and standard deviation of
+// their total tails.
+
+#ifndef _YORUBA_LINKS_H_
+#define _YORUBA_LINKS_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <tr1/unordered_map>
+
+// BamTools includes: https://github.com/pezmaster31/bamtools
+#include "api/BamAux.h"
+
+namespace yoruba {
+
+// The end of a reference sequence a read points off: a reverse read points
+// off the start, a forward read off the end
+
+enum refEnd_t { END_start = 0, END_end = 1 };
+
+const char* refEndName(refEnd_t e);
+
+
+//-------------------------------------
+
+
+// Statistics for one edge
+
+struct linkEdge {
+    int64_t n;
+    double  sum;     // of total tails
+    double  sum_sq;
+    linkEdge(void) : n(0), sum(0.0), sum_sq(0.0) { }
+    void    Add(const int32_t total_tail)
+                { ++n; sum += total_tail; sum_sq += double(total_tail) * total_tail; }
+    void    Merge(const linkEdge& other)
+                { n += other.n; sum += other.sum; sum_sq += other.sum_sq; }
+    double  Mean(void) const { return n ? sum / n : 0.0; }
+    double  SD(void) const;
+};
+
+
+//-------------------------------------
+
+
+// Edges keyed by (ref a, end a, ref b, end b), stored with the lesser
+// (ref, end) first so both reads of a pair, in either order, give the same
+// edge.  The orientation of the join follows from the ends: joining the end
+// of a to the start of b places both forward (++), joining two ends places b
+// reversed (+-), and so on.  Tables can be merged, so each thread can keep its
+// own and combine them at the end.
+
+class linkEdgeTable {
+
+    public:
+        linkEdgeTable(void) { }
+
+        void    Add(int32_t ref_a, refEnd_t end_a, int32_t ref_b, refEnd_t end_b,
+                    const int32_t total_tail);
+        void    Merge(const linkEdgeTable& other);
+
+        int64_t Size(void) const { return edges.size(); }
+        int64_t Count(void) const;
+
+        // tab-separated table, one line per edge, sorted by reference
+        void    WriteTSV(std::ostream& os, const BamTools::RefVector& refs) const;
+        // GFA 1.0, a segment per reference and a link per edge, with the
+        // link count in tag RC and the mean total tail in tag TT
+        void    WriteGFA(std::ostream& os, const BamTools::RefVector& refs) const;
+
+    private:
+        static uint64_t packKey(const int32_t ref_a, const refEnd_t end_a,
+                                const int32_t ref_b, const refEnd_t end_b)
+            { return (uint64_t(ref_a) << 33) | (uint64_t(end_a) << 32)
+                     | (uint64_t(ref_b) << 1) | uint64_t(end_b); }
+        static void     unpackKey(const uint64_t key, int32_t& ref_a, refEnd_t& end_a,
+                                  int32_t& ref_b, refEnd_t& end_b);
+        // orientation of a and b in the join, '+' or '-'
+        static void     orientation(const refEnd_t end_a, const refEnd_t end_b,
+                                    char& orient_a, char& orient_b);
+        void            sortedKeys(std::vector<uint64_t>& keys) const;
+
+    private:
+        typedef std::tr1::unordered_map<uint64_t, linkEdge> edgeMap;
+        edgeMap edges;
+
+};  // class linkEdgeTable
+
+}  // namespace yoruba
+
+#endif // _YORUBA_LINKS_H_
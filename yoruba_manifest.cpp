@@ -0,0 +1,91 @@
+// yoruba_manifest.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// The manifest of a scattered BAM file, see yoruba_manifest.h.
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "yoruba_manifest.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+bool
+scatterManifest::Write(const string& filename) const
+{
+    ofstream out(filename.c_str());
+    if (! out)
+        return false;
+    out << "# yoruba scatter manifest" << endl;
+    out << "input\t" << input << endl;
+    out << "operation\t" << operation;
+    if (! argument.empty())
+        out << "\t" << argument;
+    out << endl;
+    out << "header\t" << header_file << endl;
+    for (size_t i = 0; i < fragments.size(); ++i)
+        out << "fragment\t" << i << "\t" << fragments[i].beg << "\t" << fragments[i].end
+            << "\t" << fragments[i].file << endl;
+    out.close();
+    return ! out.fail();
+}
+
+
+//-------------------------------------
+
+
+bool
+scatterManifest::Read(const string& filename)
+{
+    ifstream in(filename.c_str());
+    if (! in) {
+        cerr << "scatterManifest: could not open " << filename << endl;
+        return false;
+    }
+    fragments.clear();
+    string line;
+    int64_t n_line = 0;
+    while (getline(in, line)) {
+        ++n_line;
+        if (line.empty() || line[0] == '#')
+            continue;
+        vector<string> fields;
+        istringstream ls(line);
+        string f;
+        while (getline(ls, f, '\t'))
+            fields.push_back(f);
+        bool ok = true;
+        if (fields[0] == "input" && fields.size() == 2) {
+            input = fields[1];
+        } else if (fields[0] == "operation" && (fields.size() == 2 || fields.size() == 3)) {
+            operation = fields[1];
+            argument = fields.size() == 3 ? fields[2] : string();
+        } else if (fields[0] == "header" && fields.size() == 2) {
+            header_file = fields[1];
+        } else if (fields[0] == "fragment" && fields.size() == 5) {
+            char* e1; char* e2; char* e3;
+            const long i = strtol(fields[1].c_str(), &e1, 10);
+            const int64_t beg = strtoll(fields[2].c_str(), &e2, 10);
+            const int64_t end = strtoll(fields[3].c_str(), &e3, 10);
+            ok = ! *e1 && ! *e2 && ! *e3 && i == long(fragments.size());
+            fragments.push_back(scatterFragment(beg, end, fields[4]));
+        } else {
+            ok = false;
+        }
+        if (! ok) {
+            cerr << "scatterManifest: " << filename << " line " << n_line << " is malformed" << endl;
+            return false;
+        }
+    }
+    if (input.empty() || operation.empty() || header_file.empty() || fragments.empty()) {
+        cerr << "scatterManifest: " << filename << " is incomplete" << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+// yoruba_manifest.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_manifest.cpp
+//
+// The manifest of a BAM file scattered for processing in pieces, written by
+// scatter, read by its workers and by gather.  It is a text file naming the
+// input, the operation applied to its records, a header-only BAM file with
+// the header of the result, and for each fragment the part of the input
+// [beg, end) it covers, in virtual offsets at record boundaries, end -1 for
+// the end of the file, and the headerless BGZF file its records go to:
+//
+//     # yoruba scatter manifest
+//     input       in.bam
+//     operation   readgroup   lane1
+//     header      out.header.bam
+//     fragment    0   4259840         1309741219840   out.0000.frag
+//     fragment    1   1309741219840   -1              out.0001.frag
+//
+// with fields separated by single tabs.
+
+#ifndef _YORUBA_MANIFEST_H_
+#define _YORUBA_MANIFEST_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace yoruba {
+
+struct scatterFragment {
+    int64_t     beg;
+    int64_t     end;
+    std::string file;
+    scatterFragment(const int64_t b = 0, const int64_t e = -1, const std::string& f = "")
+        : beg(b), end(e), file(f) { }
+};
+
+
+//-------------------------------------
+
+
+class scatterManifest {
+
+    public:
+        scatterManifest(void) { }
+
+        bool    Write(const std::string& filename) const;
+        // false with a message to cerr if filename is missing or malformed
+        bool    Read(const std::string& filename);
+
+    public:
+        std::string                  input;
+        std::string                  operation;  // copy, readgroup or forget
+        std::string                  argument;   // read group ID, for readgroup
+        std::string                  header_file;
+        std::vector<scatterFragment> fragments;
+
+};  // class scatterManifest
+
+}  // namespace yoruba
+
+#endif // _YORUBA_MANIFEST_H_
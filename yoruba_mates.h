@@ -0,0 +1,664 @@
+// yoruba_mates.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Pairing the reads of a coordinate-sorted BAM with their mates.
+//
+// pendingMateTable holds reads waiting for their mates.  Reads are keyed by
+// the hash of the read name (hashReadName() in yoruba_util.h) and held as small
+// packed records in an open-addressing table, so there are no per-entry
+// allocations and no read name strings.  An expiry queue ordered by the
+// position at which each mate is expected lets entries be dropped as soon as
+// the input has passed that position without seeing it.
+//
+// matePairer builds on it the whole job of pairing reads as they are read:
+// it holds the first read of each template seen, hands both reads to a
+// handler when the second arrives, and hands over reads whose mates did not
+// appear where expected.  Under a memory cap, held reads whose mates are on a
+// later reference are spilled to a temporary file, and read back when the
+// input reaches that reference.
+//
+// T and Payload are the packed records held, and must be copyable and
+// default-constructible.
+
+#ifndef _YORUBA_MATES_H_
+#define _YORUBA_MATES_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <stdint.h>
+
+// Yoruba includes
+#include "yoruba_memtrack.h"
+
+namespace yoruba {
+
+template <typename T>
+class pendingMateTable {
+
+    public:
+        pendingMateTable(void)
+            : slots(min_capacity), mask(min_capacity - 1), n(0), max_n(0), max_bytes(0)
+        { }
+
+        // add an entry for key whose mate is expected at mate_position,
+        // replacing any entry already present for key
+        void     Add(const uint64_t key, const int64_t mate_position, const T& value);
+        // the entry for key, or NULL
+        T*       Find(const uint64_t key);
+        // remove the entry for key, returns false if it is not present
+        bool     Remove(const uint64_t key);
+        // remove entries whose mates were expected before position, returns
+        // the number removed; if expired is given, the entries are appended
+        int64_t  ExpireBefore(const int64_t position, std::vector<T>* expired = NULL);
+        // remove all entries, for example at the end of a reference, returns
+        // the number removed
+        int64_t  ExpireAll(std::vector<T>* expired = NULL);
+        // remove entries whose mates are expected at or after position,
+        // appending them with their keys to removed
+        int64_t  RemoveFrom(const int64_t position,
+                            std::vector<std::pair<uint64_t, T> >& removed);
+
+        int64_t  Size(void) const { return n; }
+        int64_t  MaxSize(void) const { return max_n; }
+        // bytes held by the table and the expiry queue, now and at most
+        int64_t  Bytes(void) const
+            { return slots.capacity() * sizeof(slot) + expiry.capacity() * sizeof(expiry_t); }
+        int64_t  MaxBytes(void) const { return max_bytes; }
+        // bytes for each entry, for converting a memory cap to a size
+        static size_t EntryBytes(void) { return sizeof(slot) + sizeof(expiry_t); }
+
+    private:
+        struct slot {
+            uint64_t key;      // 0 if empty
+            int64_t  expires;  // the mate position, to recognise stale queue entries
+            T        value;
+            slot(void) : key(0), expires(0) { }
+        };
+        typedef std::pair<int64_t, uint64_t> expiry_t;  // (mate position, key)
+
+        static const size_t min_capacity = 1024;  // a power of 2
+
+        size_t   findSlot(const uint64_t key) const;
+        void     eraseSlot(size_t i);
+        void     grow(void);
+        // remove the entry for an expiry queue entry, if it is not stale
+        bool     expire(const expiry_t& e, std::vector<T>* expired);
+
+    private:
+        std::vector<slot>     slots;
+        size_t                mask;
+        int64_t               n;
+        int64_t               max_n;
+        int64_t               max_bytes;
+        std::vector<expiry_t> expiry;  // min-heap on mate position
+
+};  // class pendingMateTable
+
+
+//-------------------------------------
+
+
+template <typename T>
+size_t
+pendingMateTable<T>::findSlot(const uint64_t key) const
+{
+    // linear probing; the table is never full so an empty slot ends the search
+    size_t i = key & mask;
+    while (slots[i].key && slots[i].key != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+void
+pendingMateTable<T>::Add(const uint64_t key, const int64_t mate_position, const T& value)
+{
+    if (size_t(n + 1) * 10 > slots.size() * 7)
+        grow();
+    size_t i = findSlot(key);
+    if (! slots[i].key)
+        ++n;
+    slots[i].key = key;
+    slots[i].expires = mate_position;
+    slots[i].value = value;
+    expiry.push_back(expiry_t(mate_position, key));
+    std::push_heap(expiry.begin(), expiry.end(), std::greater<expiry_t>());
+    if (n > max_n) max_n = n;
+    if (Bytes() > max_bytes) max_bytes = Bytes();
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+T*
+pendingMateTable<T>::Find(const uint64_t key)
+{
+    size_t i = findSlot(key);
+    return slots[i].key ? &slots[i].value : NULL;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+bool
+pendingMateTable<T>::Remove(const uint64_t key)
+{
+    // the expiry queue entry is left behind, and ignored when it comes due
+    size_t i = findSlot(key);
+    if (! slots[i].key)
+        return false;
+    eraseSlot(i);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+void
+pendingMateTable<T>::eraseSlot(size_t i)
+{
+    // backward-shift deletion, so no tombstones accumulate
+    size_t j = i;
+    while (true) {
+        j = (j + 1) & mask;
+        if (! slots[j].key)
+            break;
+        size_t home = slots[j].key & mask;
+        // move slot j into the hole at i unless its home lies in (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+    slots[i].key = 0;
+    --n;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+bool
+pendingMateTable<T>::expire(const expiry_t& e, std::vector<T>* expired)
+{
+    // a queue entry is stale if its key was removed, or was removed and
+    // added again with another mate position
+    size_t i = findSlot(e.second);
+    if (! slots[i].key || slots[i].expires != e.first)
+        return false;
+    if (expired)
+        expired->push_back(slots[i].value);
+    eraseSlot(i);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+int64_t
+pendingMateTable<T>::ExpireBefore(const int64_t position, std::vector<T>* expired)
+{
+    int64_t removed = 0;
+    while (! expiry.empty() && expiry.front().first < position) {
+        if (expire(expiry.front(), expired))
+            ++removed;
+        std::pop_heap(expiry.begin(), expiry.end(), std::greater<expiry_t>());
+        expiry.pop_back();
+    }
+    return removed;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+int64_t
+pendingMateTable<T>::ExpireAll(std::vector<T>* expired)
+{
+    // walk the queue rather than the table, so this costs the number of
+    // entries rather than the table capacity
+    int64_t removed = 0;
+    for (size_t e = 0; e < expiry.size(); ++e)
+        if (expire(expiry[e], expired))
+            ++removed;
+    expiry.clear();
+    return removed;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+int64_t
+pendingMateTable<T>::RemoveFrom(const int64_t position,
+                                std::vector<std::pair<uint64_t, T> >& removed)
+{
+    int64_t n_removed = 0;
+    size_t keep = 0;
+    for (size_t e = 0; e < expiry.size(); ++e) {
+        if (expiry[e].first < position) {
+            expiry[keep++] = expiry[e];
+            continue;
+        }
+        size_t i = findSlot(expiry[e].second);
+        if (slots[i].key && slots[i].expires == expiry[e].first) {
+            removed.push_back(std::make_pair(slots[i].key, slots[i].value));
+            eraseSlot(i);
+            ++n_removed;
+        }
+    }
+    expiry.resize(keep);
+    std::make_heap(expiry.begin(), expiry.end(), std::greater<expiry_t>());
+    return n_removed;
+}
+
+
+//-------------------------------------
+
+
+template <typename T>
+void
+pendingMateTable<T>::grow(void)
+{
+    std::vector<slot> old;
+    old.swap(slots);
+    slots.resize(old.size() * 2);
+    mask = slots.size() - 1;
+    for (size_t i = 0; i < old.size(); ++i)
+        if (old[i].key)
+            slots[findSlot(old[i].key)] = old[i];
+}
+
+
+//-------------------------------------
+
+
+// How a payload is written to and read from a matePairer spill file.  The
+// default copies its bytes, which is right for plain structs; payloads that
+// hold pointers or strings need a specialization.
+
+template <typename Payload>
+struct matePayload {
+    static bool Write(FILE* fp, const Payload& p)
+        { return fwrite(&p, sizeof(Payload), 1, fp) == 1; }
+    static bool Read(FILE* fp, Payload& p)
+        { return fread(&p, sizeof(Payload), 1, fp) == 1; }
+};
+
+
+//-------------------------------------
+
+
+// Why a read was handed to matePairerHandler::Orphaned()
+
+enum orphan_t {
+    ORPHAN_expired,      // the input passed its mate's position without the mate
+    ORPHAN_mate_passed,  // its mate was expected before it, but was not held
+    ORPHAN_collision     // another held read has the same name hash
+};
+
+
+//-------------------------------------
+
+
+// The callbacks of a matePairer.  held is the read of the template seen
+// first, current the read that completed it.
+
+template <typename Payload>
+class matePairerHandler {
+
+    public:
+        virtual ~matePairerHandler(void) { }
+        // both reads of a template on the same reference
+        virtual void Paired(const Payload& held, const Payload& current) = 0;
+        // both reads of a template, on different references
+        virtual void CrossReference(const Payload& held, const Payload& current)
+            { Paired(held, current); }
+        // a read whose mate will not be seen
+        virtual void Orphaned(const Payload& read, const orphan_t why) { }
+
+};  // class matePairerHandler
+
+
+//-------------------------------------
+
+
+// Pairs the reads of a coordinate-sorted BAM.  For each read whose mate is
+// mapped, call Add() with the hash of its name, its coordinates and its
+// mate's; for other reads Advance() may be called so that held reads are
+// expired as early as possible.  Call Finish() at the end of the input, or
+// of each region read, to orphan reads still held.
+//
+// If max_bytes > 0, held reads beyond that many bytes that have mates on a
+// later reference are spilled to a temporary file in runs sorted by mate
+// coordinate, and read back when the input reaches that reference.  Payloads
+// holding strings should give an estimate of their heap bytes in
+// payload_bytes, so the cap counts them.
+
+template <typename Payload>
+class matePairer {
+
+    public:
+        matePairer(matePairerHandler<Payload>& h, const int64_t max_bytes = 0,
+                   const size_t payload_bytes = 0);
+        ~matePairer(void) { if (spill_fp) fclose(spill_fp); }
+
+        void     Add(const uint64_t key, const int32_t ref, const int32_t pos,
+                     const int32_t mate_ref, const int32_t mate_pos, const Payload& p);
+        void     Advance(const int32_t ref, const int32_t pos);
+        void     Finish(void);
+
+        int64_t  Size(void) const { return table.Size(); }
+        int64_t  MaxSize(void) const { return table.MaxSize(); }
+        int64_t  Bytes(void) const { return table.Bytes(); }
+        int64_t  MaxBytes(void) const { return table.MaxBytes(); }
+        int64_t  Spilled(void) const { return n_spilled; }
+        bool     Error(void) const { return error; }
+
+    private:
+        struct held {
+            int32_t ref, pos;            // of this read
+            int32_t mate_ref, mate_pos;  // where its mate is expected
+            Payload payload;
+        };
+        struct spillRun {
+            int64_t  offset;     // of the next record in spill_fp
+            int64_t  remaining;  // records after the next
+            bool     has_next;
+            uint64_t next_key;
+            held     next;
+        };
+        typedef std::pair<uint64_t, held> keyed_t;
+
+        static int64_t coordinate(const int32_t ref, const int32_t pos)
+            { return (int64_t(ref) << 32) | uint32_t(pos); }
+        static bool    byMate(const keyed_t& a, const keyed_t& b)
+            { return coordinate(a.second.mate_ref, a.second.mate_pos)
+                     < coordinate(b.second.mate_ref, b.second.mate_pos); }
+
+        void     orphanExpired(void);
+        void     spill(void);
+        bool     writeRecord(const uint64_t key, const held& h);
+        bool     readRecord(spillRun& run);
+        void     unspill(void);
+
+    private:
+        matePairerHandler<Payload>& handler;
+        pendingMateTable<held>      table;
+        std::vector<held>           expired;   // scratch, for orphaning
+        std::vector<keyed_t>        removed;   // scratch, for spilling
+        int32_t                     cur_ref;
+        int32_t                     cur_pos;
+        int64_t                     max_size;  // held reads before spilling, 0 never
+        int64_t                     spill_at;
+        FILE*                       spill_fp;
+        std::vector<spillRun>       runs;
+        int64_t                     n_spilled;
+        bool                        error;
+
+    private:  // not copyable
+        matePairer(const matePairer&);
+        matePairer& operator=(const matePairer&);
+
+};  // class matePairer
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+matePairer<Payload>::matePairer(matePairerHandler<Payload>& h, const int64_t max_bytes,
+                                const size_t payload_bytes)
+    : handler(h), cur_ref(-1), cur_pos(-1),
+      max_size(max_bytes / int64_t(pendingMateTable<held>::EntryBytes() + payload_bytes)),
+      spill_at(max_size),
+      spill_fp(NULL), n_spilled(0), error(false)
+{ }
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+void
+matePairer<Payload>::orphanExpired(void)
+{
+    for (size_t i = 0; i < expired.size(); ++i)
+        handler.Orphaned(expired[i].payload, ORPHAN_expired);
+    expired.clear();
+}
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+void
+matePairer<Payload>::Advance(const int32_t ref, const int32_t pos)
+{
+    if (ref == cur_ref && pos == cur_pos)
+        return;
+    const bool new_ref = ref != cur_ref;
+    cur_ref = ref;
+    cur_pos = pos;
+    table.ExpireBefore(coordinate(ref, pos), &expired);
+    orphanExpired();
+    if (new_ref && ! runs.empty())
+        unspill();
+}
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+void
+matePairer<Payload>::Add(const uint64_t key, const int32_t ref, const int32_t pos,
+                         const int32_t mate_ref, const int32_t mate_pos, const Payload& p)
+{
+    Advance(ref, pos);
+
+    held* h = table.Find(key);
+    if (h) {
+        if (h->mate_ref == ref && h->mate_pos == pos && h->ref == mate_ref && h->pos == mate_pos) {
+            if (ref == mate_ref)
+                handler.Paired(h->payload, p);
+            else
+                handler.CrossReference(h->payload, p);
+            table.Remove(key);
+        } else {
+            handler.Orphaned(p, ORPHAN_collision);
+        }
+        return;
+    }
+
+    if (coordinate(mate_ref, mate_pos) < coordinate(ref, pos)) {
+        handler.Orphaned(p, ORPHAN_mate_passed);
+        return;
+    }
+
+    MEM_TAG(MEM_mates);
+    held n;
+    n.ref = ref;
+    n.pos = pos;
+    n.mate_ref = mate_ref;
+    n.mate_pos = mate_pos;
+    n.payload = p;
+    table.Add(key, coordinate(mate_ref, mate_pos), n);
+
+    if (max_size && table.Size() > spill_at)
+        spill();
+}
+
+
+//-------------------------------------
+
+
+// Write held reads with mates on later references to a new run.  If that
+// leaves the table above half the cap, wait until it has doubled before
+// trying again, so reads held for this reference are not rescanned for
+// every read added.
+
+template <typename Payload>
+void
+matePairer<Payload>::spill(void)
+{
+    if (! spill_fp && ! error && ! (spill_fp = tmpfile())) {
+        std::cerr << "matePairer: could not create spill file, continuing in memory" << std::endl;
+        error = true;
+    }
+    if (error) {
+        max_size = 0;
+        return;
+    }
+    table.RemoveFrom(coordinate(cur_ref + 1, 0), removed);
+    if (! removed.empty()) {
+        std::sort(removed.begin(), removed.end(), byMate);
+        spillRun run;
+        fseeko(spill_fp, 0, SEEK_END);
+        run.offset = ftello(spill_fp);
+        for (size_t i = 0; i < removed.size() && ! error; ++i)
+            if (! writeRecord(removed[i].first, removed[i].second))
+                error = true;
+        if (error) {
+            std::cerr << "matePairer: could not write spill file" << std::endl;
+            // keep them in memory instead
+            for (size_t i = 0; i < removed.size(); ++i) {
+                const held& r = removed[i].second;
+                table.Add(removed[i].first, coordinate(r.mate_ref, r.mate_pos), r);
+            }
+            max_size = 0;
+        } else {
+            run.remaining = removed.size();
+            run.has_next = false;
+            runs.push_back(run);
+            n_spilled += removed.size();
+        }
+        removed.clear();
+    }
+    spill_at = std::max(max_size, 2 * table.Size());
+}
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+bool
+matePairer<Payload>::writeRecord(const uint64_t key, const held& h)
+{
+    return fwrite(&key, sizeof(uint64_t), 1, spill_fp) == 1
+        && fwrite(&h.ref, sizeof(int32_t), 1, spill_fp) == 1
+        && fwrite(&h.pos, sizeof(int32_t), 1, spill_fp) == 1
+        && fwrite(&h.mate_ref, sizeof(int32_t), 1, spill_fp) == 1
+        && fwrite(&h.mate_pos, sizeof(int32_t), 1, spill_fp) == 1
+        && matePayload<Payload>::Write(spill_fp, h.payload);
+}
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+bool
+matePairer<Payload>::readRecord(spillRun& run)
+{
+    if (! run.remaining)
+        return run.has_next = false;
+    held& h = run.next;
+    if (fseeko(spill_fp, run.offset, SEEK_SET) != 0
+        || fread(&run.next_key, sizeof(uint64_t), 1, spill_fp) != 1
+        || fread(&h.ref, sizeof(int32_t), 1, spill_fp) != 1
+        || fread(&h.pos, sizeof(int32_t), 1, spill_fp) != 1
+        || fread(&h.mate_ref, sizeof(int32_t), 1, spill_fp) != 1
+        || fread(&h.mate_pos, sizeof(int32_t), 1, spill_fp) != 1
+        || ! matePayload<Payload>::Read(spill_fp, h.payload)) {
+        std::cerr << "matePairer: could not read spill file" << std::endl;
+        error = true;
+        run.remaining = 0;
+        return run.has_next = false;
+    }
+    run.offset = ftello(spill_fp);
+    --run.remaining;
+    return run.has_next = true;
+}
+
+
+//-------------------------------------
+
+
+// The input has reached a new reference: bring back the spilled reads with
+// mates on it, and orphan those with mates on references it has passed
+
+template <typename Payload>
+void
+matePairer<Payload>::unspill(void)
+{
+    MEM_TAG(MEM_mates);
+    size_t keep = 0;
+    for (size_t r = 0; r < runs.size(); ++r) {
+        spillRun& run = runs[r];
+        while ((run.has_next || readRecord(run)) && run.next.mate_ref <= cur_ref) {
+            if (coordinate(run.next.mate_ref, run.next.mate_pos) < coordinate(cur_ref, cur_pos))
+                handler.Orphaned(run.next.payload, ORPHAN_expired);
+            else
+                table.Add(run.next_key, coordinate(run.next.mate_ref, run.next.mate_pos), run.next);
+            run.has_next = false;
+        }
+        if (run.has_next || run.remaining)
+            runs[keep++] = run;
+    }
+    runs.resize(keep);
+    spill_at = std::max(max_size, 2 * table.Size());
+}
+
+
+//-------------------------------------
+
+
+template <typename Payload>
+void
+matePairer<Payload>::Finish(void)
+{
+    table.ExpireAll(&expired);
+    orphanExpired();
+    for (size_t r = 0; r < runs.size(); ++r) {
+        spillRun& run = runs[r];
+        while (run.has_next || readRecord(run)) {
+            handler.Orphaned(run.next.payload, ORPHAN_expired);
+            run.has_next = false;
+        }
+    }
+    runs.clear();
+    if (spill_fp) {
+        fclose(spill_fp);
+        spill_fp = NULL;
+    }
+    cur_ref = cur_pos = -1;
+    spill_at = max_size;
+}
+
+}  // namespace yoruba
+
+#endif // _YORUBA_MATES_H_
@@ -0,0 +1,43 @@
+// yoruba_memtrack.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Heap usage by subsystem, see yoruba_memtrack.h.
+
+
+#include "yoruba_memtrack.h"
+
+#ifdef _WITH_MEMTRACK
+
+#include <iostream>
+
+using namespace std;
+using namespace yoruba;
+
+static const char* tag_names[MEM_N] = {
+    "other", "dupMap", "positions", "mates", "header", "reader", "writer"
+};
+
+// allocation counts at the end of the last phase
+static size_t last_allocs[MEM_N];
+
+
+//-------------------------------------
+
+
+void
+yoruba::memTrackReport(const string& phase)
+{
+    for (int t = 0; t < MEM_N; ++t) {
+        size_t live, peak, allocs;
+        MemTrack::TrackTagUsage(t, live, peak, allocs);
+        const size_t n = allocs - last_allocs[t];
+        last_allocs[t] = allocs;
+        if (! peak && ! n)
+            continue;
+        cerr << "[yoruba_memory][" << phase << "] " << tag_names[t] << " "
+            << live << " bytes live, " << peak << " peak, "
+            << n << " allocations" << endl;
+    }
+    MemTrack::TrackResetPeaks();
+}
+
+#endif // _WITH_MEMTRACK
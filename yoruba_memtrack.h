@@ -0,0 +1,77 @@
+// yoruba_memtrack.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_memtrack.cpp
+//
+// Where a command's heap goes, by subsystem, for builds made with
+// 'make MEMTRACK=1'.  That links in MemTrack.cpp, whose operator new and
+// delete charge every block to the tag current in the allocating thread.  A
+// scope that allocates for one subsystem declares
+//
+//     MEM_TAG(MEM_dupMap);
+//
+// and every allocation until the end of the scope is charged to dupMap,
+// including those made inside the standard containers.  At the end of each
+// phase (yoruba_profile.h) one line per tag goes to stderr with its live
+// bytes, the peak reached during the phase and the allocations made in it:
+//
+//     [yoruba_memory][pass1] dupMap 48211920 bytes live, 48211920 peak, 801236 allocations
+//
+// Memory obtained with malloc(), as by zlib and the BGZF block buffers, is
+// not seen.  In an ordinary build MEM_TAG() is empty and nothing is counted.
+
+#ifndef _YORUBA_MEMTRACK_H_
+#define _YORUBA_MEMTRACK_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+
+#ifdef _WITH_MEMTRACK
+#define MEMTRACK_NO_NEW_MACRO
+#include "MemTrack.h"
+#endif
+
+namespace yoruba {
+
+enum memTag_t {
+    MEM_other = 0,   // anything not tagged
+    MEM_dupMap,      // names of duplicate reads kept between passes
+    MEM_positions,   // reads held while those at one position are compared
+    MEM_mates,       // reads held waiting for their mates
+    MEM_header,      // SAM header and reference data
+    MEM_reader,      // records being read
+    MEM_writer,      // records and blocks being written
+    MEM_N
+};
+
+#ifdef _WITH_MEMTRACK
+
+// charge allocations to tag until the end of the scope
+
+class memTagScope {
+
+    public:
+        memTagScope(const memTag_t tag) : previous(MemTrack::TrackSetTag(tag)) { }
+        ~memTagScope(void) { MemTrack::TrackSetTag(previous); }
+
+    private:
+        int previous;
+
+};  // class memTagScope
+
+#define MEM_TAG(__tag) yoruba::memTagScope mem_tag_scope_(__tag)
+
+// print the usage of each tag at the end of phase, and start the next phase's
+// peaks and allocation counts
+void memTrackReport(const std::string& phase);
+
+#else
+
+#define MEM_TAG(__tag)
+
+#endif // _WITH_MEMTRACK
+
+}  // namespace yoruba
+
+#endif // _YORUBA_MEMTRACK_H_
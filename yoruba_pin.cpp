@@ -0,0 +1,564 @@
+// yoruba_pin.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Split a coordinate-sorted, indexed BAM file into shards of whole reference
+// sequences, of roughly equal size.
+//
+// Pín is the Yoruba (Nigeria) verb for 'divide, share out'.
+
+// planning
+//
+// The span of the file holding the records of each reference is taken from
+// the index (baiIndex::ReferenceSpan() in yoruba_bai.h), and its size in
+// compressed bytes estimated from the block offsets.  Records without a
+// reference, at the end of the file, count toward the last shard.  Each
+// reference goes to the shard in which the midpoint of its span falls when
+// the total is divided into --shards equal parts, so shards are runs of
+// whole references in file order.  A reference larger than a share has a
+// shard to itself and may leave a neighbouring shard empty.  Each shard is
+// then the part of the file from the first record of its first reference
+// with records to the first record of the next shard.
+
+// writing
+//
+// Each shard gets the header of the input.  Its blocks are copied as they are
+// by bamCopyRecords() (yoruba_bamraw.h), so only the blocks at its two ends
+// are decompressed and compressed.  With --reduce, each shard is given a
+// dictionary of the references its records mention, as gbagbe does: first
+// the shard's records are read to find the references they and their mapped
+// mates mention, and then they are read again, with RefID and MateRefID
+// rewritten to the reduced dictionary, and compressed.  With --no-mate, a
+// reference mentioned only by mates is not kept, and those mates get
+// MateRefID -1.  With --threads INT, INT shards are written at once.
+
+#include "yoruba_pin.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       input_file;
+static string       output_prefix;  // defaults to input file without .bam
+static int32_t      opt_shards = 2;
+static bool         opt_reduce = false;
+static bool         opt_mate = true;
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_pin(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " split [options] <in.bam>" << endl;
+    cerr << "         " << YORUBA_NAME << " pin [options] <in.bam>" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Split coordinate-sorted and indexed <in.bam> into shards of whole reference\n\
+sequences, of roughly equal size, written to PREFIX.NNNN.bam.\n\
+\n\
+Options: -n INT | --shards INT   number of shards [" << opt_shards << "]\n\
+         -o PREFIX | --output PREFIX\n\
+                                 prefix of the shard files [<in.bam> without .bam]\n\
+         --reduce                give each shard only the references its reads mention\n\
+         --no-mate               with --reduce, do not keep references mentioned only\n\
+                                 by mates\n\
+         --threads INT           number of shards to write at once [" << opt_threads << "]\n\
+         -l INT | --level INT    compression level, -1 for zlib default [" << opt_level << "]\n\
+\n";
+    if (long_help) {
+        cerr << "\
+Shards are planned from the sizes of the references in the index, each\n\
+reference going to the shard in which the middle of its records falls.\n\
+Reads without a reference go to the last shard.  A shard may be empty if a\n\
+neighbouring reference is larger than a share.\n\
+\n\
+Compressed blocks of the input are copied into the shards as they are, only\n\
+those at the ends of each shard being decompressed and compressed again, so\n\
+--level matters little.  Each shard has the reference dictionary of the\n\
+input, so reference IDs are unchanged.  With --reduce, the dictionary of each\n\
+shard is reduced as gbagbe would reduce it, to the references mentioned by\n\
+its reads and by their mapped mates, and its records are rewritten and\n\
+compressed.  With --no-mate, references mentioned only by mates are not kept,\n\
+and those mates are given no reference.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Pin is the Yoruba (Nigeria) verb for 'divide, share out'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// One shard of the input, the references [first_ref, end_ref) and the part
+// of the file [beg, end) holding their records, end -1 for the end of the
+// file.  The last shard also holds the reads without a reference.
+
+struct shardPlan {
+    string  file;
+    int32_t first_ref;
+    int32_t end_ref;
+    bool    last;
+    int64_t beg;
+    int64_t end;
+    int64_t bytes;  // estimated
+
+    // results
+    bool    ok;
+    int32_t n_refs;  // in the dictionary of the shard
+    int64_t n_reads;  // with --reduce
+    int64_t n_mates_derefd;
+    int64_t n_copied;
+    int64_t n_recompressed;
+
+    shardPlan(void) : first_ref(0), end_ref(0), last(false), beg(0), end(0), bytes(0),
+                      ok(false), n_refs(0), n_reads(0), n_mates_derefd(0),
+                      n_copied(0), n_recompressed(0) { }
+    bool Holds(const bamRawRecord& r) const
+        { return r.RefID() < 0 ? last : (r.RefID() >= first_ref && r.RefID() < end_ref); }
+};
+
+
+//-------------------------------------
+
+
+// Divide the references into shards
+
+static void
+planShards(const baiIndex& index, const int32_t n_refs, const int64_t first_record,
+           const int64_t file_size, vector<shardPlan>& shards)
+{
+    vector<uint64_t> span_beg(n_refs, 0);
+    vector<int64_t>  bytes(n_refs, 0);
+    vector<bool>     has(n_refs, false);
+    uint64_t tail_beg = first_record;  // reads without a reference follow the rest
+    int64_t  total = 0;
+    for (int32_t r = 0; r < n_refs && r < index.ReferenceCount(); ++r) {
+        uint64_t e;
+        if (! (has[r] = index.ReferenceSpan(r, span_beg[r], e)))
+            continue;
+        bytes[r] = max(int64_t(1), bgzfBlockOffset(e) - bgzfBlockOffset(span_beg[r]));
+        total += bytes[r];
+        tail_beg = max(tail_beg, e);
+    }
+    const int64_t tail = max(int64_t(0), file_size - BGZF_EOF_BLOCK_LENGTH
+                                         - bgzfBlockOffset(tail_beg));
+    total += tail;
+
+    const int32_t n = shards.size();
+    for (int32_t s = 0; s < n; ++s) {
+        shards[s].first_ref = shards[s].end_ref = -1;
+        shards[s].beg = -1;
+    }
+    int64_t cum = 0;
+    for (int32_t r = 0; r < n_refs; ++r) {
+        int32_t s = total ? int32_t(((cum + bytes[r] / 2) * n) / total) : 0;
+        s = min(s, n - 1);
+        if (shards[s].first_ref < 0)
+            shards[s].first_ref = r;
+        shards[s].end_ref = r + 1;
+        shards[s].bytes += bytes[r];
+        if (has[r] && shards[s].beg < 0)
+            shards[s].beg = span_beg[r];
+        cum += bytes[r];
+    }
+    shards[n - 1].last = true;
+    shards[n - 1].bytes += tail;
+    if (shards[n - 1].beg < 0 && tail > 0)
+        shards[n - 1].beg = tail_beg;
+
+    // give references not placed in a shard to the one before, and set the
+    // ends from the starts of the shards following
+    int64_t next = -1;
+    for (int32_t s = n - 1; s >= 0; --s) {
+        if (shards[s].first_ref < 0)
+            shards[s].first_ref = shards[s].end_ref = (s + 1 < n ? shards[s + 1].first_ref : n_refs);
+        if (s + 1 < n && shards[s + 1].first_ref > shards[s].end_ref)
+            shards[s].end_ref = shards[s + 1].first_ref;
+        shards[s].end = next;
+        if (shards[s].beg < 0)
+            shards[s].beg = next;  // no records
+        else
+            next = shards[s].beg;
+    }
+    if (shards[0].beg >= 0 && shards[0].beg != shards[0].end)
+        shards[0].beg = first_record;
+}
+
+
+//-------------------------------------
+
+
+// What every shard writer needs of the input
+
+struct shardInput {
+    string    header;
+    RefVector refs;
+};
+
+static shardInput input;
+
+
+//-------------------------------------
+
+
+// Write the records of shard through a reduced dictionary
+
+static bool
+writeReducedShard(shardPlan& shard)
+{
+    bamRawReader reader;
+    if (! reader.Open(input_file)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return false;
+    }
+    const int32_t n_refs = input.refs.size();
+    vector<int64_t> mentioned(n_refs, 0), mentioned_mate(n_refs, 0);
+    bamRawRecord r;
+    bool empty = shard.beg < 0 || shard.beg == shard.end;
+
+    if (! empty && reader.Seek(shard.beg)) {
+        while (reader.GetNextRecord(r) && shard.Holds(r)) {
+            if (r.RefID() >= 0)
+                ++mentioned[r.RefID()];
+            if (r.IsPaired() && r.IsMateMapped() && r.MateRefID() >= 0)
+                ++mentioned_mate[r.MateRefID()];
+        }
+    }
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << input_file << endl;
+        return false;
+    }
+
+    vector<int32_t> new_id(n_refs, -1);
+    RefVector new_refs;
+    for (int32_t i = 0; i < n_refs; ++i) {
+        if (mentioned[i] || (opt_mate && mentioned_mate[i])) {
+            new_id[i] = new_refs.size();
+            new_refs.push_back(input.refs[i]);
+        }
+    }
+    shard.n_refs = new_refs.size();
+
+    vector<pair<size_t, string> > dropped;
+    const string header = headerUnion(vector<string>(1, input.header), new_refs, dropped);
+    bamRawWriter writer;
+    if (! writer.Open(shard.file, header, new_refs, NULL, opt_level)) {
+        cerr << NAME << " could not open BAM output " << shard.file << endl;
+        return false;
+    }
+    writer.IndexRecords(yviIndex::default_interval);
+    bool ok = true;
+    if (! empty) {
+        ok = reader.Seek(shard.beg);
+        while (ok && reader.GetNextRecord(r) && shard.Holds(r)) {
+            ++shard.n_reads;
+            int32_t id = r.RefID();
+            if (id >= 0) {
+                id = new_id[id];
+                memcpy(&r.data[0], &id, 4);
+            }
+            id = r.MateRefID();
+            if (id >= 0) {
+                if (new_id[id] < 0)
+                    ++shard.n_mates_derefd;
+                id = new_id[id];
+                memcpy(&r.data[20], &id, 4);
+            }
+            ok = writer.Write(r);
+        }
+        if (reader.Error()) {
+            cerr << NAME << " could not read BAM input " << input_file << endl;
+            ok = false;
+        }
+    }
+    reader.Close();
+    if (! (ok = writer.Close() && ok))
+        cerr << NAME << " could not write BAM output " << shard.file << endl;
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// Write shard, copying blocks or through a reduced dictionary
+
+static bool
+writeShard(shardPlan& shard)
+{
+    if (opt_reduce)
+        return writeReducedShard(shard);
+
+    shard.n_refs = input.refs.size();
+    bamRawWriter writer;
+    if (! writer.Open(shard.file, input.header, input.refs, NULL, opt_level)) {
+        cerr << NAME << " could not open BAM output " << shard.file << endl;
+        return false;
+    }
+    bool ok = true;
+    if (shard.beg >= 0)
+        ok = bamCopyRecords(input_file, shard.beg, shard.end, writer,
+                            shard.n_copied, shard.n_recompressed);
+    if (! (ok = writer.Close() && ok))
+        cerr << NAME << " could not write BAM output " << shard.file << endl;
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// Shards handed out to threads
+
+struct shardQueue {
+    vector<shardPlan>* shards;
+    size_t             next;
+    pthread_mutex_t    mutex;
+};
+
+
+static void*
+shardWorker(void* arg)
+{
+    shardQueue* q = static_cast<shardQueue*>(arg);
+    while (true) {
+        pthread_mutex_lock(&q->mutex);
+        const size_t i = q->next++;
+        pthread_mutex_unlock(&q->mutex);
+        if (i >= q->shards->size())
+            break;
+        shardPlan& shard = (*q->shards)[i];
+        shard.ok = writeShard(shard);
+    }
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_pin(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_shards, OPT_output, OPT_reduce, OPT_nomate, OPT_threads, OPT_level,
+#ifdef _WITH_DEBUG
+        OPT_debug,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption pin_options[] = {
+        { OPT_shards,          "--shards",          SO_REQ_SEP },
+        { OPT_shards,          "-n",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_reduce,          "--reduce",          SO_NONE },
+        { OPT_nomate,          "--no-mate",         SO_NONE },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, pin_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_shards) {
+            opt_shards = atoi(args.OptionArg());
+            if (opt_shards < 1 || opt_shards > 9999) {
+                cerr << NAME << " --shards must be from 1 to 9999" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_reduce) {
+            opt_reduce = true;
+        } else if (args.OptionId() == OPT_nomate) {
+            opt_mate = false;
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (args.FileCount() != 1) {
+        cerr << NAME << " requires one indexed BAM file specified as input" << endl;
+        return usage();
+    }
+    input_file = args.File(0);
+
+    if (! opt_mate && ! opt_reduce) {
+        cerr << NAME << " --no-mate requires --reduce" << endl;
+        return usage();
+    }
+
+    if (output_prefix.empty()) {
+        output_prefix = input_file;
+        if (output_prefix.size() > 4 && output_prefix.compare(output_prefix.size() - 4, 4, ".bam") == 0)
+            output_prefix.erase(output_prefix.size() - 4);
+    }
+
+    //----------------- Plan shards from the index
+
+    profile.Begin("plan");
+    bamRawReader reader;
+    if (! reader.Open(input_file)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    input.header = reader.HeaderText();
+    input.refs = reader.References();
+    const int64_t first_record = reader.FirstRecordOffset();
+    reader.Close();
+
+    baiIndex index;
+    if (! index.Load(input_file)) {
+        cerr << NAME << " could not load the index of " << input_file
+            << ", it must be sorted by coordinate and indexed" << endl;
+        return EXIT_FAILURE;
+    }
+    if (index.ReferenceCount() != int32_t(input.refs.size())) {
+        cerr << NAME << " index " << index.IndexFile() << " has " << index.ReferenceCount()
+            << " references, but " << input_file << " has " << input.refs.size() << endl;
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (stat(input_file.c_str(), &st) != 0) {
+        cerr << NAME << " could not find the size of " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    vector<shardPlan> shards(opt_shards);
+    planShards(index, input.refs.size(), first_record, st.st_size, shards);
+    for (int32_t s = 0; s < opt_shards; ++s) {
+        char suffix[32];
+        sprintf(suffix, ".%04d.bam", s);
+        shards[s].file = output_prefix + suffix;
+        if (DEBUG(1))
+            cerr << NAME << " " << shards[s].file << ": references " << shards[s].first_ref
+                << " to " << shards[s].end_ref - 1 << (shards[s].last ? " and unplaced" : "")
+                << ", about " << shards[s].bytes << " bytes, from " << shards[s].beg
+                << " to " << shards[s].end << endl;
+    }
+
+    //----------------- Write shards
+
+    profile.Begin("shards");
+    if (opt_threads == 0) {
+        for (int32_t s = 0; s < opt_shards; ++s)
+            shards[s].ok = writeShard(shards[s]);
+    } else {
+        shardQueue q;
+        q.shards = &shards;
+        q.next = 0;
+        pthread_mutex_init(&q.mutex, NULL);
+        vector<pthread_t> threads;
+        for (int32_t i = 0; i < min(opt_threads, opt_shards); ++i) {
+            pthread_t t;
+            if (pthread_create(&t, NULL, shardWorker, &q) != 0) {
+                cerr << NAME << " could not create thread " << i << ", continuing with "
+                    << threads.size() << endl;
+                break;
+            }
+            threads.push_back(t);
+        }
+        if (threads.empty())
+            shardWorker(&q);
+        for (size_t i = 0; i < threads.size(); ++i)
+            pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&q.mutex);
+    }
+
+    bool ok = true;
+    int64_t n_copied = 0, n_recompressed = 0, n_reads = 0, n_mates_derefd = 0;
+    for (int32_t s = 0; s < opt_shards; ++s) {
+        ok = ok && shards[s].ok;
+        n_copied += shards[s].n_copied;
+        n_recompressed += shards[s].n_recompressed;
+        n_reads += shards[s].n_reads;
+        n_mates_derefd += shards[s].n_mates_derefd;
+        if (opt_reduce && DEBUG(1))
+            cerr << NAME << " " << shards[s].file << ": " << shards[s].n_reads << " reads, "
+                << shards[s].n_refs << " references kept" << endl;
+    }
+    if (opt_reduce)
+        profile.Reads(n_reads);
+    if (! ok)
+        return EXIT_FAILURE;
+
+    cerr << NAME << " " << opt_shards << " shard" << PLURAL(opt_shards) << " written to "
+        << output_prefix << ".NNNN.bam, ";
+    if (opt_reduce) {
+        cerr << n_reads << " reads rereferenced";
+        if (! opt_mate)
+            cerr << ", " << n_mates_derefd << " mates dereferenced";
+    } else {
+        cerr << n_copied << " block" << PLURAL(n_copied) << " copied, "
+            << n_recompressed << " recompressed";
+    }
+    cerr << endl;
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,41 @@
+// yoruba_pin.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_PIN_H_
+#define _YORUBA_PIN_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_bai.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_profile.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_split]"
+#endif
+
+// Functions defined in yoruba_pin.cpp
+//
+namespace yoruba {
+
+int  main_pin(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_PIN_H_
@@ -0,0 +1,236 @@
+// yoruba_profile.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Per-phase profile of a run, see yoruba_profile.h.
+
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+#include "yoruba_memtrack.h"
+
+using namespace std;
+using namespace yoruba;
+
+runProfile yoruba::profile;
+
+
+//-------------------------------------
+
+
+static double
+seconds(const struct timeval& tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//-------------------------------------
+
+
+profileSnapshot
+profileSnapshot::Now(void)
+{
+    profileSnapshot s;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    s.wall = seconds(tv);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    s.user = seconds(ru.ru_utime);
+    s.sys = seconds(ru.ru_stime);
+    s.max_rss_kb = ru.ru_maxrss;  // kilobytes on Linux
+    // rchar and wchar count all bytes passed by read() and write(), through
+    // pipes as well as files
+    s.bytes_read = s.bytes_written = -1;
+    FILE* fp = fopen("/proc/self/io", "r");
+    if (fp) {
+        char line[128];
+        long long v;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "rchar: %lld", &v) == 1)
+                s.bytes_read = v;
+            else if (sscanf(line, "wchar: %lld", &v) == 1)
+                s.bytes_written = v;
+        }
+        fclose(fp);
+    }
+    return s;
+}
+
+
+//-------------------------------------
+
+
+void
+profilePhase::Set(const profileSnapshot& start, const profileSnapshot& end)
+{
+    wall = end.wall - start.wall;
+    user = end.user - start.user;
+    sys = end.sys - start.sys;
+    max_rss_kb = end.max_rss_kb;
+    bytes_read = (start.bytes_read >= 0 && end.bytes_read >= 0)
+                 ? end.bytes_read - start.bytes_read : -1;
+    bytes_written = (start.bytes_written >= 0 && end.bytes_written >= 0)
+                    ? end.bytes_written - start.bytes_written : -1;
+}
+
+
+//-------------------------------------
+
+
+void
+runProfile::Start(void)
+{
+    phases.clear();
+    in_phase = false;
+    total = profilePhase("total");
+    run_start = profileSnapshot::Now();
+}
+
+
+//-------------------------------------
+
+
+void
+runProfile::Begin(const string& phase)
+{
+    End();
+    current = profilePhase(phase);
+    phase_start = profileSnapshot::Now();
+    in_phase = true;
+    progress.Phase(phase);
+}
+
+
+//-------------------------------------
+
+
+void
+runProfile::End(void)
+{
+    if (! in_phase)
+        return;
+    const int64_t reads = current.reads;
+    current.Set(phase_start, profileSnapshot::Now());
+    current.reads = reads;
+    phases.push_back(current);
+    in_phase = false;
+#ifdef _WITH_MEMTRACK
+    memTrackReport(current.name);
+#endif
+}
+
+
+//-------------------------------------
+
+
+void
+runProfile::Stop(void)
+{
+    End();
+    total.Set(run_start, profileSnapshot::Now());
+    // the reads of the run are those of its busiest phase, since a two-pass
+    // command reads each one twice
+    for (size_t i = 0; i < phases.size(); ++i)
+        if (phases[i].reads > total.reads)
+            total.reads = phases[i].reads;
+}
+
+
+//-------------------------------------
+
+
+void
+runProfile::Report(ostream& os, const string& prefix) const
+{
+    const ios_base::fmtflags flags = os.flags();
+    const streamsize precision = os.precision();
+    for (size_t i = 0; i < phases.size(); ++i) {
+        const profilePhase& p = phases[i];
+        os << fixed << setprecision(3) << prefix << " phase " << p.name << " " << p.wall << " sec wall, "
+            << p.user << " user, " << p.sys << " sys, " << p.max_rss_kb << " KB peak RSS";
+        if (p.reads >= 0)
+            os << ", " << p.reads << " reads, " << setprecision(0) << p.ReadsPerSecond() << " reads/sec";
+        os << endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+
+//-------------------------------------
+
+
+static string
+jsonString(const string& s)
+{
+    string j = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+        const unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            j += '\\';
+            j += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            sprintf(buf, "\\u%04x", c);
+            j += buf;
+        } else {
+            j += c;
+        }
+    }
+    return j + "\"";
+}
+
+
+//-------------------------------------
+
+
+static void
+jsonPhase(ostream& os, const profilePhase& p)
+{
+    os << "{\"name\": " << jsonString(p.name)
+        << fixed << setprecision(6)
+        << ", \"wall_sec\": " << p.wall
+        << ", \"user_sec\": " << p.user
+        << ", \"sys_sec\": " << p.sys
+        << ", \"max_rss_kb\": " << p.max_rss_kb
+        << ", \"bytes_read\": " << p.bytes_read
+        << ", \"bytes_written\": " << p.bytes_written
+        << ", \"reads\": " << p.reads
+        << ", \"reads_per_sec\": " << setprecision(1) << p.ReadsPerSecond()
+        << "}";
+}
+
+
+//-------------------------------------
+
+
+bool
+runProfile::WriteJson(const string& filename, const string& version,
+                      const string& command, const int exit_status) const
+{
+    ofstream os(filename.c_str());
+    if (! os)
+        return false;
+    os << "{" << endl;
+    os << "  \"version\": " << jsonString(version) << "," << endl;
+    os << "  \"command\": " << jsonString(command) << "," << endl;
+    os << "  \"exit_status\": " << exit_status << "," << endl;
+    os << "  \"phases\": [";
+    for (size_t i = 0; i < phases.size(); ++i) {
+        os << (i ? "," : "") << endl << "    ";
+        jsonPhase(os, phases[i]);
+    }
+    os << endl << "  ]," << endl;
+    os << "  \"total\": ";
+    jsonPhase(os, total);
+    os << endl << "}" << endl;
+    os.close();
+    return ! os.fail();
+}
@@ -0,0 +1,109 @@
+// yoruba_profile.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_profile.cpp
+//
+// Where a command spends its time, phase by phase.  A command marks the start
+// of each of its phases with profile.Begin("pass1") and so on, which also
+// names the phase in progress reports (yoruba_progress.h), and notes the reads
+// it handled with profile.Reads(n).  For each phase the profile keeps
+// wall time, user and system CPU time summed over all threads, the peak RSS
+// reached by its end, and the bytes read and written by all threads of the
+// process, from /proc/self/io where there is one.  main() (yoruba.cpp) prints
+// the totals, and with 'yoruba --stats-json FILE <command> ...' writes the
+// whole report to FILE as JSON.  In a 'make MEMTRACK=1' build the end of each
+// phase also reports the heap by subsystem (yoruba_memtrack.h).
+
+#ifndef _YORUBA_PROFILE_H_
+#define _YORUBA_PROFILE_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace yoruba {
+
+// resource usage of the process at one moment
+
+struct profileSnapshot {
+    double  wall;           // seconds since the epoch
+    double  user;           // CPU seconds
+    double  sys;
+    int64_t max_rss_kb;
+    int64_t bytes_read;     // -1 if unknown
+    int64_t bytes_written;
+
+    static profileSnapshot Now(void);
+};
+
+
+//-------------------------------------
+
+
+struct profilePhase {
+    std::string name;
+    double      wall;
+    double      user;
+    double      sys;
+    int64_t     max_rss_kb;
+    int64_t     bytes_read;
+    int64_t     bytes_written;
+    int64_t     reads;      // -1 if the phase did not count them
+
+    profilePhase(const std::string& n = "")
+        : name(n), wall(0), user(0), sys(0), max_rss_kb(0), bytes_read(-1),
+          bytes_written(-1), reads(-1) { }
+    // difference between start and end
+    void    Set(const profileSnapshot& start, const profileSnapshot& end);
+    double  ReadsPerSecond(void) const
+                { return (reads >= 0 && wall > 0) ? reads / wall : 0; }
+};
+
+
+//-------------------------------------
+
+
+class runProfile {
+
+    public:
+        runProfile(void) : in_phase(false) { }
+
+        // start the whole run, clearing any phases
+        void    Start(void);
+        // end any current phase and start the next
+        void    Begin(const std::string& phase);
+        // end the current phase, if there is one
+        void    End(void);
+        // the reads handled in the current phase
+        void    Reads(const int64_t n) { if (in_phase) current.reads = n; }
+        // end any current phase and the whole run
+        void    Stop(void);
+
+        const profilePhase&              Total(void) const { return total; }
+        const std::vector<profilePhase>& Phases(void) const { return phases; }
+
+        // one line per phase, each beginning with prefix
+        void    Report(std::ostream& os, const std::string& prefix) const;
+        // false if filename cannot be written
+        bool    WriteJson(const std::string& filename, const std::string& version,
+                          const std::string& command, const int exit_status) const;
+
+    private:
+        profileSnapshot           run_start;
+        profileSnapshot           phase_start;
+        profilePhase              current;
+        bool                      in_phase;
+        profilePhase              total;
+        std::vector<profilePhase> phases;
+
+};  // class runProfile
+
+// the profile of this run, begun and written by main()
+extern runProfile profile;
+
+}  // namespace yoruba
+
+#endif // _YORUBA_PROFILE_H_
@@ -0,0 +1,381 @@
+// yoruba_progress.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Progress reports from a timer thread, see yoruba_progress.h.
+
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "yoruba_progress.h"
+
+using namespace std;
+using namespace yoruba;
+
+progressMeter yoruba::progress;
+
+const double progressMeter::default_metrics_interval = 10.0;
+
+
+//-------------------------------------
+
+
+static double
+now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//-------------------------------------
+
+
+// seconds as 2h31m, 4m12s or 37s
+
+static string
+hms(const double sec)
+{
+    const int64_t s = int64_t(sec + 0.5);
+    ostringstream os;
+    if (s >= 3600)
+        os << s / 3600 << "h" << setw(2) << setfill('0') << (s % 3600) / 60 << "m";
+    else if (s >= 60)
+        os << s / 60 << "m" << setw(2) << setfill('0') << s % 60 << "s";
+    else
+        os << s << "s";
+    return os.str();
+}
+
+
+//-------------------------------------
+
+
+progressMeter::progressMeter(void)
+    : interval(0)
+    , report(false)
+    , running(false)
+    , shutdown(false)
+    , reads(0)
+    , expected(-1)
+    , phase_start(now())
+    , last_time(phase_start)
+    , last_reads(0)
+    , last_position(-1)
+    , reads_per_sec(0)
+    , bytes_per_sec(-1)
+    , fraction(-1)
+    , eta(-1)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&wake, NULL);
+}
+
+
+//-------------------------------------
+
+
+progressMeter::~progressMeter(void)
+{
+    Stop();
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+//-------------------------------------
+
+
+bool
+progressMeter::Start(const string& p, const string& c, const double i, const string& m)
+{
+    if (running)
+        return true;
+    prefix = p;
+    command = c;
+    metrics_file = m;
+    report = i > 0;
+    interval = report ? i : default_metrics_interval;
+    if (! report && metrics_file.empty())
+        return true;
+    shutdown = false;
+    if (pthread_create(&thread, NULL, progressMeter::timer, this) != 0) {
+        cerr << prefix << " could not create progress thread" << endl;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::Stop(void)
+{
+    if (! running)
+        return;
+    pthread_mutex_lock(&mutex);
+    shutdown = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+    running = false;
+    tick(true);
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::Phase(const string& p)
+{
+    pthread_mutex_lock(&mutex);
+    phase = p;
+    inputs.clear();
+    reads = 0;
+    expected = -1;
+    phase_start = last_time = now();
+    last_reads = 0;
+    last_position = -1;
+    reads_per_sec = 0;
+    bytes_per_sec = fraction = eta = -1;
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::Input(const string& filename, const int64_t from, const int64_t to)
+{
+    pthread_mutex_lock(&mutex);
+    inputs.clear();
+    pthread_mutex_unlock(&mutex);
+    AddInput(filename, from, to);
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::AddInput(const string& filename, const int64_t from, const int64_t to)
+{
+    // only a regular file has a size to measure progress against
+    struct stat st;
+    char path[PATH_MAX];
+    if (stat(filename.c_str(), &st) != 0 || ! S_ISREG(st.st_mode)
+        || ! realpath(filename.c_str(), path))
+        return;
+    inputFile f;
+    f.path = path;
+    f.from = from;
+    f.to = (to < 0 || to > st.st_size) ? st.st_size : to;
+    pthread_mutex_lock(&mutex);
+    inputs.push_back(f);
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------
+
+
+// The bytes read so far of the inputs, by the offset of the descriptors open
+// on them, or -1 if none is open
+
+int64_t
+progressMeter::inputPosition(void) const
+{
+    if (inputs.empty())
+        return -1;
+    DIR* dir = opendir("/proc/self/fd");
+    if (! dir)
+        return -1;
+    vector<int64_t> pos(inputs.size(), -1);
+    struct dirent* e;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        char link[64], target[PATH_MAX];
+        sprintf(link, "/proc/self/fd/%s", e->d_name);
+        const ssize_t n = readlink(link, target, sizeof(target) - 1);
+        if (n <= 0)
+            continue;
+        target[n] = '\0';
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            if (inputs[i].path != target)
+                continue;
+            char info[64], line[128];
+            sprintf(info, "/proc/self/fdinfo/%s", e->d_name);
+            FILE* fp = fopen(info, "r");
+            long long p;
+            while (fp && fgets(line, sizeof(line), fp))
+                if (sscanf(line, "pos: %lld", &p) == 1 && p > pos[i])
+                    pos[i] = p;
+            if (fp)
+                fclose(fp);
+        }
+    }
+    closedir(dir);
+    int64_t total = -1;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (pos[i] < 0)
+            continue;
+        const int64_t p = min(max(pos[i], inputs[i].from), inputs[i].to) - inputs[i].from;
+        total = (total < 0 ? 0 : total) + p;
+    }
+    return total;
+}
+
+
+//-------------------------------------
+
+
+void*
+progressMeter::timer(void* arg)
+{
+    static_cast<progressMeter*>(arg)->run();
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::run(void)
+{
+    pthread_mutex_lock(&mutex);
+    while (! shutdown) {
+        const double t = now() + interval;
+        struct timespec ts;
+        ts.tv_sec = time_t(t);
+        ts.tv_nsec = long((t - ts.tv_sec) * 1000000000.0);
+        while (! shutdown && pthread_cond_timedwait(&wake, &mutex, &ts) == 0)
+            ;
+        if (shutdown)
+            break;
+        pthread_mutex_unlock(&mutex);
+        tick(false);
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------
+
+
+void
+progressMeter::tick(const bool final)
+{
+    pthread_mutex_lock(&mutex);
+    const double t = now();
+    const int64_t r = reads;
+    const int64_t e = expected;
+    const int64_t pos = inputPosition();
+    int64_t size = 0;
+    for (size_t i = 0; i < inputs.size(); ++i)
+        size += inputs[i].to - inputs[i].from;
+
+    const double dt = t - last_time;
+    if (dt > 0) {
+        reads_per_sec = (r - last_reads) / dt;
+        bytes_per_sec = (pos >= 0 && last_position >= 0) ? (pos - last_position) / dt : -1;
+    }
+    if (e > 0)
+        fraction = double(r) / e;
+    else if (pos >= 0 && size > 0)
+        fraction = double(pos) / size;
+    else
+        fraction = -1;
+    if (fraction > 1)
+        fraction = 1;
+    eta = fraction > 0 ? (t - phase_start) * (1 - fraction) / fraction : -1;
+    last_time = t;
+    last_reads = r;
+    last_position = pos;
+
+    if (report && ! final) {
+        // formatted apart from cerr, whose state the command itself may be
+        // using, and written whole so it is not broken up by other output
+        ostringstream line;
+        line << prefix << "[" << phase << "] " << r << " reads, "
+            << fixed << setprecision(0) << reads_per_sec << " reads/s";
+        if (bytes_per_sec >= 0)
+            line << ", " << setprecision(1) << bytes_per_sec / (1024 * 1024) << " MB/s";
+        if (fraction >= 0)
+            line << ", " << setprecision(1) << fraction * 100 << "% done, ETA " << hms(eta);
+        line << "\n";
+        cerr << line.str();
+    }
+    if (! writeMetrics(! final))
+        cerr << prefix << " could not write metrics file " << metrics_file << endl;
+    pthread_mutex_unlock(&mutex);
+}
+
+
+//-------------------------------------
+
+
+// Prometheus text exposition format, written to a temporary file and renamed
+// so that a collector never sees half a file.  Values that are not known
+// are left out.
+
+bool
+progressMeter::writeMetrics(const bool live)
+{
+    if (metrics_file.empty())
+        return true;
+    const string tmp = metrics_file + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (! fp)
+        return false;
+    const string labels = "{command=\"" + command + "\",phase=\"" + phase + "\"}";
+    const char* l = labels.c_str();
+    fprintf(fp, "# HELP yoruba_running 1 while the command runs, 0 once it has finished\n");
+    fprintf(fp, "# TYPE yoruba_running gauge\n");
+    fprintf(fp, "yoruba_running%s %d\n", l, live ? 1 : 0);
+    fprintf(fp, "# HELP yoruba_phase_reads Reads handled so far in the current phase\n");
+    fprintf(fp, "# TYPE yoruba_phase_reads gauge\n");
+    fprintf(fp, "yoruba_phase_reads%s %lld\n", l, (long long)last_reads);
+    fprintf(fp, "# HELP yoruba_reads_per_second Reads per second over the last interval\n");
+    fprintf(fp, "# TYPE yoruba_reads_per_second gauge\n");
+    fprintf(fp, "yoruba_reads_per_second%s %.1f\n", l, reads_per_sec);
+    if (bytes_per_sec >= 0) {
+        fprintf(fp, "# HELP yoruba_input_bytes_per_second Compressed input bytes read per second over the last interval\n");
+        fprintf(fp, "# TYPE yoruba_input_bytes_per_second gauge\n");
+        fprintf(fp, "yoruba_input_bytes_per_second%s %.1f\n", l, bytes_per_sec);
+    }
+    if (fraction >= 0) {
+        fprintf(fp, "# HELP yoruba_phase_progress_ratio Fraction of the current phase done\n");
+        fprintf(fp, "# TYPE yoruba_phase_progress_ratio gauge\n");
+        fprintf(fp, "yoruba_phase_progress_ratio%s %.4f\n", l, fraction);
+        fprintf(fp, "# HELP yoruba_phase_eta_seconds Estimated seconds until the current phase ends\n");
+        fprintf(fp, "# TYPE yoruba_phase_eta_seconds gauge\n");
+        fprintf(fp, "yoruba_phase_eta_seconds%s %.0f\n", l, eta);
+    }
+    fprintf(fp, "# HELP yoruba_phase_elapsed_seconds Seconds since the current phase began\n");
+    fprintf(fp, "# TYPE yoruba_phase_elapsed_seconds gauge\n");
+    fprintf(fp, "yoruba_phase_elapsed_seconds%s %.1f\n", l, last_time - phase_start);
+    fprintf(fp, "# HELP yoruba_last_update_timestamp_seconds Time of this update\n");
+    fprintf(fp, "# TYPE yoruba_last_update_timestamp_seconds gauge\n");
+    fprintf(fp, "yoruba_last_update_timestamp_seconds%s %.0f\n", l, last_time);
+    if (fclose(fp) != 0 || rename(tmp.c_str(), metrics_file.c_str()) != 0) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
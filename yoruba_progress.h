@@ -0,0 +1,112 @@
+// yoruba_progress.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_progress.cpp
+//
+// Progress of a long run, reported from a timer thread so that the loops
+// reading records only store their read count with progress.Reads(n).  Every
+// --progress SEC seconds a line goes to stderr with the reads of the current
+// phase, reads/s and compressed MB/s over the last interval, the percent done
+// and an estimate of the time remaining:
+//
+//     [yoruba_forget][pass2] 61200000 reads, 412000 reads/s, 21.3 MB/s, 37.5% done, ETA 2h31m
+//
+// The percent done is of the reads expected, if the command knows them, as in
+// a second pass, and otherwise of the input file by the position of the file
+// descriptor reading it, found through /proc/self/fd, so BamTools readers are
+// followed too.  With --metrics FILE the same figures are also written every
+// interval to FILE in the Prometheus textfile format, replacing it whole, for
+// a node exporter's textfile collector to pick up.  Phases are named by
+// profile.Begin() (yoruba_profile.h).
+
+#ifndef _YORUBA_PROGRESS_H_
+#define _YORUBA_PROGRESS_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace yoruba {
+
+class progressMeter {
+
+    public:
+        progressMeter(void);
+        ~progressMeter(void);
+
+        // report every interval seconds to cerr with lines beginning with
+        // prefix, and if metrics_file is given write metrics labelled with
+        // command there; with interval 0, only metrics are written, every
+        // default_metrics_interval seconds.  Does nothing if there is nothing
+        // to report
+        bool    Start(const std::string& prefix, const std::string& command,
+                      const double interval, const std::string& metrics_file);
+        // write the final metrics and stop the timer thread
+        void    Stop(void);
+
+        // a new phase, clearing the reads, the reads expected and the inputs
+        void    Phase(const std::string& phase);
+        // the input followed for the percent done, or the part of it from
+        // file offset from up to to; AddInput() adds another
+        void    Input(const std::string& filename, const int64_t from = 0, const int64_t to = -1);
+        void    AddInput(const std::string& filename, const int64_t from = 0, const int64_t to = -1);
+        // the reads this phase is expected to handle, when they are known
+        void    Expect(const int64_t n) { expected = n; }
+        // the reads handled so far this phase; cheap enough for every read
+        void    Reads(const int64_t n) { reads = n; }
+
+        static const double default_metrics_interval;
+
+    private:
+        struct inputFile {
+            std::string path;   // as resolved by realpath()
+            int64_t     from;
+            int64_t     to;
+        };
+
+        static void* timer(void* arg);
+        void    run(void);
+        void    tick(const bool final);
+        int64_t inputPosition(void) const;
+        bool    writeMetrics(const bool live);
+
+        std::string            prefix;
+        std::string            command;
+        std::string            metrics_file;
+        double                 interval;
+        bool                   report;
+
+        pthread_t              thread;
+        pthread_mutex_t        mutex;
+        pthread_cond_t         wake;
+        bool                   running;
+        bool                   shutdown;
+
+        // set by the command, read by the timer thread; a stale value read
+        // there costs only a slightly low count in one report
+        volatile int64_t       reads;
+        volatile int64_t       expected;
+
+        // guarded by mutex
+        std::string            phase;
+        std::vector<inputFile> inputs;
+        double                 phase_start;
+        double                 last_time;
+        int64_t                last_reads;
+        int64_t                last_position;
+        double                 reads_per_sec;
+        double                 bytes_per_sec;
+        double                 fraction;
+        double                 eta;
+
+};  // class progressMeter
+
+// the progress of this run, stopped by main()
+extern progressMeter progress;
+
+}  // namespace yoruba
+
+#endif // _YORUBA_PROGRESS_H_
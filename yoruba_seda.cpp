@@ -67,13 +67,16 @@ static detect_t     opt_detect = DETECT_all;
 static bool         opt_remove;         // set with --remove
 static bool         opt_duplicatefile;  // set with --duplicate-file FILE
 static string       duplicate_file;     // set with --duplicate-file FILE, holds FILE
+static int64_t      opt_checkpoint = 0; // reads between checkpoints, 0 for none
+static bool         opt_resume = false;
+static string       opt_tmp_prefix;     // defaults to output file, or yoruba_duplicate
+static string       metrics_file;
 #ifdef _WITH_DEBUG
 static bool         opt_override = false;
 static int32_t      opt_debug = 1;
-static int32_t      debug_progress = 100000;
+static double       debug_progress = 10;
 static int64_t      opt_reads = -1;
-static int64_t      opt_progress = 100000; // 100000;
-static int64_t      last_n_reads_mod = 0;  // helps with progress output during pass1
+static double       opt_progress = 0;
 #endif
 static const string delim = "'";
 static const string sep = "\t";
@@ -99,11 +102,13 @@ usage()
 {
     cerr << endl;
     cerr << "\
-Usage:   " << YORUBA_NAME << " duplicate [options] <in.bam>\n\
-         " << YORUBA_NAME << " seda      [options] <in.bam>\n\
+Usage:   " << YORUBA_NAME << " duplicate [options] [<in.bam>]\n\
+         " << YORUBA_NAME << " seda      [options] [<in.bam>]\n\
 \n\
 Determines duplicate reads in a BAM file, marks them as duplicates, and removes\n\
-them on option.  Either command invokes this function.\n\
+them on option.  Either command invokes this function.  If <in.bam> is not\n\
+given, input is read from stdin; a piped input is copied to PREFIX.PID.spool\n\
+during the first pass for the second to read.\n\
 \n\
 NOTE: THIS COMMAND IS INCOMPLETE AND IN AN UNKNOWN STATE OF READINESS\n\
 \n\
@@ -114,13 +119,19 @@ Options: --as-single-end           all reads treated as single-end, ignore pairi
          --duplicate-file FILE     write duplicate reads to BAM file FILE,\n\
                                    note this does not currently imply --remove\n\
          -o FILE | --output FILE   output file name [default is stdout]\n\
+         --checkpoint INT          checkpoint every INT reads, for --resume [" << opt_checkpoint << "]\n\
+         --resume                  resume from the checkpoint of -o FILE, repeating\n\
+                                   the first pass\n\
+         -T PREFIX | --tmp-prefix PREFIX\n\
+                                   prefix for spooling stdin [output file, or yoruba_duplicate]\n\
+         --metrics FILE            write progress metrics to FILE for Prometheus\n\
          -? | --help               onger help\n\
 \n";
 #ifdef _WITH_DEBUG
     cerr << "\
          --debug INT      debug info level INT [" << opt_debug << "]\n\
          --reads INT      only process INT reads [" << opt_reads << "]\n\
-         --progress INT   print reads processed mod INT [" << opt_progress << "]\n\
+         --progress SEC   report progress every SEC seconds [" << opt_progress << "]\n\
 \n\
          --override       override the non-usage of this command\n\
 \n";
@@ -145,6 +156,13 @@ enum dup_t { // types of potential duplicate reads in a dupMap
     dupMap_paired_one  = 1, 
     dupMap_paired_both = 2
 };
+// dupMap is not a matePairer (yoruba_mates.h), though it too sees the first
+// read of a pair before the second.  It holds only duplicate templates, and
+// keeps a template once both reads are seen, since it is the list of names
+// to flag in pass 2.  Pass 2 looks up every read by name in file order,
+// consuming an entry by the number of its reads seen rather than by the
+// position of a mate.  And a name hash collision there would flag a read
+// that is not a duplicate, so it is keyed by the full name.
 //typedef map<string, dup_t>            dupMap;
 typedef std::tr1::unordered_map<string, dup_t>  dupMap;
 typedef dupMap::iterator              dupMapI;
@@ -187,7 +205,8 @@ yoruba::main_seda(int argc, char* argv[])
 	}
     
     enum { OPT_output, OPT_as_single, OPT_single_only, OPT_paired_only,
-        OPT_remove, OPT_duplicatefile,
+        OPT_remove, OPT_duplicatefile, OPT_checkpoint, OPT_resume,
+        OPT_tmp_prefix, OPT_metrics,
 #ifdef _WITH_DEBUG
         OPT_debug, OPT_reads, OPT_progress, OPT_override,
 #endif
@@ -203,6 +222,11 @@ yoruba::main_seda(int argc, char* argv[])
         { OPT_help,            "-?",                SO_NONE }, 
         { OPT_output,          "--output",          SO_REQ_SEP },
         { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_checkpoint,      "--checkpoint",      SO_REQ_SEP },
+        { OPT_resume,          "--resume",          SO_NONE },
+        { OPT_tmp_prefix,      "--tmp-prefix",      SO_REQ_SEP },
+        { OPT_tmp_prefix,      "-T",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
 #ifdef _WITH_DEBUG
         { OPT_debug,           "--debug",           SO_REQ_SEP },
         { OPT_reads,           "--reads",           SO_REQ_SEP },
@@ -233,13 +257,21 @@ yoruba::main_seda(int argc, char* argv[])
             opt_duplicatefile = true; duplicate_file = args.OptionArg();
         } else if (args.OptionId() == OPT_output) {
             output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_checkpoint) {
+            opt_checkpoint = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_resume) {
+            opt_resume = true;
+        } else if (args.OptionId() == OPT_tmp_prefix) {
+            opt_tmp_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
 #ifdef _WITH_DEBUG
         } else if (args.OptionId() == OPT_debug) {
             opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
         } else if (args.OptionId() == OPT_reads) {
             opt_reads = strtoll(args.OptionArg(), NULL, 10);
         } else if (args.OptionId() == OPT_progress) {
-            opt_progress = args.OptionArg() ? strtoll(args.OptionArg(), NULL, 10) : opt_progress;
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
         } else if (args.OptionId() == OPT_override) {
             opt_override = true;
 #endif
@@ -251,6 +283,8 @@ yoruba::main_seda(int argc, char* argv[])
 
     if (DEBUG(1) && ! opt_progress)
         opt_progress = debug_progress;
+    if (! progress.Start(NAME, "duplicate", opt_progress, metrics_file))
+        return EXIT_FAILURE;
 
     if (args.FileCount() > 1) {
         cerr << NAME << " requires at most one BAM file specified as input" << endl;
@@ -258,14 +292,23 @@ yoruba::main_seda(int argc, char* argv[])
     } else if (args.FileCount() == 1) {
         input_file = args.File(0);
     } else if (input_file.empty()) {
-        cerr << NAME << " can't currently read from stdin, ask Doug about it" << endl;
-        return EXIT_FAILURE;
         input_file = "/dev/stdin";
     }
 
+    if ((opt_checkpoint || opt_resume) && output_file.empty()) {
+        cerr << NAME << " --checkpoint and --resume require -o FILE" << endl;
+        return usage();
+    }
+
     if (output_file.empty())
         output_file = "/dev/stdout";
 
+    if (opt_tmp_prefix.empty())
+        opt_tmp_prefix = output_file == "/dev/stdout" ? string("yoruba_duplicate") : output_file;
+    char pid[32];
+    sprintf(pid, ".%d", int(getpid()));
+    opt_tmp_prefix += pid;
+
     if (! opt_override) {
         cerr << NAME << " *** this command is not yet ready for general use ***" << endl;
         return usage();
@@ -292,11 +335,20 @@ yoruba::main_seda(int argc, char* argv[])
 
     //----------------- Open files, start reading data
 
-	BamReader reader;
-
-	if (! reader.Open(input_file)) {
-        cerr << NAME << " could not open BAM input" << endl;
+    profile.Begin("open");
+    // a piped input is spooled during pass 1 for reading again in pass 2
+    inputSpool spool;
+    if (! spool.Start(input_file, opt_tmp_prefix + ".spool"))
         return EXIT_FAILURE;
+
+    BamReader reader;
+
+    {
+        MEM_TAG(MEM_header);
+        if (! reader.Open(spool.FirstPass())) {
+            cerr << NAME << " could not open BAM input" << endl;
+            return EXIT_FAILURE;
+        }
     }
 
 #ifdef _IF_BAMTOOLS_IS_BROKEN
@@ -305,22 +357,53 @@ yoruba::main_seda(int argc, char* argv[])
     const SamHeader& header = reader.GetConstSamHeader();
 #endif
 
-    BamWriter writer;
-    BamWriter writer_dups;
-
-    if (! writer.Open(output_file, header, reader.GetReferenceData())) {
-        cerr << NAME << " could not open output " << output_file << endl;
-        return EXIT_FAILURE;
-    }
-
-    if (opt_duplicatefile && ! writer_dups.Open(duplicate_file, header, reader.GetReferenceData())) {
-        cerr << NAME << " could not open duplicate output file  " << duplicate_file << endl;
-        return EXIT_FAILURE;
+    // pass 2 handles records raw, which lets the output be cut at block
+    // boundaries for checkpoints
+    bamRawWriter writer;
+    bamRawWriter writer_dups;
+    // before any resume, so the indexes left at the checkpoint are continued
+    writer.IndexRecords(yviIndex::default_interval);
+    writer_dups.IndexRecords(yviIndex::default_interval);
+    vector<pair<string, bamRawWriter*> > writers(1, make_pair(output_file, &writer));
+    if (opt_duplicatefile)
+        writers.push_back(make_pair(duplicate_file, &writer_dups));
+    const string state_file = checkpointState::Filename(output_file);
+    checkpointState state;
+    state.command = checkpointState::Command(argc, argv);
+    int64_t resume_offset = -1;  // records before this only rebuild pass 2 state
+
+    if (opt_resume) {
+        checkpointState saved;
+        if (! saved.Read(state_file))
+            return EXIT_FAILURE;
+        if (saved.command != state.command) {
+            cerr << NAME << " " << state_file << " is a checkpoint of another command: "
+                << saved.command << endl;
+            return EXIT_FAILURE;
+        }
+        if (! saved.Restore(writers)) {
+            cerr << NAME << " could not resume from " << state_file << endl;
+            return EXIT_FAILURE;
+        }
+        resume_offset = saved.input_offset;
+        cerr << NAME << " resuming after " << saved.Counter("n_reads") << " reads" << endl;
+    } else {
+        if (! writer.Open(output_file, header.ToString(), reader.GetReferenceData())) {
+            cerr << NAME << " could not open output " << output_file << endl;
+            return EXIT_FAILURE;
+        }
+        if (opt_duplicatefile
+            && ! writer_dups.Open(duplicate_file, header.ToString(), reader.GetReferenceData())) {
+            cerr << NAME << " could not open duplicate output file  " << duplicate_file << endl;
+            return EXIT_FAILURE;
+        }
     }
 
 
     //----------------- Pass 1: Determine which reads are duplicates
 
+    profile.Begin("pass1");
+    progress.Input(input_file);
 
     dupMap dup_map;
 
@@ -339,6 +422,7 @@ yoruba::main_seda(int argc, char* argv[])
     int32_t last_Position = -1;
 
     if (reader.GetNextAlignment(al)) {
+        MEM_TAG(MEM_positions);
         al_set.push_back(al);
         last_RefID = al.RefID;
         last_Position = al.Position;
@@ -350,6 +434,8 @@ yoruba::main_seda(int argc, char* argv[])
 
 	while (! al_set.empty() && (opt_reads < 0 || n_reads < opt_reads)) {
 
+        MEM_TAG(MEM_positions);
+
         IF_DEBUG(3) 
             cerr << al_set.size() << " alignments at start of alignment-reading loop" << endl;
 
@@ -398,14 +484,8 @@ yoruba::main_seda(int argc, char* argv[])
             last_Position = al.Position;
             ++n_reads;
         }
-        
-        // because we eat reads in chunks, we rarely hit n_reads % opt_progress == 0
-        if ((opt_progress || DEBUG(1)) && (n_reads % opt_progress <= last_n_reads_mod))
-            cerr << NAME << "[pass1] " << n_reads << " reads examined"
-                << ", last at Ref = " << last_RefID << " Pos = " << last_Position
-                << ", size of dupMap = " << dup_map.size()
-                << endl;
-        last_n_reads_mod = n_reads % opt_progress;
+
+        progress.Reads(n_reads);
 	}
 
     if (opt_progress || DEBUG(1)) {
@@ -414,7 +494,9 @@ yoruba::main_seda(int argc, char* argv[])
             << ", size of dupMap = " << dup_map.size()
             << endl;
     }
+    profile.Reads(n_reads);
 
+    profile.Begin("cleanup");
     { // clean the map: remove PE reads with unseen mates
         size_t initial_size = dup_map.size();
         clear_dupMap(dup_map, dupMap_paired_one);
@@ -430,6 +512,7 @@ yoruba::main_seda(int argc, char* argv[])
 
     //----------------- Pass 2: dup_map holds names of duplicate reads
 
+    profile.Begin("pass2");
 
     IF_DEBUG(1) {
         cerr << NAME << "[pass2] ";
@@ -441,35 +524,51 @@ yoruba::main_seda(int argc, char* argv[])
     int64_t n_dupMap_entries_erased_SE = 0;
     int64_t n_dupMap_entries_erased_PE = 0;
 
-    reader.Rewind();
+    reader.Close();
+    if (! spool.Finish())
+        return EXIT_FAILURE;
+    bamRawReader raw_reader;
+    if (! raw_reader.Open(spool.SecondPass())) {
+        cerr << NAME << "[pass2] could not reopen BAM input" << endl;
+        return EXIT_FAILURE;
+    }
+    progress.Input(spool.SecondPass());
+    progress.Expect(n_reads_pass1);
+    bamRawRecord r;
 
-    // we nead the read name, so GetNextAlignmentCore() is insufficient
-	while (reader.GetNextAlignment(al) && (opt_reads < 0 || n_reads < opt_reads)) {
+    // when resuming, records before the checkpoint are read again to bring
+    // dup_map and the counts to where they were, but are not written
+	while (opt_reads < 0 || n_reads < opt_reads) {
+
+        const bool replay = raw_reader.Tell() < resume_offset;
+        if (! raw_reader.GetNextRecord(r))
+            break;
 
         ++n_reads;
 
-        dupMapI dupI = dup_map.find(al.Name);
+        dupMapI dupI = dup_map.find(r.Name());
+        bool ok = true;
 
         if (dupI == dup_map.end()) {  // we did not find this read name in dup_map
             
-            al.SetIsDuplicate(false);
+            r.SetFlag(r.Flag() & ~BAM_FDUP);
 
-            writer.SaveAlignment(al);
+            ok = replay || writer.Write(r);
             ++n_reads_written_to_output;
 
         } else {  // read name found in dup_map
 
-            al.SetIsDuplicate(true);
+            r.SetFlag(r.Flag() | BAM_FDUP);
 
             if (opt_duplicatefile) {
-                writer_dups.SaveAlignment(al);
+                ok = replay || writer_dups.Write(r);
                 ++n_reads_written_to_dups;
             }
 
             if (opt_remove) {
                 ++n_reads_removed;
             } else {
-                writer.SaveAlignment(al);
+                ok = (replay || writer.Write(r)) && ok;
                 ++n_reads_written_to_output;
             }
 
@@ -489,26 +588,33 @@ yoruba::main_seda(int argc, char* argv[])
             }
         }
 
-        if ((opt_progress && DEBUG(1)) && n_reads % opt_progress == 0) 
-            cerr << NAME << "[pass2] dupMap operations:"
-                << " erased " << n_dupMap_entries_erased_SE << " SE, "
-                << " erased " << n_dupMap_entries_erased_PE << " PE, "
-                << " decremented " << n_dupMap_entries_decremented << " PE halves" << endl;
-        if ((opt_progress || DEBUG(1)) && n_reads % opt_progress == 0) 
-            cerr << NAME << "[pass2] "
-                << n_reads << " reads seen, last at RefID = " << al.RefID 
-                << " Pos = " << al.Position << ", "
-                << n_reads_written_to_output << " written to " << output_file << ", "
-                << n_reads_written_to_dups << " written to " << duplicate_file << ", "
-                << n_reads_removed << " removed" << endl;
+        if (! ok) {
+            cerr << NAME << "[pass2] could not write output" << endl;
+            return EXIT_FAILURE;
+        }
+
+        if (! replay && opt_checkpoint && n_reads % opt_checkpoint == 0) {
+            state.counters["n_reads"] = n_reads;
+            state.counters["n_reads_written_to_output"] = n_reads_written_to_output;
+            state.counters["n_reads_written_to_dups"] = n_reads_written_to_dups;
+            state.counters["n_reads_removed"] = n_reads_removed;
+            if (! state.Save(state_file, raw_reader, writers))
+                return EXIT_FAILURE;
+        }
+
+        progress.Reads(n_reads);
 	}
+    if (raw_reader.Error()) {
+        cerr << NAME << "[pass2] could not read BAM input" << endl;
+        return EXIT_FAILURE;
+    }
 
     if (opt_progress && DEBUG(1))
         cerr << NAME << "[pass2] dupMap operations: "
             << " erased " << n_dupMap_entries_erased_SE << " SE, "
             << " erased " << n_dupMap_entries_erased_PE << " PE, "
             << " decremented " << n_dupMap_entries_decremented << " PE halves" << endl;
-    if ((opt_progress || DEBUG(1)) && n_reads % opt_progress == 0) 
+    if (opt_progress || DEBUG(1))
         cerr << NAME << "[pass2] "
             << n_reads << " reads seen, "
             << n_reads_written_to_output << " written to " << output_file << ", "
@@ -519,13 +625,18 @@ yoruba::main_seda(int argc, char* argv[])
         cerr << n_reads_pass1 << " reads in pass 1" << endl;
         cerr << n_reads << " reads in pass 2" << endl;
     }
+    profile.Reads(n_reads);
 
-	reader.Close();
-	writer.Close();
-    if (opt_duplicatefile)
-        writer_dups.Close();
+    profile.Begin("close");
+    raw_reader.Close();
+    if (! writer.Close() || (opt_duplicatefile && ! writer_dups.Close())) {
+        cerr << NAME << "[pass2] could not write output" << endl;
+        return EXIT_FAILURE;
+    }
+    if (opt_checkpoint || opt_resume)
+        remove(state_file.c_str());
 
-	return EXIT_SUCCESS;
+    return EXIT_SUCCESS;
 }
 
 
@@ -809,6 +920,7 @@ query_dupMap(const dupMap& this_dm)
 static void
 update_dupMap(alignmentList& al_set, dupMap& this_dm)
 {
+    MEM_TAG(MEM_dupMap);
     const string HERE = "update_dupMap():";
     IF_DEBUG(2) cerr << HERE << " received " << al_set.size() 
         << " duplicate alignments" << endl;
@@ -5,6 +5,7 @@
 
 // Std C/C++ includes
 #include <cstdlib>
+#include <cstdio>
 #include <iostream>
 #include <iomanip>
 #include <string>
@@ -18,6 +19,7 @@
 // #else
 #include <tr1/unordered_map>
 #include <tr1/unordered_set>
+#include <unistd.h>
 // #endif
 #include <new>
 
@@ -38,6 +40,13 @@
 #include "yoruba.h"
 // #include "yoruba_lightAlignment.h"  // do I need this for 'yoruba seda'?
 #include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_yvi.h"
+#include "yoruba_checkpoint.h"
+#include "yoruba_spool.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+#include "yoruba_memtrack.h"
 
 #ifndef _YORUBA_MAIN
 #define NAME "[yoruba_duplicate]"
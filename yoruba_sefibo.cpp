@@ -18,19 +18,19 @@
 //
 // process name-sorted BAM files with --name/-n
 // regular expression handling for matching strings
-// command line opotion processing via SimpleOpt.h
-// debugging options
-// lightweight alignment class to reduce memory usage?
+// xxx lightweight alignment class to reduce memory usage
+// xxx command line option processing via SimpleOpt.h
+// xxx debugging options
 //
 // Command line options
 //
-//   --read-orientation/-r FR|FF|RR|RF
+// xxx --read-orientation/-r FR|FF|RR|RF
 //   
-//   --insert-type/-t outer(5'L to 5'R)|inner (3'L to 3'R)|left(5'L to 3'R|right(3'R to 5'L)
+// xxx --insert-type/-t outer(5'L to 5'R)|inner (3'L to 3'R)|left(5'L to 3'R|right(3'R to 5'L)
 //
-//   --quantiles/-q <comma-separated list of quantiles to produce, 0-1>
+// xxx --quantiles/-q <comma-separated list of quantiles to produce, 0-1>
 //
-//   --bam-insert-size/-b  calculate statistics using insert size recorded in the BAM file
+// xxx --bam-insert-size/-b  calculate statistics using insert size recorded in the BAM file
 //
 //   --better-estimate  Adjust insert size estimate using complement of Kristoffer's gap size 
 //                      estimator.  In short, the set of reads that both map to the same contig
@@ -58,20 +58,34 @@
 
 // First, some definitions
 
-// tail
+// insert size
 //
-// The distance between the start of a mapped read and the appropriate end of
-// the reference sequence.  For a forward-oriented read, this is the distance
-// between the leftmost mapped position and the 3' end of the reference, and
-// has positive sign.  For a reverse-oriented read, this is the distance
-// between the rightmost mapped position and the 5' end of the reference, and
-// has negative sign.  The absolute value of the tail is the total number of
-// bases.
-
-// total tail
+// Calculated from the mapped extents of the two reads of a pair mapped to the
+// same reference, the left read being the one with the lesser position.  The
+// four types of insert size (--insert-type) are described in the usage.
+// Each pair is counted once in a histogram for its read group and for its
+// orientation (FR, RF or FF; RR pairs are counted as FF).
+
+// BAM insert size
+//
+// With --bam-insert-size, the insert size recorded in the TLEN field of each
+// record is used instead.  TLEN is positive for the leftmost read of a pair
+// and negative for its mate, so counting only records with TLEN > 0 counts
+// each pair once without pairing the reads, and the input need not be
+// sorted.  Records are read raw (yoruba_bamraw.h) and only their core fields
+// are examined, with BGZF decompression spread over --threads threads.
+
+// pending mates
+//
+// Otherwise reads are paired by a matePairer (yoruba_mates.h), which keeps the
+// first read of each pair seen as a packed sefiboMate, keyed by the hash of its
+// name, until its mate arrives or the input passes the mate's position.
+
+// histogram
 //
-// The sum of the absolute values of the tails for two link pair candidate
-// reads.
+// The histograms have a fixed size, independent of the number of pairs
+// (see yoruba_histogram.h), so memory use for the distributions does not
+// grow with the size of the BAM file.
 
 #include "yoruba_sefibo.h"
 
@@ -79,15 +93,106 @@ using namespace std;
 using namespace BamTools;
 using namespace yoruba;
 
-//options
-static string  output_bam_filename = "test.bam";
-static int64_t pairs_to_process = 20;
-static int64_t max_read_length = 101;
-static int64_t link_pair_total_tail = 1000;
-static int64_t link_pair_crit_tail = 999999;
-static bool    link_pair_diff_chrom = true;
-static int64_t mate_tail_est_crit = link_pair_total_tail + max_read_length;
-static bool    debug_ref_mate = false;
+// options
+static string            input_file;
+static string            output_file;  // defaults to stdout, set with -o FILE
+static insertType_t      opt_insert_type = INSERT_outer;
+static pairOrientation_t opt_orientation = ORIENT_N;  // ORIENT_N reports all
+static string            opt_quantiles = "0.05,0.25,0.5,0.75,0.95";
+static vector<double>    quantiles;
+static bool              opt_bam_insert_size = false;
+static int32_t           opt_threads = 0;
+static bool              opt_sample = false;
+static int32_t           opt_sample_window = 100000;
+static double            opt_sample_tolerance = 0.01;
+static int64_t           opt_sample_min_pairs = 10000;
+static int64_t           opt_sample_max_windows = 100000;
+static uint64_t          opt_seed = 1;
+static int32_t           opt_parallel = 0;
+static int64_t           opt_parallel_batch = 100000;
+static const double      sample_z = 1.96;  // for 95% confidence bounds
+static string            metrics_file;
+#ifdef _WITH_DEBUG
+static int32_t           opt_debug = 0;
+static double            debug_progress = 10;
+static int64_t           opt_reads = -1;
+static double            opt_progress = 0;
+#endif
+static bool              debug_ref_mate = false;
+
+// A read awaiting its mate, 12 bytes rather than a BamAlignment; the
+// matePairer keeps its coordinates and its mate's alongside
+
+struct sefiboMate {
+    int32_t position;
+    int32_t end_position;
+    bool    reverse;
+};
+
+
+//-------------------------------------
+
+
+// Adds the insert size of each pair to stats, and to all if given and the pair
+// has the orientation reported.  The read group is taken from the current
+// record, the second read of the pair.
+
+class sefiboPairs : public matePairerHandler<sefiboMate> {
+
+    public:
+        sefiboPairs(insertSizeStats& s, const bamRawRecord& r, insertHistogram* a = NULL)
+            : n_pairs(0), n_expired(0), n_mate_passed(0), n_collision(0),
+              stats(s), current(r), all(a), no_rg_idx(s.ReadGroupIndex("*"))
+        { }
+
+        void Paired(const sefiboMate& held, const sefiboMate& cur)
+        {
+            int32_t rg_idx = current.GetTagString("RG", rg) ? stats.ReadGroupIndex(rg) : no_rg_idx;
+            pairOrientation_t o = pairOrientation(held.reverse, cur.reverse);
+            int64_t insert = insertSize(opt_insert_type, 
+                                        held.position, held.end_position,
+                                        cur.position, cur.end_position);
+            stats.Add(rg_idx, o, insert);
+            if (all && (opt_orientation == ORIENT_N || o == opt_orientation))
+                all->Add(insert);
+            ++n_pairs;
+        }
+        void Orphaned(const sefiboMate& read, const orphan_t why)
+        {
+            switch (why) {
+                case ORPHAN_expired:     ++n_expired; break;
+                case ORPHAN_mate_passed: ++n_mate_passed; break;
+                case ORPHAN_collision:   ++n_collision; break;
+            }
+        }
+
+        int64_t n_pairs;
+        int64_t n_expired;      // mate not found where expected
+        int64_t n_mate_passed;  // mate expected earlier, so won't be seen
+        int64_t n_collision;    // read name hash collision
+
+    private:
+        insertSizeStats&    stats;
+        const bamRawRecord& current;
+        insertHistogram*    all;
+        const int32_t       no_rg_idx;
+        string              rg;
+
+};  // class sefiboPairs
+
+
+//-------------------------------------
+
+
+static sefiboMate
+mateOf(const bamRawRecord& r)
+{
+    sefiboMate m;
+    m.position = r.Position();
+    m.end_position = r.EndPosition();
+    m.reverse = r.IsReverseStrand();
+    return m;
+}
 
 
 //-------------------------------------
@@ -114,20 +219,39 @@ usage(bool long_help = false)
     cerr << "Either command invokes this function." << endl;
     cerr << endl;
     cerr << "\
-Calculate the insert size distribution among alignments in <in.bam>.\n\
+Calculate the insert size distribution among alignments in <in.bam>, which\n\
+must be coordinate-sorted.  Only pairs with both reads mapped to the same\n\
+reference sequence are used.\n\
 \n\
-Options: --read-orientation | -r  FR|FF|RR|RF          expected orientation of reads\n\
-         --insert-type | -t  outer|inner|left|right    insert type to calculate\n\
+Options: --read-orientation | -r  FR|FF|RR|RF          only report pairs with this orientation\n\
+         --insert-type | -t  outer|inner|left|right    insert type to calculate [outer]\n\
          --quantiles | -q LIST                         list of quantiles to report for distribution\n\
-         --better-estimate | -b                        improve insertion distribution calculation\n\
+                                                       [" << opt_quantiles << "]\n\
+         --bam-insert-size | -b                        use the insert size recorded in the BAM file\n\
+         --threads INT                                 additional threads for decompression [" << opt_threads << "]\n\
+         -o FILE | --output FILE                       report file name [default is stdout]\n\
+         --metrics FILE                                write progress metrics to FILE for Prometheus\n\
+\n\
+         --parallel INT                                pair reads on each reference in INT worker threads,\n\
+                                                       using the index [" << opt_parallel << "]\n\
+         --batch INT                                   with --parallel, batch references with fewer than\n\
+                                                       INT reads [" << opt_parallel_batch << "]\n\
+\n\
+         --sample                                      estimate from randomly-chosen windows, using the index\n\
+         --window INT                                  length of each sampled window [" << opt_sample_window << "]\n\
+         --tolerance FLOAT                             stop when quantile bounds are within FLOAT of the\n\
+                                                       estimate, relative [" << opt_sample_tolerance << "]\n\
+         --min-pairs INT                               sample at least INT pairs [" << opt_sample_min_pairs << "]\n\
+         --max-windows INT                             sample at most INT windows [" << opt_sample_max_windows << "]\n\
+         --seed INT                                    seed for choosing windows [" << opt_seed << "]\n\
 \n";
     if (long_help) {
         cerr << "\
-By default, all reads in the BAM file will be given the supplied read group.\n\
-If the dictionary already defines a read group with the same ID, its definition\n\
-will be replaced with the supplied information.  If the dictionary contains\n\
-other read groups, their definitions will remain in the BAM file header but\n\
-all reads will be given the supplied read group.\n\
+Insert sizes are accumulated separately for each read group and for each\n\
+orientation of the pair (FR, RF or FF, with RR pairs counted as FF).  One line\n\
+is reported for each read group and orientation containing pairs, unless\n\
+--read-orientation is given.  Quantiles are calculated from fixed-size\n\
+histograms, and are exact for insert sizes below 256 and within 1% above that.\n\
 \n\
 The --insert-type argument specifies the manner in which the insert size should\n\
 be calculated.  Assuming orientations relative to the forward strand, insert size\n\
@@ -142,9 +266,30 @@ is calculates as follows: \n\
     right   maximal 3' extent of the 5'-most read to maximal 3' extent \n\
             of the 3'-most read, exclusive of the left, inclusive of the right;\n\
 \n\
+Unmapped reads, secondary alignments, reads failing QC and duplicates are not\n\
+used.\n\
+\n\
+With --bam-insert-size, the TLEN field written by the mapper is used rather\n\
+than calculating insert sizes from the alignments.  TLEN is an outer insert\n\
+size, so --insert-type cannot be other than outer.  Reads are not paired, so\n\
+the input need not be sorted and memory use does not depend on the input.\n\
 \n\
+Reads awaiting their mates are kept in a table keyed by a hash of the read\n\
+name, and are dropped once the input passes the position at which the mate\n\
+should have appeared.  --threads adds threads for decompressing the input.\n\
 \n\
+With --parallel, each reference is paired separately by one of INT worker\n\
+threads, each reading its part of the file through the BAM index.  Work is\n\
+handed out largest reference first.  Small references are batched with their\n\
+neighbours so that each task holds at least --batch reads.\n\
 \n\
+With --sample, the BAM index is used to read windows of --window bp chosen at\n\
+random from the reference sequences, weighted by their length.  Windows do not\n\
+overlap, and sampling stops if there are no more.  Pairs with both reads in a\n\
+window are used.  After at least --min-pairs pairs, sampling stops\n\
+once the 95% confidence bounds of every requested quantile lie within\n\
+--tolerance of the estimate.  The bounds are reported after each quantile.\n\
+Windows much longer than the insert size avoid favouring short inserts.\n\
 \n";
     }
     cerr << "         -? | --help     longer help" << endl;
@@ -152,12 +297,11 @@ is calculates as follows: \n\
 #ifdef _WITH_DEBUG
     cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
     cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
-    cerr << "         --progress INT  print reads processed mod INT [" << opt_progress << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
     cerr << endl;
 #endif
     cerr << "Sefibo is the Yoruba (Nigeria) noun for 'insert'." << endl;
     cerr << endl;
-    }
 
     return EXIT_FAILURE;
 }
@@ -166,183 +310,814 @@ is calculates as follows: \n\
 //-------------------------------------
 
 
-int 
-yoruba::main_sefibo(int argc, char* argv[]) {
-
-	// first process options
-	if( argc < 2 ) {
-		return usage();
-	}
+// Accumulate insert sizes from the TLEN field of each record, see "BAM insert
+// size" above.  Only core fields are read unless there are read groups.
 
-	string filename = argv[1];
-	//cerr << "Printing alignments from file: " << filename << endl;
-	
-	BamReader reader;
-	if (!reader.Open(filename)) {
-        cerr << "could not open filename " << filename << ", exiting" << endl;
+static int
+bamInsertSizes(void)
+{
+    profile.Begin("open");
+    bgzfPool pool(opt_threads);
+    bamRawReader reader;
+    if (! reader.Open(input_file, &pool)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
         return EXIT_FAILURE;
     }
 
-    // Header can't be used to accurately determine sort order because samtools never
-    // changes it; instead, check after loading each read as is done with "samtools index"
+    const string& header = reader.HeaderText();
+    const bool has_rg = header.compare(0, 4, "@RG\t") == 0
+                        || header.find("\n@RG\t") != string::npos;
+
+    insertSizeStats stats;
+    const int32_t no_rg_idx = stats.ReadGroupIndex("*");
+
+    bamRawRecord r;
+    string rg, last_rg;
+    int32_t last_rg_idx = no_rg_idx;
+    int64_t n_reads = 0;
+    int64_t n_pairs = 0;
+    int64_t n_reads_skipped = 0;
+
+    profile.Begin("reads");
+    progress.Input(input_file);
+    while (reader.GetNextRecord(r) && (opt_reads < 0 || n_reads < opt_reads)) {
 
-    const SamHeader header = reader.GetHeader();
+        progress.Reads(++n_reads);
 
-    const RefVector refs = reader.GetReferenceData();
+        const uint16_t flag = r.Flag();
+        if ((flag & (BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP)) != BAM_FPAIRED
+            || (flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY | BAM_FQCFAIL | BAM_FDUP))
+            || r.MateRefID() != r.RefID() || r.InsertSize() <= 0) {
+            ++n_reads_skipped;
+            continue;
+        }
 
-	
-    BamWriter writer;
-    if (! output_bam_filename.empty()) {
-        if (! writer.Open(output_bam_filename, header, refs)) {
-            cerr << "Could not open BAM output file " << output_bam_filename << endl;
-            exit(1);
+        int32_t rg_idx = no_rg_idx;
+        if (has_rg && r.GetTagString("RG", rg)) {
+            // records of one read group tend to come in runs
+            if (rg != last_rg) {
+                last_rg = rg;
+                last_rg_idx = stats.ReadGroupIndex(rg);
+            }
+            rg_idx = last_rg_idx;
         }
-        cerr << filename << ": Done opening BAM output file " << output_bam_filename << endl;
-    }
-
-    alignmentMap read1Map;  // a single map, for all reads awaiting their mate
-    typedef map<string,int64_t> stringMap;
-    typedef stringMap::iterator stringMapI;
-    stringMap ref_mates;
-    // alignmentMap read1Map, read2Map;
-
-	BamAlignment full_al;
-    int64_t count = 0;
-    int64_t max_reads_in_map = 0;
-    int64_t n_reads_skipped_unmapped = 0;
-    int64_t n_reads_skipped_mate_unmapped = 0;
-    int64_t n_reads_skipped_wont_see_mate = 0;
-    int64_t n_reads_skipped_mate_tail_est = 0;
-    int64_t n_reads_skipped_ref_mate = 0;
+        pairOrientation_t o = pairOrientation(r.IsReverseStrand(), r.IsMateReverseStrand());
+        stats.Add(rg_idx, o, r.InsertSize());
+        ++n_pairs;
+    }
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("report");
+    reader.Close();
+
+    ofstream output_stream(output_file.c_str());
+    if (! output_stream) {
+        cerr << NAME << " could not open output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    stats.Report(output_stream, quantiles, opt_orientation);
+    output_stream.close();
+
+    if (opt_progress || DEBUG(1)) {
+        cerr << NAME << " " << n_reads << " total reads" << endl;
+        cerr << NAME << " " << n_pairs << " pairs used for insert sizes" << endl;
+        cerr << NAME << " " << n_reads_skipped << " reads skipped because filtered, mate on another reference or TLEN <= 0" << endl;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
+
+
+// True if the quantiles of h are known to within opt_sample_tolerance
+
+static bool
+sampleConverged(const insertHistogram& h)
+{
+    if (h.Count() < opt_sample_min_pairs)
+        return false;
+    for (size_t q = 0; q < quantiles.size(); ++q) {
+        int64_t lo, hi;
+        h.QuantileBounds(quantiles[q], sample_z, lo, hi);
+        double value = fabs(double(h.Quantile(quantiles[q])));
+        if (double(hi - lo) / 2.0 > opt_sample_tolerance * value)
+            return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// Accumulate insert sizes from windows chosen at random using the index.
+// Within each window reads are paired as for the full pass.
+
+static int
+sampleInsertSizes(void)
+{
+    profile.Begin("open");
+    bgzfPool pool(opt_threads);
+    bamRawReader reader;
+    if (! reader.Open(input_file, &pool)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    baiIndex index;
+    if (! index.Load(input_file)) {
+        cerr << NAME << " --sample requires a BAM index for " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    const RefVector& refs = reader.References();
+    if (index.ReferenceCount() != int32_t(refs.size())) {
+        cerr << NAME << " index " << index.IndexFile() << " does not match " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    // each reference is cut into slots of --window bp, from a random phase,
+    // skipping references the index says have no mapped reads; windows are
+    // slots drawn without replacement, so are weighted by reference length
+    // and never overlap
+    vector<int32_t> slot_ref;
+    vector<int32_t> slot_phase;
+    vector<int64_t> slot_cum;
+    int64_t n_slots = 0;
+    yorubaRandom random(opt_seed);
+    for (int32_t i = 0; i < int32_t(refs.size()); ++i) {
+        if (refs[i].RefLength <= 0 || index.Reference(i).linear.empty()
+            || (index.HasMetadata(i) && ! index.Mapped(i)))
+            continue;
+        const int32_t phase = int32_t(random.Below(opt_sample_window));
+        n_slots += (int64_t(refs[i].RefLength) + phase + opt_sample_window - 1) / opt_sample_window;
+        slot_ref.push_back(i);
+        slot_phase.push_back(phase);
+        slot_cum.push_back(n_slots);
+    }
+    if (! n_slots) {
+        cerr << NAME << " no reference sequences with mapped reads to sample" << endl;
+        return EXIT_FAILURE;
+    }
+    // slots drawn so far are swapped to the front of a virtual shuffle of
+    // 0..n_slots-1, holding only the entries moved
+    tr1::unordered_map<int64_t, int64_t> shuffled;
+    const int64_t max_windows = min(opt_sample_max_windows, n_slots);
+
+    insertSizeStats stats;
+    insertHistogram all;  // all read groups together, to check convergence
+    bamRawRecord r;
+    sefiboPairs pairs(stats, r, &all);
+    matePairer<sefiboMate> pairer(pairs);
+
+    int64_t n_windows = 0;
     int64_t n_reads = 0;
-    int64_t n_singleton_reads = 0;
-    int64_t last_RefID = -1;
-    int64_t last_Position = -1;
+    bool converged = false;
+
+    profile.Begin("sample");
+    while (n_windows < max_windows && ! (converged = sampleConverged(all))) {
+
+        const int64_t j = n_windows + int64_t(random.Below(n_slots - n_windows));
+        tr1::unordered_map<int64_t, int64_t>::iterator sI = shuffled.find(j);
+        const int64_t slot = sI == shuffled.end() ? j : sI->second;
+        sI = shuffled.find(n_windows);
+        shuffled[j] = sI == shuffled.end() ? n_windows : sI->second;
+        ++n_windows;
+
+        const size_t w = upper_bound(slot_cum.begin(), slot_cum.end(), slot) - slot_cum.begin();
+        const int32_t ref = slot_ref[w];
+        const int64_t k = slot - (w ? slot_cum[w - 1] : 0);
+        const int32_t beg = int32_t(max(int64_t(0), k * opt_sample_window - slot_phase[w]));
+        const int32_t end = int32_t(min(int64_t(refs[ref].RefLength),
+                                        (k + 1) * opt_sample_window - slot_phase[w]));
+
+        if (! reader.Seek(index.LinearOffset(ref, beg))) {
+            cerr << NAME << " could not seek within " << input_file << endl;
+            return EXIT_FAILURE;
+        }
+
+        while (reader.GetNextRecord(r)) {
+
+            if (r.RefID() < ref || (r.RefID() == ref && r.Position() < beg))
+                continue;
+            if (r.RefID() != ref || r.Position() >= end)
+                break;
+            ++n_reads;
+
+            const uint16_t flag = r.Flag();
+            if ((flag & (BAM_FPAIRED | BAM_FUNMAP | BAM_FMUNMAP)) != BAM_FPAIRED
+                || (flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY | BAM_FQCFAIL | BAM_FDUP))
+                || r.MateRefID() != r.RefID())
+                continue;
+
+            if (r.MatePosition() >= end)
+                continue;  // the mate is beyond the window
+            // reads whose mates are before the window are orphaned
+            pairer.Add(hashReadName(r.Name(), r.NameLength() - 1),
+                       r.RefID(), r.Position(), r.MateRefID(), r.MatePosition(), mateOf(r));
+        }
+        if (reader.Error()) {
+            cerr << NAME << " could not read BAM input " << input_file << endl;
+            return EXIT_FAILURE;
+        }
+        pairer.Finish();
+        progress.Reads(n_reads);
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("report");
+    reader.Close();
+
+    ofstream output_stream(output_file.c_str());
+    if (! output_stream) {
+        cerr << NAME << " could not open output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    stats.Report(output_stream, quantiles, opt_orientation, sample_z);
+    output_stream.close();
+
+    cerr << NAME << " " << n_windows << " windows of " << opt_sample_window << " bp sampled, "
+        << n_reads << " reads, " << all.Count() << " pairs used, "
+        << (converged ? "converged" : "DID NOT CONVERGE") << " within tolerance "
+        << opt_sample_tolerance << endl;
+
+    return EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
 
-    cerr << filename << ": Looking for up to " << pairs_to_process << " link pairs,"
-        << " total tail = " << link_pair_total_tail 
-        << " critical tail = " << link_pair_crit_tail 
-        << ", must be on diff chromosome = " << link_pair_diff_chrom << endl;
 
-	while (reader.GetNextAlignment(full_al) 
-           && (! pairs_to_process || count < pairs_to_process)) {
+// Counts of reads used and skipped while pairing, summed over workers
 
-        BamAlignment al = full_al;
+struct sefiboCounts {
+    int64_t n_reads;
+    int64_t n_pairs;
+    int64_t max_pending;
+    int64_t max_pending_bytes;
+    int64_t n_reads_skipped_unmapped;
+    int64_t n_reads_skipped_mate_unmapped;
+    int64_t n_reads_skipped_unpaired;
+    int64_t n_reads_skipped_filtered;
+    int64_t n_reads_skipped_diff_ref;
+    int64_t n_reads_skipped_wont_see_mate;
+    int64_t n_reads_skipped_ref_mate;
+    int64_t n_reads_skipped_name_collision;
+    sefiboCounts(void) { memset(this, 0, sizeof(*this)); }
+    void Merge(const sefiboCounts& o) {
+        n_reads += o.n_reads;
+        n_pairs += o.n_pairs;
+        // peaks of concurrent workers add up
+        max_pending += o.max_pending;
+        max_pending_bytes += o.max_pending_bytes;
+        n_reads_skipped_unmapped += o.n_reads_skipped_unmapped;
+        n_reads_skipped_mate_unmapped += o.n_reads_skipped_mate_unmapped;
+        n_reads_skipped_unpaired += o.n_reads_skipped_unpaired;
+        n_reads_skipped_filtered += o.n_reads_skipped_filtered;
+        n_reads_skipped_diff_ref += o.n_reads_skipped_diff_ref;
+        n_reads_skipped_wont_see_mate += o.n_reads_skipped_wont_see_mate;
+        n_reads_skipped_ref_mate += o.n_reads_skipped_ref_mate;
+        n_reads_skipped_name_collision += o.n_reads_skipped_name_collision;
+    }
+};
+
+
+//-------------------------------------
+
+
+// Pair reads from the reader's current position and add their insert sizes
+// to stats.  Reading stops at the end of the file, or if last_ref >= 0 at
+// the first record beyond last_ref or at or beyond virtual offset stop.
+// Returns false if the input is not coordinate-sorted or could not be read.
+
+static bool
+pairReads(bamRawReader& reader, const RefVector& refs,
+          const int32_t last_ref, const int64_t stop,
+          const int64_t max_reads,
+          insertSizeStats& stats, sefiboCounts& c, const bool report_progress)
+{
+    bamRawRecord r;
+    sefiboPairs pairs(stats, r);
+    // reads awaiting their mate on this reference, see yoruba_mates.h
+    matePairer<sefiboMate> pairer(pairs);
+
+    int64_t n_reads = 0;
+    int32_t last_RefID = -1;
+    int32_t last_Position = -1;
+
+    while ((max_reads < 0 || n_reads < max_reads)
+           && (stop < 0 || reader.Tell() < stop)
+           && reader.GetNextRecord(r)) {
+
+        if (last_ref >= 0 && r.RefID() > last_ref)
+            break;
 
-        //printAlignmentInfo(al, refs);
-        //++count;
         ++n_reads;
+        ++c.n_reads;
 
-        if (last_RefID < 0) last_RefID = al.RefID;
-        if (last_Position < 0) last_Position = al.Position;
-        if (al.RefID > last_RefID) {
-            // We've moved to the next reference sequence
-            // Clean up reads with mates expected here that haven't been seen
-            if (debug_ref_mate) {
-                cerr << "MISSED " << ref_mates.size() << " ref_mates on this reference "
-                    << last_RefID << " " << refs[last_RefID].RefName << endl;
-            }
-            for (stringMapI rmI = ref_mates.begin(); rmI != ref_mates.end(); ++rmI) {
-                ++n_reads_skipped_ref_mate;
-                read1Map.erase(read1Map.find(rmI->first));
-                ref_mates.erase(ref_mates.find(rmI->first));
-            }
-            last_RefID = al.RefID;
-            last_Position = al.Position;
-        } else if (al.RefID < last_RefID) {
-            cerr << filename << " does not appear to be sorted, chromosome out of order: "
-                 << last_RefID << " (" << refs[last_RefID].RefName << ") "
-                 << al.RefID << " (" << refs[al.RefID].RefName << ") " << endl;
-            exit(1);
-        } else if (al.Position < last_Position) {
-            cerr << filename << " does not appear to be sorted, reads out of order: "
-                 << last_Position << " (last read) "
-                 << al.Position << " (" << al.Name << ")" << endl;
-            exit(1);
+        if (report_progress)
+            progress.Reads(n_reads);
+
+        if (! r.IsMapped()) { ++c.n_reads_skipped_unmapped; continue; }
+
+        if (last_RefID < 0) last_RefID = r.RefID();
+        if (last_Position < 0) last_Position = r.Position();
+        if (! isCoordinateSorted(r.RefID(), r.Position(), last_RefID, last_Position)) {
+            cerr << NAME << " input is not coordinate-sorted, " << r.Name() 
+                << " out of position" << endl;
+            return false;
         }
+        if (r.RefID() != last_RefID && debug_ref_mate) {
+            cerr << "MISSED " << pairer.Size() << " ref_mates on this reference "
+                << last_RefID << " " << refs[last_RefID].RefName << endl;
+        }
+        // mates expected at positions we have passed will not be seen
+        pairer.Advance(r.RefID(), r.Position());
+        last_RefID = r.RefID();
+        last_Position = r.Position();
 
-        if (! al.IsMapped()) { ++n_reads_skipped_unmapped; continue; }
+        if (! r.IsPaired()) { ++c.n_reads_skipped_unpaired; continue; }
 
-        if (! al.IsMateMapped()) { ++n_reads_skipped_mate_unmapped; continue; }
+        if (! r.IsMateMapped()) { ++c.n_reads_skipped_mate_unmapped; continue; }
 
-        alignmentMapI mI = read1Map.find(al.Name);
+        if (! r.IsPrimaryAlignment() || r.IsFailedQC() || r.IsDuplicate()) { 
+            ++c.n_reads_skipped_filtered; 
+            continue;
+        }
 
-        if (mI == read1Map.end()) {
-            // the read name has not been seen before
+        if (r.MateRefID() != r.RefID()) { ++c.n_reads_skipped_diff_ref; continue; }
 
-            if (al.MateRefID < al.RefID
-                || (al.MateRefID == al.RefID && al.MatePosition < al.Position)) {
-                // we should have seen its mate earlier, so skip it
-                ++n_reads_skipped_wont_see_mate;
-                continue;
-            }
+        // held until its mate arrives, or paired with it if already held
+        pairer.Add(hashReadName(r.Name(), r.NameLength() - 1),
+                   r.RefID(), r.Position(), r.MateRefID(), r.MatePosition(), mateOf(r));
 
-            // If the mate likely to also be a link pair candidate, add the read
-            int64_t mate_tail_est = readTailS(al.IsMateMapped(), al.IsMateReverseStrand(),
-                            al.MatePosition, refs[al.MateRefID].RefLength, max_read_length);
-            if (mate_tail_est <= mate_tail_est_crit) {
-                // the mate tail estimate suggests it might be a link pair candidate
-                read1Map[al.Name] = al;  // add the read to the map
-            } else {
-                // the mate tail estimate appears too long for the mate to be a candidate
-                ++n_reads_skipped_mate_tail_est;
-                continue;
-            }
+    }
+    if (reader.Error())
+        return false;
 
-            if (read1Map.size() > max_reads_in_map) max_reads_in_map = read1Map.size();
-            if (al.MateRefID == al.RefID && al.MatePosition >= al.Position) {
-                // the mate is expected later on this contig
-                ref_mates[al.Name] = al.MateRefID;
-            }
+    pairer.Finish();
+    c.n_pairs += pairs.n_pairs;
+    c.n_reads_skipped_ref_mate += pairs.n_expired;
+    c.n_reads_skipped_wont_see_mate += pairs.n_mate_passed;
+    c.n_reads_skipped_name_collision += pairs.n_collision;
+    if (pairer.MaxSize() > c.max_pending) c.max_pending = pairer.MaxSize();
+    if (pairer.MaxBytes() > c.max_pending_bytes) c.max_pending_bytes = pairer.MaxBytes();
 
-        } else {
-            // get the mate's alignment, and process the pair
+    return true;
+}
 
-            const BamAlignment& al_mate = mI->second;
 
-            if (processReadPair(al, al_mate, refs, link_pair_total_tail, 
-                                link_pair_crit_tail, link_pair_diff_chrom)) {
-                ++count;
+//-------------------------------------
 
-                // write to the new BAM file, if the string is not empty
-                if (! output_bam_filename.empty()) {
-                    writer.SaveAlignment(al_mate);  // the first one seen
-                    writer.SaveAlignment(al);  // the second one seen
-                }
-            }
 
-            read1Map.erase(mI);
+static int
+report(const insertSizeStats& stats, const sefiboCounts& c)
+{
+    ofstream output_stream(output_file.c_str());
+    if (! output_stream) {
+        cerr << NAME << " could not open output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    stats.Report(output_stream, quantiles, opt_orientation);
+    output_stream.close();
+
+    if (opt_progress || DEBUG(1)) {
+        cerr << NAME << " " << c.n_reads << " total reads" << endl;
+        cerr << NAME << " " << c.n_pairs << " pairs used for insert sizes" << endl;
+        cerr << NAME << " " << c.max_pending << " maximum number of reads awaiting mates, "
+            << c.max_pending_bytes << " bytes" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_unmapped << " reads skipped because unmapped" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_unpaired << " reads skipped because not paired" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_mate_unmapped << " reads skipped because mate unmapped" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_filtered << " reads skipped because secondary, QC fail or duplicate" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_diff_ref << " reads skipped because mate on another reference" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_wont_see_mate << " reads skipped because mate won't be seen" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_ref_mate << " reads skipped because mate not found on reference" << endl;
+        cerr << NAME << " " << c.n_reads_skipped_name_collision << " reads skipped because of a read name hash collision" << endl;
+    }
+
+	return EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
+
+
+// A span of the input holding the records of one or more consecutive
+// references, for one worker to pair
+
+struct sefiboTask {
+    int32_t first_ref;
+    int32_t last_ref;
+    int64_t beg;     // virtual offsets
+    int64_t end;
+    int64_t reads;   // from the index, or an estimate
+    bool operator<(const sefiboTask& other) const { return reads > other.reads; }
+};
+
+// State shared by the workers
+
+struct sefiboWork {
+    const vector<sefiboTask>* tasks;
+    size_t                    next_task;
+    const vector<string>*     read_groups;
+    bgzfPool*                 pool;
+    insertSizeStats           stats;
+    sefiboCounts              counts;
+    int64_t                   n_reads_done;  // by finished tasks, for progress
+    bool                      ok;
+    pthread_mutex_t           mutex;
+};
+
+
+//-------------------------------------
 
-            if (al.MateRefID == al.RefID) {
-                stringMapI rmI = ref_mates.find(al.Name);
-                if (rmI == ref_mates.end()) {
-                    cerr << "expected a ref_mate, couldn't find its name: " << al.Name << endl;
-                    exit(1);
-                }
-                ref_mates.erase(rmI);
-            }
 
+// Worker thread: take tasks from the queue, largest first, pairing reads in
+// each with its own reader, and merge its statistics when the queue is empty
+
+static void*
+pairReadsWorker(void* arg)
+{
+    sefiboWork& work = *static_cast<sefiboWork*>(arg);
+    insertSizeStats stats;
+    sefiboCounts counts;
+    bool ok = true;
+    // register read groups in header order so the report order is fixed
+    stats.ReadGroupIndex("*");
+    for (size_t i = 0; i < work.read_groups->size(); ++i)
+        stats.ReadGroupIndex((*work.read_groups)[i]);
+
+    bamRawReader reader;
+    if (! reader.Open(input_file, work.pool)) {
+        cerr << NAME << " worker could not open BAM input " << input_file << endl;
+        ok = false;
+    }
+    while (ok) {
+        pthread_mutex_lock(&work.mutex);
+        const sefiboTask* task = (work.ok && work.next_task < work.tasks->size())
+                                 ? &(*work.tasks)[work.next_task++] : NULL;
+        pthread_mutex_unlock(&work.mutex);
+        if (! task)
+            break;
+        if (! reader.Seek(task->beg)) {
+            cerr << NAME << " worker could not seek within " << input_file << endl;
+            ok = false;
+            break;
+        }
+        sefiboCounts task_counts;
+        ok = pairReads(reader, reader.References(), task->last_ref, task->end, 
+                       opt_reads, stats, task_counts, false);
+        // a worker's tasks run one after another, so its peak is the largest
+        counts.max_pending = max(counts.max_pending, task_counts.max_pending);
+        counts.max_pending_bytes = max(counts.max_pending_bytes, task_counts.max_pending_bytes);
+        task_counts.max_pending = task_counts.max_pending_bytes = 0;
+        counts.Merge(task_counts);
+        pthread_mutex_lock(&work.mutex);
+        work.n_reads_done += task_counts.n_reads;
+        progress.Reads(work.n_reads_done);
+        pthread_mutex_unlock(&work.mutex);
+    }
+    reader.Close();
+
+    pthread_mutex_lock(&work.mutex);
+    work.stats.Merge(stats);
+    work.counts.Merge(counts);
+    if (! ok)
+        work.ok = false;
+    pthread_mutex_unlock(&work.mutex);
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+// Pair reads on each reference separately, in opt_parallel worker threads.
+// The index gives the span of the file holding each reference and its read
+// count.  References with few reads are batched with their neighbours into
+// tasks of at least min_task_reads, and tasks are queued largest first.
+
+static int
+parallelInsertSizes(void)
+{
+    profile.Begin("open");
+    bamRawReader reader;
+    if (! reader.Open(input_file)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    const RefVector refs = reader.References();
+    const string header = reader.HeaderText();
+    reader.Close();
+
+    baiIndex index;
+    if (! index.Load(input_file)) {
+        cerr << NAME << " --parallel requires a BAM index for " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    if (index.ReferenceCount() != int32_t(refs.size())) {
+        cerr << NAME << " index " << index.IndexFile() << " does not match " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    // the span and read count of each reference with records
+    vector<sefiboTask> spans;
+    int64_t total_reads = 0;
+    bool counted = true;  // total_reads is a count, not an estimate
+    for (int32_t i = 0; i < index.ReferenceCount(); ++i) {
+        sefiboTask t;
+        t.first_ref = t.last_ref = i;
+        const baiReference& ref = index.Reference(i);
+        if (ref.has_metadata) {
+            t.beg = ref.ref_beg;
+            t.end = ref.ref_end;
+            t.reads = ref.n_mapped + ref.n_unmapped;
+        } else {
+            // without counts, use the compressed size of the span as an estimate
+            baiChunkVector chunks = index.Chunks(i, 0, 1 << 29);
+            if (chunks.empty())
+                continue;
+            t.beg = chunks.front().beg;
+            t.end = chunks.back().end;
+            t.reads = bgzfBlockOffset(t.end - t.beg) + 1;
+            counted = false;
+        }
+        if (t.reads <= 0 || t.end <= t.beg)
+            continue;
+        spans.push_back(t);
+        total_reads += t.reads;
+    }
+
+    // batch neighbouring small references
+    const int64_t min_task_reads = max(int64_t(opt_parallel_batch),
+                                       total_reads / (int64_t(opt_parallel) * 64));
+    vector<sefiboTask> tasks;
+    for (size_t i = 0; i < spans.size(); ++i) {
+        if (! tasks.empty() && tasks.back().reads < min_task_reads
+            && spans[i].reads < min_task_reads) {
+            tasks.back().last_ref = spans[i].last_ref;
+            tasks.back().end = spans[i].end;
+            tasks.back().reads += spans[i].reads;
+        } else {
+            tasks.push_back(spans[i]);
         }
+    }
+    sort(tasks.begin(), tasks.end());
+
+    if (DEBUG(1))
+        cerr << NAME << " " << spans.size() << " references with reads in "
+            << tasks.size() << " tasks for " << opt_parallel << " workers" << endl;
 
+    // read group IDs from the header, in order
+    vector<string> read_groups;
+    istringstream hs(header);
+    string line;
+    while (getline(hs, line)) {
+        if (line.compare(0, 4, "@RG\t") != 0)
+            continue;
+        size_t id = line.find("\tID:");
+        if (id != string::npos)
+            read_groups.push_back(line.substr(id + 4, line.find('\t', id + 4) - (id + 4)));
+    }
+
+    bgzfPool pool(opt_threads);
+    sefiboWork work;
+    work.tasks = &tasks;
+    work.next_task = 0;
+    work.read_groups = &read_groups;
+    work.pool = opt_threads ? &pool : NULL;
+    work.n_reads_done = 0;
+    work.ok = true;
+    work.stats.ReadGroupIndex("*");
+    for (size_t i = 0; i < read_groups.size(); ++i)
+        work.stats.ReadGroupIndex(read_groups[i]);
+    pthread_mutex_init(&work.mutex, NULL);
+
+    profile.Begin("reads");
+    // the workers seek about the file, so progress is by reads counted
+    if (counted)
+        progress.Expect(total_reads);
+    vector<pthread_t> workers(opt_parallel);
+    for (int32_t i = 0; i < opt_parallel; ++i)
+        pthread_create(&workers[i], NULL, pairReadsWorker, &work);
+    for (int32_t i = 0; i < opt_parallel; ++i)
+        pthread_join(workers[i], NULL);
+    pthread_mutex_destroy(&work.mutex);
+
+    if (! work.ok)
+        return EXIT_FAILURE;
+    profile.Reads(work.counts.n_reads);
+
+    profile.Begin("report");
+    return report(work.stats, work.counts);
+}
+
+
+//-------------------------------------
+
+
+int 
+yoruba::main_sefibo(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
 	}
 
-	cerr << "===============================" << endl;
-    cerr << read1Map.size() << " alignments left in read1Map" << endl;
-    cerr << max_reads_in_map << " maximum number of reads in read1Map" << endl;
-    cerr << count << " pairs processed" << endl;
-	cerr << "===============================" << endl;
-    cerr << n_reads << " total reads" << endl;
-    cerr << n_singleton_reads << " singleton reads" << endl;
-    cerr << n_reads_skipped_unmapped << " reads skipped because unmapped" << endl;
-    cerr << n_reads_skipped_mate_unmapped << " reads skipped because mate unmapped" << endl;
-    cerr << n_reads_skipped_wont_see_mate << " reads skipped because mate won't be seen" << endl;
-    cerr << n_reads_skipped_mate_tail_est << " reads skipped because mate tail appears too long" << endl;
-    cerr << n_reads_skipped_ref_mate << " reads skipped because mate not on reference" << endl;
-
-	reader.Close();
-    if (! output_bam_filename.empty()) {
-	    writer.Close();
+    enum { OPT_orientation, OPT_insert_type, OPT_quantiles, OPT_output,
+        OPT_bam_insert_size, OPT_threads, OPT_metrics,
+        OPT_parallel, OPT_batch,
+        OPT_sample, OPT_window, OPT_tolerance, OPT_min_pairs, OPT_max_windows, OPT_seed,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_reads, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption sefibo_options[] = {
+        { OPT_orientation,     "--read-orientation", SO_REQ_SEP },
+        { OPT_orientation,     "-r",                SO_REQ_SEP },
+        { OPT_insert_type,     "--insert-type",     SO_REQ_SEP },
+        { OPT_insert_type,     "-t",                SO_REQ_SEP },
+        { OPT_quantiles,       "--quantiles",       SO_REQ_SEP },
+        { OPT_quantiles,       "-q",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_bam_insert_size, "--bam-insert-size", SO_NONE },
+        { OPT_bam_insert_size, "-b",                SO_NONE },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_parallel,        "--parallel",        SO_REQ_SEP },
+        { OPT_batch,           "--batch",           SO_REQ_SEP },
+        { OPT_sample,          "--sample",          SO_NONE },
+        { OPT_window,          "--window",          SO_REQ_SEP },
+        { OPT_tolerance,       "--tolerance",       SO_REQ_SEP },
+        { OPT_min_pairs,       "--min-pairs",       SO_REQ_SEP },
+        { OPT_max_windows,     "--max-windows",     SO_REQ_SEP },
+        { OPT_seed,            "--seed",            SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE }, 
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, sefibo_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_orientation) {
+            if (! parsePairOrientation(args.OptionArg(), opt_orientation)) {
+                cerr << NAME << " unknown read orientation '" << args.OptionArg() << "'" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_insert_type) {
+            if (! parseInsertType(args.OptionArg(), opt_insert_type)) {
+                cerr << NAME << " unknown insert type '" << args.OptionArg() << "'" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_quantiles) {
+            opt_quantiles = args.OptionArg();
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_bam_insert_size) {
+            opt_bam_insert_size = true;
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_parallel) {
+            opt_parallel = atoi(args.OptionArg());
+            if (opt_parallel < 0) {
+                cerr << NAME << " --parallel must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_batch) {
+            opt_parallel_batch = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_sample) {
+            opt_sample = true;
+        } else if (args.OptionId() == OPT_window) {
+            opt_sample_window = atoi(args.OptionArg());
+            if (opt_sample_window < 1) {
+                cerr << NAME << " --window must be greater than 0" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_tolerance) {
+            opt_sample_tolerance = atof(args.OptionArg());
+            if (opt_sample_tolerance <= 0.0) {
+                cerr << NAME << " --tolerance must be greater than 0" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_min_pairs) {
+            opt_sample_min_pairs = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_max_windows) {
+            opt_sample_max_windows = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_seed) {
+            opt_seed = strtoull(args.OptionArg(), NULL, 10);
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "insertsize", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (! parseQuantiles(opt_quantiles, quantiles)) {
+        cerr << NAME << " quantiles must be a comma-separated list of values within 0-1" << endl;
+        return usage();
     }
-	return EXIT_SUCCESS;
+
+    if (opt_bam_insert_size && opt_insert_type != INSERT_outer) {
+        cerr << NAME << " BAM insert sizes are outer, so --bam-insert-size requires --insert-type outer" << endl;
+        return usage();
+    }
+
+    if (opt_parallel && (opt_sample || opt_bam_insert_size)) {
+        cerr << NAME << " --parallel cannot be combined with --sample or --bam-insert-size" << endl;
+        return usage();
+    }
+
+    if (opt_sample && opt_bam_insert_size) {
+        cerr << NAME << " --sample cannot be combined with --bam-insert-size" << endl;
+        return usage();
+    }
+
+    if (args.FileCount() > 1) {
+        cerr << NAME << " requires at most one BAM file specified as input" << endl;
+        return usage();
+    } else if (args.FileCount() == 1) {
+        input_file = args.File(0);
+    } else if (input_file.empty()) {
+        input_file = "/dev/stdin";
+    }
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    if (opt_bam_insert_size)
+        return bamInsertSizes();
+
+    if (opt_sample)
+        return sampleInsertSizes();
+
+    if (opt_parallel)
+        return parallelInsertSizes();
+
+    //----------------- Open input BAM
+
+    profile.Begin("open");
+    bgzfPool pool(opt_threads);
+    bamRawReader reader;
+    if (! reader.Open(input_file, &pool)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Header can't be used to accurately determine sort order because samtools never
+    // changes it; instead, check after loading each read as is done with "samtools index"
+
+    //----------------- Pair reads and accumulate insert sizes
+
+    profile.Begin("reads");
+    progress.Input(input_file);
+    insertSizeStats stats;
+    sefiboCounts counts;
+    if (! pairReads(reader, reader.References(), -1, -1, opt_reads, stats, counts, true))
+        return EXIT_FAILURE;
+    profile.Reads(counts.n_reads);
+
+    //----------------- Report
+
+    profile.Begin("report");
+    reader.Close();
+    return report(stats, counts);
 }
 
@@ -9,6 +9,14 @@
 #include <iomanip>
 #include <string>
 #include <list>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <tr1/unordered_map>
+#include <pthread.h>
 
 // BamTools includes: https://github.com/pezmaster31/bamtools
 #include "api/BamMultiReader.h"
@@ -27,8 +35,12 @@
 // Yoruba includes
 #include "yoruba.h"
 #include "yoruba_util.h"
-// #include "ibejiAlignment.h"  lightweight alignment class not completed
-#include "processReadPair.h"  // needed for now, probably not in future
+#include "yoruba_histogram.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_mates.h"
+#include "yoruba_bai.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
 
 #ifndef _YORUBA_MAIN
 #define NAME "[yoruba_insertsize]"
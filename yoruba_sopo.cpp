@@ -0,0 +1,239 @@
+// yoruba_sopo.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Concatenate BAM files sharing a reference dictionary, copying their
+// compressed blocks.
+//
+// Sopọ̀ is the Yoruba (Nigeria) verb for 'join together'.
+
+// headers
+//
+// Every input must have the reference dictionary of the first, the same
+// names and lengths in the same order, since records are copied without
+// being decoded and their reference IDs cannot be remapped.  Inputs that
+// differ can be combined with merge.  The output header is the union of the
+// input headers (headerUnion() in yoruba_sort.h), and with more than one
+// input its sort order is set to unsorted.
+
+// blocks
+//
+// The record stream of each input begins at the virtual offset of its first
+// record, and is copied by bamCopyRecords() (yoruba_bamraw.h).  If that falls
+// inside a block, the block also holds the end of the header, so it is
+// decompressed and the records in it are written through the output's
+// compressor.  Every block after it is copied verbatim in large reads,
+// skipping empty blocks, among them the EOF marker.  samtools and yoruba
+// start records in a new block, so for their files nothing is decompressed or
+// compressed but the output header.
+
+#include "yoruba_sopo.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static vector<string> input_files;
+static string       output_file;  // defaults to stdout, set with -o FILE
+static int32_t      opt_level = -1;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_sopo(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " cat [options] <in1.bam> <in2.bam> ..." << endl;
+    cerr << "         " << YORUBA_NAME << " sopo [options] <in1.bam> <in2.bam> ..." << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Concatenate BAM files with identical reference dictionaries, copying their\n\
+compressed blocks without decompressing them.\n\
+\n\
+Options: -l INT | --level INT    compression level of the output header, -1 for zlib default [" << opt_level << "]\n\
+         -o FILE | --output FILE output BAM file [default is stdout]\n\
+\n";
+    if (long_help) {
+        cerr << "\
+Every input must have the same reference sequences, in the same order, as the\n\
+first.  Use merge to combine inputs whose dictionaries differ.  The output\n\
+header has the @HD line of the first input, the @SQ lines, and the other lines\n\
+of all inputs, identical lines kept once.  An @RG or @PG line repeating an ID\n\
+with different content is dropped with a warning.  With more than one input,\n\
+the header is given SO:unsorted.\n\
+\n\
+Only a block holding both the end of the header and records is decompressed,\n\
+and its records compressed again.  Empty blocks, among them the EOF marker of\n\
+each input, are dropped.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Sopo is the Yoruba (Nigeria) verb for 'join together'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_sopo(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_level, OPT_output,
+#ifdef _WITH_DEBUG
+        OPT_debug,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption sopo_options[] = {
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, sopo_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (args.FileCount() < 1) {
+        cerr << NAME << " requires one or more BAM files specified as input" << endl;
+        return usage();
+    }
+    for (int i = 0; i < args.FileCount(); ++i)
+        input_files.push_back(args.File(i));
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    //----------------- Read and check headers
+
+    profile.Begin("headers");
+    vector<string>  texts;
+    vector<int64_t> starts;  // virtual offset of the first record
+    RefVector       refs;
+    for (size_t i = 0; i < input_files.size(); ++i) {
+        bamRawReader reader;
+        if (! reader.Open(input_files[i])) {
+            cerr << NAME << " could not open BAM input " << input_files[i] << endl;
+            return EXIT_FAILURE;
+        }
+        const RefVector& in_refs = reader.References();
+        if (i == 0) {
+            refs = in_refs;
+        } else {
+            bool same = in_refs.size() == refs.size();
+            for (size_t j = 0; same && j < refs.size(); ++j)
+                same = in_refs[j].RefName == refs[j].RefName
+                       && in_refs[j].RefLength == refs[j].RefLength;
+            if (! same) {
+                cerr << NAME << " reference sequences of " << input_files[i]
+                    << " differ from those of " << input_files[0]
+                    << ", use merge to combine them" << endl;
+                return EXIT_FAILURE;
+            }
+        }
+        texts.push_back(reader.HeaderText());
+        starts.push_back(reader.FirstRecordOffset());
+        reader.Close();
+        if (DEBUG(1))
+            cerr << NAME << " " << input_files[i] << " records start at block "
+                << bgzfBlockOffset(starts.back()) << " offset "
+                << bgzfWithinBlockOffset(starts.back()) << endl;
+    }
+
+    vector<pair<size_t, string> > dropped;
+    string header = headerUnion(texts, refs, dropped);
+    for (size_t i = 0; i < dropped.size(); ++i)
+        cerr << NAME << " warning: dropping " << dropped[i].second.substr(0, 3) << " line from "
+            << input_files[dropped[i].first] << ", its ID is that of an earlier input: "
+            << dropped[i].second << endl;
+    if (input_files.size() > 1)
+        header = headerWithSortOrder(header, SORT_unsorted);
+
+    //----------------- Copy blocks
+
+    profile.Begin("copy");
+    bamRawWriter writer;
+    if (! writer.Open(output_file, header, refs, NULL, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+    int64_t n_copied = 0, n_recompressed = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < input_files.size(); ++i)
+        ok = bamCopyRecords(input_files[i], starts[i], -1, writer, n_copied, n_recompressed);
+    profile.Begin("close");
+    if (! writer.Close() && ok) {
+        cerr << NAME << " could not write BAM output " << output_file << endl;
+        ok = false;
+    }
+    if (! ok)
+        return EXIT_FAILURE;
+
+    cerr << NAME << " " << input_files.size() << " input" << PLURAL(input_files.size())
+        << " concatenated, " << n_copied << " block" << PLURAL(n_copied) << " copied, "
+        << n_recompressed << " recompressed" << endl;
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,36 @@
+// yoruba_sopo.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_SOPO_H_
+#define _YORUBA_SOPO_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_sort.h"
+#include "yoruba_profile.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_cat]"
+#endif
+
+// Functions defined in yoruba_sopo.cpp
+//
+namespace yoruba {
+
+int  main_sopo(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_SOPO_H_
@@ -0,0 +1,175 @@
+// yoruba_sort.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Sort keys, radix sort and headers, see yoruba_sort.h.
+
+
+#include <sstream>
+#include <tr1/unordered_map>
+
+#include "yoruba_sort.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+const char*
+yoruba::sortOrderName(const sortOrder_t o)
+{
+    switch (o) {
+        case SORT_coordinate: return "coordinate";
+        case SORT_name:       return "queryname";
+        default:              return "unsorted";
+    }
+}
+
+
+//-------------------------------------
+
+
+void
+yoruba::radixSort(vector<sortEntry>& entries, vector<sortEntry>& tmp)
+{
+    const size_t n = entries.size();
+    if (n < 2)
+        return;
+
+    // count every byte of every key in one pass
+    vector<size_t> count(8 * 256, 0);
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t key = entries[i].key;
+        for (int b = 0; b < 8; ++b, key >>= 8)
+            ++count[b * 256 + (key & 0xff)];
+    }
+
+    tmp.resize(n);
+    sortEntry* from = &entries[0];
+    sortEntry* to = &tmp[0];
+    for (int b = 0; b < 8; ++b) {
+        size_t* c = &count[b * 256];
+        // a byte the same in every key leaves the order as it is
+        if (c[(from[0].key >> (8 * b)) & 0xff] == n)
+            continue;
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            const size_t t = c[d];
+            c[d] = sum;
+            sum += t;
+        }
+        for (size_t i = 0; i < n; ++i)
+            to[c[(from[i].key >> (8 * b)) & 0xff]++] = from[i];
+        swap(from, to);
+    }
+    if (from != &entries[0])
+        entries.swap(tmp);
+}
+
+
+//-------------------------------------
+
+
+string
+yoruba::headerWithSortOrder(const string& text, const sortOrder_t o)
+{
+    string so = string("SO:") + sortOrderName(o);
+    if (o == SORT_name)
+        so += "\tSS:queryname:lexicographical";
+    else if (o == SORT_collated)
+        so += "\tGO:query";
+
+    if (text.compare(0, 4, "@HD\t") != 0)
+        return "@HD\tVN:1.6\t" + so + "\n" + text;
+
+    size_t eol = text.find('\n');
+    if (eol == string::npos)
+        eol = text.size();
+    istringstream hd(text.substr(4, eol - 4));
+    string hd_line = "@HD", tag;
+    while (getline(hd, tag, '\t')) {
+        if (tag.compare(0, 3, "SO:") == 0 || tag.compare(0, 3, "GO:") == 0
+            || tag.compare(0, 3, "SS:") == 0 || tag.empty())
+            continue;
+        hd_line += "\t" + tag;
+    }
+    hd_line += "\t" + so;
+    return hd_line + text.substr(eol);
+}
+
+
+//-------------------------------------
+
+
+// The value of tag in a header line, or the empty string if absent
+
+static string
+headerTag(const string& line, const char* tag)
+{
+    const string t = string("\t") + tag + ":";
+    size_t p = line.find(t);
+    if (p == string::npos)
+        return string();
+    p += t.size();
+    return line.substr(p, line.find('\t', p) - p);
+}
+
+
+//-------------------------------------
+
+
+string
+yoruba::headerUnion(const vector<string>& texts, const BamTools::RefVector& refs,
+                    vector<pair<size_t, string> >& dropped)
+{
+    string hd;
+    tr1::unordered_map<string, string> sq;   // reference name to @SQ line
+    vector<string> other;
+    tr1::unordered_map<string, bool> seen;   // lines in other
+    tr1::unordered_map<string, bool> ids;    // "@RG\tID" seen
+
+    for (size_t i = 0; i < texts.size(); ++i) {
+        istringstream text(texts[i]);
+        string line;
+        while (getline(text, line)) {
+            if (line.size() < 3 || line[0] != '@')
+                continue;
+            const string type = line.substr(0, 3);
+            if (type == "@HD") {
+                if (i == 0 && hd.empty())
+                    hd = line;
+            } else if (type == "@SQ") {
+                const string sn = headerTag(line, "SN");
+                if (! sq.count(sn))
+                    sq[sn] = line;
+            } else if (! seen.count(line)) {
+                if (type == "@RG" || type == "@PG") {
+                    const string id = type + "\t" + headerTag(line, "ID");
+                    if (ids.count(id)) {
+                        dropped.push_back(make_pair(i, line));
+                        continue;
+                    }
+                    ids[id] = true;
+                }
+                seen[line] = true;
+                other.push_back(line);
+            }
+        }
+    }
+
+    string header;
+    if (! hd.empty())
+        header += hd + "\n";
+    for (size_t i = 0; i < refs.size(); ++i) {
+        if (sq.count(refs[i].RefName)) {
+            header += sq[refs[i].RefName] + "\n";
+        } else {
+            ostringstream line;
+            line << "@SQ\tSN:" << refs[i].RefName << "\tLN:" << refs[i].RefLength << "\n";
+            header += line.str();
+        }
+    }
+    for (size_t i = 0; i < other.size(); ++i)
+        header += other[i] + "\n";
+    return header;
+}
@@ -0,0 +1,214 @@
+// yoruba_sort.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_sort.cpp
+//
+// Pieces shared by commands that put BAM records in order: sort keys read
+// straight from raw records, a radix sort of (key, offset) entries, a loser
+// tree for merging sorted runs, and setting the sort order in the header.
+//
+// Coordinate order is by reference ID with unmapped reads lacking one last,
+// then by position.  Name order is lexicographic by read name, then read 1
+// before read 2, as the SAM specification's queryname:lexicographical
+// subsort.  Both are stable, so records that tie keep their input order.
+// Collated order only groups the records of each read name together, in no
+// particular order of names.  Unsorted order makes no claim at all.
+
+#ifndef _YORUBA_SORT_H_
+#define _YORUBA_SORT_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// BamTools includes: https://github.com/pezmaster31/bamtools
+#include "api/BamAux.h"
+
+namespace yoruba {
+
+enum sortOrder_t { SORT_coordinate, SORT_name, SORT_collated, SORT_unsorted };
+
+// the SO tag value for the order
+
+const char* sortOrderName(const sortOrder_t o);
+
+
+//-------------------------------------
+
+
+// Fields of a raw BAM record, data pointing to the bytes following
+// block_size, as held by bamRawRecord
+
+inline int32_t
+rawRefID(const char* data)
+    { int32_t v; memcpy(&v, data, 4); return v; }
+
+inline int32_t
+rawPosition(const char* data)
+    { int32_t v; memcpy(&v, data + 4, 4); return v; }
+
+inline uint16_t
+rawFlag(const char* data)
+    { uint16_t v; memcpy(&v, data + 14, 2); return v; }
+
+inline const char*
+rawName(const char* data)
+    { return data + 32; }
+
+// Coordinate sort key: the reference ID as unsigned puts -1 last, and
+// position -1 becomes 0
+
+inline uint64_t
+coordinateKey(const char* data)
+    { return (uint64_t(uint32_t(rawRefID(data))) << 32) | uint32_t(rawPosition(data) + 1); }
+
+// Name sort key: the 8 name bytes following the first skip, big-endian so
+// keys compare as the names do, with bytes past the end of the name 0
+
+inline uint64_t
+nameKey(const char* data, const size_t skip)
+{
+    const char* name = rawName(data) + skip;
+    uint64_t key = 0;
+    size_t i = 0;
+    for (; i < 8 && name[i]; ++i)
+        key = (key << 8) | uint8_t(name[i]);
+    return key << (8 * (8 - i));
+}
+
+// Compare records by name then read 1 before read 2, <0, 0 or >0 like
+// strcmp.  Names are compared from skip, so a prefix known to be shared can
+// be passed over.
+
+inline int
+compareNames(const char* a, const char* b, const size_t skip = 0)
+{
+    int c = strcmp(rawName(a) + skip, rawName(b) + skip);
+    if (c)
+        return c;
+    return int(rawFlag(a) & 0xc0) - int(rawFlag(b) & 0xc0);
+}
+
+// Length of the prefix name shares with prefix, at most len
+
+inline size_t
+sharedPrefix(const char* name, const char* prefix, size_t len)
+{
+    size_t i = 0;
+    while (i < len && name[i] == prefix[i])
+        ++i;
+    return i;
+}
+
+
+//-------------------------------------
+
+
+// A record to be sorted, its key and where its bytes are
+
+struct sortEntry {
+    uint64_t key;
+    uint64_t offset;
+};
+
+// Stable LSD radix sort of entries by key, one byte per pass, skipping bytes
+// that are the same in every key.  tmp is scratch, resized as needed.
+
+void
+radixSort(std::vector<sortEntry>& entries, std::vector<sortEntry>& tmp);
+
+
+//-------------------------------------
+
+
+// Selects the least of k sources in log2(k) comparisons per record.  Less
+// is called as less(i, j) for sources i and j and must return true if the
+// head of i sorts before that of j; an exhausted source sorts after all
+// others, and ties must be broken (by source index, say) so the order is
+// total.  Call Build() once every source has its first head, then after
+// advancing the source Winner(), call Replay().
+
+template <typename Less>
+class loserTree {
+
+    public:
+        loserTree(const size_t k, Less l) : n(k), less(l), tree(k > 0 ? k : 1, 0) { }
+
+        void    Build(void) { if (n) tree[0] = build(1); }
+        size_t  Winner(void) const { return tree[0]; }
+        void    Replay(void);
+
+    private:
+        size_t  build(const size_t node);
+
+    private:
+        size_t              n;
+        Less                less;
+        std::vector<size_t> tree;  // losers at nodes 1..n-1, the winner at 0
+
+};  // class loserTree
+
+
+//-------------------------------------
+
+
+// Nodes 1..n-1 are internal, node i having children 2i and 2i+1, and nodes
+// n..2n-1 are the leaves, source s at node n + s
+
+template <typename Less>
+size_t
+loserTree<Less>::build(const size_t node)
+{
+    if (node >= n)
+        return node - n;
+    size_t a = build(2 * node), b = build(2 * node + 1);
+    if (less(b, a))
+        std::swap(a, b);
+    tree[node] = b;
+    return a;
+}
+
+
+//-------------------------------------
+
+
+template <typename Less>
+void
+loserTree<Less>::Replay(void)
+{
+    size_t w = tree[0];
+    for (size_t node = (w + n) / 2; node > 0; node /= 2)
+        if (less(tree[node], w))
+            std::swap(tree[node], w);
+    tree[0] = w;
+}
+
+
+//-------------------------------------
+
+
+// The header text with its @HD line giving order o, adding an @HD line if
+// there is none.  Any GO or SS tags are dropped; for name order SS is set to
+// queryname:lexicographical, and collated order is SO:unsorted GO:query.
+
+std::string
+headerWithSortOrder(const std::string& text, const sortOrder_t o);
+
+// The header text combining those of several inputs sharing the reference
+// dictionary refs: the @HD line of the first, an @SQ line for each of refs,
+// from the first input to have one, and the union of the other lines in the
+// order they are first seen, identical lines kept once.  An @RG or @PG line
+// whose ID was already seen with different content is left out and appended
+// to dropped, along with the index of its input.
+
+std::string
+headerUnion(const std::vector<std::string>& texts, const BamTools::RefVector& refs,
+            std::vector<std::pair<size_t, std::string> >& dropped);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_SORT_H_
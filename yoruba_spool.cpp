@@ -0,0 +1,195 @@
+// yoruba_spool.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Spooling of streamed input for two-pass commands, see yoruba_spool.h.
+
+
+#include <cstdio>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "yoruba_spool.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+// write all of len bytes to fd, false if it fails
+static bool
+writeAll(const int fd, const char* buf, size_t len)
+{
+    while (len > 0) {
+        const ssize_t w = write(fd, buf, len);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        buf += w;
+        len -= w;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+inputSpool::inputSpool(void)
+    : in_fd(-1)
+    , spool_fd(-1)
+    , pipe_fd(-1)
+    , read_fd(-1)
+    , running(false)
+    , ok(true)
+    , n_bytes(0)
+{ }
+
+
+//-------------------------------------
+
+
+inputSpool::~inputSpool(void)
+{
+    if (read_fd >= 0)
+        close(read_fd);
+    if (running) {  // we are giving up, so do not wait for the input to end
+        pthread_cancel(thread);
+        pthread_join(thread, NULL);
+        running = false;
+    }
+    if (pipe_fd >= 0)
+        close(pipe_fd);
+    if (spool_fd >= 0)
+        close(spool_fd);
+    if (in_fd >= 0)
+        close(in_fd);
+    if (! spool.empty())
+        remove(spool.c_str());
+}
+
+
+//-------------------------------------
+
+
+bool
+inputSpool::Start(const string& input_file, const string& spool_file)
+{
+    struct stat st;
+    if (stat(input_file.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        first_pass = second_pass = input_file;
+        return true;
+    }
+    in_fd = open(input_file.c_str(), O_RDONLY);
+    if (in_fd < 0) {
+        cerr << "inputSpool: could not open " << input_file << endl;
+        return false;
+    }
+    spool_fd = open(spool_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (spool_fd < 0) {
+        cerr << "inputSpool: could not open spool file " << spool_file << endl;
+        return false;
+    }
+    spool = spool_file;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        cerr << "inputSpool: could not create pipe" << endl;
+        return false;
+    }
+    read_fd = fds[0];
+    pipe_fd = fds[1];
+    fcntl(pipe_fd, F_SETFD, FD_CLOEXEC);
+    char name[32];
+    sprintf(name, "/dev/fd/%d", read_fd);
+    first_pass = name;
+    second_pass = spool_file;
+    if (pthread_create(&thread, NULL, inputSpool::copier, this) != 0) {
+        cerr << "inputSpool: could not create thread" << endl;
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void*
+inputSpool::copier(void* arg)
+{
+    static_cast<inputSpool*>(arg)->copy();
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+void
+inputSpool::copy(void)
+{
+    // the first pass may stop reading early, which must give this thread
+    // EPIPE rather than kill us; the rest of the process keeps its SIGPIPE
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, NULL);
+
+    vector<char> buf(1 << 20);
+    for (;;) {
+        const ssize_t r = read(in_fd, &buf[0], buf.size());
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            ok = false;
+        if (r <= 0)
+            break;
+        if (! writeAll(spool_fd, &buf[0], r)) {
+            ok = false;
+            break;
+        }
+        // once the first pass has stopped reading, only spool
+        if (pipe_fd >= 0 && ! writeAll(pipe_fd, &buf[0], r)) {
+            close(pipe_fd);
+            pipe_fd = -1;
+        }
+        n_bytes += r;
+    }
+    if (pipe_fd >= 0) {  // end of input for the first pass
+        close(pipe_fd);
+        pipe_fd = -1;
+    }
+}
+
+
+//-------------------------------------
+
+
+bool
+inputSpool::Finish(void)
+{
+    if (read_fd >= 0) {  // so that a copier blocked on a full pipe carries on
+        close(read_fd);
+        read_fd = -1;
+    }
+    if (running) {
+        pthread_join(thread, NULL);
+        running = false;
+        if (close(spool_fd) != 0)
+            ok = false;
+        spool_fd = -1;
+        close(in_fd);
+        in_fd = -1;
+    }
+    if (! ok)
+        cerr << "inputSpool: could not spool input to " << spool << endl;
+    return ok;
+}
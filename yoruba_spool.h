@@ -0,0 +1,62 @@
+// yoruba_spool.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_spool.cpp
+//
+// Lets a command that reads its input twice take that input from a pipe.  A
+// thread copies the stream verbatim, still compressed, to a temporary file
+// while passing the same bytes through a pipe that the first pass reads, so
+// spooling overlaps the first pass.  The second pass reads the temporary
+// file, which is removed when the spool is destroyed.  If the input is a
+// regular file after all, as with 'yoruba forget < in.bam', nothing is copied
+// and both passes read the input itself.
+
+#ifndef _YORUBA_SPOOL_H_
+#define _YORUBA_SPOOL_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace yoruba {
+
+class inputSpool {
+
+    public:
+        inputSpool(void);
+        ~inputSpool(void);
+
+        // start spooling input_file to spool_file, false with a message to
+        // cerr if either cannot be opened
+        bool    Start(const std::string& input_file, const std::string& spool_file);
+        // the file the first pass reads, then the one the second pass reads
+        // once Finish() returns true
+        const std::string& FirstPass(void) const { return first_pass; }
+        const std::string& SecondPass(void) const { return second_pass; }
+        // wait for the input to be spooled to its end, false if it could not be
+        bool    Finish(void);
+        int64_t Bytes(void) const { return n_bytes; }
+
+    private:
+        static void* copier(void* arg);
+        void    copy(void);
+
+        std::string first_pass;
+        std::string second_pass;
+        std::string spool;
+        int         in_fd;
+        int         spool_fd;
+        int         pipe_fd;     // the write end of the pipe
+        int         read_fd;     // its read end, named by first_pass
+        pthread_t   thread;
+        bool        running;
+        bool        ok;
+        int64_t     n_bytes;
+
+};  // class inputSpool
+
+}  // namespace yoruba
+
+#endif // _YORUBA_SPOOL_H_
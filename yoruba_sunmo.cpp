@@ -0,0 +1,604 @@
+// yoruba_sunmo.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Collate a BAM file, bringing the records of each read name together
+// without sorting.
+//
+// Súnmọ́ is the Yoruba (Nigeria) verb for 'come close to'.
+
+// buckets
+//
+// Records are read raw (yoruba_bamraw.h) into a buffer.  If the input ends
+// before the buffer holds --memory MB, the buffer is collated and written
+// directly.  Otherwise the records are partitioned by the hash of their
+// names into --buckets temporary files, BGZF compressed at level 1, in one
+// streaming pass, so all records with the same name land in the same bucket.
+// Without --buckets, the number is chosen so each bucket should fit in
+// --memory, from the compression ratio of the input read so far.  It stays
+// below the limit on open files, and the buffers of the bucket writers take
+// at most a quarter of --memory; the buffer is filled only to what they
+// leave.
+
+// collating
+//
+// Each bucket is read back into the buffer, and its records chained by name
+// through a hash table keyed on the name hash, with full names compared to
+// separate names whose hashes collide.  Groups are written in the order in
+// which their first records were read, so the records of each name are
+// adjacent, in their input order.
+
+#include "yoruba_sunmo.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       input_file;
+static string       output_file;  // defaults to stdout, set with -o FILE
+static string       opt_tmp_prefix;  // defaults to output file, or yoruba_collate
+static int64_t      opt_memory = 768;  // MB
+static int32_t      opt_buckets = 0;  // 0 to choose from the input
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+static string       metrics_file;
+static const int32_t bucket_level = 1;  // fast compression for buckets
+static const int32_t default_buckets = 64;  // when the input size is unknown
+static const int32_t max_buckets = 4096;
+static const int32_t reserved_files = 16;  // files open besides the buckets
+// a bucket writer holds its block being filled and one being compressed
+static const size_t  bucket_writer_bytes = 2 * BGZF_MAX_BLOCK_SIZE;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static int64_t      opt_reads = -1;
+static double       opt_progress = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_sunmo(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " collate [options] [<in.bam>]" << endl;
+    cerr << "         " << YORUBA_NAME << " sunmo [options] [<in.bam>]" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Collate <in.bam> so the records of each read name are adjacent, without\n\
+sorting, and set GO:query in the header.  If <in.bam> is not supplied, input\n\
+is read from stdin.\n\
+\n\
+Options: -m INT | --memory INT   MB of memory for holding records [" << opt_memory << "]\n\
+         -b INT | --buckets INT  number of temporary files, 0 to choose from the\n\
+                                 input size [" << opt_buckets << "]\n\
+         -T PREFIX | --tmp-prefix PREFIX\n\
+                                 prefix for temporary files [output file, or yoruba_collate]\n\
+         --threads INT           threads for compression [" << opt_threads << "]\n\
+         -l INT | --level INT    compression level of the output, -1 for zlib default [" << opt_level << "]\n\
+         -o FILE | --output FILE output BAM file [default is stdout]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+If <in.bam> fits in --memory MB, it is collated in memory.  Otherwise records\n\
+are partitioned by the hash of their names into --buckets temporary files\n\
+PREFIX.PID.NNNN.bucket compressed at level " << bucket_level << ", and each bucket is then\n\
+read back and collated in memory.  Without --buckets, enough buckets are used\n\
+for each to fit in --memory, estimated from the compression ratio of the input\n\
+read so far, or " << default_buckets << " if the input size is unknown.  There are at most\n\
+" << max_buckets << ", fewer than the limit on open files, and few enough that their writers,\n\
+" << bucket_writer_bytes / 1024 << " KB each, take at most a quarter of --memory.\n\
+\n\
+The records of each name are written together in their input order, and names\n\
+in the order they were first seen within each bucket.  The header gets\n\
+SO:unsorted and GO:query.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Sunmo is the Yoruba (Nigeria) verb for 'come close to'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// Records held in memory, each as block_size followed by its bytes
+
+class collateBuffer {
+
+    public:
+        collateBuffer(void) { }
+
+        void        Add(const char* data, const int32_t length);
+        void        Clear(void) { arena.clear(); offsets.clear(); }
+        size_t      Bytes(void) const { return arena.size() + offsets.size() * sizeof(uint64_t); }
+        size_t      Size(void) const { return offsets.size(); }
+        const char* Record(const size_t i) const
+                        { return arena.data() + offsets[i] + 4; }
+        int32_t     RecordLength(const size_t i) const
+                        { int32_t l; memcpy(&l, arena.data() + offsets[i], 4); return l; }
+        // write the records with those of each name together
+        bool        Write(bamRawWriter& writer) const;
+
+    private:
+        string           arena;
+        vector<uint64_t> offsets;
+
+};  // class collateBuffer
+
+
+//-------------------------------------
+
+
+void
+collateBuffer::Add(const char* data, const int32_t length)
+{
+    offsets.push_back(arena.size());
+    arena.append((const char*)&length, 4);
+    arena.append(data, length);
+}
+
+
+//-------------------------------------
+
+
+bool
+collateBuffer::Write(bamRawWriter& writer) const
+{
+    const uint32_t none = 0xffffffff;
+    const size_t n = offsets.size();
+    vector<uint32_t> next(n, none);  // next record with the same name
+    vector<uint32_t> last(n, none);  // last record of the group, for a first record
+    typedef tr1::unordered_map<uint64_t, uint32_t> groupMap;
+    groupMap groups;  // name hash to first record
+    groups.rehash(n / 2 + 1);
+
+    for (size_t i = 0; i < n; ++i) {
+        const char* name = rawName(Record(i));
+        uint64_t h = hashReadName(name, strlen(name));
+        while (true) {
+            pair<groupMap::iterator, bool> g = groups.insert(make_pair(h, uint32_t(i)));
+            if (g.second) {
+                last[i] = i;
+                break;
+            }
+            const uint32_t first = g.first->second;
+            if (strcmp(rawName(Record(first)), name) == 0) {
+                next[last[first]] = i;
+                last[first] = i;
+                break;
+            }
+            // another name with the same hash, so try the next key
+            ++h;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (last[i] == none)
+            continue;  // written with the first record of its name
+        for (uint32_t j = i; j != none; j = next[j])
+            if (! writer.Write(Record(j), RecordLength(j)))
+                return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// The temporary files records are partitioned into by name hash
+
+class bucketSet {
+
+    public:
+        bucketSet(void) { }
+        ~bucketSet(void);
+
+        bool    Open(const int32_t n, const string& prefix, bgzfPool* pool);
+        bool    Add(const char* data, const int32_t length);
+        bool    Close(void);
+        // read bucket b into buffer
+        bool    Read(const int32_t b, collateBuffer& buffer, bgzfPool* pool);
+        void    Remove(void);
+
+        int32_t Size(void) const { return files.size(); }
+        bool    IsOpen(void) const { return ! writers.empty(); }
+
+    private:
+        vector<string>      files;
+        vector<bgzfWriter*> writers;
+
+    private:  // not copyable
+        bucketSet(const bucketSet&);
+        bucketSet& operator=(const bucketSet&);
+
+};  // class bucketSet
+
+
+//-------------------------------------
+
+
+bucketSet::~bucketSet(void)
+{
+    for (size_t i = 0; i < writers.size(); ++i)
+        delete writers[i];
+}
+
+
+//-------------------------------------
+
+
+bool
+bucketSet::Open(const int32_t n, const string& prefix, bgzfPool* pool)
+{
+    for (int32_t i = 0; i < n; ++i) {
+        char suffix[32];
+        sprintf(suffix, ".%04d.bucket", i);
+        files.push_back(prefix + suffix);
+        writers.push_back(new bgzfWriter);
+        if (! writers.back()->Open(files.back(), pool, bucket_level)) {
+            cerr << NAME << " could not open temporary file " << files.back() << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+bucketSet::Add(const char* data, const int32_t length)
+{
+    const char* name = rawName(data);
+    bgzfWriter* w = writers[hashReadName(name, strlen(name)) % writers.size()];
+    return w->Write(&length, 4) && w->Write(data, length);
+}
+
+
+//-------------------------------------
+
+
+bool
+bucketSet::Close(void)
+{
+    bool ok = true;
+    for (size_t i = 0; i < writers.size(); ++i) {
+        if (! writers[i]->Close()) {
+            cerr << NAME << " could not write temporary file " << files[i] << endl;
+            ok = false;
+        }
+        delete writers[i];
+    }
+    writers.clear();
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+bool
+bucketSet::Read(const int32_t b, collateBuffer& buffer, bgzfPool* pool)
+{
+    bgzfReader reader;
+    if (! reader.Open(files[b], pool)) {
+        cerr << NAME << " could not open temporary file " << files[b] << endl;
+        return false;
+    }
+    string data;
+    int32_t length;
+    int64_t n;
+    while ((n = reader.Read(&length, 4)) == 4) {
+        data.resize(length);
+        if (reader.Read(&data[0], length) != length)
+            break;
+        buffer.Add(data.data(), length);
+    }
+    reader.Close();
+    if (n != 0) {
+        cerr << NAME << " truncated temporary file " << files[b] << endl;
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+void
+bucketSet::Remove(void)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+        remove(files[i].c_str());
+}
+
+
+//-------------------------------------
+
+
+// The most buckets that may be open at once, below the limit on open files
+
+static int32_t
+openBucketLimit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY)
+        return max_buckets;
+    const int64_t n = int64_t(rl.rlim_cur) - reserved_files;
+    return int32_t(max(int64_t(2), min(int64_t(max_buckets), n)));
+}
+
+
+//-------------------------------------
+
+
+// Enough buckets, up to limit, that each should fit in memory, given that
+// the first consumed bytes of the input file filled buffered bytes
+
+static int32_t
+chooseBuckets(const int64_t consumed, const size_t buffered, const size_t memory,
+              const int32_t limit)
+{
+    struct stat st;
+    if (input_file == "/dev/stdin" || stat(input_file.c_str(), &st) != 0
+        || ! S_ISREG(st.st_mode) || consumed <= 0)
+        return min(default_buckets, limit);
+    // a quarter more than the expected number, for uneven buckets
+    const double bytes = double(st.st_size) / consumed * buffered;
+    const int64_t n = int64_t(1.25 * bytes / memory) + 1;
+    if (n > limit)
+        cerr << NAME << " " << n << " buckets wanted but only " << limit
+            << " allowed by open files and --memory, so buckets may not fit" << endl;
+    return int32_t(max(int64_t(2), min(int64_t(limit), n)));
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_sunmo(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_memory, OPT_buckets, OPT_tmp_prefix, OPT_threads, OPT_level, OPT_output,
+        OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_reads, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption sunmo_options[] = {
+        { OPT_memory,          "--memory",          SO_REQ_SEP },
+        { OPT_memory,          "-m",                SO_REQ_SEP },
+        { OPT_buckets,         "--buckets",         SO_REQ_SEP },
+        { OPT_buckets,         "-b",                SO_REQ_SEP },
+        { OPT_tmp_prefix,      "--tmp-prefix",      SO_REQ_SEP },
+        { OPT_tmp_prefix,      "-T",                SO_REQ_SEP },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, sunmo_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_memory) {
+            opt_memory = strtoll(args.OptionArg(), NULL, 10);
+            if (opt_memory < 1) {
+                cerr << NAME << " --memory must be greater than 0" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_buckets) {
+            opt_buckets = atoi(args.OptionArg());
+            if (opt_buckets < 0 || opt_buckets > openBucketLimit()) {
+                cerr << NAME << " --buckets must be from 0 to " << openBucketLimit()
+                    << ", below the limit on open files" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_tmp_prefix) {
+            opt_tmp_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "collate", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (args.FileCount() > 1) {
+        cerr << NAME << " requires at most one BAM file specified as input" << endl;
+        return usage();
+    } else if (args.FileCount() == 1) {
+        input_file = args.File(0);
+    } else if (input_file.empty()) {
+        input_file = "/dev/stdin";
+    }
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    if (opt_tmp_prefix.empty())
+        opt_tmp_prefix = output_file == "/dev/stdout" ? string("yoruba_collate") : output_file;
+    char pid[32];
+    sprintf(pid, ".%d", int(getpid()));
+    opt_tmp_prefix += pid;
+
+    //----------------- Read records, partitioning them once memory is full
+
+    profile.Begin("partition");
+    progress.Input(input_file);
+    bgzfPool pool(opt_threads);
+    bamRawReader reader;
+    if (! reader.Open(input_file, &pool)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    const string header = headerWithSortOrder(reader.HeaderText(), SORT_collated);
+    const RefVector refs = reader.References();
+
+    const size_t memory = opt_memory * 1024 * 1024;
+    // the bucket writers take at most a quarter of memory, the buffer the rest
+    const int32_t bucket_limit = opt_buckets ? opt_buckets
+        : max(int32_t(2), min(openBucketLimit(), int32_t(memory / 4 / bucket_writer_bytes)));
+    const size_t buffer_memory = memory - min(memory / 2, bucket_limit * bucket_writer_bytes);
+    collateBuffer buffer;
+    bucketSet buckets;
+    bamRawRecord r;
+    int64_t n_reads = 0;
+    bool ok = true;
+
+    while (ok && (opt_reads < 0 || n_reads < opt_reads) && reader.GetNextRecord(r)) {
+
+        progress.Reads(++n_reads);
+
+        if (buckets.IsOpen()) {
+            ok = buckets.Add(r.data.data(), r.data.size());
+            continue;
+        }
+        buffer.Add(r.data.data(), r.data.size());
+        if (buffer.Bytes() >= buffer_memory) {
+            // the input does not fit, so partition it
+            const int32_t n = opt_buckets ? opt_buckets
+                              : chooseBuckets(reader.CompressedOffset(), buffer.Bytes(),
+                                              memory, bucket_limit);
+            ok = buckets.Open(n, opt_tmp_prefix, &pool);
+            for (size_t i = 0; ok && i < buffer.Size(); ++i)
+                ok = buckets.Add(buffer.Record(i), buffer.RecordLength(i));
+            buffer.Clear();
+        }
+    }
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << input_file << endl;
+        ok = false;
+    }
+    reader.Close();
+    ok = buckets.Close() && ok;
+    profile.Reads(n_reads);
+    if (! ok) {
+        cerr << NAME << " could not partition the input into temporary files" << endl;
+        buckets.Remove();
+        return EXIT_FAILURE;
+    }
+
+    //----------------- Collate each bucket into the output
+
+    profile.Begin("collate");
+    bamRawWriter writer;
+    if (! writer.Open(output_file, header, refs, &pool, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        buckets.Remove();
+        return EXIT_FAILURE;
+    }
+    writer.IndexRecords(yviIndex::default_interval);
+    progress.Expect(n_reads);
+    if (! buckets.Size()) {
+        ok = buffer.Write(writer);
+    } else {
+        size_t max_bucket_bytes = 0;
+        int64_t n_collated = 0;
+        for (int32_t b = 0; ok && b < buckets.Size(); ++b) {
+            buffer.Clear();
+            ok = buckets.Read(b, buffer, &pool) && buffer.Write(writer);
+            max_bucket_bytes = max(max_bucket_bytes, buffer.Bytes());
+            n_collated += buffer.Size();
+            progress.Reads(n_collated);
+        }
+        if (max_bucket_bytes > memory)
+            cerr << NAME << " largest bucket held " << max_bucket_bytes / (1024 * 1024)
+                << " MB, more than --memory; use more --buckets" << endl;
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("close");
+    ok = writer.Close() && ok;
+    buckets.Remove();
+
+    if (! ok) {
+        cerr << NAME << " could not write BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << NAME << " " << n_reads << " reads collated, " << buckets.Size()
+        << " bucket" << PLURAL(buckets.Size()) << " used" << endl;
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,43 @@
+// yoruba_sunmo.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_SUNMO_H_
+#define _YORUBA_SUNMO_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <tr1/unordered_map>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_collate]"
+#endif
+
+// Functions defined in yoruba_sunmo.cpp
+//
+namespace yoruba {
+
+int  main_sunmo(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_SUNMO_H_
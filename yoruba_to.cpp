@@ -0,0 +1,885 @@
+// yoruba_to.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Sort a BAM file by coordinate or by read name.
+//
+// Tò is the Yoruba (Nigeria) verb for 'arrange in order'.
+
+// runs
+//
+// Records are read raw (yoruba_bamraw.h) into a run, a single buffer holding
+// each record as it appears in the file, alongside an entry of (key, offset)
+// for each.  When the run reaches its share of --memory it is radix-sorted on
+// the keys and spilled to a temporary file as a BGZF stream of records,
+// compressed at level 1.  The last run is sorted and kept in memory.
+//
+// The coordinate key is the reference ID and position, so a run is sorted by
+// the radix sort alone.  The name key is the 8 bytes of the name following
+// the prefix shared by every name in the run; Illumina names share a long
+// prefix, and the bytes after it nearly always tell them apart.  Entries
+// whose keys tie, mostly the two reads of a pair, are then ordered by
+// comparing their full names.
+
+// merge
+//
+// The spilled runs and the run in memory are merged with a loser tree
+// (yoruba_sort.h), ties going to the earlier run so the sort is stable, and
+// written to the output.  If nothing was spilled, the run in memory is
+// written as it is.  Each spilled run is read through a bgzfReader with its
+// own buffer and blocks read ahead, so the runs merged at once are limited by
+// the memory the run in memory leaves and by the limit on open files.  More
+// runs than that are first merged, consecutive runs together, into fewer.
+
+// threads
+//
+// With --threads INT, full runs are handed to INT threads that sort and spill
+// them while reading continues into the next run, and a pool of INT threads
+// compresses and decompresses blocks for the input, the spilled runs and the
+// output.  --memory is shared among the run being filled and those being
+// sorted.
+
+#include "yoruba_to.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       input_file;
+static string       output_file;  // defaults to stdout, set with -o FILE
+static string       opt_tmp_prefix;  // defaults to output file, or yoruba_sort
+static sortOrder_t  opt_order = SORT_coordinate;
+static int64_t      opt_memory = 768;  // MB
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+static string       metrics_file;
+static const int32_t spill_level = 1;  // fast compression for spilled runs
+static const int32_t reserved_files = 16;  // files open besides the runs merged
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static int64_t      opt_reads = -1;
+static double       opt_progress = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_to(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " sort [options] <in.bam>" << endl;
+    cerr << "         " << YORUBA_NAME << " to [options] <in.bam>" << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Sort <in.bam> by coordinate, or with --name by read name, and set the sort\n\
+order in the header.\n\
+\n\
+Options: -n | --name             sort by read name rather than coordinate\n\
+         -m INT | --memory INT   MB of memory for holding records [" << opt_memory << "]\n\
+         -T PREFIX | --tmp-prefix PREFIX\n\
+                                 prefix for temporary files [output file, or yoruba_sort]\n\
+         --threads INT           threads for sorting and for compression [" << opt_threads << "]\n\
+         -l INT | --level INT    compression level of the output, -1 for zlib default [" << opt_level << "]\n\
+         -o FILE | --output FILE output BAM file [default is stdout]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+Coordinate order is by reference and then position, with unmapped reads that\n\
+have no reference last.  Name order is lexicographic by read name, then read 1\n\
+before read 2, and the header gets SO:queryname and SS:queryname:lexicographical.\n\
+Records that tie keep their input order.\n\
+\n\
+Records are gathered into runs of at most --memory / (--threads + 1) MB, and\n\
+at most three quarters of --memory, each radix-sorted and spilled to a\n\
+temporary file PREFIX.PID.NNNN.run compressed at level " << spill_level << ".  The runs are\n\
+then merged into the output, and the temporary files removed.  If the input\n\
+fits in one run, nothing is spilled.  The readers of the runs merged share the\n\
+memory the last run leaves, and their number is also kept below the limit on\n\
+open files; if there are more runs, runs are first merged into fewer, larger\n\
+ones, PREFIX.PID.mergeNNNN.run.\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --reads INT     process at most this many reads [" << opt_reads << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "To is the Yoruba (Nigeria) verb for 'arrange in order'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// Records held in memory, each as block_size followed by its bytes, with an
+// entry of (key, offset) for each
+
+class sortRun {
+
+    public:
+        sortRun(const sortOrder_t o, const size_t capacity)
+            : order(o), first_name(0), shared(0)
+            { arena.reserve(capacity); }
+
+        void        Add(const bamRawRecord& r);
+        void        Sort(void);
+        // bytes held, counting the radix sort's scratch entries
+        size_t      Bytes(void) const
+                        { return arena.size() + 2 * entries.size() * sizeof(sortEntry); }
+        size_t      Size(void) const { return entries.size(); }
+        const char* Record(const size_t i) const
+                        { return arena.data() + entries[i].offset + 4; }
+        int32_t     RecordLength(const size_t i) const
+                        { int32_t l; memcpy(&l, arena.data() + entries[i].offset, 4); return l; }
+
+    private:
+        sortOrder_t       order;
+        string            arena;
+        vector<sortEntry> entries;
+        size_t            first_name;  // offset of the first record's name
+        size_t            shared;      // length of the prefix every name shares
+
+};  // class sortRun
+
+
+//-------------------------------------
+
+
+void
+sortRun::Add(const bamRawRecord& r)
+{
+    sortEntry e;
+    e.offset = arena.size();
+    const int32_t block_size = r.data.size();
+    arena.append((const char*)&block_size, 4);
+    arena.append(r.data);
+    if (order == SORT_coordinate) {
+        e.key = coordinateKey(r.data.data());
+    } else {
+        // the key is set in Sort(), once the shared prefix is known
+        e.key = 0;
+        if (entries.empty()) {
+            first_name = e.offset + 4 + BAM_CORE_LENGTH;
+            shared = strlen(r.Name());
+        } else if (shared) {
+            shared = sharedPrefix(r.Name(), arena.data() + first_name, shared);
+        }
+    }
+    entries.push_back(e);
+}
+
+
+//-------------------------------------
+
+
+// Orders entries with tied name keys by their full names
+
+struct nameLess {
+    const char* arena;
+    size_t      skip;
+    nameLess(const char* a, const size_t s) : arena(a), skip(s) { }
+    bool operator()(const sortEntry& a, const sortEntry& b) const
+        { return compareNames(arena + a.offset + 4, arena + b.offset + 4, skip) < 0; }
+};
+
+
+//-------------------------------------
+
+
+void
+sortRun::Sort(void)
+{
+    if (order == SORT_name)
+        for (size_t i = 0; i < entries.size(); ++i)
+            entries[i].key = nameKey(arena.data() + entries[i].offset + 4, shared);
+
+    vector<sortEntry> tmp;
+    radixSort(entries, tmp);
+    vector<sortEntry>().swap(tmp);
+
+    if (order == SORT_name) {
+        nameLess less(arena.data(), shared);
+        size_t beg = 0;
+        while (beg < entries.size()) {
+            size_t end = beg + 1;
+            while (end < entries.size() && entries[end].key == entries[beg].key)
+                ++end;
+            if (end - beg > 1)
+                stable_sort(entries.begin() + beg, entries.begin() + end, less);
+            beg = end;
+        }
+    }
+}
+
+
+//-------------------------------------
+
+
+// Sorts full runs and spills them to temporary files, in n_threads threads,
+// or at Submit() if n_threads is 0.  At most n_threads runs are waiting or
+// being sorted at once, Submit() blocking until there is room.
+
+class runSorter {
+
+    public:
+        runSorter(const int32_t n_threads, const string& prefix, bgzfPool* p);
+        ~runSorter(void);
+
+        // takes ownership of run, and returns false if a spill has failed
+        bool    Submit(sortRun* run);
+        // wait for all runs to be spilled, returns false if any failed
+        bool    Finish(void);
+        // remove the temporary files
+        void    Remove(void);
+
+        const vector<string>& Files(void) const { return files; }
+
+    private:
+        static void* worker(void* arg);
+        bool         spill(sortRun* run, const string& file);
+
+    private:
+        string                 tmp_prefix;
+        bgzfPool*              pool;
+        vector<pthread_t>      threads;
+        deque<size_t>          queue;     // indices of runs waiting
+        vector<sortRun*>       runs;      // waiting, by index
+        vector<string>         files;     // temporary file of each run
+        int32_t                n_busy;
+        pthread_mutex_t        mutex;
+        pthread_cond_t         run_ready;
+        pthread_cond_t         run_done;
+        bool                   shutdown;
+        bool                   ok;
+
+    private:  // not copyable
+        runSorter(const runSorter&);
+        runSorter& operator=(const runSorter&);
+
+};  // class runSorter
+
+
+//-------------------------------------
+
+
+runSorter::runSorter(const int32_t n_threads, const string& prefix, bgzfPool* p)
+    : tmp_prefix(prefix), pool(p), n_busy(0), shutdown(false), ok(true)
+{
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&run_ready, NULL);
+    pthread_cond_init(&run_done, NULL);
+    for (int32_t i = 0; i < n_threads; ++i) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, worker, this) == 0)
+            threads.push_back(t);
+    }
+}
+
+
+//-------------------------------------
+
+
+runSorter::~runSorter(void)
+{
+    pthread_mutex_lock(&mutex);
+    shutdown = true;
+    pthread_cond_broadcast(&run_ready);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < threads.size(); ++i)
+        pthread_join(threads[i], NULL);
+    for (size_t i = 0; i < runs.size(); ++i)
+        delete runs[i];
+    pthread_cond_destroy(&run_done);
+    pthread_cond_destroy(&run_ready);
+    pthread_mutex_destroy(&mutex);
+}
+
+
+//-------------------------------------
+
+
+bool
+runSorter::Submit(sortRun* run)
+{
+    char suffix[32];
+    sprintf(suffix, ".%04d.run", int(files.size()));
+    const string file = tmp_prefix + suffix;
+
+    if (threads.empty()) {
+        files.push_back(file);
+        ok = spill(run, file) && ok;
+        return ok;
+    }
+
+    pthread_mutex_lock(&mutex);
+    while (int32_t(queue.size()) + n_busy >= int32_t(threads.size()))
+        pthread_cond_wait(&run_done, &mutex);
+    files.push_back(file);
+    runs.push_back(run);
+    queue.push_back(runs.size() - 1);
+    pthread_cond_signal(&run_ready);
+    const bool r = ok;
+    pthread_mutex_unlock(&mutex);
+    return r;
+}
+
+
+//-------------------------------------
+
+
+bool
+runSorter::Finish(void)
+{
+    pthread_mutex_lock(&mutex);
+    while (! queue.empty() || n_busy)
+        pthread_cond_wait(&run_done, &mutex);
+    const bool r = ok;
+    pthread_mutex_unlock(&mutex);
+    return r;
+}
+
+
+//-------------------------------------
+
+
+void
+runSorter::Remove(void)
+{
+    for (size_t i = 0; i < files.size(); ++i)
+        remove(files[i].c_str());
+}
+
+
+//-------------------------------------
+
+
+void*
+runSorter::worker(void* arg)
+{
+    runSorter& s = *static_cast<runSorter*>(arg);
+    pthread_mutex_lock(&s.mutex);
+    while (true) {
+        while (s.queue.empty() && ! s.shutdown)
+            pthread_cond_wait(&s.run_ready, &s.mutex);
+        if (s.queue.empty())
+            break;
+        const size_t i = s.queue.front();
+        s.queue.pop_front();
+        sortRun* run = s.runs[i];
+        s.runs[i] = NULL;
+        const string file = s.files[i];
+        ++s.n_busy;
+        pthread_mutex_unlock(&s.mutex);
+
+        const bool spilled = s.spill(run, file);
+
+        pthread_mutex_lock(&s.mutex);
+        --s.n_busy;
+        if (! spilled)
+            s.ok = false;
+        pthread_cond_broadcast(&s.run_done);
+    }
+    pthread_mutex_unlock(&s.mutex);
+    return NULL;
+}
+
+
+//-------------------------------------
+
+
+// Sort run and write it to file, then free it
+
+bool
+runSorter::spill(sortRun* run, const string& file)
+{
+    run->Sort();
+    bgzfWriter w;
+    bool r = w.Open(file, pool, spill_level);
+    for (size_t i = 0; r && i < run->Size(); ++i) {
+        const int32_t len = run->RecordLength(i);
+        r = w.Write(&len, 4) && w.Write(run->Record(i), len);
+    }
+    r = w.Close() && r;
+    if (! r)
+        cerr << NAME << " could not write temporary file " << file << endl;
+    delete run;
+    return r;
+}
+
+
+//-------------------------------------
+
+
+// One of the sorted runs being merged, either a spilled run read back from
+// its file or the run kept in memory
+
+struct mergeSource {
+    sortRun*    run;
+    size_t      next;   // in run
+    bgzfReader* file;
+    string      buf;    // the head, for a spilled run
+    const char* data;   // the head
+    int32_t     length;
+    uint64_t    key;    // of the head, for coordinate order
+    bool        done;
+
+    mergeSource(void) : run(0), next(0), file(0), data(0), length(0), key(0), done(false) { }
+    // move to the next record, setting done at the end; false if a spilled
+    // run could not be read
+    bool Advance(void);
+};
+
+
+//-------------------------------------
+
+
+bool
+mergeSource::Advance(void)
+{
+    if (run) {
+        if (next == run->Size())
+            return done = true;
+        data = run->Record(next);
+        length = run->RecordLength(next);
+        ++next;
+    } else {
+        int64_t n = file->Read(&length, 4);
+        if (n == 0 && ! file->Error())
+            return done = true;
+        if (n != 4 || length < BAM_CORE_LENGTH) {
+            cerr << NAME << " truncated temporary file" << endl;
+            return ! (done = true);
+        }
+        buf.resize(length);
+        if (file->Read(&buf[0], length) != length) {
+            cerr << NAME << " truncated temporary file" << endl;
+            return ! (done = true);
+        }
+        data = buf.data();
+    }
+    if (opt_order == SORT_coordinate)
+        key = coordinateKey(data);
+    return true;
+}
+
+
+//-------------------------------------
+
+
+// Order of merge sources by their heads, exhausted sources last and ties to
+// the earlier run
+
+struct mergeLess {
+    const vector<mergeSource>* sources;
+    mergeLess(const vector<mergeSource>& s) : sources(&s) { }
+    bool operator()(const size_t i, const size_t j) const
+    {
+        const mergeSource& a = (*sources)[i];
+        const mergeSource& b = (*sources)[j];
+        if (a.done || b.done)
+            return ! a.done || (b.done && i < j);
+        if (opt_order == SORT_coordinate) {
+            if (a.key != b.key)
+                return a.key < b.key;
+        } else {
+            int c = compareNames(a.data, b.data);
+            if (c)
+                return c < 0;
+        }
+        return i < j;
+    }
+};
+
+
+//-------------------------------------
+
+
+// Merge sources into out until all are done, false if a source could not
+// be read or out could not be written.  With report, the records merged are
+// given to progress.
+
+template <class W>
+static bool
+mergeSources(vector<mergeSource>& sources, W& out, const bool report)
+{
+    bool ok = true;
+    for (size_t i = 0; ok && i < sources.size(); ++i)
+        ok = sources[i].Advance();
+    if (! ok)
+        return false;
+    loserTree<mergeLess> tree(sources.size(), mergeLess(sources));
+    tree.Build();
+    int64_t n_reads = 0;
+    while (ok) {
+        mergeSource& s = sources[tree.Winner()];
+        if (s.done)
+            break;
+        ok = out.Write(s.data, s.length) && s.Advance();
+        if (report)
+            progress.Reads(++n_reads);
+        tree.Replay();
+    }
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// Writes merged records to a temporary file, as runSorter::spill() does
+
+struct runWriter {
+    bgzfWriter bgzf;
+    bool Write(const char* data, const int32_t length)
+        { return bgzf.Write(&length, 4) && bgzf.Write(data, length); }
+};
+
+
+//-------------------------------------
+
+
+// Open the spilled runs files[beg, end) as the first sources, false with a
+// message if one could not be opened
+
+static bool
+openSources(const vector<string>& files, const size_t beg, const size_t end,
+            bgzfPool& pool, vector<mergeSource>& sources)
+{
+    bool ok = true;
+    for (size_t i = beg; i < end; ++i) {
+        sources[i - beg].file = new bgzfReader;
+        if (! sources[i - beg].file->Open(files[i], &pool)) {
+            cerr << NAME << " could not open temporary file " << files[i] << endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// Close the spilled runs among sources, false if one could not be read
+
+static bool
+closeSources(vector<mergeSource>& sources)
+{
+    bool ok = true;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].file && sources[i].file->Error())
+            ok = false;
+        delete sources[i].file;
+        sources[i].file = NULL;
+    }
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+// The most spilled runs to merge at once: fewer than the limit on open files,
+// and few enough that their readers, with the writer of an intermediate
+// merge, fit in memory bytes
+
+static int32_t
+mergeFanIn(const size_t memory)
+{
+    int64_t n = int64_t(memory / bgzfReader::Footprint(opt_threads)) - 1;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        n = min(n, int64_t(rl.rlim_cur) - reserved_files);
+    return int32_t(max(int64_t(2), min(int64_t(INT32_MAX), n)));
+}
+
+
+//-------------------------------------
+
+
+// Merge the spilled runs named in files, in order, and then run into writer.
+// While there are more than fan_in spilled runs, consecutive runs are merged
+// into temporary files, just enough that the rest can be merged at once;
+// merging consecutive runs keeps ties in input order.  The merged runs are
+// removed as they are used.
+
+static bool
+mergeRuns(vector<string> files, sortRun* run, const int32_t fan_in, bgzfPool& pool,
+          bamRawWriter& writer)
+{
+    bool ok = true;
+    int32_t n_merged = 0;
+    vector<string> made;  // temporary files of intermediate merges
+
+    while (ok && files.size() > size_t(fan_in)) {
+        vector<string> next;
+        size_t excess = files.size() - fan_in;
+        size_t i = 0;
+        while (ok && i < files.size()) {
+            const size_t n = min(size_t(fan_in), min(files.size() - i, excess + 1));
+            if (n < 2) {
+                next.push_back(files[i++]);
+                continue;
+            }
+            char suffix[32];
+            sprintf(suffix, ".merge%04d.run", int(n_merged++));
+            const string file = opt_tmp_prefix + suffix;
+            made.push_back(file);
+            vector<mergeSource> sources(n);
+            runWriter out;
+            ok = openSources(files, i, i + n, pool, sources)
+                 && out.bgzf.Open(file, &pool, spill_level)
+                 && mergeSources(sources, out, false);
+            ok = closeSources(sources) && out.bgzf.Close() && ok;
+            if (! ok)
+                cerr << NAME << " could not merge runs into temporary file " << file << endl;
+            for (size_t k = i; k < i + n; ++k)
+                remove(files[k].c_str());
+            next.push_back(file);
+            excess -= n - 1;
+            i += n;
+        }
+        files.swap(next);
+        IF_DEBUG(1) cerr << NAME << " runs merged to " << files.size() << endl;
+    }
+
+    if (ok) {
+        vector<mergeSource> sources(files.size() + 1);
+        sources.back().run = run;
+        ok = openSources(files, 0, files.size(), pool, sources)
+             && mergeSources(sources, writer, true);
+        ok = closeSources(sources) && ok;
+    }
+
+    for (size_t i = 0; i < made.size(); ++i)
+        remove(made[i].c_str());
+    return ok;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_to(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_name, OPT_memory, OPT_tmp_prefix, OPT_threads, OPT_level, OPT_output,
+        OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_reads, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption to_options[] = {
+        { OPT_name,            "--name",            SO_NONE },
+        { OPT_name,            "-n",                SO_NONE },
+        { OPT_memory,          "--memory",          SO_REQ_SEP },
+        { OPT_memory,          "-m",                SO_REQ_SEP },
+        { OPT_tmp_prefix,      "--tmp-prefix",      SO_REQ_SEP },
+        { OPT_tmp_prefix,      "-T",                SO_REQ_SEP },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_reads,           "--reads",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, to_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_name) {
+            opt_order = SORT_name;
+        } else if (args.OptionId() == OPT_memory) {
+            opt_memory = strtoll(args.OptionArg(), NULL, 10);
+            if (opt_memory < 1) {
+                cerr << NAME << " --memory must be greater than 0" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_tmp_prefix) {
+            opt_tmp_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_file = args.OptionArg();
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_reads) {
+            opt_reads = strtoll(args.OptionArg(), NULL, 10);
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "sort", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (args.FileCount() > 1) {
+        cerr << NAME << " requires at most one BAM file specified as input" << endl;
+        return usage();
+    } else if (args.FileCount() == 1) {
+        input_file = args.File(0);
+    } else if (input_file.empty()) {
+        input_file = "/dev/stdin";
+    }
+
+    if (output_file.empty())
+        output_file = "/dev/stdout";
+
+    if (opt_tmp_prefix.empty())
+        opt_tmp_prefix = output_file == "/dev/stdout" ? string("yoruba_sort") : output_file;
+    char pid[32];
+    sprintf(pid, ".%d", int(getpid()));
+    opt_tmp_prefix += pid;
+
+    //----------------- Read records into runs, spilling full runs
+
+    profile.Begin("runs");
+    progress.Input(input_file);
+    bgzfPool pool(opt_threads);
+    bamRawReader reader;
+    if (! reader.Open(input_file, &pool)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    const string header = headerWithSortOrder(reader.HeaderText(), opt_order);
+    const RefVector refs = reader.References();
+
+    // the last run is kept while the spilled runs are merged, and their
+    // readers get the memory it leaves, at least a quarter
+    const size_t memory = opt_memory * 1024 * 1024;
+    const size_t run_bytes = min(memory / (opt_threads + 1), memory - memory / 4);
+    const int32_t fan_in = mergeFanIn(memory - run_bytes);
+    runSorter sorter(opt_threads, opt_tmp_prefix, &pool);
+    sortRun* run = new sortRun(opt_order, run_bytes);
+    bamRawRecord r;
+    int64_t n_reads = 0;
+    bool ok = true;
+
+    while ((opt_reads < 0 || n_reads < opt_reads) && reader.GetNextRecord(r)) {
+
+        progress.Reads(++n_reads);
+
+        run->Add(r);
+        if (run->Bytes() >= run_bytes) {
+            if (! (ok = sorter.Submit(run)))
+                break;
+            run = new sortRun(opt_order, run_bytes);
+        }
+    }
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << input_file << endl;
+        ok = false;
+    }
+    reader.Close();
+    profile.Reads(n_reads);
+
+    profile.Begin("spill");
+    ok = sorter.Finish() && ok;
+    if (! ok) {
+        delete run;
+        sorter.Remove();
+        return EXIT_FAILURE;
+    }
+    run->Sort();
+
+    //----------------- Merge runs into the output
+
+    profile.Begin("merge");
+    bamRawWriter writer;
+    if (! writer.Open(output_file, header, refs, &pool, opt_level)) {
+        cerr << NAME << " could not open BAM output " << output_file << endl;
+        delete run;
+        sorter.Remove();
+        return EXIT_FAILURE;
+    }
+    writer.IndexRecords(yviIndex::default_interval);
+    progress.Expect(n_reads);
+    if (sorter.Files().empty()) {
+        for (size_t i = 0; ok && i < run->Size(); ++i) {
+            ok = writer.Write(run->Record(i), run->RecordLength(i));
+            progress.Reads(i + 1);
+        }
+    } else {
+        ok = mergeRuns(sorter.Files(), run, fan_in, pool, writer);
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("close");
+    ok = writer.Close() && ok;
+    delete run;
+    sorter.Remove();
+
+    if (! ok) {
+        cerr << NAME << " could not write BAM output " << output_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << NAME << " " << n_reads << " reads sorted by " << sortOrderName(opt_order)
+        << ", " << sorter.Files().size() << " run" << PLURAL(sorter.Files().size())
+        << " spilled" << endl;
+
+    return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,43 @@
+// yoruba_to.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_TO_H_
+#define _YORUBA_TO_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_sort]"
+#endif
+
+// Functions defined in yoruba_to.cpp
+//
+namespace yoruba {
+
+int  main_to(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_TO_H_
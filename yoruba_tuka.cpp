@@ -0,0 +1,585 @@
+// yoruba_tuka.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Scatter a BAM file into fragments to be processed separately, perhaps on
+// several machines, and gathered with gather (yoruba_kojo.cpp).
+//
+// Túká is the Yoruba (Nigeria) verb for 'scatter'.
+
+// scatter
+//
+// The input is cut into --fragments parts of roughly equal compressed size.
+// Cuts are made at record boundaries known from the index, the starts of its
+// chunks and of its 16 kbp linear windows, choosing for each the first at or
+// after an equal share of the file.  Without one, the entries of a record
+// index (.yvi, yoruba_yvi.h) serve as well.  Without either, as for fresh
+// aligner output, the boundaries are found from the file itself by
+// bamFindRecordBoundary() (yoruba_bamraw.h): the first block at or after each
+// share, by its magic bytes and a chain of block sizes, then the first place in
+// it where a chain of plausible records starts.  The parts and the operation
+// to apply to their records are written to PREFIX.manifest
+// (yoruba_manifest.h), and the header the result will have to
+// PREFIX.header.bam, a BAM file with no records.
+
+// operations
+//
+// The operations are those of readgroup and of the second pass of forget,
+// done on raw records (yoruba_bamraw.h).  --ID sets the RG tag of every read
+// and adds or replaces the read group in the header, as readgroup does with
+// only --ID and the other read group options.  --forget reduces the reference
+// dictionary to the references that hold records, from the index, and
+// rewrites RefID and MateRefID of every read; this is the dictionary forget
+// would produce, since mapped mates are themselves records on their
+// references.  Without either, records are copied unchanged.
+
+// workers
+//
+// With --worker INT <PREFIX.manifest>, fragment INT of the manifest is
+// processed: its records are read from the input, the operation applied, and
+// they are written to PREFIX.NNNN.frag, a BGZF file of records without a
+// header.  The fragment is written under a temporary name and renamed when
+// complete, so gather sees only finished fragments.  Workers are independent
+// processes, so they can run at once on one machine or on any that share the
+// files.
+
+#include "yoruba_tuka.h"
+
+using namespace std;
+using namespace BamTools;
+using namespace yoruba;
+
+// options
+static string       input_file;
+static string       output_prefix;  // defaults to input file without .bam
+static int32_t      opt_fragments = 4;
+static int32_t      opt_worker = -1;
+static bool         opt_forget = false;
+static string       opt_rg_id;
+static string       opt_rg_sm;
+static string       opt_rg_lb;
+static string       opt_rg_pl;
+static int32_t      opt_threads = 0;
+static int32_t      opt_level = -1;
+static string       metrics_file;
+#ifdef _WITH_DEBUG
+static int32_t      opt_debug = 0;
+static double       debug_progress = 10;
+static double       opt_progress = 0;
+#endif
+
+
+//-------------------------------------
+
+
+#ifdef _STANDALONE
+int
+main(int argc, char* argv[]) {
+    return main_tuka(argc, argv);
+}
+#endif
+
+
+//-------------------------------------
+
+
+static int
+usage(bool long_help = false)
+{
+    cerr << endl;
+    cerr << "Usage:   " << YORUBA_NAME << " scatter [options] <in.bam>" << endl;
+    cerr << "         " << YORUBA_NAME << " scatter --worker INT [options] <PREFIX.manifest>" << endl;
+    cerr << "         " << YORUBA_NAME << " tuka ..." << endl;
+    cerr << endl;
+    cerr << "Either command invokes this function." << endl;
+    cerr << endl;
+    cerr << "\
+Scatter <in.bam> into fragments for separate processing, writing\n\
+PREFIX.manifest and PREFIX.header.bam.  With --worker INT, process fragment INT\n\
+of PREFIX.manifest into PREFIX.NNNN.frag.  Combine the fragments with gather.\n\
+\n\
+Options: -n INT | --fragments INT number of fragments [" << opt_fragments << "]\n\
+         -o PREFIX | --output PREFIX\n\
+                                 prefix of the manifest and fragments [<in.bam> without .bam]\n\
+         --ID STR                give every read the read group STR, as readgroup\n\
+         --SM STR | --LB STR | --PL STR\n\
+                                 sample, library and platform of read group --ID\n\
+         --forget                forget references without reads, as forget\n\
+\n\
+         --worker INT            process fragment INT of <PREFIX.manifest>\n\
+         --threads INT           worker threads for compression [" << opt_threads << "]\n\
+         -l INT | --level INT    worker compression level, -1 for zlib default [" << opt_level << "]\n\
+         --metrics FILE          write progress metrics to FILE for Prometheus\n\
+\n";
+    if (long_help) {
+        cerr << "\
+Fragments are cut at record boundaries known from the index, each at or after\n\
+an equal share of the file, or from a record index (.yvi) written by sort,\n\
+collate or merge.  Without either they are found by scanning each share for\n\
+a block and then a record start, so fresh aligner output can be scattered\n\
+too; --forget requires a BAM index.  The operation, --ID or --forget,\n\
+is recorded in the manifest with the fragments, and the header of the result\n\
+is written to PREFIX.header.bam.  Without an operation, records are copied\n\
+unchanged.\n\
+\n\
+Each worker is a separate process reading only its fragment of <in.bam>, so\n\
+workers may run at once on one machine or on several sharing the files:\n\
+\n\
+    yoruba scatter -n 4 -o out --ID lane1 in.bam\n\
+    for i in 0 1 2 3; do yoruba scatter --worker $i out.manifest & done; wait\n\
+    yoruba gather -o out.bam out.manifest\n\
+\n";
+    }
+    cerr << "         -? | --help             longer help" << endl;
+    cerr << endl;
+#ifdef _WITH_DEBUG
+    cerr << "         --debug INT     debug info level INT [" << opt_debug << "]" << endl;
+    cerr << "         --progress SEC  report progress every SEC seconds [" << opt_progress << "]" << endl;
+    cerr << endl;
+#endif
+    cerr << "Tuka is the Yoruba (Nigeria) verb for 'scatter'." << endl;
+    cerr << endl;
+
+    return EXIT_FAILURE;
+}
+
+
+//-------------------------------------
+
+
+// Virtual offsets of record starts known from the index, sorted
+
+static void
+indexedRecordStarts(const baiIndex& index, vector<int64_t>& starts)
+{
+    for (int32_t r = 0; r < index.ReferenceCount(); ++r) {
+        const baiReference& ref = index.Reference(r);
+        for (map<uint32_t, baiChunkVector>::const_iterator bI = ref.bins.begin();
+             bI != ref.bins.end(); ++bI) {
+            if (bI->first == baiIndex::pseudo_bin)
+                continue;
+            for (size_t c = 0; c < bI->second.size(); ++c)
+                starts.push_back(bI->second[c].beg);
+        }
+        for (size_t i = 0; i < ref.linear.size(); ++i)
+            if (ref.linear[i])
+                starts.push_back(ref.linear[i]);
+    }
+    sort(starts.begin(), starts.end());
+    starts.erase(unique(starts.begin(), starts.end()), starts.end());
+}
+
+
+//-------------------------------------
+
+
+// The header text with read group opt_rg_id added, replacing any with its ID
+
+static string
+headerWithReadGroup(const string& text)
+{
+    istringstream in(text);
+    string out, line;
+    while (getline(in, line)) {
+        const size_t id = line.find("\tID:");
+        if (line.compare(0, 4, "@RG\t") == 0 && id != string::npos
+            && line.substr(id + 4, line.find('\t', id + 4) - id - 4) == opt_rg_id)
+            continue;
+        out += line + "\n";
+    }
+    out += "@RG\tID:" + opt_rg_id;
+    if (! opt_rg_sm.empty()) out += "\tSM:" + opt_rg_sm;
+    if (! opt_rg_lb.empty()) out += "\tLB:" + opt_rg_lb;
+    if (! opt_rg_pl.empty()) out += "\tPL:" + opt_rg_pl;
+    return out + "\n";
+}
+
+
+//-------------------------------------
+
+
+// Plan the fragments and write the manifest and header
+
+static int
+scatter(void)
+{
+    profile.Begin("open");
+    bamRawReader reader;
+    if (! reader.Open(input_file)) {
+        cerr << NAME << " could not open BAM input " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+    baiIndex index;
+    const bool indexed = index.Load(input_file);
+    if (! indexed && opt_forget) {
+        cerr << NAME << " could not load the index of " << input_file
+            << ", --forget requires it be sorted by coordinate and indexed" << endl;
+        return EXIT_FAILURE;
+    }
+    struct stat st;
+    if (stat(input_file.c_str(), &st) != 0) {
+        cerr << NAME << " could not find the size of " << input_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    //----------------- Cut at record starts, indexed or found
+
+    profile.Begin("plan");
+    vector<int64_t> starts;
+    yviIndex yvi;
+    if (indexed) {
+        indexedRecordStarts(index, starts);
+    } else if (yvi.Load(input_file)) {
+        for (size_t i = 0; i < yvi.Entries().size(); ++i)
+            starts.push_back(yvi.Entries()[i].voffset);
+    } else {
+        cerr << NAME << " no index for " << input_file
+            << ", finding record boundaries from the blocks" << endl;
+    }
+    const bool known_starts = indexed || ! starts.empty();
+    const int64_t first = reader.FirstRecordOffset();
+    const int64_t first_c = bgzfBlockOffset(first);
+    const int64_t size = max(int64_t(1), int64_t(st.st_size) - BGZF_EOF_BLOCK_LENGTH - first_c);
+    vector<int64_t> cuts(1, first);
+    for (int32_t k = 1; k < opt_fragments; ++k) {
+        const int64_t target_c = first_c + (size * k) / opt_fragments;
+        int64_t cut;
+        if (known_starts) {
+            vector<int64_t>::iterator s = lower_bound(starts.begin(), starts.end(),
+                                                      bgzfVirtualOffset(target_c, 0));
+            if (s == starts.end())
+                break;
+            // the same place may be block end and next block start, so settle it
+            if (! reader.Seek(*s)) {
+                cerr << NAME << " could not seek to " << *s << " in " << input_file << endl;
+                return EXIT_FAILURE;
+            }
+            cut = reader.Tell();
+        } else if (! bamFindRecordBoundary(input_file, target_c,
+                                           reader.ReferenceCount(), cut)) {
+            break;
+        }
+        if (DEBUG(1))
+            cerr << NAME << " cut " << k << " at block " << bgzfBlockOffset(cut)
+                << " offset " << bgzfWithinBlockOffset(cut) << endl;
+        if (cut > cuts.back())
+            cuts.push_back(cut);
+    }
+
+    scatterManifest manifest;
+    manifest.input = input_file;
+    manifest.header_file = output_prefix + ".header.bam";
+    for (size_t k = 0; k < cuts.size(); ++k) {
+        char suffix[32];
+        sprintf(suffix, ".%04d.frag", int(k));
+        manifest.fragments.push_back(scatterFragment(cuts[k],
+            k + 1 < cuts.size() ? cuts[k + 1] : -1, output_prefix + suffix));
+    }
+
+    //----------------- The operation and the header of the result
+
+    profile.Begin("header");
+    string header = reader.HeaderText();
+    RefVector refs = reader.References();
+    reader.Close();
+    if (! opt_rg_id.empty()) {
+        manifest.operation = "readgroup";
+        manifest.argument = opt_rg_id;
+        header = headerWithReadGroup(header);
+    } else if (opt_forget) {
+        manifest.operation = "forget";
+        RefVector kept;
+        for (int32_t r = 0; r < int32_t(refs.size()) && r < index.ReferenceCount(); ++r) {
+            uint64_t b, e;
+            if (index.ReferenceSpan(r, b, e) || index.Mapped(r) || index.Unmapped(r))
+                kept.push_back(refs[r]);
+        }
+        vector<pair<size_t, string> > dropped;
+        header = headerUnion(vector<string>(1, header), kept, dropped);
+        cerr << NAME << " " << kept.size() << " of " << refs.size()
+            << " references kept" << endl;
+        refs = kept;
+    } else {
+        manifest.operation = "copy";
+    }
+
+    bamRawWriter writer;
+    if (! writer.Open(manifest.header_file, header, refs) || ! writer.Close()) {
+        cerr << NAME << " could not write header " << manifest.header_file << endl;
+        return EXIT_FAILURE;
+    }
+    const string manifest_file = output_prefix + ".manifest";
+    if (! manifest.Write(manifest_file)) {
+        cerr << NAME << " could not write manifest " << manifest_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    cerr << NAME << " " << manifest.fragments.size() << " fragment"
+        << PLURAL(manifest.fragments.size()) << " planned in " << manifest_file
+        << ", operation " << manifest.operation << endl;
+    if (int32_t(manifest.fragments.size()) < opt_fragments)
+        cerr << NAME << " " << (known_starts ? "the index had" : "found") << " too few record starts for "
+            << opt_fragments << " fragments" << endl;
+
+    return EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
+
+
+// Process one fragment of the manifest
+
+static int
+worker(const string& manifest_file)
+{
+    scatterManifest manifest;
+    if (! manifest.Read(manifest_file))
+        return EXIT_FAILURE;
+    if (opt_worker >= int32_t(manifest.fragments.size())) {
+        cerr << NAME << " " << manifest_file << " has only " << manifest.fragments.size()
+            << " fragments" << endl;
+        return EXIT_FAILURE;
+    }
+    const scatterFragment& frag = manifest.fragments[opt_worker];
+    const bool readgroup = manifest.operation == "readgroup";
+    const bool forget = manifest.operation == "forget";
+    if (! readgroup && ! forget && manifest.operation != "copy") {
+        cerr << NAME << " unknown operation " << manifest.operation << " in "
+            << manifest_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    profile.Begin("open");
+    bgzfPool pool(opt_threads);
+    bamRawReader reader, header;
+    if (! reader.Open(manifest.input, &pool)) {
+        cerr << NAME << " could not open BAM input " << manifest.input << endl;
+        return EXIT_FAILURE;
+    }
+    if (! header.Open(manifest.header_file)) {
+        cerr << NAME << " could not open header " << manifest.header_file << endl;
+        return EXIT_FAILURE;
+    }
+
+    // reference IDs of the input to those of the result
+    const RefVector& in_refs = reader.References();
+    const RefVector& out_refs = header.References();
+    vector<int32_t> remap(in_refs.size(), -1);
+    size_t o = 0;
+    for (size_t i = 0; i < in_refs.size(); ++i)
+        if (o < out_refs.size() && out_refs[o].RefName == in_refs[i].RefName)
+            remap[i] = o++;
+    header.Close();
+    if (o != out_refs.size() || (! forget && o != in_refs.size())) {
+        cerr << NAME << " references of " << manifest.header_file
+            << " do not match those of " << manifest.input << endl;
+        return EXIT_FAILURE;
+    }
+
+    //----------------- Read the fragment and write its records
+
+    profile.Begin("reads");
+    int64_t end = frag.end;
+    if (end >= 0) {
+        if (! reader.Seek(end)) {
+            cerr << NAME << " could not seek to " << end << " in " << manifest.input << endl;
+            return EXIT_FAILURE;
+        }
+        end = reader.Tell();
+    }
+    if (! reader.Seek(frag.beg)) {
+        cerr << NAME << " could not seek to " << frag.beg << " in " << manifest.input << endl;
+        return EXIT_FAILURE;
+    }
+    progress.Input(manifest.input, bgzfBlockOffset(frag.beg),
+                   end < 0 ? -1 : bgzfBlockOffset(end));
+
+    const string tmp_file = frag.file + ".tmp";
+    bgzfWriter writer;
+    if (! writer.Open(tmp_file, &pool, opt_level)) {
+        cerr << NAME << " could not open fragment " << tmp_file << endl;
+        return EXIT_FAILURE;
+    }
+    bamRawRecord r;
+    int64_t n_reads = 0, n_mates_derefd = 0;
+    bool ok = true;
+    while (ok && (end < 0 || reader.Tell() < end) && reader.GetNextRecord(r)) {
+        progress.Reads(++n_reads);
+        if (readgroup) {
+            r.SetTagString("RG", manifest.argument);
+        } else if (forget) {
+            int32_t id = r.RefID();
+            if (id >= 0) {
+                id = remap[id];
+                memcpy(&r.data[0], &id, 4);
+            }
+            id = r.MateRefID();
+            if (id >= 0) {
+                if (remap[id] < 0)
+                    ++n_mates_derefd;
+                id = remap[id];
+                memcpy(&r.data[20], &id, 4);
+            }
+        }
+        const int32_t block_size = r.data.size();
+        ok = writer.Write(&block_size, 4) && writer.Write(r.data.data(), block_size);
+    }
+    if (reader.Error()) {
+        cerr << NAME << " could not read BAM input " << manifest.input << endl;
+        ok = false;
+    }
+    profile.Reads(n_reads);
+
+    profile.Begin("close");
+    reader.Close();
+    ok = writer.Close() && ok;
+    if (! ok || rename(tmp_file.c_str(), frag.file.c_str()) != 0) {
+        cerr << NAME << " could not write fragment " << frag.file << endl;
+        remove(tmp_file.c_str());
+        return EXIT_FAILURE;
+    }
+
+    cerr << NAME << " fragment " << opt_worker << ": " << n_reads << " reads written to "
+        << frag.file;
+    if (n_mates_derefd)
+        cerr << ", " << n_mates_derefd << " mates dereferenced";
+    cerr << endl;
+
+    return EXIT_SUCCESS;
+}
+
+
+//-------------------------------------
+
+
+int
+yoruba::main_tuka(int argc, char* argv[])
+{
+    //----------------- Command-line options
+
+	if( argc < 2 ) {
+		return usage();
+	}
+
+    enum { OPT_fragments, OPT_output, OPT_id, OPT_sm, OPT_lb, OPT_pl, OPT_forget,
+        OPT_worker, OPT_threads, OPT_level, OPT_metrics,
+#ifdef _WITH_DEBUG
+        OPT_debug, OPT_progress,
+#endif
+        OPT_help };
+
+    CSimpleOpt::SOption tuka_options[] = {
+        { OPT_fragments,       "--fragments",       SO_REQ_SEP },
+        { OPT_fragments,       "-n",                SO_REQ_SEP },
+        { OPT_output,          "--output",          SO_REQ_SEP },
+        { OPT_output,          "-o",                SO_REQ_SEP },
+        { OPT_id,              "--ID",              SO_REQ_SEP },
+        { OPT_sm,              "--SM",              SO_REQ_SEP },
+        { OPT_lb,              "--LB",              SO_REQ_SEP },
+        { OPT_pl,              "--PL",              SO_REQ_SEP },
+        { OPT_forget,          "--forget",          SO_NONE },
+        { OPT_worker,          "--worker",          SO_REQ_SEP },
+        { OPT_threads,         "--threads",         SO_REQ_SEP },
+        { OPT_level,           "--level",           SO_REQ_SEP },
+        { OPT_level,           "-l",                SO_REQ_SEP },
+        { OPT_metrics,         "--metrics",         SO_REQ_SEP },
+        { OPT_help,            "--help",            SO_NONE },
+        { OPT_help,            "-?",                SO_NONE },
+#ifdef _WITH_DEBUG
+        { OPT_debug,           "--debug",           SO_REQ_SEP },
+        { OPT_progress,        "--progress",        SO_REQ_SEP },
+#endif
+        SO_END_OF_OPTIONS
+    };
+
+    CSimpleOpt args(argc, argv, tuka_options);
+
+    while (args.Next()) {
+        if (args.LastError() != SO_SUCCESS) {
+            cerr << NAME << " invalid argument '" << args.OptionText() << "'" << endl;
+            return usage();
+        }
+        if (args.OptionId() == OPT_help) {
+            return usage(true);
+        } else if (args.OptionId() == OPT_fragments) {
+            opt_fragments = atoi(args.OptionArg());
+            if (opt_fragments < 1 || opt_fragments > 9999) {
+                cerr << NAME << " --fragments must be from 1 to 9999" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_output) {
+            output_prefix = args.OptionArg();
+        } else if (args.OptionId() == OPT_id) {
+            opt_rg_id = args.OptionArg();
+        } else if (args.OptionId() == OPT_sm) {
+            opt_rg_sm = args.OptionArg();
+        } else if (args.OptionId() == OPT_lb) {
+            opt_rg_lb = args.OptionArg();
+        } else if (args.OptionId() == OPT_pl) {
+            opt_rg_pl = args.OptionArg();
+        } else if (args.OptionId() == OPT_forget) {
+            opt_forget = true;
+        } else if (args.OptionId() == OPT_worker) {
+            opt_worker = atoi(args.OptionArg());
+            if (opt_worker < 0) {
+                cerr << NAME << " --worker must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_threads) {
+            opt_threads = atoi(args.OptionArg());
+            if (opt_threads < 0) {
+                cerr << NAME << " --threads must be 0 or more" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_level) {
+            opt_level = atoi(args.OptionArg());
+            if (opt_level < -1 || opt_level > 9) {
+                cerr << NAME << " --level must be from -1 to 9" << endl;
+                return usage();
+            }
+        } else if (args.OptionId() == OPT_metrics) {
+            metrics_file = args.OptionArg();
+#ifdef _WITH_DEBUG
+        } else if (args.OptionId() == OPT_debug) {
+            opt_debug = args.OptionArg() ? atoi(args.OptionArg()) : opt_debug;
+        } else if (args.OptionId() == OPT_progress) {
+            opt_progress = args.OptionArg() ? atof(args.OptionArg()) : opt_progress;
+#endif
+        } else {
+            cerr << NAME << " unprocessed argument '" << args.OptionText() << "'" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (DEBUG(1) && ! opt_progress)
+        opt_progress = debug_progress;
+    if (! progress.Start(NAME, "scatter", opt_progress, metrics_file))
+        return EXIT_FAILURE;
+
+    if (args.FileCount() != 1) {
+        cerr << NAME << " requires one input, a BAM file or with --worker a manifest" << endl;
+        return usage();
+    }
+
+    if (opt_worker >= 0)
+        return worker(args.File(0));
+
+    input_file = args.File(0);
+
+    if (opt_forget && ! opt_rg_id.empty()) {
+        cerr << NAME << " only one of --ID and --forget may be given" << endl;
+        return usage();
+    }
+    if (opt_rg_id.empty() && (! opt_rg_sm.empty() || ! opt_rg_lb.empty() || ! opt_rg_pl.empty())) {
+        cerr << NAME << " --SM, --LB and --PL require --ID" << endl;
+        return usage();
+    }
+
+    if (output_prefix.empty()) {
+        output_prefix = input_file;
+        if (output_prefix.size() > 4 && output_prefix.compare(output_prefix.size() - 4, 4, ".bam") == 0)
+            output_prefix.erase(output_prefix.size() - 4);
+    }
+
+    return scatter();
+}
+
@@ -0,0 +1,44 @@
+// yoruba_tuka.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+
+#ifndef _YORUBA_TUKA_H_
+#define _YORUBA_TUKA_H_
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <cstring>
+
+// SimpleOpt includes: http://code.jellycan.com/simpleopt, http://code.google.com/p/simpleopt/
+#include "SimpleOpt.h"
+
+// Yoruba includes
+#include "yoruba.h"
+#include "yoruba_util.h"
+#include "yoruba_bamraw.h"
+#include "yoruba_bgzf.h"
+#include "yoruba_bai.h"
+#include "yoruba_sort.h"
+#include "yoruba_yvi.h"
+#include "yoruba_manifest.h"
+#include "yoruba_profile.h"
+#include "yoruba_progress.h"
+
+#ifndef _YORUBA_MAIN
+#define NAME "[yoruba_scatter]"
+#endif
+
+// Functions defined in yoruba_tuka.cpp
+//
+namespace yoruba {
+
+int  main_tuka(int argc, char* argv[]);
+
+}  // namespace yoruba
+
+#endif // _YORUBA_TUKA_H_
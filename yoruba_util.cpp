@@ -22,6 +22,28 @@ yoruba::isCoordinateSorted(int32_t ref, int32_t pos, int32_t prev_ref, int32_t p
 //-------------------------------------
 
 
+uint64_t
+yoruba::hashReadName(const char* name, size_t len)
+{
+    // FNV-1a, then the MurmurHash3 finalizer so the low bits used to index
+    // hash tables depend on every character
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= uint64_t(uint8_t(name[i]));
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h ? h : 1;
+}
+
+
+//-------------------------------------
+
+
 bool
 yoruba::isMateUpstream(const BamAlignment& alignment)
 {
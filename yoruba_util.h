@@ -7,6 +7,7 @@
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <stdint.h>
 
 // #define NDEBUG  // uncomment to remove assert() code
 #include <assert.h>
@@ -38,6 +39,39 @@ namespace yoruba {
 bool 
 isCoordinateSorted(int32_t ref, int32_t pos, int32_t prev_ref, int32_t prev_pos);
 
+// 64-bit hash of a read name, never 0 so 0 can mark an empty table slot
+
+uint64_t
+hashReadName(const char* name, size_t len);
+
+inline uint64_t
+hashReadName(const std::string& name)
+    { return hashReadName(name.data(), name.size()); }
+
+// A small seeded random number generator (splitmix64), so that runs given
+// the same seed make the same choices on every platform
+
+class yorubaRandom {
+
+    public:
+        yorubaRandom(const uint64_t seed = 1) : state(seed) { }
+        void     Seed(const uint64_t seed) { state = seed; }
+        uint64_t Next(void) {
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+        // uniform on [0, 1)
+        double   Uniform(void) { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+        // uniform on [0, n)
+        uint64_t Below(const uint64_t n) { return n ? uint64_t(Uniform() * n) : 0; }
+
+    private:
+        uint64_t state;
+
+};  // class yorubaRandom
+
 bool 
 isMateUpstream(const BamTools::BamAlignment&);
 
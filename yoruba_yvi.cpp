@@ -0,0 +1,95 @@
+// yoruba_yvi.cpp  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// The linear record index of a BAM file, see yoruba_yvi.h.
+
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "yoruba_yvi.h"
+
+using namespace std;
+using namespace yoruba;
+
+
+//-------------------------------------
+
+
+static int64_t
+fileSize(const string& filename)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return -1;
+    return st.st_size;
+}
+
+
+//-------------------------------------
+
+
+bool
+yviIndex::Load(const string& bam_file)
+{
+    entries.clear();
+    n_records = 0;
+    bam_size = -1;
+    const string filename = Filename(bam_file);
+    FILE* fp = fopen(filename.c_str(), "rb");
+    if (! fp)
+        return false;
+    char magic[4];
+    int64_t n_entries = 0;
+    bool ok = fread(magic, 1, 4, fp) == 4 && memcmp(magic, "YVI\1", 4) == 0
+              && fread(&interval, 4, 1, fp) == 1 && fread(&n_records, 8, 1, fp) == 1
+              && fread(&bam_size, 8, 1, fp) == 1 && fread(&n_entries, 8, 1, fp) == 1
+              && interval > 0 && n_entries >= 0;
+    if (ok) {
+        entries.resize(n_entries);
+        for (int64_t i = 0; ok && i < n_entries; ++i)
+            ok = fread(&entries[i].ordinal, 8, 1, fp) == 1
+                 && fread(&entries[i].voffset, 8, 1, fp) == 1
+                 && (i == 0 || entries[i - 1].ordinal < entries[i].ordinal);
+    }
+    fclose(fp);
+    if (! ok) {
+        cerr << "yviIndex: " << filename << " is not a record index, or is corrupt" << endl;
+        entries.clear();
+        return false;
+    }
+    if (bam_size != fileSize(bam_file)) {
+        cerr << "yviIndex: " << filename << " is stale, " << bam_file
+            << " has changed since it was written" << endl;
+        entries.clear();
+        return false;
+    }
+    return true;
+}
+
+
+//-------------------------------------
+
+
+bool
+yviIndex::Write(const string& bam_file) const
+{
+    const string filename = Filename(bam_file);
+    const int64_t size = fileSize(bam_file);
+    const int64_t n_entries = entries.size();
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (! fp || size < 0)
+        return false;
+    bool ok = fwrite("YVI\1", 1, 4, fp) == 4 && fwrite(&interval, 4, 1, fp) == 1
+              && fwrite(&n_records, 8, 1, fp) == 1 && fwrite(&size, 8, 1, fp) == 1
+              && fwrite(&n_entries, 8, 1, fp) == 1;
+    for (int64_t i = 0; ok && i < n_entries; ++i)
+        ok = fwrite(&entries[i].ordinal, 8, 1, fp) == 1
+             && fwrite(&entries[i].voffset, 8, 1, fp) == 1;
+    if (fclose(fp) != 0)
+        ok = false;
+    if (! ok)
+        remove(filename.c_str());
+    return ok;
+}
@@ -0,0 +1,79 @@
+// yoruba_yvi.h  (c) Douglas G. Scofield, douglasgscofield@gmail.com
+//
+// Header file for yoruba_yvi.cpp
+//
+// A linear index of a BAM file in any order, kept beside it as <file.bam>.yvi.
+// It holds the virtual offset of every Nth record with its ordinal, 0-based,
+// so a reader can start at any record after reading at most N-1 others.  A
+// BAM index (.bai) does this only by coordinate, and only for sorted files.
+// The file is little-endian:
+//
+//     char[4]  magic "YVI\1"
+//     int32    interval N
+//     int64    number of records in the BAM file
+//     int64    size of the BAM file, to recognise a stale index
+//     int64    number of entries
+//     int64[2] ordinal and virtual offset of each entry, by ordinal
+//
+// bamRawWriter::IndexRecords() builds one while writing, at the cost of a
+// mark every N records.
+
+#ifndef _YORUBA_YVI_H_
+#define _YORUBA_YVI_H_
+
+
+// Std C/C++ includes
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace yoruba {
+
+struct yviEntry {
+    int64_t ordinal;
+    int64_t voffset;
+    yviEntry(const int64_t o = 0, const int64_t v = 0) : ordinal(o), voffset(v) { }
+    bool operator<(const yviEntry& other) const { return ordinal < other.ordinal; }
+};
+
+
+//-------------------------------------
+
+
+class yviIndex {
+
+    public:
+        static const int32_t default_interval = 4096;
+
+    public:
+        yviIndex(const int32_t n = default_interval)
+            : interval(n), n_records(0), bam_size(-1) { }
+
+        static std::string Filename(const std::string& bam_file) { return bam_file + ".yvi"; }
+
+        // load the index of bam_file, false if it is missing, malformed, or
+        // was written for a file of another size
+        bool    Load(const std::string& bam_file);
+        bool    Write(const std::string& bam_file) const;
+
+        int32_t Interval(void) const { return interval; }
+        int64_t Records(void) const { return n_records; }
+        const std::vector<yviEntry>& Entries(void) const { return entries; }
+
+        // for building the index
+        void    Add(const int64_t ordinal, const int64_t voffset)
+                    { entries.push_back(yviEntry(ordinal, voffset)); }
+        void    SetRecords(const int64_t n) { n_records = n; }
+
+    private:
+        int32_t               interval;
+        int64_t               n_records;
+        int64_t               bam_size;
+        std::vector<yviEntry> entries;
+
+};  // class yviIndex
+
+}  // namespace yoruba
+
+#endif // _YORUBA_YVI_H_